@@ -59,6 +59,7 @@ enum
 
 static struct tcp_pcb *demo_isocket = NULL;
 static struct tcp_pcb *demo_osocket = NULL;
+static bool            demo_echo    = false;
 
 /**
  * Callback triggered when TCP socket is connected.
@@ -87,16 +88,52 @@ void demo_tcperr(void *arg, err_t err)
 	demo_osocket = NULL;
 }
 
+/**
+ * Send received data back to the sender, for throughput testing.
+ * @param tpcb A pointer to the relevant socket
+ * @param p A buffer containing the received data
+ * @return ERR_OK if the data was queued, ERR_MEM if there is not yet room for it
+ */
+static err_t demo_tcpecho(struct tcp_pcb *tpcb, struct pbuf *p)
+{
+	//Only queue the data if all of it fits, so that it is never echoed twice when lwIP delivers it again
+	if (tcp_sndbuf(tpcb) < p->tot_len || tcp_sndqueuelen(tpcb) + pbuf_clen(p) > TCP_SND_QUEUELEN)
+		return ERR_MEM;
+
+	for (struct pbuf *curp = p; curp; curp = curp->next)
+	{
+		u8_t flags = TCP_WRITE_FLAG_COPY;
+
+		if (curp->next)
+			flags |= TCP_WRITE_FLAG_MORE;
+		tcp_write(tpcb, curp->payload, curp->len, flags);
+	}
+	tcp_output(tpcb);
+
+	return ERR_OK;
+}
+
 /**
  * Callback triggered when data is received on a TCP socket
  * @param arg unused
  * @param tpcb A pointer to the relevant socket
  * @param p A buffer containing the received data
  * @param err The status of the TCP connection
- * @return ERR_OK
+ * @return ERR_OK, or ERR_MEM if echoed data must be delivered again later
  */
 static err_t demo_tcpreceive(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
+	if (err == ERR_OK && p && demo_echo)
+	{
+		//lwIP keeps refused data and delivers it again later, so p is not freed
+		if (demo_tcpecho(tpcb, p) != ERR_OK)
+			return ERR_MEM;
+
+		tcp_recved(tpcb, p->tot_len);
+		pbuf_free(p);
+		return ERR_OK;
+	}
+
 	if (err == ERR_OK && p)
 	{
 		struct pbuf *curp = p;
@@ -211,6 +248,7 @@ void handle_cli_lwipdemo(int argc, char *argv[])
 		otCliOutputFormat("lwip tcp con <ip> - open tcp connection to port %d\r\n", 51700);
 		otCliOutputFormat("lwip tcp sen <msg> - send text string over tcp connection\r\n");
 		otCliOutputFormat("lwip tcp clo - close tcp connection\r\n");
+		otCliOutputFormat("lwip tcp ech - toggle echoing of data received on port %d\r\n", DEMO_PORT);
 		otCliOutputFormat("lwip dns <hostname> - Resolve IP address of hostname using DNS\r\n");
 		otCliOutputFormat("lwip dns ser <ipv6 addr> - Set the IPv6 address of the DNS server\r\n");
 		return;
@@ -289,6 +327,12 @@ void handle_cli_lwipdemo(int argc, char *argv[])
 			else
 				otCliOutputFormat("Closed outgoing TCP Socket\r\n");
 		}
+		//strncmp is used so 'ech', 'echo' etc are all accepted
+		else if (strncmp(argv[1], "ech", 3) == 0)
+		{
+			demo_echo = !demo_echo;
+			otCliOutputFormat("TCP echo %s\r\n", demo_echo ? "enabled" : "disabled");
+		}
 	}
 	else if (strcmp(argv[0], "dns") == 0)
 	{
@@ -0,0 +1,241 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021, Cascoda Ltd.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Distribution License v1.0
+ * which accompanies this distribution.
+ *
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "mbedtls/version.h"
+
+#include "dtls_session.h"
+
+#if defined(LWM2M_PERSIST_DTLS_SESSION) && MBEDTLS_VERSION_NUMBER < 0x02130000
+#warning "This version of mbedtls cannot serialise sessions, so DTLS sessions will only be cached in RAM"
+#undef LWM2M_PERSIST_DTLS_SESSION
+#endif
+
+#ifdef LWM2M_PERSIST_DTLS_SESSION
+#include "openthread/platform/settings.h"
+#include "platform.h"
+#endif
+
+/** Session negotiated with a server */
+struct dtls_session_entry
+{
+	uint32_t            server;    //!< Key of the server, from dtls_session_server_key
+	uint32_t            last_used; //!< Value of sCacheClock when last used, 0 if the entry is free
+	mbedtls_ssl_session session;
+};
+
+static struct dtls_session_entry sCache[DTLS_SESSION_CACHE_SIZE];
+static uint32_t                  sCacheClock;
+
+#ifdef LWM2M_PERSIST_DTLS_SESSION
+/** Flash record: the key of the server, followed by the serialised session */
+static uint8_t sRecord[sizeof(uint32_t) + DTLS_SESSION_MAX_LEN];
+#endif
+
+// FNV-1a
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+
+	while (len--) hash = (hash ^ *bytes++) * 16777619u;
+	return hash;
+}
+
+static struct dtls_session_entry *cache_find(uint32_t server)
+{
+	for (int i = 0; i < DTLS_SESSION_CACHE_SIZE; ++i)
+	{
+		if (sCache[i].last_used && sCache[i].server == server)
+		{
+			sCache[i].last_used = ++sCacheClock;
+			return &sCache[i];
+		}
+	}
+
+	return NULL;
+}
+
+/** Get an empty entry for server, evicting the least recently used session if needed */
+static struct dtls_session_entry *cache_alloc(uint32_t server)
+{
+	struct dtls_session_entry *lru = &sCache[0];
+
+	for (int i = 1; i < DTLS_SESSION_CACHE_SIZE; ++i)
+	{
+		if (sCache[i].last_used < lru->last_used)
+			lru = &sCache[i];
+	}
+
+	mbedtls_ssl_session_free(&lru->session);
+	lru->server    = server;
+	lru->last_used = ++sCacheClock;
+	return lru;
+}
+
+static void cache_free(struct dtls_session_entry *entry)
+{
+	mbedtls_ssl_session_free(&entry->session);
+	entry->last_used = 0;
+}
+
+#ifdef LWM2M_PERSIST_DTLS_SESSION
+/** Find the flash record for server, leaving it in sRecord. Returns its settings index, or -1 if there is none. */
+static int record_find(otInstance *aInstance, uint32_t server, uint16_t *record_len)
+{
+	uint32_t record_server;
+
+	for (int i = 0;; ++i)
+	{
+		*record_len = sizeof(sRecord);
+
+		if (otPlatSettingsGet(aInstance, lwm2m_dtls_session_key, i, sRecord, record_len) != OT_ERROR_NONE)
+			return -1;
+
+		memcpy(&record_server, sRecord, sizeof(record_server));
+
+		if (*record_len > sizeof(record_server) && *record_len <= sizeof(sRecord) && record_server == server)
+			return i;
+	}
+}
+
+static void record_delete(otInstance *aInstance, uint32_t server)
+{
+	uint16_t record_len;
+	int      index;
+
+	while ((index = record_find(aInstance, server, &record_len)) >= 0)
+		otPlatSettingsDelete(aInstance, lwm2m_dtls_session_key, index);
+}
+
+static void record_store(otInstance *aInstance, uint32_t server, const mbedtls_ssl_session *session)
+{
+	size_t session_len;
+
+	record_delete(aInstance, server);
+
+	// Sessions with large tickets are only cached in RAM
+	if (mbedtls_ssl_session_save(session, sRecord + sizeof(server), DTLS_SESSION_MAX_LEN, &session_len))
+		return;
+
+	memcpy(sRecord, &server, sizeof(server));
+	otPlatSettingsAdd(aInstance, lwm2m_dtls_session_key, sRecord, sizeof(server) + session_len);
+}
+
+static struct dtls_session_entry *record_load(otInstance *aInstance, uint32_t server)
+{
+	struct dtls_session_entry *entry;
+	uint16_t                   record_len;
+
+	if (record_find(aInstance, server, &record_len) < 0)
+		return NULL;
+
+	entry = cache_alloc(server);
+
+	if (mbedtls_ssl_session_load(&entry->session, sRecord + sizeof(server), record_len - sizeof(server)))
+	{
+		// Stored by an incompatible version of mbedtls
+		cache_free(entry);
+		record_delete(aInstance, server);
+		return NULL;
+	}
+
+	return entry;
+}
+#endif
+
+uint32_t dtls_session_server_key(const char *uri, const void *pskid, size_t pskidlen)
+{
+	uint32_t hash = 2166136261u;
+
+	hash = hash_bytes(hash, uri, strlen(uri) + 1);
+	if (pskid)
+		hash = hash_bytes(hash, pskid, pskidlen);
+	return hash;
+}
+
+bool dtls_session_resume(otInstance *aInstance, mbedtls_ssl_context *ssl, uint32_t server)
+{
+	struct dtls_session_entry *entry = cache_find(server);
+
+#ifdef LWM2M_PERSIST_DTLS_SESSION
+	if (!entry)
+		entry = record_load(aInstance, server);
+#else
+	(void)aInstance;
+#endif
+
+	if (!entry)
+		return false;
+
+	return mbedtls_ssl_set_session(ssl, &entry->session) == 0;
+}
+
+bool dtls_session_is_resumed(const mbedtls_ssl_context *ssl, uint32_t server)
+{
+	struct dtls_session_entry *entry = cache_find(server);
+
+	if (!entry || ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER || !ssl->session)
+		return false;
+
+	// An abbreviated handshake keeps the master secret, whether it was resumed by session ID or by ticket
+	return memcmp(entry->session.master, ssl->session->master, sizeof(entry->session.master)) == 0;
+}
+
+ca_error dtls_session_save(otInstance *aInstance, const mbedtls_ssl_context *ssl, uint32_t server)
+{
+	struct dtls_session_entry *entry;
+	bool                       resumed;
+
+	if (ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER)
+		return CA_ERROR_INVALID_STATE;
+
+	resumed = dtls_session_is_resumed(ssl, server);
+	entry   = cache_find(server);
+
+	if (entry)
+		mbedtls_ssl_session_free(&entry->session);
+	else
+		entry = cache_alloc(server);
+
+	// The server may have issued a new ticket, so the copy in RAM is always updated
+	if (mbedtls_ssl_get_session(ssl, &entry->session))
+	{
+		cache_free(entry);
+		return CA_ERROR_NO_BUFFER;
+	}
+
+#ifdef LWM2M_PERSIST_DTLS_SESSION
+	// Only a full handshake is written to flash, to limit wear
+	if (!resumed)
+		record_store(aInstance, server, &entry->session);
+#else
+	(void)aInstance;
+	(void)resumed;
+#endif
+
+	return CA_ERROR_SUCCESS;
+}
+
+void dtls_session_forget(otInstance *aInstance, uint32_t server)
+{
+	struct dtls_session_entry *entry = cache_find(server);
+
+	if (entry)
+		cache_free(entry);
+
+#ifdef LWM2M_PERSIST_DTLS_SESSION
+	record_delete(aInstance, server);
+#else
+	(void)aInstance;
+#endif
+}
@@ -0,0 +1,92 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021, Cascoda Ltd.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Distribution License v1.0
+ * which accompanies this distribution.
+ *
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ *******************************************************************************/
+
+/**
+ * @file
+ * Cache of the DTLS sessions negotiated with each LWM2M server, so that later connections to the same server can use
+ * an abbreviated handshake instead of a full one.
+ */
+
+#ifndef DTLS_SESSION_H_
+#define DTLS_SESSION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbedtls/ssl.h"
+#include "openthread/instance.h"
+
+#include "ca821x_error.h"
+
+enum
+{
+	DTLS_SESSION_CACHE_SIZE = 2,   //!< Number of servers whose session is kept in RAM
+	DTLS_SESSION_MAX_LEN    = 256, //!< Maximum length of a serialised session stored in flash
+};
+
+/**
+ * Get the key that identifies the sessions with a server.
+ *
+ * @param uri       URI of the server, as configured in the security object
+ * @param pskid     PSK identity used to connect to the server, or NULL
+ * @param pskidlen  Length of pskid
+ * @return The key to pass to the other functions of this module
+ */
+uint32_t dtls_session_server_key(const char *uri, const void *pskid, size_t pskidlen);
+
+/**
+ * Offer the cached session with a server for resumption. Must be called after mbedtls_ssl_setup and before the
+ * handshake. If the server no longer knows the session, it falls back to a full handshake by itself.
+ *
+ * When LWM2M_PERSIST_DTLS_SESSION is defined, a session that is not cached in RAM is loaded from flash.
+ *
+ * @param aInstance  Openthread instance pointer, used to access the settings
+ * @param ssl        The ssl context that is about to perform the handshake
+ * @param server     Key of the server, from dtls_session_server_key
+ * @return true if a session was offered to the server
+ */
+bool dtls_session_resume(otInstance *aInstance, mbedtls_ssl_context *ssl, uint32_t server);
+
+/**
+ * Check whether a completed handshake resumed the cached session with a server.
+ *
+ * @param ssl     The ssl context that has completed the handshake
+ * @param server  Key of the server, from dtls_session_server_key
+ * @return true if the handshake was abbreviated
+ */
+bool dtls_session_is_resumed(const mbedtls_ssl_context *ssl, uint32_t server);
+
+/**
+ * Cache the session of a completed handshake, replacing any older session with the same server.
+ *
+ * When LWM2M_PERSIST_DTLS_SESSION is defined, the session of a full handshake is also stored in flash so that it
+ * survives a reset. Resumed sessions are not written again, to limit flash wear.
+ *
+ * @param aInstance  Openthread instance pointer, used to access the settings
+ * @param ssl        The ssl context that has completed the handshake
+ * @param server     Key of the server, from dtls_session_server_key
+ * @retval CA_ERROR_SUCCESS       The session is cached
+ * @retval CA_ERROR_INVALID_STATE The handshake has not completed
+ * @retval CA_ERROR_NO_BUFFER     The session could not be copied
+ */
+ca_error dtls_session_save(otInstance *aInstance, const mbedtls_ssl_context *ssl, uint32_t server);
+
+/**
+ * Discard the cached session with a server, such as after the server rejected a handshake that offered it.
+ *
+ * @param aInstance  Openthread instance pointer, used to access the settings
+ * @param server     Key of the server, from dtls_session_server_key
+ */
+void dtls_session_forget(otInstance *aInstance, uint32_t server);
+
+#endif
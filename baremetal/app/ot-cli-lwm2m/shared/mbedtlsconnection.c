@@ -44,13 +44,47 @@ static connection_t *GetFreeCon()
 	return NULL;
 }
 
+/**
+ * Check the progress of the DTLS handshake after mbedtls has been called. Once the handshake completes, its session is
+ * cached so that the next connection to the server can be resumed. If a handshake that offered a cached session fails,
+ * the session is discarded so that the next attempt performs a full handshake.
+ */
+static void connection_handshake_update(connection_t *connection, int rval)
+{
+	if (!connection->isSecure || connection->isHandshakeDone)
+		return;
+
+	if (connection->ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER)
+	{
+		bool resumed = connection->isResuming && dtls_session_is_resumed(&connection->ssl, connection->serverKey);
+
+		ca_log_info("DTLS handshake %s in %u ms\r\n",
+		            resumed ? "resumed" : "completed",
+		            (unsigned int)(TIME_ReadAbsoluteTime() - connection->handshakeStart));
+
+		dtls_session_save(connection->otInstance, &connection->ssl, connection->serverKey);
+		connection->isHandshakeDone = true;
+	}
+	else if (rval < 0 && rval != MBEDTLS_ERR_SSL_WANT_READ && rval != MBEDTLS_ERR_SSL_WANT_WRITE &&
+	         connection->isResuming)
+	{
+		ca_log_warn("DTLS handshake failed with error -0x%x, discarding cached session\r\n", -rval);
+		dtls_session_forget(connection->otInstance, connection->serverKey);
+		connection->isResuming = false;
+	}
+}
+
 static ca_error mbedtls_tasklet_callback(void *context)
 {
 	connection_t *connection = context;
+	int           rval;
 
 	connection->isTimerPassed = true;
 
-	mbedtls_ssl_handshake(&connection->ssl);
+	rval = mbedtls_ssl_handshake(&connection->ssl);
+	connection_handshake_update(connection, rval);
+
+	return CA_ERROR_SUCCESS;
 }
 
 static connection_t *connection_new_incoming(otInstance *aInstance, lwm2m_context_t *lwm2mH)
@@ -91,6 +125,8 @@ static void connection_udp_receive(void *aContext, otMessage *aMessage, const ot
 			}
 		} while (rval > 0);
 		rxMessage = NULL;
+
+		connection_handshake_update(connection, rval);
 	}
 	else
 	{
@@ -295,6 +331,9 @@ static void connection_dns_callback(ca_error aError, const otIp6Address *aAddres
 		mbedtls_ssl_conf_rng(&connection->conf, mbedtls_ctr_drbg_random, otRandomCryptoMbedTlsContextGet());
 		mbedtls_ssl_conf_min_version(&connection->conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
 		mbedtls_ssl_conf_max_version(&connection->conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+		mbedtls_ssl_conf_cid(&connection->conf, 0, MBEDTLS_SSL_UNEXPECTED_CID_IGNORE);
+#endif
 
 		secMode = security_get_mode(connection->securityObj, connection->securityInstId);
 		switch (secMode)
@@ -338,11 +377,26 @@ static void connection_dns_callback(ca_error aError, const otIp6Address *aAddres
 		mbedtls_ssl_set_bio(&connection->ssl, connection, mbedtls_ssl_send, mbedtls_ssl_recv, NULL);
 		mbedtls_ssl_set_timer_cb(&connection->ssl, connection, &mbedtls_set_timer, &mbedtls_get_timer);
 
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+		// Ask the server for a connection ID, so that it keeps the connection if our address or port changes.
+		// Our own connection ID is empty, as the socket already identifies the connection on our side.
+		if (mbedtls_ssl_set_cid(&connection->ssl, MBEDTLS_SSL_CID_ENABLED, NULL, 0))
+		{
+			aError = CA_ERROR_FAIL;
+			goto exit;
+		}
+#endif
+
 		//TODO: Can call mbedtls_ssl_set_hostname to verify certificate hostname here if desired.
 
+		connection->isResuming =
+		    dtls_session_resume(connection->otInstance, &connection->ssl, connection->serverKey);
+		connection->handshakeStart = TIME_ReadAbsoluteTime();
+
 		rval = mbedtls_ssl_handshake(&connection->ssl);
 		if (rval != 0 && rval != MBEDTLS_ERR_SSL_WANT_READ && rval != MBEDTLS_ERR_SSL_WANT_WRITE)
 		{
+			connection_handshake_update(connection, rval);
 			aError = CA_ERROR_FAIL;
 			goto exit;
 		}
@@ -411,7 +465,9 @@ connection_t *connection_create(otInstance *     aInstance,
 {
 	connection_t *connection = connection_new_incoming(aInstance, lwm2mH);
 	const char *  const_uri;
-	char *        uri = NULL;
+	const char *  pskid;
+	size_t        pskidlen = 0;
+	char *        uri      = NULL;
 	char *        host;
 	char *        port;
 	int           porti = 0;
@@ -429,6 +485,9 @@ connection_t *connection_create(otInstance *     aInstance,
 	if (uri == NULL)
 		return NULL;
 
+	pskid                 = security_get_public_id(securityObj, instanceId, &pskidlen);
+	connection->serverKey = dtls_session_server_key(const_uri, pskid, pskidlen);
+
 	error = split_hostname(uri, &host, &port);
 
 	if (error)
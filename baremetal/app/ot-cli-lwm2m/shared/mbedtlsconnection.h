@@ -35,6 +35,8 @@
 #include "cascoda-util/cascoda_tasklet.h"
 #include "ca821x_error.h"
 
+#include "dtls_session.h"
+
 #define LWM2M_STANDARD_PORT_STR "5683"
 #define LWM2M_STANDARD_PORT 5683
 #define LWM2M_DTLS_PORT_STR "5684"
@@ -64,9 +66,13 @@ typedef struct connection_t
 	int                 cipherSuites[CIPHERSUITE_COUNT + 1]; //!< List of the cipher suites in use
 	int                 securityInstId;                      //!< lwm2m security instance ID
 	uint32_t            intermediateTime; //!< Used with mbedtls_tasklet to implement the intermediate time
+	uint32_t            serverKey;        //!< Key of the server in the DTLS session cache
+	uint32_t            handshakeStart;   //!< Time the DTLS handshake was started, to log how long it took
 	bool                inUse;            //!< Used internally to determine whether this connection structure is in use
 	bool                isTimerPassed;    //!< Used in with mbedtls_tasklet to determine expired or cancelled
 	bool                isSecure;         //!< Used to determine whether this connection is secured with dtls
+	bool                isResuming;       //!< A cached DTLS session was offered to the server for resumption
+	bool                isHandshakeDone;  //!< The DTLS handshake has completed and its session has been cached
 } connection_t;
 
 /**
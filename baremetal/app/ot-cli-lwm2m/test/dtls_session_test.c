@@ -0,0 +1,444 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021, Cascoda Ltd.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Distribution License v1.0
+ * which accompanies this distribution.
+ *
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ *******************************************************************************/
+/**
+ * @file
+ * @brief  Unit tests and benchmark for the DTLS session cache of the LWM2M client
+ *
+ * The client connects to a stand-in DTLS server running in the same process, with the datagrams passed through
+ * in-memory queues. This counts the round trips of each handshake, which dominate the connection time over a
+ * multi-hop Thread network, and measures the CPU time spent on them.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "dtls_session.h"
+
+#if defined(MBEDTLS_SSL_CLI_C) && defined(MBEDTLS_SSL_SRV_C) && defined(MBEDTLS_SSL_PROTO_DTLS) && \
+    defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED) && defined(MBEDTLS_CCM_C)
+#define DTLS_TEST_SUPPORTED 1
+#else
+#define DTLS_TEST_SUPPORTED 0
+#endif
+
+#if DTLS_TEST_SUPPORTED
+enum
+{
+	QUEUE_LEN         = 16,   //!< Maximum number of datagrams in flight in each direction
+	DATAGRAM_LEN      = 1280, //!< Maximum length of a datagram, the link MTU
+	MAX_STEPS         = 32,   //!< Maximum number of times each side is called before the handshake is abandoned
+	BENCH_REPEATS     = 20,   //!< Number of handshakes of each kind timed by the benchmark
+	MASTER_SECRET_LEN = 48,   //!< Length of the master secret of a session
+};
+
+enum peer_id
+{
+	PEER_CLIENT = 1,
+	PEER_SERVER = 2,
+};
+
+static const char kServerUri[] = "coaps://[fd00::1]:5684";
+static const char kPsk[]       = "cascoda-test-psk";
+static const char kPskId[]     = "cascoda-test";
+
+/** One direction of the link */
+struct datagram_queue
+{
+	uint8_t  data[QUEUE_LEN][DATAGRAM_LEN];
+	size_t   len[QUEUE_LEN];
+	unsigned head;
+	unsigned count;
+};
+
+/** What was sent over the link during a handshake */
+struct handshake_stats
+{
+	unsigned     flights;     //!< Number of times the sending side changed
+	unsigned     round_trips; //!< Number of flights the client had to wait for
+	unsigned     datagrams;
+	unsigned     bytes;
+	enum peer_id last_sender; //!< Peer that sent the last datagram, 0 before the first
+};
+
+/** One end of the link */
+struct peer
+{
+	enum peer_id           id;
+	mbedtls_ssl_context    ssl;
+	struct datagram_queue *rx;
+	struct datagram_queue *tx;
+	uint32_t               timer_fin_ms;
+};
+
+/** Session cache of the stand-in server, which only remembers one session */
+struct server_cache
+{
+	bool          valid;
+	int           ciphersuite;
+	size_t        id_len;
+	unsigned char id[32];
+	unsigned char master[MASTER_SECRET_LEN];
+};
+
+static mbedtls_ssl_config     sClientConf;
+static mbedtls_ssl_config     sServerConf;
+static int                    sCipherSuites[2] = {MBEDTLS_TLS_PSK_WITH_AES_128_CCM_8, 0};
+static struct server_cache    sServerCache;
+static struct datagram_queue  sToServer;
+static struct datagram_queue  sToClient;
+static struct handshake_stats sStats;
+
+//The test does not need cryptographically secure randomness
+static int test_rng(void *ctx, unsigned char *out, size_t len)
+{
+	(void)ctx;
+	for (size_t i = 0; i < len; i++) out[i] = rand();
+	return 0;
+}
+
+static int queue_send(void *ctx, const unsigned char *buf, size_t len)
+{
+	struct peer *          peer  = ctx;
+	struct datagram_queue *queue = peer->tx;
+	unsigned               tail;
+
+	if (len > DATAGRAM_LEN)
+		return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+	if (queue->count == QUEUE_LEN)
+		return MBEDTLS_ERR_SSL_WANT_WRITE;
+
+	tail = (queue->head + queue->count++) % QUEUE_LEN;
+	memcpy(queue->data[tail], buf, len);
+	queue->len[tail] = len;
+
+	if (sStats.last_sender != peer->id)
+	{
+		sStats.flights++;
+		if (peer->id == PEER_SERVER)
+			sStats.round_trips++;
+		sStats.last_sender = peer->id;
+	}
+	sStats.datagrams++;
+	sStats.bytes += len;
+
+	return (int)len;
+}
+
+static int queue_recv(void *ctx, unsigned char *buf, size_t len)
+{
+	struct peer *          peer  = ctx;
+	struct datagram_queue *queue = peer->rx;
+	size_t                 dlen;
+
+	if (queue->count == 0)
+		return MBEDTLS_ERR_SSL_WANT_READ;
+
+	dlen = queue->len[queue->head];
+	if (dlen > len)
+		dlen = len;
+	memcpy(buf, queue->data[queue->head], dlen);
+	queue->head = (queue->head + 1) % QUEUE_LEN;
+	queue->count--;
+
+	return (int)dlen;
+}
+
+//The link never loses datagrams, so the retransmission timer never expires
+static void timer_set(void *ctx, uint32_t int_ms, uint32_t fin_ms)
+{
+	struct peer *peer = ctx;
+
+	(void)int_ms;
+	peer->timer_fin_ms = fin_ms;
+}
+
+static int timer_get(void *ctx)
+{
+	struct peer *peer = ctx;
+
+	return peer->timer_fin_ms ? 0 : -1;
+}
+
+static int server_cache_get(void *ctx, mbedtls_ssl_session *session)
+{
+	struct server_cache *cache = ctx;
+
+	if (!cache->valid || session->ciphersuite != cache->ciphersuite || session->id_len != cache->id_len ||
+	    memcmp(session->id, cache->id, cache->id_len))
+		return 1;
+
+	memcpy(session->master, cache->master, sizeof(cache->master));
+	return 0;
+}
+
+static int server_cache_set(void *ctx, const mbedtls_ssl_session *session)
+{
+	struct server_cache *cache = ctx;
+
+	cache->valid       = true;
+	cache->ciphersuite = session->ciphersuite;
+	cache->id_len      = session->id_len;
+	memcpy(cache->id, session->id, session->id_len);
+	memcpy(cache->master, session->master, sizeof(cache->master));
+	return 0;
+}
+
+static void conf_setup(mbedtls_ssl_config *conf, int endpoint)
+{
+	mbedtls_ssl_config_init(conf);
+	assert_int_equal(
+	    mbedtls_ssl_config_defaults(conf, endpoint, MBEDTLS_SSL_TRANSPORT_DATAGRAM, MBEDTLS_SSL_PRESET_DEFAULT), 0);
+	mbedtls_ssl_conf_rng(conf, test_rng, NULL);
+	mbedtls_ssl_conf_min_version(conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+	mbedtls_ssl_conf_max_version(conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+	mbedtls_ssl_conf_ciphersuites(conf, sCipherSuites);
+	assert_int_equal(mbedtls_ssl_conf_psk(conf,
+	                                      (const unsigned char *)kPsk,
+	                                      strlen(kPsk),
+	                                      (const unsigned char *)kPskId,
+	                                      strlen(kPskId)),
+	                 0);
+}
+
+static int group_setup(void **state)
+{
+	(void)state;
+
+	conf_setup(&sClientConf, MBEDTLS_SSL_IS_CLIENT);
+	conf_setup(&sServerConf, MBEDTLS_SSL_IS_SERVER);
+	mbedtls_ssl_conf_session_cache(&sServerConf, &sServerCache, server_cache_get, server_cache_set);
+#if defined(MBEDTLS_SSL_DTLS_HELLO_VERIFY)
+	// A real server would also send a HelloVerifyRequest, adding one round trip to every handshake
+	mbedtls_ssl_conf_dtls_cookies(&sServerConf, NULL, NULL, NULL);
+#endif
+	return 0;
+}
+
+static int group_teardown(void **state)
+{
+	(void)state;
+
+	mbedtls_ssl_config_free(&sClientConf);
+	mbedtls_ssl_config_free(&sServerConf);
+	return 0;
+}
+
+static void peer_setup(struct peer *peer, enum peer_id id, mbedtls_ssl_config *conf)
+{
+	memset(peer, 0, sizeof(*peer));
+	peer->id = id;
+	peer->rx = (id == PEER_CLIENT) ? &sToClient : &sToServer;
+	peer->tx = (id == PEER_CLIENT) ? &sToServer : &sToClient;
+
+	mbedtls_ssl_init(&peer->ssl);
+	assert_int_equal(mbedtls_ssl_setup(&peer->ssl, conf), 0);
+	mbedtls_ssl_set_bio(&peer->ssl, peer, queue_send, queue_recv, NULL);
+	mbedtls_ssl_set_timer_cb(&peer->ssl, peer, timer_set, timer_get);
+}
+
+static bool handshake_step(struct peer *peer)
+{
+	int rval = mbedtls_ssl_handshake(&peer->ssl);
+
+	if (rval != 0 && rval != MBEDTLS_ERR_SSL_WANT_READ && rval != MBEDTLS_ERR_SSL_WANT_WRITE)
+		fail_msg("%s handshake failed with -0x%x", peer->id == PEER_CLIENT ? "Client" : "Server", -rval);
+
+	return peer->ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER;
+}
+
+/**
+ * Connect to the stand-in server the way the LWM2M client does, offering and then caching the session.
+ * Returns whether the handshake was resumed, and fills stats with what was sent.
+ */
+static bool connect_to_server(uint32_t server, bool *offered, struct handshake_stats *stats, double *cpu_ms)
+{
+	struct peer client, server_peer;
+	bool        resumed;
+	bool        client_done = false, server_done = false;
+	clock_t     start;
+
+	memset(&sToServer, 0, sizeof(sToServer));
+	memset(&sToClient, 0, sizeof(sToClient));
+	memset(&sStats, 0, sizeof(sStats));
+
+	peer_setup(&client, PEER_CLIENT, &sClientConf);
+	peer_setup(&server_peer, PEER_SERVER, &sServerConf);
+	*offered = dtls_session_resume(NULL, &client.ssl, server);
+
+	start = clock();
+	for (int i = 0; i < MAX_STEPS && !(client_done && server_done && !sToServer.count && !sToClient.count); i++)
+	{
+		client_done = handshake_step(&client);
+		server_done = handshake_step(&server_peer);
+	}
+	if (cpu_ms)
+		*cpu_ms = (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	assert_true(client_done);
+	assert_true(server_done);
+
+	resumed = dtls_session_is_resumed(&client.ssl, server);
+	assert_int_equal(dtls_session_save(NULL, &client.ssl, server), CA_ERROR_SUCCESS);
+	*stats = sStats;
+
+	mbedtls_ssl_free(&client.ssl);
+	mbedtls_ssl_free(&server_peer.ssl);
+	return resumed;
+}
+
+static void print_stats(const char *kind, const struct handshake_stats *stats)
+{
+	printf("%s handshake: %u round trips, %u flights, %u datagrams, %u bytes\n",
+	       kind,
+	       stats->round_trips,
+	       stats->flights,
+	       stats->datagrams,
+	       stats->bytes);
+}
+#endif
+
+static void dtls_session_resume_test(void **state)
+{
+#if DTLS_TEST_SUPPORTED
+	uint32_t               server = dtls_session_server_key(kServerUri, kPskId, strlen(kPskId));
+	struct handshake_stats full, abbreviated;
+	bool                   offered;
+
+	(void)state;
+	sServerCache.valid = false;
+
+	//Nothing cached yet, so the first handshake is a full one
+	assert_false(connect_to_server(server, &offered, &full, NULL));
+	assert_false(offered);
+	print_stats("Full", &full);
+
+	assert_true(connect_to_server(server, &offered, &abbreviated, NULL));
+	assert_true(offered);
+	print_stats("Resumed", &abbreviated);
+
+	assert_true(abbreviated.round_trips < full.round_trips);
+	assert_true(abbreviated.bytes < full.bytes);
+
+	//And again, now that the resumed session has been cached
+	assert_true(connect_to_server(server, &offered, &abbreviated, NULL));
+#else
+	(void)state;
+	skip();
+#endif
+}
+
+static void dtls_session_server_forgot_test(void **state)
+{
+#if DTLS_TEST_SUPPORTED
+	uint32_t               server = dtls_session_server_key(kServerUri, kPskId, strlen(kPskId));
+	struct handshake_stats stats;
+	bool                   offered;
+
+	(void)state;
+	sServerCache.valid = false;
+	connect_to_server(server, &offered, &stats, NULL);
+	assert_true(connect_to_server(server, &offered, &stats, NULL));
+
+	//The server dropped the session, so the offer is refused and a full handshake happens instead
+	sServerCache.valid = false;
+	assert_false(connect_to_server(server, &offered, &stats, NULL));
+	assert_true(offered);
+
+	//The new session replaces the stale one
+	assert_true(connect_to_server(server, &offered, &stats, NULL));
+#else
+	(void)state;
+	skip();
+#endif
+}
+
+static void dtls_session_key_test(void **state)
+{
+#if DTLS_TEST_SUPPORTED
+	uint32_t               server = dtls_session_server_key(kServerUri, kPskId, strlen(kPskId));
+	uint32_t               other  = dtls_session_server_key("coaps://[fd00::2]:5684", kPskId, strlen(kPskId));
+	struct handshake_stats stats;
+	bool                   offered;
+
+	(void)state;
+	assert_int_not_equal(server, other);
+	assert_int_not_equal(server, dtls_session_server_key(kServerUri, "other", 5));
+
+	sServerCache.valid = false;
+	connect_to_server(server, &offered, &stats, NULL);
+
+	//A different server is not offered the session
+	assert_false(connect_to_server(other, &offered, &stats, NULL));
+	assert_false(offered);
+
+	//A forgotten session is not offered
+	dtls_session_forget(NULL, server);
+	assert_false(connect_to_server(server, &offered, &stats, NULL));
+	assert_false(offered);
+#else
+	(void)state;
+	skip();
+#endif
+}
+
+static void dtls_session_benchmark(void **state)
+{
+#if DTLS_TEST_SUPPORTED
+	uint32_t               server = dtls_session_server_key(kServerUri, kPskId, strlen(kPskId));
+	struct handshake_stats stats;
+	bool                   offered;
+	double                 cpu_ms, full_ms = 0, resumed_ms = 0;
+
+	(void)state;
+
+	for (int i = 0; i < BENCH_REPEATS; i++)
+	{
+		dtls_session_forget(NULL, server);
+		assert_false(connect_to_server(server, &offered, &stats, &cpu_ms));
+		full_ms += cpu_ms;
+
+		assert_true(connect_to_server(server, &offered, &stats, &cpu_ms));
+		resumed_ms += cpu_ms;
+	}
+
+	printf("PSK handshake CPU time (client and server): full %.3f ms, resumed %.3f ms\n",
+	       full_ms / BENCH_REPEATS,
+	       resumed_ms / BENCH_REPEATS);
+#else
+	(void)state;
+	skip();
+#endif
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test(dtls_session_resume_test),
+	    cmocka_unit_test(dtls_session_server_forgot_test),
+	    cmocka_unit_test(dtls_session_key_test),
+	    cmocka_unit_test(dtls_session_benchmark),
+	};
+
+#if DTLS_TEST_SUPPORTED
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+#else
+	return cmocka_run_group_tests(tests, NULL, NULL);
+#endif
+}
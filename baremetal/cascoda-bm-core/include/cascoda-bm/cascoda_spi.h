@@ -55,8 +55,11 @@ extern "C" {
 #define SPI_T_HOLD_8210 100 //!< Hold time before transmitting for the CA-8210 [us]
 #define SPI_T_CSHOLD 50     //!< Time to hold the chip select active before re-checking the IRQ [us].
 
-#define SPI_RX_FIFO_SIZE 7 //!< Maximum Size of Rx FIFO \ref SPI_Receive_Buffer
-#define SPI_RX_FIFO_RESV 4 //!< Number of SPI RX FIFOs to be reserved for piggyback messages
+#define SPI_RX_FIFO_SIZE 7 //!< Size of Rx FIFO \ref SPI_Receive_Buffer, in maximum size messages
+#define SPI_RX_FIFO_RESV 4 //!< Number of maximum size messages to be reserved for piggyback messages
+
+//! Size of Rx FIFO \ref SPI_Receive_Buffer in bytes. Smaller messages are packed, so many more of them fit.
+#define SPI_RX_FIFO_BYTES (SPI_RX_FIFO_SIZE * sizeof(struct MAC_Message))
 
 #if !(SPI_RX_FIFO_RESV < SPI_RX_FIFO_SIZE)
 #error "SPI_RX_FIFO_RESV must be less than SPI_RX_FIFO_SIZE"
@@ -104,6 +107,9 @@ ca_error SPI_Send(const uint8_t *buf, u8_t *response, struct ca821x_dev *pDevice
  * Calling this function does not remove the buffer from the queue, so after
  * the buffer has been processed, SPI_DequeueFullBuffer should be used.
  *
+ * The buffer points directly into the FIFO, which only stores the CommandId,
+ * Length and Length bytes of payload, so nothing beyond that may be accessed.
+ *
  * RFIRQ must be enabled when calling.
  *
  * \retval A full SPI Buffer, or NULL if none are available.
@@ -122,6 +128,17 @@ struct MAC_Message *SPI_PeekFullBuf(void);
  */
 void SPI_DequeueFullBuf(void);
 
+/**
+ * \brief Get the highest fill level that the SPI message FIFO has reached
+ *
+ * RFIRQ must be enabled when calling.
+ *
+ * \param aMessages - Filled with the highest number of messages held at once, or NULL
+ * \param aBytes - Filled with the highest number of bytes used at once, or NULL
+ *
+ */
+void SPI_GetHighWaterMark(uint16_t *aMessages, uint16_t *aBytes);
+
 /**
  * \brief Query whether the SPI message FIFO is full or not
  *
@@ -129,7 +146,7 @@ void SPI_DequeueFullBuf(void);
  *
  * RFIRQ must be enabled when calling.
  *
- * \retval true if FIFO is full, false if there is space for another message
+ * \retval true if FIFO is full, false if there is space for another maximum size message
  *
  */
 bool SPI_IsFifoFull(void);
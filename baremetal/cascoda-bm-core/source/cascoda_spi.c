@@ -43,14 +43,17 @@
 /******************************************************************************/
 /****** Global Variables for SPI Message Buffers                         ******/
 /******************************************************************************/
-/** Cyclic SPI receive message FIFO. Messages are read from the SPI and put into
- *  the next available index. */
-struct MAC_Message SPI_Receive_Buffer[SPI_RX_FIFO_SIZE];
-static int         SPI_FIFO_Start = 0;
-static int         SPI_FIFO_End   = 0;
-static bool        SPI_FIFO_Full  = false;
-static uint32_t    waterMark      = 0; //!< Actual current fifo level
-static uint32_t    highWaterMark  = 0; //!< Actual worst fifo level
+/** Cyclic SPI receive message FIFO. Messages are read from the SPI and packed into
+ *  the next available bytes, each taking only its CommandId, Length and payload. A
+ *  message is never split across the end of the buffer, instead the rest of the
+ *  buffer is skipped and marked with SPI_IDLE. */
+uint8_t          SPI_Receive_Buffer[SPI_RX_FIFO_BYTES];
+static uint16_t  SPI_FIFO_Start     = 0; //!< Offset of the oldest message
+static uint16_t  SPI_FIFO_End       = 0; //!< Offset at which the next message will be stored
+static uint16_t  SPI_FIFO_Used      = 0; //!< Bytes in use, including any skipped at the end of the buffer
+static uint16_t  waterMark          = 0; //!< Actual current fifo level, in messages
+static uint16_t  highWaterMark      = 0; //!< Actual worst fifo level, in messages
+static uint16_t  highWaterMarkBytes = 0; //!< Actual worst fifo level, in bytes
 
 static volatile bool ExchangeInProgress = false; //!< SPI Exchange currently in progress (possibly dma)
 static volatile bool FinalExchange      = false; //!< If true, the RFSS pin will be set to high upon exchange completion
@@ -68,17 +71,37 @@ static struct MAC_Message *SPI_Wait_Buf;
 /****** Static function declarations for cascoda_spi.c                   ******/
 /******************************************************************************/
 static ca_error            SPI_SyncWait(uint8_t cmdid);
-static struct MAC_Message *SPI_GetFreeBuf();
-static struct MAC_Message *getBuf(uint8_t cmdid);
+static struct MAC_Message *SPI_GetFreeBuf(uint8_t len);
+static struct MAC_Message *getBuf(uint8_t cmdid, uint8_t len);
 static ca_error            SPI_WaitSlave(void);
 static void                SPI_Error(ca_error errcode);
 
+/**
+ * Get the number of maximum size messages that can still be stored in the FIFO.
+ *
+ * RFIRQ must be disabled when calling.
+ */
+static uint16_t SPI_GetFreeMessages()
+{
+	const uint16_t maxLen = sizeof(struct MAC_Message);
+
+	if (!waterMark)
+		return SPI_RX_FIFO_BYTES / maxLen;
+	if (SPI_FIFO_Used == SPI_RX_FIFO_BYTES)
+		return 0;
+	if (SPI_FIFO_End < SPI_FIFO_Start)
+		return (SPI_FIFO_Start - SPI_FIFO_End) / maxLen;
+
+	//The free space is split between the end and the start of the buffer
+	return (SPI_RX_FIFO_BYTES - SPI_FIFO_End) / maxLen + SPI_FIFO_Start / maxLen;
+}
+
 bool SPI_IsFifoFull()
 {
 	bool rval;
 
 	BSP_DisableRFIRQ();
-	rval = SPI_FIFO_Full;
+	rval = !SPI_GetFreeMessages();
 	BSP_EnableRFIRQ();
 
 	return rval;
@@ -89,7 +112,7 @@ bool SPI_IsFifoEmpty()
 	bool rval;
 
 	BSP_DisableRFIRQ();
-	rval = (SPI_FIFO_Start == SPI_FIFO_End) && !SPI_FIFO_Full;
+	rval = !waterMark;
 	BSP_EnableRFIRQ();
 
 	return rval;
@@ -106,8 +129,8 @@ static bool SPI_IsSingleFifoBufInUse()
 	bool rval;
 
 	BSP_DisableRFIRQ();
-	rval = (SPI_FIFO_End == ((SPI_FIFO_Start + 1) % SPI_RX_FIFO_SIZE)); //One item in the fifo
-	rval = rval && ExchangeInProgress;                                  //Currently being filled.
+	rval = (waterMark == 1);           //One item in the fifo
+	rval = rval && ExchangeInProgress; //Currently being filled.
 	BSP_EnableRFIRQ();
 
 	return rval;
@@ -117,18 +140,20 @@ bool SPI_IsFifoAlmostFull()
 {
 	//This deals with the case that we are receiving a sync response
 	if (SPI_Wait_Buf)
-		return SPI_FIFO_Full;
-	//This deals with the case that the fifo is full (otherwise can't differentiate from empty)
-	if (SPI_FIFO_Full)
-		return true;
-	/* Skipping the 'full' case that is handled above, check the reserved
-	 * FIFO slots are all empty. */
-	for (int i = 1; i <= SPI_RX_FIFO_RESV; i++)
-	{
-		if (SPI_FIFO_Start == ((SPI_FIFO_End + i) % SPI_RX_FIFO_SIZE))
-			return true;
-	}
-	return false;
+		return !SPI_GetFreeMessages();
+	/* Otherwise, keep room for the reserved number of maximum size messages,
+	 * however small the messages already in the FIFO are. */
+	return SPI_GetFreeMessages() <= SPI_RX_FIFO_RESV;
+}
+
+void SPI_GetHighWaterMark(uint16_t *aMessages, uint16_t *aBytes)
+{
+	BSP_DisableRFIRQ();
+	if (aMessages)
+		*aMessages = highWaterMark;
+	if (aBytes)
+		*aBytes = highWaterMarkBytes;
+	BSP_EnableRFIRQ();
 }
 
 bool SPI_IsExchangeInProgress()
@@ -171,11 +196,20 @@ void SPI_StopSyncChain(struct ca821x_dev *pDeviceRef)
 
 static void SPI_IncrementWaterMark()
 {
+	bool isNew = false;
+
 	if (++waterMark > highWaterMark)
 	{
 		highWaterMark = waterMark;
-		ca_log_debg("New SPI hwm: %d", highWaterMark);
+		isNew         = true;
 	}
+	if (SPI_FIFO_Used > highWaterMarkBytes)
+	{
+		highWaterMarkBytes = SPI_FIFO_Used;
+		isNew              = true;
+	}
+	if (isNew)
+		ca_log_debg("New SPI hwm: %d messages, %d bytes", highWaterMark, highWaterMarkBytes);
 }
 
 static void SPI_ExchangeBlocking(uint8_t *RxBuf, const uint8_t *TxBuf, uint8_t RxLen, uint8_t TxLen)
@@ -187,24 +221,42 @@ static void SPI_ExchangeBlocking(uint8_t *RxBuf, const uint8_t *TxBuf, uint8_t R
 }
 
 /**
- *\brief Return an empty async buffer to be filled, or NULL if none available
+ *\brief Return an empty async buffer to be filled with a message of len payload bytes, or NULL if none available
  *
  * RFIRQ must be disabled when calling.
  */
-static struct MAC_Message *SPI_GetFreeBuf()
+static struct MAC_Message *SPI_GetFreeBuf(uint8_t len)
 {
 	struct MAC_Message *rval = NULL;
+	uint16_t            size = 2 + len; //CommandId, Length and payload
+
+	//Start from the beginning of the buffer whenever it is empty, to keep the free space contiguous
+	if (!waterMark)
+		SPI_FIFO_Start = SPI_FIFO_End = SPI_FIFO_Used = 0;
+
+	if (SPI_RX_FIFO_BYTES - SPI_FIFO_Used < size)
+		return NULL;
 
-	if (!SPI_FIFO_Full)
+	if (SPI_FIFO_End >= SPI_FIFO_Start && SPI_RX_FIFO_BYTES - SPI_FIFO_End < size)
 	{
-		rval         = SPI_Receive_Buffer + SPI_FIFO_End;
-		SPI_FIFO_End = (SPI_FIFO_End + 1) % SPI_RX_FIFO_SIZE;
-		SPI_IncrementWaterMark();
+		//Not enough room at the end of the buffer, so skip the rest of it and use the start
+		if (SPI_FIFO_Start < size)
+			return NULL;
 
-		if (SPI_FIFO_Start == SPI_FIFO_End)
-			SPI_FIFO_Full = true;
+		SPI_Receive_Buffer[SPI_FIFO_End] = SPI_IDLE;
+		SPI_FIFO_Used += SPI_RX_FIFO_BYTES - SPI_FIFO_End;
+		SPI_FIFO_End = 0;
+	}
+	else if (SPI_FIFO_End < SPI_FIFO_Start && SPI_FIFO_Start - SPI_FIFO_End < size)
+	{
+		return NULL;
 	}
 
+	rval         = (struct MAC_Message *)(SPI_Receive_Buffer + SPI_FIFO_End);
+	SPI_FIFO_End = (SPI_FIFO_End + size) % SPI_RX_FIFO_BYTES;
+	SPI_FIFO_Used += size;
+	SPI_IncrementWaterMark();
+
 	return rval;
 }
 
@@ -214,7 +266,7 @@ struct MAC_Message *SPI_PeekFullBuf()
 
 	if (!SPI_IsFifoEmpty() && !SPI_IsSingleFifoBufInUse())
 	{
-		rval = SPI_Receive_Buffer + SPI_FIFO_Start;
+		rval = (struct MAC_Message *)(SPI_Receive_Buffer + SPI_FIFO_Start);
 	}
 
 	return rval;
@@ -224,10 +276,20 @@ void SPI_DequeueFullBuf()
 {
 	if (!SPI_IsFifoEmpty())
 	{
+		uint16_t size;
+
 		BSP_DisableRFIRQ();
-		SPI_FIFO_Start = (SPI_FIFO_Start + 1) % SPI_RX_FIFO_SIZE;
-		SPI_FIFO_Full  = false;
+		size           = 2 + SPI_Receive_Buffer[SPI_FIFO_Start + 1];
+		SPI_FIFO_Start = (SPI_FIFO_Start + size) % SPI_RX_FIFO_BYTES;
+		SPI_FIFO_Used -= size;
 		waterMark--;
+
+		//Skip the end of the buffer if the next message was stored at the start
+		if (waterMark && SPI_Receive_Buffer[SPI_FIFO_Start] == SPI_IDLE)
+		{
+			SPI_FIFO_Used -= SPI_RX_FIFO_BYTES - SPI_FIFO_Start;
+			SPI_FIFO_Start = 0;
+		}
 		BSP_EnableRFIRQ();
 	}
 }
@@ -239,7 +301,7 @@ void SPI_DequeueFullBuf()
  *
  *\retval pointer to buffer or NULL upon failure
  */
-static struct MAC_Message *getBuf(uint8_t cmdid)
+static struct MAC_Message *getBuf(uint8_t cmdid, uint8_t len)
 {
 	struct MAC_Message *rval = NULL;
 
@@ -265,7 +327,7 @@ static struct MAC_Message *getBuf(uint8_t cmdid)
 	}
 	else
 	{
-		rval = SPI_GetFreeBuf();
+		rval = SPI_GetFreeBuf(len);
 	}
 
 exit:
@@ -417,7 +479,7 @@ ca_error SPI_Exchange(const struct MAC_Message *pTxBuffer, struct ca821x_dev *pD
 
 	/* If the receive fifo is full, and this isn't a sync response,
 	 * then we can't safely do SPI exchange.*/
-	if (SPI_FIFO_Full && (SPI_Wait_Buf && !pTxBuffer))
+	if (!SPI_GetFreeMessages() && (SPI_Wait_Buf && !pTxBuffer))
 	{
 		ca_log_warn("SPI_Exchange failed - No buffers");
 		return CA_ERROR_NO_BUFFER;
@@ -448,7 +510,7 @@ ca_error SPI_Exchange(const struct MAC_Message *pTxBuffer, struct ca821x_dev *pD
 
 	if (pTxBuffer)
 		TxLen = pTxBuffer->Length - AlignMod;
-	pRxBuffer = getBuf(triageBuf[0]);
+	pRxBuffer = getBuf(triageBuf[0], triageBuf[1]);
 
 	if (!TxLen && !pRxBuffer)
 	{
@@ -581,5 +643,7 @@ void SPI_Initialise(void)
 	memset(SPI_Receive_Buffer, SPI_IDLE, sizeof(SPI_Receive_Buffer));
 	SPI_FIFO_Start = 0;
 	SPI_FIFO_End   = 0;
+	SPI_FIFO_Used  = 0;
+	waterMark      = 0;
 	BSP_EnableRFIRQ();
 }
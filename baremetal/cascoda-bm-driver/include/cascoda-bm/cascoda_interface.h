@@ -220,6 +220,16 @@ u8_t *BSP_USBSerialRxPeek(void);
  */
 void BSP_USBSerialRxDequeue(void);
 
+/**
+ * \brief Get the most recently queued USB fragment, if it has not started transmission.
+ * The fragment can be modified until the serial irq is re-enabled.
+ *
+ * Must be called with the serial irq disabled (see BSP_DisableSerialIRQ)
+ *
+ * \return Pointer to the queued fragment or NULL if none is waiting
+ */
+u8_t *BSP_USBSerialTxPeekLast(void);
+
 #endif // USE_USB
 #if defined(USE_UART)
 
@@ -129,6 +129,24 @@ void EVBME_Message_USB(char *pBuffer, size_t Count);
  *******************************************************************************
  ******************************************************************************/
 void EVBME_Message_UART(char *pBuffer, size_t Count);
+
+#if defined(USE_USB)
+/**
+ * Get whether messages are packed into queued USB reports.
+ *
+ * @returns true if packing is enabled
+ */
+bool SerialUSBGetPacked(void);
+
+/**
+ * Enable or disable packing several messages into each USB report, as negotiated by the host.
+ * Received packed reports are always unpacked.
+ *
+ * @param aPacked true to enable packing
+ */
+void SerialUSBSetPacked(bool aPacked);
+#endif
+
 #if defined(USE_UART)
 /**
  * Send an EVBME_RXRDY message to signal receive success
@@ -144,6 +162,23 @@ void SerialSendRxFail(void);
  * For an asynchronous (DMA) read, call this when the DMA transfer is complete.
  */
 void SerialReadComplete(void);
+
+/**
+ * Get the maximum number of windowed UART frames this device can have in flight.
+ *
+ * @returns The receive window, as configured by CASCODA_BM_UART_WINDOW. 0 if windowing is compiled out,
+ *          in which case the host stays with stop-and-wait framing.
+ */
+u8_t SerialUARTGetWindow(void);
+
+/**
+ * Set the number of windowed UART frames in flight, as negotiated by the host.
+ * Sequence numbers are reset. A window of 0 reverts to stop-and-wait framing. Has no effect if windowing
+ * is compiled out.
+ *
+ * @param aWindow The host's receive window, limited to SerialUARTGetWindow()
+ */
+void SerialUARTSetWindow(u8_t aWindow);
 #endif
 
 #ifdef __cplusplus
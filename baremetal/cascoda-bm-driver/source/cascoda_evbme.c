@@ -48,6 +48,10 @@
 #include "evbme_messages.h"
 #include "mac_messages.h"
 
+#if CASCODA_BM_DFU_COMPRESSION
+#include "uzlib.h"
+#endif
+
 /******************************************************************************/
 /****** Global Parameters that can by set via EVBME_SET_request          ******/
 /******************************************************************************/
@@ -84,6 +88,7 @@ static void     EVBMESendDownStream(const uint8_t *buf, struct ca821x_dev *pDevi
 static void     EVBME_Disconnect(void);
 static ca_error EVBME_GET_request(struct EVBME_GET_request *req);
 static ca_error EVBME_SET_request(struct EVBME_SET_request *req, struct ca821x_dev *pDeviceRef);
+static void     EVBME_PIB_BATCH_request(struct EVBME_Message *rxBuf, struct ca821x_dev *pDeviceRef);
 
 static void EVBME_COMM_CHECK_request(struct EVBME_Message *rxBuf)
 {
@@ -146,6 +151,60 @@ static ca_error EVBME_DFU_write(struct EVBME_Message *rxMsg)
 	return BSP_FlashWriteInitial(startAddr, data, writeLen);
 }
 
+#if CASCODA_BM_DFU_COMPRESSION
+/** Compressed DFU block being received, and the state used to decompress it */
+static struct
+{
+	uint32_t  startAddr;                                    //!< Flash address of the block being received
+	uint16_t  received;                                     //!< Number of compressed bytes received so far
+	uint8_t   zData[DFU_ZBLOCK_MAX_LEN];                    //!< Compressed block
+	uint32_t  block[DFU_ZBLOCK_MAX_LEN / sizeof(uint32_t)]; //!< Decompressed block, word aligned for flash
+	TINF_DATA inflater;                                     //!< Decompression state
+} sDfuZBlock;
+
+static ca_error EVBME_DFU_zwrite(struct EVBME_Message *rxMsg)
+{
+	struct evbme_dfu_zwrite_cmd *zCmd      = &rxMsg->EVBME.DFU_cmd.mSubCmd.zwrite_cmd;
+	uint32_t                     dataLen   = rxMsg->mLen - sizeof(rxMsg->EVBME.DFU_cmd.mDfuSubCmdId) - sizeof(*zCmd);
+	uint32_t                     startAddr = GETLE32(zCmd->startAddr);
+	uint16_t                     blockLen  = GETLE16(zCmd->blockLen);
+	uint16_t                     zLen      = GETLE16(zCmd->zLen);
+	uint16_t                     offset    = GETLE16(zCmd->offset);
+	TINF_DATA *                  d         = &sDfuZBlock.inflater;
+
+	if (blockLen > DFU_ZBLOCK_MAX_LEN || (blockLen % sizeof(uint32_t)) || zLen > DFU_ZBLOCK_MAX_LEN ||
+	    offset + dataLen > zLen)
+		return CA_ERROR_INVALID_ARGS;
+
+	// Each block starts at offset 0, and the rest of it must follow in order
+	if (offset == 0)
+		sDfuZBlock.startAddr = startAddr;
+	else if (offset != sDfuZBlock.received || startAddr != sDfuZBlock.startAddr)
+		return CA_ERROR_INVALID_ARGS;
+
+	memcpy(sDfuZBlock.zData + offset, zCmd->data, dataLen);
+	sDfuZBlock.received = offset + dataLen;
+
+	if (sDfuZBlock.received < zLen)
+		return CA_ERROR_SUCCESS;
+
+	uzlib_init();
+	uzlib_uncompress_init(d, NULL, 0);
+	d->source         = sDfuZBlock.zData;
+	d->source_limit   = sDfuZBlock.zData + zLen;
+	d->source_read_cb = NULL;
+	d->dest_start     = (uint8_t *)sDfuZBlock.block;
+	d->dest           = d->dest_start;
+	d->dest_limit     = d->dest_start + blockLen;
+
+	// Stops at the end of the stream, or once the block is full
+	if (uzlib_uncompress(d) < 0 || d->dest != d->dest_limit)
+		return CA_ERROR_FAIL;
+
+	return BSP_FlashWriteInitial(startAddr, sDfuZBlock.block, blockLen);
+}
+#endif
+
 static ca_error EVBME_DFU_check(struct EVBME_DFU_cmd *dfuCmd)
 {
 	u32_t startaddr = GETLE32(dfuCmd->mSubCmd.check_cmd.startAddr);
@@ -169,6 +228,7 @@ static void EVBME_DFU_cmd(struct EVBME_Message *rxMsg)
 	ca_error              status = CA_ERROR_FAIL;
 	struct EVBME_DFU_cmd *dfuCmd = &rxMsg->EVBME.DFU_cmd;
 	struct EVBME_DFU_cmd  dfuRsp;
+	u8_t                  rspLen = 2;
 
 	switch (dfuCmd->mDfuSubCmdId)
 	{
@@ -181,6 +241,11 @@ static void EVBME_DFU_cmd(struct EVBME_Message *rxMsg)
 	case DFU_WRITE:
 		status = EVBME_DFU_write(rxMsg);
 		break;
+#if CASCODA_BM_DFU_COMPRESSION
+	case DFU_ZWRITE:
+		status = EVBME_DFU_zwrite(rxMsg);
+		break;
+#endif
 	case DFU_CHECK:
 		status = EVBME_DFU_check(dfuCmd);
 		break;
@@ -193,7 +258,15 @@ static void EVBME_DFU_cmd(struct EVBME_Message *rxMsg)
 	}
 	dfuRsp.mDfuSubCmdId              = DFU_STATUS;
 	dfuRsp.mSubCmd.status_cmd.status = (uint8_t)status;
-	MAC_Message(EVBME_DFU_CMD, 2, (u8_t *)&dfuRsp);
+
+	// Writes can be pipelined by the host, so say which one this is
+	if (dfuCmd->mDfuSubCmdId == DFU_WRITE)
+	{
+		memcpy(dfuRsp.mSubCmd.status_cmd.startAddr, dfuCmd->mSubCmd.write_cmd.startAddr, 4);
+		rspLen += sizeof(dfuRsp.mSubCmd.status_cmd.startAddr);
+	}
+
+	MAC_Message(EVBME_DFU_CMD, rspLen, (u8_t *)&dfuRsp);
 }
 
 /******************************************************************************/
@@ -222,12 +295,23 @@ static int EVBMEUpStreamDispatch(struct SerialBuffer *SerialRxBuffer, struct ca8
 		ret = 1;
 		EVBME_SET_request(&rxEvbme->EVBME.SET_request, pDeviceRef);
 		break;
+	case EVBME_PIB_BATCH_REQUEST:
+		ret = 1;
+		EVBME_PIB_BATCH_request(rxEvbme, pDeviceRef);
+		break;
 	case EVBME_HOST_CONNECTED:
 		ret = 1;
+#if defined(USE_USB)
+		/* A new host must negotiate packing again */
+		SerialUSBSetPacked(false);
+#endif
 		EVBME_Connect(app_name, pDeviceRef);
 		break;
 	case EVBME_HOST_DISCONNECTED:
 		ret = 1;
+#if defined(USE_USB)
+		SerialUSBSetPacked(false);
+#endif
 		EVBME_Disconnect();
 		break;
 	case EVBME_MESSAGE_INDICATION:
@@ -367,6 +451,22 @@ static ca_error EVBME_GET_request(struct EVBME_GET_request *req)
 		getInd->mAttributeLen = maxAttrLen;
 		status                = EVBME_GET_OT_Attrib(req->mAttributeId, &(getInd->mAttributeLen), getInd->mAttribute);
 		break;
+#if defined(USE_UART)
+	case EVBME_UART_WINDOW:
+		getInd->mAttributeLen = 1;
+		getInd->mAttribute[0] = SerialUARTGetWindow();
+		break;
+#endif
+#if defined(USE_USB)
+	case EVBME_USB_PACKED:
+		getInd->mAttributeLen = 1;
+		getInd->mAttribute[0] = SerialUSBGetPacked();
+		break;
+#endif
+	case EVBME_PIB_BATCH:
+		getInd->mAttributeLen = 1;
+		getInd->mAttribute[0] = EVBME_PIB_BATCH_MAX_LEN;
+		break;
 	default:
 		status = CA_ERROR_UNKNOWN;
 		break;
@@ -436,6 +536,34 @@ static ca_error EVBME_SET_request(struct EVBME_SET_request *req, struct ca821x_d
 		EVBME_WakeUpRF();
 		break;
 
+#if defined(USE_UART)
+	case EVBME_UART_WINDOW:
+		if ((req->mAttributeLen != 1) || (req->mAttribute[0] && !SerialUARTGetWindow()))
+		{
+			status = CA_ERROR_INVALID;
+		}
+		else
+		{
+			/* The confirm is sent using the new framing */
+			SerialUARTSetWindow(req->mAttribute[0]);
+			status = CA_ERROR_SUCCESS;
+		}
+		break;
+#endif
+#if defined(USE_USB)
+	case EVBME_USB_PACKED:
+		if ((req->mAttributeLen != 1) || (req->mAttribute[0] > 1))
+		{
+			status = CA_ERROR_INVALID;
+		}
+		else
+		{
+			SerialUSBSetPacked(req->mAttribute[0]);
+			status = CA_ERROR_SUCCESS;
+		}
+		break;
+#endif
+
 	default:
 		status = CA_ERROR_UNKNOWN; /* what's that ??? */
 		break;
@@ -448,6 +576,79 @@ static ca_error EVBME_SET_request(struct EVBME_SET_request *req, struct ca821x_d
 	return status;
 }
 
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Apply a batch of PIB and HWME operations over SPI and report the
+ *        result of each one in a single EVBME_PIB_BATCH_CONFIRM
+ *******************************************************************************
+ * Operations are applied in order. Processing stops at the first malformed
+ * operation, or when the result of an operation would not fit in the confirm,
+ * in which case the host sends the remaining operations again.
+ *******************************************************************************
+ * \param rxBuf - The EVBME_PIB_BATCH_REQUEST received
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ ******************************************************************************/
+static void EVBME_PIB_BATCH_request(struct EVBME_Message *rxBuf, struct ca821x_dev *pDeviceRef)
+{
+	uint8_t                         cnfBuf[EVBME_PIB_BATCH_MAX_LEN];
+	uint8_t                         getBuf[MAX_ATTRIBUTE_SIZE];
+	struct EVBME_PIB_BATCH_confirm *cnf    = (struct EVBME_PIB_BATCH_confirm *)cnfBuf;
+	uint8_t *                       reqBuf = (uint8_t *)&rxBuf->EVBME;
+	uint8_t                         reqOff = 0;
+	uint8_t                         cnfOff = sizeof(*cnf);
+
+	cnf->mCount = 0;
+
+	while (reqOff + sizeof(struct EVBME_PIB_BATCH_op) <= rxBuf->mLen)
+	{
+		struct EVBME_PIB_BATCH_op *    op  = (struct EVBME_PIB_BATCH_op *)(reqBuf + reqOff);
+		struct EVBME_PIB_BATCH_result *res = (struct EVBME_PIB_BATCH_result *)(cnfBuf + cnfOff);
+		uint8_t                        len = sizeof(getBuf);
+
+		if (reqOff + sizeof(*op) + op->mLen > rxBuf->mLen)
+			break;
+		if (cnfOff + sizeof(*res) > sizeof(cnfBuf))
+			break;
+
+		switch (op->mOp)
+		{
+		case EVBME_PIB_MLME_SET:
+			res->mStatus = MLME_SET_request_sync(op->mAttribute, op->mIndex, op->mLen, op->mValue, pDeviceRef);
+			len          = 0;
+			break;
+		case EVBME_PIB_MLME_GET:
+			res->mStatus = MLME_GET_request_sync(op->mAttribute, op->mIndex, &len, getBuf, pDeviceRef);
+			break;
+		case EVBME_PIB_HWME_SET:
+			res->mStatus = HWME_SET_request_sync(op->mAttribute, op->mLen, op->mValue, pDeviceRef);
+			len          = 0;
+			break;
+		case EVBME_PIB_HWME_GET:
+			res->mStatus = HWME_GET_request_sync(op->mAttribute, &len, getBuf, pDeviceRef);
+			break;
+		default:
+			res->mStatus = MAC_INVALID_PARAMETER;
+			len          = 0;
+			break;
+		}
+
+		if (res->mStatus != MAC_SUCCESS)
+			len = 0;
+		/* A GET that does not fit is reported in the next batch, it has no side effects */
+		if (cnfOff + sizeof(*res) + len > sizeof(cnfBuf))
+			break;
+
+		res->mLen = len;
+		memcpy(res->mValue, getBuf, len);
+		cnfOff += sizeof(*res) + len;
+		reqOff += sizeof(*op) + op->mLen;
+		cnf->mCount++;
+	}
+
+	MAC_Message(EVBME_PIB_BATCH_CONFIRM, cnfOff, cnfBuf);
+}
+
 #else // defined(USE_USB) || defined(USE_UART)
 
 /** dummy stub function if no serial interface is defined */
@@ -37,6 +37,7 @@
 #include "cascoda-bm/cascoda_interface.h"
 #include "cascoda-bm/cascoda_serial.h"
 #include "cascoda-bm/cascoda_types.h"
+#include "cascoda-util/cascoda_hash.h"
 #include "cascoda-util/cascoda_time.h"
 
 #if defined(USE_UART)
@@ -50,20 +51,31 @@ enum serial_state
 	SERIAL_CMDID     = 1,
 	SERIAL_CMDLEN    = 2,
 	SERIAL_DATA      = 3,
+#if SERIAL_UART_WINDOW
+	SERIAL_SEQ       = 4,
+	SERIAL_ACK       = 5,
+#endif
 };
 
 #define SERIAL_SOM (0xDE)
+#define SERIAL_WIN_SOM (0xDF) /* start-of-packet delimiter for windowed frames */
 
 #define SERIAL_TIMEOUT 1000 /* serial rx_rdy timeout in [ms] */
 #define MAX_TIMEOUTS 5      /* number of rx_rdy timeouts before the Chili stops waiting */
 #define RX_TIMEOUT 200      /* serial rx timeout in [ms] */
 
+#define SERIAL_WIN_CRC_LEN 2  /* length of windowed frame CRC */
+#define SERIAL_WIN_OVERHEAD 5 /* SOM, Seq, Ack and CRC of windowed frame */
+
 /******************************************************************************/
 /****** Global Variables for Serial State                                ******/
 /******************************************************************************/
-static u8_t                SerialCount;                      //!< Number of bytes read so far
-static volatile u8_t       SerialRemainder;                  //!< Number of bytes left to receive
+static u16_t               SerialCount;                      //!< Number of bytes read so far
+static volatile u16_t      SerialRemainder;                  //!< Number of bytes left to receive
 volatile enum serial_state SerialRxState = SERIAL_INBETWEEN; //!< State of serial receive state machine
+#if SERIAL_UART_WINDOW
+static bool                SerialRxWin   = false;            //!< Frame being received is windowed
+#endif
 
 /* combine Serial Buffer and Framing for UART transfers */
 struct SerialUARTBuffer
@@ -72,6 +84,13 @@ struct SerialUARTBuffer
 	struct SerialBuffer SerialBuf; /* Serial Buffer */
 };
 
+/* windowed frame held until it has been acknowledged */
+struct SerialWinTxBuffer
+{
+	u16_t Len;                                                /* Length of frame */
+	u8_t  Frame[SERIAL_WIN_OVERHEAD + 2 + SERIAL_MAC_RX_LEN]; /* Frame as sent */
+};
+
 /******************************************************************************/
 /****** Global Variables for Serial Message Buffers                      ******/
 /******************************************************************************/
@@ -87,6 +106,28 @@ static u8_t                    SerialTimeoutCount = 0;     //!< Number of timeou
 static u8_t SerialCmdId  = 0xFF;
 static u8_t SerialCmdLen = 0;
 
+#if SERIAL_UART_WINDOW
+/******************************************************************************/
+/****** Global Variables for Windowed Framing                            ******/
+/******************************************************************************/
+/* Windowed frame being received, without SOM: Seq, Ack, CmdId, CmdLen, Data, CRC */
+static u8_t                     SerialWinRxFrame[4 + SERIAL_MAC_RX_LEN + SERIAL_WIN_CRC_LEN];
+static struct SerialBuffer      SerialWinRxSlots[SERIAL_UART_WINDOW]; //!< Frames received, indexed by Seq
+static volatile bool            SerialWinRxValid[SERIAL_UART_WINDOW]; //!< Slot holds a frame to deliver
+static struct SerialWinTxBuffer SerialWinTxSlots[SERIAL_UART_WINDOW]; //!< Unacknowledged frames, indexed by Seq
+static volatile u8_t            SerialWinTxWindow  = 0;     //!< Transmit window, 0 for stop-and-wait
+static u8_t                     SerialWinTxSeq     = 0;     //!< Seq of next frame to transmit
+static volatile u8_t            SerialWinTxAcked   = 0;     //!< Seq of oldest unacknowledged frame
+static volatile u32_t           SerialWinTxTime    = 0;     //!< Time oldest unacknowledged frame was sent
+static volatile u8_t            SerialWinRxSeq     = 0;     //!< Seq of next frame to deliver
+static volatile bool            SerialWinAckReq    = false; //!< Acknowledgement required
+static volatile bool            SerialWinNackReq   = false; //!< Negative acknowledgement required
+static bool                     SerialWinNackSent  = false; //!< Next frame has already been NACKed
+static volatile bool            SerialWinResendReq = false; //!< Windowed resend required
+static volatile u8_t            SerialWinResendSeq = 0;     //!< Seq of frame to resend
+static bool                     SerialRxBufferWin  = false; //!< SerialRxBuffer holds a windowed frame
+#endif
+
 /* Local Functions */
 static u8_t SerialFindStart(void);
 static u8_t SerialReceivedRxRdy(void);
@@ -95,12 +136,24 @@ static void SerialResend(void);
 static void SerialSetTxTimeout(void);
 static void SerialCheckTxTimeout(void);
 static void SerialCheckRxTimeout(void);
+static void SerialRxReset(void);
+static void SerialRxFrameComplete(void);
+#if SERIAL_UART_WINDOW
+static void SerialWinReceive(void);
+static void SerialWinHandleAck(u8_t Ack);
+static void SerialWinSendAck(u8_t CmdId);
+static void SerialWinResend(u8_t Seq);
+static void SerialWinFallback(void);
+static void SerialWinCheckTx(void);
+static void SerialWinService(void);
+#endif
+static void SerialSend(u8_t CommandId, u8_t Count, const u8_t *pBuffer);
 
 /******************************************************************************/
 /***************************************************************************/ /**
  * \brief Find start of block from Serial input
  *******************************************************************************
- * \return 1 if start found , 0 if not
+ * \return SOM found (SERIAL_SOM or SERIAL_WIN_SOM), 0 if not
  *******************************************************************************
  ******************************************************************************/
 static u8_t SerialFindStart(void)
@@ -109,9 +162,9 @@ static u8_t SerialFindStart(void)
 
 	if (BSP_SerialRead(&InputChar, 1) != 0)
 	{
-		if (InputChar == SERIAL_SOM)
+		if (InputChar == SERIAL_SOM || (SERIAL_UART_WINDOW && InputChar == SERIAL_WIN_SOM))
 		{
-			return 1;
+			return InputChar;
 		}
 	}
 	return 0;
@@ -119,20 +172,42 @@ static u8_t SerialFindStart(void)
 
 u8_t Serial_ReadInterface(void)
 {
-	u8_t Count;
+	u8_t  Count;
+	u8_t *pData;
 
 	while (1)
 	{
 		switch (SerialRxState)
 		{
 		case SERIAL_INBETWEEN:
-			if (SerialFindStart())
+			if ((Count = SerialFindStart()) != 0)
 			{
+#if SERIAL_UART_WINDOW
+				SerialRxWin     = (Count == SERIAL_WIN_SOM);
+				SerialRxState   = SerialRxWin ? SERIAL_SEQ : SERIAL_CMDID;
+#else
 				SerialRxState   = SERIAL_CMDID;
+#endif
 				SerialRxTimeout = TIME_ReadAbsoluteTime();
 				continue;
 			}
 			return 0;
+#if SERIAL_UART_WINDOW
+		case SERIAL_SEQ:
+			if ((Count = BSP_SerialRead(&SerialWinRxFrame[0], 1)) != 0)
+			{
+				SerialRxState = SERIAL_ACK;
+				continue;
+			}
+			return 0;
+		case SERIAL_ACK:
+			if ((Count = BSP_SerialRead(&SerialWinRxFrame[1], 1)) != 0)
+			{
+				SerialRxState = SERIAL_CMDID;
+				continue;
+			}
+			return 0;
+#endif
 		case SERIAL_CMDID:
 			if ((Count = BSP_SerialRead(&SerialCmdId, 1)) != 0)
 			{
@@ -143,6 +218,22 @@ u8_t Serial_ReadInterface(void)
 		case SERIAL_CMDLEN:
 			if ((Count = BSP_SerialRead(&SerialCmdLen, 1)) != 0)
 			{
+#if SERIAL_UART_WINDOW
+				if (SerialRxWin)
+				{
+					if (SerialCmdLen > SERIAL_MAC_RX_LEN)
+					{
+						SerialRxState = SERIAL_INBETWEEN; // not a valid frame
+						return 0;
+					}
+					SerialWinRxFrame[2] = SerialCmdId;
+					SerialWinRxFrame[3] = SerialCmdLen;
+					SerialRemainder     = SerialCmdLen + SERIAL_WIN_CRC_LEN;
+					SerialCount         = 0;
+					SerialRxState       = SERIAL_DATA;
+					continue;
+				}
+#endif
 				if (SerialReceivedRxRdy() || SerialReceivedRxFail())
 				{
 					SerialRxState = SERIAL_INBETWEEN;
@@ -150,6 +241,12 @@ u8_t Serial_ReadInterface(void)
 				}
 				else
 				{
+#if SERIAL_UART_WINDOW
+					// a stop-and-wait command means the host has restarted without windowed framing
+					SerialWinTxWindow = 0;
+					SerialWinTxAcked  = SerialWinTxSeq;
+#endif
+
 					SerialRxBuffer.CmdId  = SerialCmdId;
 					SerialRxBuffer.CmdLen = SerialCmdLen;
 					SerialRemainder       = SerialCmdLen;
@@ -169,16 +266,19 @@ u8_t Serial_ReadInterface(void)
 			}
 			return 0;
 		case SERIAL_DATA:
-			if ((Count = BSP_SerialRead(SerialRxBuffer.Data + SerialCount, SerialRemainder)) != 0)
+			pData = SerialRxBuffer.Data;
+#if SERIAL_UART_WINDOW
+			if (SerialRxWin)
+				pData = SerialWinRxFrame + 4;
+#endif
+			if ((Count = BSP_SerialRead(pData + SerialCount, SerialRemainder)) != 0)
 			{
 				SerialCount += Count;
 				SerialRemainder -= Count;
 				if (SerialRemainder == 0)
 				{
-					SerialRxState   = SERIAL_INBETWEEN;
-					SerialRemainder = 0;
-					SerialCount     = 0;
-					SerialRxPending = true;
+					SerialRxReset();
+					SerialRxFrameComplete();
 					return 1;
 				}
 			}
@@ -194,6 +294,9 @@ u8_t SerialGetCommand(void)
 	{
 		SerialResend();
 	}
+#if SERIAL_UART_WINDOW
+	SerialWinService();
+#endif
 	if (SerialRxPending)
 	{
 		SerialTimeoutCount = 0;
@@ -203,21 +306,57 @@ u8_t SerialGetCommand(void)
 
 /******************************************************************************/
 /***************************************************************************/ /**
- * \brief Completes Serial Read
+ * \brief Reset the receive state machine
  *******************************************************************************
  ******************************************************************************/
-void SerialReadComplete(void)
+static void SerialRxReset(void)
 {
 	SerialRxState   = SERIAL_INBETWEEN;
 	SerialRemainder = 0;
 	SerialCount     = 0;
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Process a completely received frame
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialRxFrameComplete(void)
+{
+#if SERIAL_UART_WINDOW
+	if (SerialRxWin)
+	{
+		SerialWinReceive();
+		return;
+	}
+#endif
 	SerialRxPending = true;
 }
 
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Completes Serial Read
+ *******************************************************************************
+ ******************************************************************************/
+void SerialReadComplete(void)
+{
+	SerialRxReset();
+	SerialRxFrameComplete();
+}
+
 void SerialSendRxRdy()
 {
 	uint8_t buf[3];
 
+#if SERIAL_UART_WINDOW
+	if (SerialRxBufferWin)
+	{
+		SerialRxBufferWin = false;
+		SerialWinSendAck(EVBME_RXRDY);
+		return;
+	}
+#endif
+
 	buf[0] = SERIAL_SOM;  /* start-of-packet delimiter */
 	buf[1] = EVBME_RXRDY; /* CmdId  = EVBME_RXRDY */
 	buf[2] = 0x00;        /* CmdLen = 0 */
@@ -328,34 +467,321 @@ static void SerialCheckRxTimeout(void)
 	if (SerialRxState != SERIAL_INBETWEEN && (TIME_ReadAbsoluteTime() - SerialRxTimeout) > RX_TIMEOUT)
 	{
 		BSP_SerialRead(NULL, 0); //Cancel DMA
-		SerialReadComplete();    //Reset rx state machine
+		SerialRxReset();         //Reset rx state machine
+#if SERIAL_UART_WINDOW
+		if (SerialRxWin)
+		{
+			SerialWinNackReq = true; //Signal for repeat send
+			return;
+		}
+#endif
 		SerialRxPending = false; //Remove pending transaction
 		SerialSendRxFail();      //Signal for repeat send
 	}
 }
 
-void EVBME_Message_UART(char *pBuffer, size_t Count)
+#if SERIAL_UART_WINDOW
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Process a completely received windowed frame (called from interrupt)
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialWinReceive(void)
+{
+	u8_t Seq    = SerialWinRxFrame[0];
+	u8_t Ack    = SerialWinRxFrame[1];
+	u8_t CmdId  = SerialWinRxFrame[2];
+	u8_t CmdLen = SerialWinRxFrame[3];
+	u8_t Ahead  = Seq - SerialWinRxSeq;
+
+	if (GETLE16(SerialWinRxFrame + 4 + CmdLen) != HASH_crc16_ccitt(SerialWinRxFrame, 4 + CmdLen))
+	{
+		SerialWinNackReq = true;
+		return;
+	}
+
+	SerialWinHandleAck(Ack);
+
+	if ((CmdId == EVBME_RXRDY) && (CmdLen == 0))
+		return;
+
+	if ((CmdId == EVBME_RXFAIL) && (CmdLen == 0))
+	{
+		SerialWinResendSeq = Ack;
+		SerialWinResendReq = true;
+		return;
+	}
+
+	if (Ahead < SERIAL_UART_WINDOW)
+	{
+		u8_t Slot = Seq % SERIAL_UART_WINDOW;
+
+		if (!SerialWinRxValid[Slot])
+		{
+			SerialWinRxSlots[Slot].CmdId  = CmdId;
+			SerialWinRxSlots[Slot].CmdLen = CmdLen;
+			memcpy(SerialWinRxSlots[Slot].Data, SerialWinRxFrame + 4, CmdLen);
+			SerialWinRxValid[Slot] = true;
+		}
+		/* frames before this one are missing */
+		if (Ahead)
+			SerialWinNackReq = true;
+	}
+	else
+	{
+		/* duplicate, so the acknowledgement was lost */
+		SerialWinAckReq = true;
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Process a cumulative acknowledgement of transmitted windowed frames
+ *******************************************************************************
+ * \param Ack - Seq of the next frame the host expects
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialWinHandleAck(u8_t Ack)
+{
+	u8_t InFlight = SerialWinTxSeq - SerialWinTxAcked;
+	u8_t Acked    = Ack - SerialWinTxAcked;
+
+	if (!Acked || Acked > InFlight)
+		return;
+
+	SerialWinTxAcked   = Ack;
+	SerialWinTxTime    = TIME_ReadAbsoluteTime();
+	SerialTimeoutCount = 0;
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Send a windowed acknowledgement of the frames delivered so far
+ *******************************************************************************
+ * If frames after the next one have already arrived, the next one has been lost,
+ * and is NACKed instead so that it is resent immediately.
+ *******************************************************************************
+ * \param CmdId - EVBME_RXRDY to acknowledge, EVBME_RXFAIL to always NACK
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialWinSendAck(u8_t CmdId)
+{
+	u8_t buf[SERIAL_WIN_OVERHEAD + 2];
+	u8_t Seq = SerialWinRxSeq;
+
+	if (!SerialWinNackSent && !SerialWinRxValid[Seq % SERIAL_UART_WINDOW])
+	{
+		for (u8_t i = 1; (i < SERIAL_UART_WINDOW) && (CmdId == EVBME_RXRDY); i++)
+		{
+			if (SerialWinRxValid[(u8_t)(Seq + i) % SERIAL_UART_WINDOW])
+				CmdId = EVBME_RXFAIL;
+		}
+	}
+	if (CmdId == EVBME_RXFAIL)
+	{
+		if (SerialWinNackSent)
+			CmdId = EVBME_RXRDY;
+		SerialWinNackSent = true;
+	}
+
+	buf[0] = SERIAL_WIN_SOM; /* start-of-packet delimiter */
+	buf[1] = 0x00;           /* Seq unused */
+	buf[2] = Seq;            /* Ack */
+	buf[3] = CmdId;          /* CmdId  = EVBME_RXRDY or EVBME_RXFAIL */
+	buf[4] = 0x00;           /* CmdLen = 0 */
+	PUTLE16(HASH_crc16_ccitt(buf + 1, 4), buf + 5);
+	BSP_SerialWriteAll(buf, sizeof(buf));
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Resend an unacknowledged windowed frame
+ *******************************************************************************
+ * \param Seq - Seq of the frame to resend
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialWinResend(u8_t Seq)
+{
+	struct SerialWinTxBuffer *TxBuf = &SerialWinTxSlots[Seq % SERIAL_UART_WINDOW];
+	u8_t                      Acked = SerialWinTxAcked;
+
+	if ((u8_t)(Seq - Acked) >= (u8_t)(SerialWinTxSeq - Acked))
+		return;
+
+	if (Seq == Acked)
+		SerialWinTxTime = TIME_ReadAbsoluteTime();
+	BSP_SerialWriteAll(TxBuf->Frame, TxBuf->Len);
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Revert to stop-and-wait framing, resending the unacknowledged frames
+ *******************************************************************************
+ * The frames are resent with stop-and-wait framing rather than dropped, so that
+ * a host that has restarted without windowed framing still receives them.
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialWinFallback(void)
+{
+	SerialWinTxWindow = 0;
+
+	while (SerialWinTxSeq != SerialWinTxAcked)
+	{
+		struct SerialWinTxBuffer *TxBuf = &SerialWinTxSlots[SerialWinTxAcked % SERIAL_UART_WINDOW];
+
+		SerialCheckTxTimeout();
+		/* CmdId, CmdLen and Data follow the SOM, Seq and Ack of the windowed frame */
+		SerialTxBuffer.SofPkt = SERIAL_SOM;
+		memcpy(&SerialTxBuffer.SerialBuf, TxBuf->Frame + 3, TxBuf->Frame[4] + 2);
+		BSP_SerialWriteAll(&SerialTxBuffer.SofPkt, TxBuf->Frame[4] + 3);
+		SerialSetTxTimeout();
+		SerialWinTxAcked++;
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Handle windowed resend requests and acknowledgement timeouts
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialWinCheckTx(void)
+{
+	if (SerialWinResendReq)
+	{
+		SerialWinResendReq = false;
+		SerialWinResend(SerialWinResendSeq);
+	}
+
+	if ((SerialWinTxSeq != SerialWinTxAcked) && ((TIME_ReadAbsoluteTime() - SerialWinTxTime) > SERIAL_TIMEOUT))
+	{
+		if (++SerialTimeoutCount >= MAX_TIMEOUTS)
+		{
+			/* host has gone, stop waiting and revert to stop-and-wait */
+			SerialWinFallback();
+		}
+		else
+		{
+			SerialWinResend(SerialWinTxAcked);
+		}
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Service windowed framing: resends, acknowledgements and delivery
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialWinService(void)
+{
+	u8_t Slot;
+
+	SerialWinCheckTx();
+
+	if (SerialWinNackReq)
+	{
+		SerialWinNackReq = false;
+		SerialWinSendAck(EVBME_RXFAIL);
+	}
+	if (SerialWinAckReq)
+	{
+		SerialWinAckReq = false;
+		SerialWinSendAck(EVBME_RXRDY);
+	}
+
+	/* deliver the next frame in sequence */
+	Slot = SerialWinRxSeq % SERIAL_UART_WINDOW;
+	if (!SerialRxPending && SerialWinRxValid[Slot])
+	{
+		memcpy(&SerialRxBuffer, &SerialWinRxSlots[Slot], SerialWinRxSlots[Slot].CmdLen + 2);
+		SerialWinRxValid[Slot] = false;
+		SerialWinRxSeq++;
+		SerialWinNackSent = false;
+		SerialRxBufferWin = true;
+		SerialRxPending   = true;
+	}
+}
+
+#endif
+
+u8_t SerialUARTGetWindow(void)
+{
+	return SERIAL_UART_WINDOW;
+}
+
+void SerialUARTSetWindow(u8_t aWindow)
+{
+#if SERIAL_UART_WINDOW
+	for (u8_t i = 0; i < SERIAL_UART_WINDOW; i++) SerialWinRxValid[i] = false;
+
+	SerialWinTxSeq     = 0;
+	SerialWinTxAcked   = 0;
+	SerialWinRxSeq     = 0;
+	SerialWinAckReq    = false;
+	SerialWinNackReq   = false;
+	SerialWinNackSent  = false;
+	SerialWinResendReq = false;
+	SerialWinTxWindow  = (aWindow > SERIAL_UART_WINDOW) ? SERIAL_UART_WINDOW : aWindow;
+#else
+	(void)aWindow;
+#endif
+}
+
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Send a message upstream, windowed if negotiated
+ *******************************************************************************
+ * \param CommandId - command id of message
+ * \param Count - Number of Characters
+ * \param pBuffer - Pointer to Character Buffer
+ *******************************************************************************
+ ******************************************************************************/
+static void SerialSend(u8_t CommandId, u8_t Count, const u8_t *pBuffer)
 {
 	SerialGetCommand();
 	SerialCheckTxTimeout();
+
+#if SERIAL_UART_WINDOW
+	/* wait for space in the window */
+	while (SerialWinTxWindow && ((u8_t)(SerialWinTxSeq - SerialWinTxAcked) >= SerialWinTxWindow))
+		SerialWinCheckTx();
+
+	if (SerialWinTxWindow)
+	{
+		struct SerialWinTxBuffer *TxBuf = &SerialWinTxSlots[SerialWinTxSeq % SERIAL_UART_WINDOW];
+
+		TxBuf->Frame[0] = SERIAL_WIN_SOM;
+		TxBuf->Frame[1] = SerialWinTxSeq;
+		TxBuf->Frame[2] = SerialWinRxSeq;
+		TxBuf->Frame[3] = CommandId;
+		TxBuf->Frame[4] = Count;
+		memcpy(TxBuf->Frame + 5, pBuffer, Count);
+		PUTLE16(HASH_crc16_ccitt(TxBuf->Frame + 1, Count + 4), TxBuf->Frame + 5 + Count);
+		TxBuf->Len = Count + SERIAL_WIN_OVERHEAD + 2;
+
+		if (SerialWinTxSeq == SerialWinTxAcked)
+			SerialWinTxTime = TIME_ReadAbsoluteTime();
+		SerialWinTxSeq++;
+		BSP_SerialWriteAll(TxBuf->Frame, TxBuf->Len);
+		return;
+	}
+#endif
+
 	SerialTxBuffer.SofPkt           = SERIAL_SOM;
-	SerialTxBuffer.SerialBuf.CmdId  = EVBME_MESSAGE_INDICATION;
+	SerialTxBuffer.SerialBuf.CmdId  = CommandId;
 	SerialTxBuffer.SerialBuf.CmdLen = Count;
 	memcpy(SerialTxBuffer.SerialBuf.Data, pBuffer, Count);
 	BSP_SerialWriteAll(&SerialTxBuffer.SofPkt, Count + 3);
 	SerialSetTxTimeout();
+}
+
+void EVBME_Message_UART(char *pBuffer, size_t Count)
+{
+	SerialSend(EVBME_MESSAGE_INDICATION, Count, (const u8_t *)pBuffer);
 } // End of EVBME_Message()
 
 void MAC_Message_UART(u8_t CommandId, u8_t Count, const u8_t *pBuffer)
 {
-	SerialGetCommand();
-	SerialCheckTxTimeout();
-	SerialTxBuffer.SofPkt           = SERIAL_SOM;
-	SerialTxBuffer.SerialBuf.CmdId  = CommandId;
-	SerialTxBuffer.SerialBuf.CmdLen = Count;
-	memcpy(SerialTxBuffer.SerialBuf.Data, pBuffer, Count);
-	BSP_SerialWriteAll(&SerialTxBuffer.SofPkt, Count + 3);
-	SerialSetTxTimeout();
+	SerialSend(CommandId, Count, pBuffer);
 } // End of MAC_Message()
 
 #endif
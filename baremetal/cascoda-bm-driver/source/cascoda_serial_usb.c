@@ -54,18 +54,62 @@ u8_t Serial_Stdout = EVBME_MESSAGE_INDICATION;
 #define USB_MAX_DATA (USB_FRAG_SIZE - 1)
 #define USB_FRAG_FIRST (0x40)
 #define USB_FRAG_LAST (0x80)
+#define USB_FRAG_LEN_MASK (0x3F)
+#define USB_FRAG_SINGLE (USB_FRAG_FIRST | USB_FRAG_LAST)
 
 /******************************************************************************/
 /****** Global Variables for buffering fragmented USB Packets            ******/
 /******************************************************************************/
 u8_t UsbTxFrag[USB_FRAG_SIZE];
 
+static u8_t UsbRxOffset     = 0;     //!< Offset of the next message in a received packed report
+static bool SerialUSBPacked = false; //!< Pack messages into queued reports, enabled by the host
+
 /******************************************************************************/
 /****** Global Variables for Serial Message Buffers                      ******/
 /******************************************************************************/
 struct SerialBuffer SerialRxBuffer; //Must be protected by locks (enable/disable serial IRQ)
 volatile bool       SerialRxPending = false;
 
+/******************************************************************************/
+/***************************************************************************/ /**
+ * \brief Append a message to the last queued report if it is waiting to be sent
+ *******************************************************************************
+ * \param Command - Command ID of message
+ * \param pBuffer - Pointer to message Buffer
+ * \param Length - Length of pBuffer
+ *******************************************************************************
+ * \return true if the message was packed, false if it must be sent separately
+ *******************************************************************************
+ ******************************************************************************/
+static bool SerialUSBPack(u8_t Command, const u8_t *pBuffer, u8_t Length)
+{
+	u8_t *LastFrag;
+	u8_t  LastLen;
+	bool  Packed = false;
+
+	if (!SerialUSBPacked || (Length + 2) > USB_MAX_DATA)
+		return false;
+
+	BSP_DisableSerialIRQ();
+	LastFrag = BSP_USBSerialTxPeekLast();
+	if (LastFrag && (LastFrag[0] & USB_FRAG_SINGLE) == USB_FRAG_SINGLE)
+	{
+		LastLen = LastFrag[0] & USB_FRAG_LEN_MASK;
+		if ((LastLen + Length + 2) <= USB_MAX_DATA)
+		{
+			LastFrag[1 + LastLen] = Command;
+			LastFrag[2 + LastLen] = Length;
+			memcpy(LastFrag + 3 + LastLen, pBuffer, Length);
+			LastFrag[0] += Length + 2;
+			Packed = true;
+		}
+	}
+	BSP_EnableSerialIRQ();
+
+	return Packed;
+}
+
 /******************************************************************************/
 /***************************************************************************/ /**
  * \brief Send confirm or ind via USB
@@ -82,6 +126,9 @@ static void SerialUSBSend(u8_t Command, const u8_t *pBuffer, u8_t Length)
 	u8_t FragOffset;
 	u8_t SizeLeft;
 
+	if (SerialUSBPack(Command, pBuffer, Length))
+		return;
+
 	UsbTxFrag[1] = Command;
 	UsbTxFrag[2] = Length;
 	FragOffset   = 3;
@@ -123,9 +170,38 @@ u8_t SerialGetCommand(void)
 			return 0;
 		}
 		ControlByte = UsbRxFrag[0];
-		Count       = ControlByte & 0x3F;
+		Count       = ControlByte & USB_FRAG_LEN_MASK;
 
-		if (ControlByte & USB_FRAG_FIRST)
+		if ((ControlByte & USB_FRAG_SINGLE) == USB_FRAG_SINGLE)
+		{
+			/* Complete report, which may hold several packed messages */
+			u8_t *Msg  = UsbRxFrag + 1 + UsbRxOffset;
+			u8_t  Left = Count - UsbRxOffset;
+
+			if (Left < 2 || Msg[1] > (Left - 2))
+			{
+				/* Malformed, drop the rest of the report */
+				UsbRxOffset = 0;
+				BSP_USBSerialRxDequeue();
+				continue;
+			}
+
+			SerialRxBuffer.CmdId  = Msg[0];
+			SerialRxBuffer.CmdLen = Msg[1];
+			memcpy(SerialRxBuffer.Data, Msg + 2, Msg[1]);
+			UsbRxOffset += Msg[1] + 2;
+
+			/* Keep the report until every message in it has been read */
+			if (UsbRxOffset >= Count)
+			{
+				UsbRxOffset = 0;
+				BSP_USBSerialRxDequeue();
+			}
+			SerialRxPending = true;
+			SerialCount     = 0;
+			return 1;
+		}
+		else if (ControlByte & USB_FRAG_FIRST)
 		{
 			SerialRxBuffer.CmdId  = UsbRxFrag[1];
 			SerialRxBuffer.CmdLen = UsbRxFrag[2];
@@ -161,4 +237,14 @@ void MAC_Message_USB(u8_t CommandId, u8_t Count, const u8_t *pBuffer)
 
 } // End of MAC_Message()
 
+bool SerialUSBGetPacked(void)
+{
+	return SerialUSBPacked;
+}
+
+void SerialUSBSetPacked(bool aPacked)
+{
+	SerialUSBPacked = aPacked;
+}
+
 #endif // USE_USB
@@ -79,6 +79,8 @@ static const uint16_t sensordemo_key = 0xCA5C;
 static const uint16_t actuatordemo_key = 0xCA5D;
 /** Flash settings key for the stack profiler */
 static const uint16_t stack_profiler_key = 0xCA5E;
+/** Flash settings key for the DTLS sessions of the LWM2M client */
+static const uint16_t lwm2m_dtls_session_key = 0xCA5F;
 /** Flash settings key used for storing OCF data */
 static const uint16_t OC_SETTINGS_KEY = 0xe107;
 /** Flash settings key used for storing OCF encryption private key */
@@ -84,6 +84,17 @@ struct settingsBlock
 #define SETTINGS_CONFIG_BASE_ADDRESS 0
 #endif // SETTINGS_CONFIG_BASE_ADDRESS
 
+/**
+ * @def SETTINGS_CONFIG_INDEX_SIZE
+ *
+ * The number of live settings blocks that can be indexed in RAM. If there are more, lookups fall back to
+ * scanning the settings in flash until the settings are next reinitialised or swapped.
+ *
+ */
+#ifndef SETTINGS_CONFIG_INDEX_SIZE
+#define SETTINGS_CONFIG_INDEX_SIZE 64
+#endif // SETTINGS_CONFIG_INDEX_SIZE
+
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 static uint32_t sSettingsBaseAddress;
@@ -94,6 +105,138 @@ static uint16_t getAlignLength(uint16_t length)
 	return (length + 3) & 0xfffc;
 }
 
+/**
+ * Index entry for a live settings block. The entries are kept in the order of the blocks in flash, so the
+ * entries for a key are its values in index order.
+ */
+struct settingsIndexEntry
+{
+	uint16_t key;
+	uint16_t offset; //!< Offset of the block from sSettingsBaseAddress
+	uint16_t length; //!< Length of the value
+};
+
+static struct settingsIndexEntry sIndex[SETTINGS_CONFIG_INDEX_SIZE];
+static uint16_t                  sIndexCount;
+static bool                      sIndexValid;
+
+static void indexReset(void)
+{
+	sIndexCount = 0;
+	sIndexValid = true;
+}
+
+static struct settingsIndexEntry *indexFind(uint16_t aKey, int aIndex)
+{
+	int index = 0;
+
+	for (uint16_t i = 0; i < sIndexCount; i++)
+	{
+		if (sIndex[i].key == aKey && index++ == aIndex)
+			return &sIndex[i];
+	}
+
+	return NULL;
+}
+
+// Remove the aIndex-th value of aKey from the index, or all of them if aIndex is -1
+static void indexRemove(uint16_t aKey, int aIndex)
+{
+	uint16_t kept  = 0;
+	int      index = 0;
+
+	for (uint16_t i = 0; i < sIndexCount; i++)
+	{
+		if (sIndex[i].key == aKey && (aIndex == -1 || index++ == aIndex))
+			continue;
+		sIndex[kept++] = sIndex[i];
+	}
+
+	sIndexCount = kept;
+}
+
+// Update the index with the block at aOffset, which must be the last block in the settings
+static void indexRecord(const struct settingsBlock *aBlock, uint32_t aOffset)
+{
+	if (!sIndexValid)
+		return;
+
+	// A block marked as index 0 supersedes every earlier value of its key, whatever its state
+	if (!(aBlock->flag & kBlockIndex0Flag))
+		indexRemove(aBlock->key, -1);
+
+	if ((aBlock->flag & kBlockAddCompleteFlag) || !(aBlock->flag & kBlockDeleteFlag))
+		return;
+
+	if (sIndexCount == SETTINGS_CONFIG_INDEX_SIZE || aOffset > UINT16_MAX)
+	{
+		sIndexValid = false;
+		return;
+	}
+
+	sIndex[sIndexCount].key    = aBlock->key;
+	sIndex[sIndexCount].offset = aOffset;
+	sIndex[sIndexCount].length = aBlock->length;
+	sIndexCount++;
+}
+
+// Rebuild the index by scanning the settings in flash
+static void indexBuild(void)
+{
+	uint32_t offset = kSettingsFlagSize;
+
+	indexReset();
+
+	while (offset < sSettingsUsedSize)
+	{
+		struct settingsBlock block;
+
+		utilsFlashRead(sSettingsBaseAddress + offset, (uint8_t *)(&block), sizeof(block));
+		indexRecord(&block, offset);
+		offset += (getAlignLength(block.length) + sizeof(struct settingsBlock));
+	}
+}
+
+static void clearBlockFlag(uint32_t aOffset, uint16_t aFlag)
+{
+	struct settingsBlock block;
+
+	utilsFlashRead(sSettingsBaseAddress + aOffset, (uint8_t *)(&block), sizeof(block));
+	block.flag &= (~aFlag);
+	utilsFlashWrite(sSettingsBaseAddress + aOffset, (uint8_t *)(&block), sizeof(block));
+}
+
+// Delete values of a key using the index, with the same effect as scanning the settings in otPlatSettingsDelete
+static otError indexDelete(uint16_t aKey, int aIndex)
+{
+	otError error = OT_ERROR_NOT_FOUND;
+	int     index = 0;
+
+	for (uint16_t i = 0; i < sIndexCount; i++)
+	{
+		if (sIndex[i].key != aKey)
+			continue;
+
+		if (aIndex == index || aIndex == -1)
+		{
+			error = OT_ERROR_NONE;
+			clearBlockFlag(sIndex[i].offset, kBlockDeleteFlag);
+		}
+
+		if (index == 1 && aIndex == 0)
+		{
+			clearBlockFlag(sIndex[i].offset, kBlockIndex0Flag);
+		}
+
+		index++;
+	}
+
+	if (error == OT_ERROR_NONE)
+		indexRemove(aKey, aIndex);
+
+	return error;
+}
+
 static void setSettingsFlag(uint32_t aBase, uint32_t aFlag)
 {
 	utilsFlashWrite(aBase, (uint8_t *)(&aFlag), sizeof(aFlag));
@@ -126,6 +269,7 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 	BSP_GetFlashInfo(&flash_info);
 	uint8_t  pageNum      = flash_info.numPages;
 	uint32_t settingsSize = pageNum > 1 ? flash_info.pageSize * pageNum / 2 : flash_info.pageSize;
+	uint16_t cursor       = 0;
 
 	(void)aInstance;
 
@@ -153,16 +297,23 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 			// Address points to the end of the current file
 			uint32_t address = swapAddress + getAlignLength(new_block.length);
 
-			while (address < (oldBase + usedSize))
+			if (sIndexValid)
+			{
+				// The index holds exactly the live blocks, in the order they are stored
+				valid = (cursor < sIndexCount) &&
+				        (sIndex[cursor].offset == swapAddress - oldBase - sizeof(struct settingsBlock));
+			}
+
+			// Otherwise, check that no later block replaces this one
+			while (!sIndexValid && address < (oldBase + usedSize))
 			{
 				struct settingsBlock block;
 
 				// Read the settings at address
 				utilsFlashRead(address, (uint8_t *)(&block), sizeof(block));
 
-				// Block is complete and not set to be deleted and is index0 and the correct key
-				if (!(block.flag & kBlockAddCompleteFlag) && (block.flag & kBlockDeleteFlag) &&
-				    !(block.flag & kBlockIndex0Flag) && (block.key == new_block.key))
+				// A later index0 block of the same key replaces this one, even if it was since deleted
+				if (!(block.flag & kBlockIndex0Flag) && (block.key == new_block.key))
 				{
 					// The block is invalid - go to the next one
 					valid = false;
@@ -182,6 +333,10 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 				// the start of the settings block
 				uint32_t start_address       = swapAddress - sizeof(struct settingsBlock);
 				uint16_t bytes_copied_so_far = 0;
+
+				if (sIndexValid)
+					sIndex[cursor++].offset = sSettingsUsedSize;
+
 				// Copy the settings block. Flash data may be corrupted if power is lost past this point!
 				utilsFlashWrite(
 				    sSettingsBaseAddress + sSettingsUsedSize, (uint8_t *)(&new_block), sizeof(struct settingsBlock));
@@ -222,6 +377,9 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 	setSettingsFlag(sSettingsBaseAddress, (uint32_t)(kSettingsInUse));
 	setSettingsFlag(oldBase, (uint32_t)(kSettingsNotUse));
 
+	if (!sIndexValid)
+		indexBuild();
+
 exit:
 	// Returns the amount of space left
 	return settingsSize - sSettingsUsedSize;
@@ -294,6 +452,7 @@ static otError addSettingVector(otInstance *          aInstance,
 
 	block.flag &= (~kBlockAddCompleteFlag);
 	utilsFlashWrite(sSettingsBaseAddress + sSettingsUsedSize, (uint8_t *)(&block), sizeof(struct settingsBlock));
+	indexRecord(&block, sSettingsUsedSize);
 	sSettingsUsedSize += (sizeof(struct settingsBlock) + getAlignLength(block.length));
 
 exit:
@@ -334,6 +493,7 @@ void otPlatSettingsInit(otInstance *aInstance)
 	}
 
 	sSettingsUsedSize = kSettingsFlagSize;
+	indexReset();
 
 	while (sSettingsUsedSize < settingsSize)
 	{
@@ -343,6 +503,7 @@ void otPlatSettingsInit(otInstance *aInstance)
 
 		if (!(block.flag & kBlockAddBeginFlag))
 		{
+			indexRecord(&block, sSettingsUsedSize);
 			sSettingsUsedSize += (getAlignLength(block.length) + sizeof(struct settingsBlock));
 		}
 		else
@@ -381,6 +542,17 @@ static otError getRelativeAddress(uint16_t aKey, int aIndex, uint32_t *aAddress,
 	uint32_t address = sSettingsBaseAddress + kSettingsFlagSize;
 	int      index   = 0;
 
+	if (sIndexValid)
+	{
+		struct settingsIndexEntry *entry = indexFind(aKey, aIndex);
+
+		otEXPECT(entry != NULL);
+		*aAddress     = sSettingsBaseAddress + entry->offset + sizeof(struct settingsBlock);
+		*aValueLength = entry->length;
+		error         = OT_ERROR_NONE;
+		goto exit;
+	}
+
 	while (address < (sSettingsBaseAddress + sSettingsUsedSize))
 	{
 		struct settingsBlock block;
@@ -409,6 +581,8 @@ static otError getRelativeAddress(uint16_t aKey, int aIndex, uint32_t *aAddress,
 		}
 		address += (getAlignLength(block.length) + sizeof(struct settingsBlock));
 	}
+
+exit:
 	return error;
 }
 
@@ -499,6 +673,9 @@ otError otPlatSettingsDelete(otInstance *aInstance, uint16_t aKey, int aIndex)
 
 	(void)aInstance;
 
+	if (sIndexValid)
+		return indexDelete(aKey, aIndex);
+
 	while (address < (sSettingsBaseAddress + sSettingsUsedSize))
 	{
 		struct settingsBlock block;
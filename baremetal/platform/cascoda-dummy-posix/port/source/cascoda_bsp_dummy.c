@@ -109,6 +109,11 @@ void BSP_USBSerialRxDequeue(void)
 {
 }
 
+u8_t *BSP_USBSerialTxPeekLast(void)
+{
+	return NULL;
+}
+
 #endif // USE_USB
 
 #if defined(USE_UART)
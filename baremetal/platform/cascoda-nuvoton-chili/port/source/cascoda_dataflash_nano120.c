@@ -40,6 +40,7 @@
 #include "sys.h"
 /* Cascoda */
 #include "cascoda-bm/cascoda_types.h"
+#include "cascoda-util/cascoda_crc32.h"
 #include "cascoda_chili.h"
 
 /******************************************************************************/
@@ -59,44 +60,6 @@ void                   BSP_GetFlashInfo(struct FlashInfo *aFlashInfoOut)
 	memcpy(aFlashInfoOut, &BSP_FlashInfo, sizeof(BSP_FlashInfo));
 }
 
-/*
- * CRC32 algorithm taken from the zlib source, which is
- * Copyright (C) 1995-1998 Jean-loup Gailly and Mark Adler
- */
-static const unsigned int tinf_crc32tab[16] = {0x00000000,
-                                               0x1db71064,
-                                               0x3b6e20c8,
-                                               0x26d930ac,
-                                               0x76dc4190,
-                                               0x6b6b51f4,
-                                               0x4db26158,
-                                               0x5005713c,
-                                               0xedb88320,
-                                               0xf00f9344,
-                                               0xd6d6a3e8,
-                                               0xcb61b38c,
-                                               0x9b64c2b0,
-                                               0x86d3d2d4,
-                                               0xa00ae278,
-                                               0xbdbdf21c};
-
-/* crc is previous value for incremental computation, 0xffffffff initially */
-static uint32_t uzlib_crc32(const void *data, unsigned int length, uint32_t crc)
-{
-	const unsigned char *buf = (const unsigned char *)data;
-	unsigned int         i;
-
-	for (i = 0; i < length; ++i)
-	{
-		crc ^= buf[i];
-		crc = tinf_crc32tab[crc & 0x0f] ^ (crc >> 4);
-		crc = tinf_crc32tab[crc & 0x0f] ^ (crc >> 4);
-	}
-
-	// return value suitable for passing in next time, for final value invert it
-	return crc /* ^ 0xffffffff*/;
-}
-
 /*---------------------------------------------------------------------------*
  * See cascoda-bm/cascoda_interface.h for docs                               *
  *---------------------------------------------------------------------------*/
@@ -236,7 +199,7 @@ ca_error BSP_FlashRead(u32_t startaddr, u32_t *data, u32_t datasize)
 
 ca_error BSP_FlashCheck(u32_t startaddr, u32_t checklen, u32_t crc32)
 {
-	uint32_t crc_flash = 0xFFFFFFFF;
+	uint32_t crc_flash = 0;
 
 	if (!isValidFlashAddr(startaddr))
 	{
@@ -246,17 +209,15 @@ ca_error BSP_FlashCheck(u32_t startaddr, u32_t checklen, u32_t crc32)
 	SYS_UnlockReg();
 	FMC_Open();
 	/* Loop to read the data into the buffer */
-	for (uint32_t i = 0; i < checklen; ++i)
+	for (uint32_t i = 0; i < checklen; i += sizeof(uint32_t))
 	{
 		uint32_t data = FMC_Read(startaddr);
-		crc_flash     = uzlib_crc32(&data, sizeof(data), crc_flash);
+		crc_flash     = CRC32_Update(crc_flash, &data, sizeof(data));
 		startaddr += sizeof(data);
 	}
 	FMC_Close();
 	SYS_LockReg();
 
-	crc_flash = ~crc_flash;
-
 	if (crc_flash != crc32)
 		return CA_ERROR_FAIL;
 	return CA_ERROR_SUCCESS;
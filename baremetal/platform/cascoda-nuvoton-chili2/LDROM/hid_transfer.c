@@ -61,6 +61,12 @@
 struct SerialBuf gRxBuffer;
 struct SerialBuf gTxBuffer;
 
+/** Is a fragment armed in EP2, waiting for the host to collect it? gTxBuffer must not be reused until it is */
+volatile uint8_t gTxBusy;
+
+/** Command received while gRxBuffer is still being processed, such as the next write while flash is programmed */
+static struct SerialBuf sRxNext;
+
 /******************************************************************************/
 /****** String descriptors for this device                               ******/
 /******************************************************************************/
@@ -113,9 +119,9 @@ const S_USBD_INFO_T gsInfo = {(uint8_t *)&HidDeviceDescriptor,
                               ConfigHidDescIdx};
 
 /**
- * Assemble fragments into gRxBuffer
+ * Assemble fragments into sRxNext, which is moved to gRxBuffer by take_next_rx once complete
  * @param frag_in Incoming USB fragment
- * @return 0 if we are expecting more in buffer, 1 if app needs to process first
+ * @return 0 if we are expecting more in buffer, 1 if sRxNext holds a complete command
  */
 static int assemble_frags(uint8_t *frag_in)
 {
@@ -138,19 +144,30 @@ static int assemble_frags(uint8_t *frag_in)
 		return 0;
 	}
 
-	memcpy(&gRxBuffer.cmdid + offset, &frag_in[1], frag_len);
+	memcpy(&sRxNext.cmdid + offset, &frag_in[1], frag_len);
 
 	offset += frag_len;
 	len = offset;
 
 	if (is_last)
 	{
-		gRxBuffer.isReady = true;
-		offset            = 0;
+		sRxNext.isReady = true;
+		offset          = 0;
 	}
 	return is_last;
 }
 
+/**
+ * Move the received command from sRxNext to gRxBuffer for processing, and start receiving the next one
+ */
+static void take_next_rx(void)
+{
+	memcpy((void *)&gRxBuffer, (const void *)&sRxNext, sizeof(gRxBuffer));
+	sRxNext.isReady   = false;
+	gRxBuffer.isReady = true;
+	USBD_SET_PAYLOAD_LEN(EP3, EP3_MAX_PKT_SIZE);
+}
+
 /**
  * Get the next fragment from gTxBuffer
  * @param frag_out The buffer to build the fragment into
@@ -185,7 +202,10 @@ static void get_next_frag(uint8_t *frag_out)
 	}
 }
 
-void EP2_Handler(void) /* Interrupt IN handler */
+/**
+ * Arm EP2 with the next fragment of gTxBuffer, if there is one
+ */
+static void arm_next_frag(void)
 {
 	uint8_t *ptr;
 	ptr = (uint8_t *)(USBD_BUF_BASE + USBD_GET_EP_BUF_ADDR(EP2));
@@ -196,9 +216,17 @@ void EP2_Handler(void) /* Interrupt IN handler */
 
 	//We have not sent complete packet, load next fragment
 	get_next_frag(ptr);
+	gTxBusy = true;
 	USBD_SET_PAYLOAD_LEN(EP2, EP2_MAX_PKT_SIZE);
 }
 
+void EP2_Handler(void) /* Interrupt IN handler */
+{
+	//The host has collected the armed fragment
+	gTxBusy = false;
+	arm_next_frag();
+}
+
 void EP3_Handler(void) /* Interrupt OUT handler */
 {
 	uint8_t *ptr;
@@ -207,18 +235,25 @@ void EP3_Handler(void) /* Interrupt OUT handler */
 	//Unstall receive if we have not got complete packet
 	if (!assemble_frags(ptr))
 		USBD_SET_PAYLOAD_LEN(EP3, EP3_MAX_PKT_SIZE);
+	//Otherwise hand it over if the main loop is free, or hold it (stalling the host) until RxHandled
+	else if (!gRxBuffer.isReady)
+		take_next_rx();
 }
 
 void RxHandled(void)
 {
-	gRxBuffer.isReady = false;
-	USBD_SET_PAYLOAD_LEN(EP3, EP3_MAX_PKT_SIZE);
+	NVIC_DisableIRQ(USBD_IRQn);
+	if (sRxNext.isReady)
+		take_next_rx();
+	else
+		gRxBuffer.isReady = false;
+	NVIC_EnableIRQ(USBD_IRQn);
 }
 
 void TxReady(void)
 {
 	gTxBuffer.isReady = false;
-	EP2_Handler();
+	arm_next_frag();
 }
 
 //from cascoda_hash.c
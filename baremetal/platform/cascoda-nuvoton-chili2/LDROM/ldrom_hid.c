@@ -155,6 +155,10 @@ void ParseWrite(void)
 	uint32_t startAddr = GETLE32(gRxBuffer.dfu_cmd.write_cmd.startAddr);
 	uint8_t  writeLen  = gRxBuffer.len - 5; //1 for dfu_cmdid, 4 for startAddr
 
+	//Writes can be pipelined by the host, so say which one this is
+	memcpy(gTxBuffer.dfu_cmd.status_cmd.startAddr, gRxBuffer.dfu_cmd.write_cmd.startAddr, 4);
+	gTxBuffer.len = 6;
+
 	//Check that startAddr is word aligned and writeLen is word-aligned
 	if ((startAddr % sizeof(uint32_t)) || (writeLen % sizeof(uint32_t)))
 	{
@@ -347,8 +351,8 @@ int32_t main(void)
 			USBD->INTSTS = USBD_INTSTS_SOFIF_Msk;
 		}
 
-		//If we have received something and the previous Tx has been fully sent.
-		if (gRxBuffer.isReady && gTxBuffer.isReady)
+		//If we have received something and the previous Tx has been collected by the host, not just loaded into EP2.
+		if (gRxBuffer.isReady && gTxBuffer.isReady && !gTxBusy)
 		{
 			if (gRxBuffer.cmdid == EVBME_DFU_CMD)
 			{
@@ -74,6 +74,7 @@ ca_static_assert(sizeof(struct SerialBuf) == sizeof(struct dfu_write_cmd_aligned
 
 extern struct SerialBuf gRxBuffer;
 extern struct SerialBuf gTxBuffer;
+extern volatile uint8_t gTxBusy;
 
 void HID_Init(void);
 void EP2_Handler(void);
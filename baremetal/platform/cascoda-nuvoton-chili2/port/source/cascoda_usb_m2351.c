@@ -490,6 +490,17 @@ void BSP_USBSerialRxDequeue(void)
 	NVIC_EnableIRQ(USBD_IRQn);
 }
 
+u8_t *BSP_USBSerialTxPeekLast(void)
+{
+	u8_t Last;
+
+	if (FullTransmitBuffers == 0)
+		return NULL;
+
+	Last = NextTransmitBufferToFill ? (NextTransmitBufferToFill - 1) : (TBUFFS - 1);
+	return &TransmitBuffer[Last][0];
+}
+
 void USB_SetConnectedFlag(bool is_connected)
 {
 	Connected = is_connected;
@@ -5,6 +5,7 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 //cmocka must be after system headers
 #include <cmocka.h>
 
@@ -38,6 +39,27 @@ u8_t __wrap_BSP_SPIPopByte(u8_t *InByte)
 	return 1;
 }
 
+/** Clock an asynchronous message of len bytes of fill out of the CA-821x into the receive FIFO */
+static void receive_async(uint8_t len, uint8_t fill)
+{
+	will_return(__wrap_BSP_SPIPopByte, SPI_MCPS_DATA_INDICATION);
+	will_return(__wrap_BSP_SPIPopByte, len);
+	will_return_count(__wrap_BSP_SPIPopByte, fill, len);
+	assert_int_equal(SPI_Exchange(NULL, &sdev), CA_ERROR_SUCCESS);
+}
+
+/** Check that the oldest message in the receive FIFO is as expected, then dequeue it */
+static void dequeue_async(uint8_t len, uint8_t fill)
+{
+	struct MAC_Message *msg = SPI_PeekFullBuf();
+
+	assert_non_null(msg);
+	assert_int_equal(msg->CommandId, SPI_MCPS_DATA_INDICATION);
+	assert_int_equal(msg->Length, len);
+	for (int i = 0; i < len; i++) assert_int_equal(msg->PData.Payload[i], fill);
+	SPI_DequeueFullBuf();
+}
+
 static void empty_test(void **state)
 {
 	(void)state;
@@ -102,6 +124,86 @@ static void async_send_test(void **state)
 	assert_int_equal(MCPS_DATA_request(0, dest, 1, &msdu, 0, 0x05, NULL, &sdev), MAC_SUCCESS);
 }
 
+/** Test that many small messages are packed into the space of a few full size ones */
+static void packed_test(void **state)
+{
+	uint16_t count = 0, hwmMessages, hwmBytes;
+	(void)state;
+
+	//Read small messages like DISPATCH_ReadCA821x does, until it would stop
+	while (!SPI_IsFifoAlmostFull())
+	{
+		receive_async(3, count);
+		count++;
+	}
+
+	//The unpacked FIFO could only read SPI_RX_FIFO_SIZE - SPI_RX_FIFO_RESV messages
+	assert_true(count > SPI_RX_FIFO_SIZE);
+	assert_false(SPI_IsFifoFull());
+
+	SPI_GetHighWaterMark(&hwmMessages, &hwmBytes);
+	assert_true(hwmMessages >= count);
+	assert_true(hwmBytes >= count * 5);
+
+	for (uint16_t i = 0; i < count; i++) dequeue_async(3, i);
+	assert_true(SPI_IsFifoEmpty());
+	assert_null(SPI_PeekFullBuf());
+}
+
+/** Test that messages of varying sizes are kept intact and in order as the FIFO wraps around */
+static void wrap_test(void **state)
+{
+	uint8_t  lens[64];
+	uint16_t head = 0, tail = 0;
+	(void)state;
+
+	for (uint16_t i = 0; i < 500; i++)
+	{
+		uint8_t len = (i * 37) % 254 + 1;
+
+		//Drain until there is room, keeping some messages queued so that the free space is split
+		while (SPI_IsFifoAlmostFull())
+		{
+			dequeue_async(lens[tail % 64], tail);
+			tail++;
+		}
+
+		receive_async(len, i);
+		lens[head++ % 64] = len;
+	}
+
+	while (tail != head)
+	{
+		dequeue_async(lens[tail % 64], tail);
+		tail++;
+	}
+	assert_true(SPI_IsFifoEmpty());
+}
+
+/** Test that a full FIFO refuses messages without corrupting those already queued */
+static void full_test(void **state)
+{
+	(void)state;
+
+	for (int i = 0; i < SPI_RX_FIFO_SIZE; i++) receive_async(sizeof(struct MAC_Message) - 2, i);
+	assert_true(SPI_IsFifoFull());
+	assert_true(SPI_IsFifoAlmostFull());
+
+	//There is no room for the payload, so only the first 2 bytes are read
+	will_return(__wrap_BSP_SPIPopByte, SPI_MCPS_DATA_INDICATION);
+	will_return(__wrap_BSP_SPIPopByte, 1);
+	assert_int_equal(SPI_Exchange(NULL, &sdev), CA_ERROR_SUCCESS);
+
+	//Dequeueing one message makes room for another
+	dequeue_async(sizeof(struct MAC_Message) - 2, 0);
+	assert_false(SPI_IsFifoFull());
+	receive_async(1, 0xAA);
+
+	for (int i = 1; i < SPI_RX_FIFO_SIZE; i++) dequeue_async(sizeof(struct MAC_Message) - 2, i);
+	dequeue_async(1, 0xAA);
+	assert_true(SPI_IsFifoEmpty());
+}
+
 static int setup(void **state)
 {
 	(void)state;
@@ -119,7 +221,10 @@ int main(void)
 	const struct CMUnitTest tests[] = {cmocka_unit_test(empty_test),
 	                                   cmocka_unit_test(sync_fail_test),
 	                                   cmocka_unit_test(sync_success_test),
-	                                   cmocka_unit_test(async_send_test)};
+	                                   cmocka_unit_test(async_send_test),
+	                                   cmocka_unit_test(packed_test),
+	                                   cmocka_unit_test(wrap_test),
+	                                   cmocka_unit_test(full_test)};
 
 	return cmocka_run_group_tests(tests, setup, NULL);
 }
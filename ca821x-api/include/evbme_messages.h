@@ -52,10 +52,12 @@ extern "C" {
 /** EVBME Command IDs */
 enum evbme_command_ids
 {
-	EVBME_GET_CONFIRM = 0x5C, //!< M<-S Response containing EVBME parameter data (sync resp)
-	EVBME_GET_REQUEST = 0x5D, //!< M->S Get an EVBME parameter (sync req)
-	EVBME_SET_CONFIRM = 0x5E, //!< M<-S Response including status for EVBME set (sync resp)
-	EVBME_SET_REQUEST = 0x5F, //!< M->S Set an EVBME parameter (sync req)
+	EVBME_PIB_BATCH_CONFIRM = 0x5A, //!< M<-S Per-operation results of a PIB batch (sync resp)
+	EVBME_PIB_BATCH_REQUEST = 0x5B, //!< M->S Apply a batch of PIB/HWME SET & GET operations over SPI (sync req)
+	EVBME_GET_CONFIRM       = 0x5C, //!< M<-S Response containing EVBME parameter data (sync resp)
+	EVBME_GET_REQUEST       = 0x5D, //!< M->S Get an EVBME parameter (sync req)
+	EVBME_SET_CONFIRM       = 0x5E, //!< M<-S Response including status for EVBME set (sync resp)
+	EVBME_SET_REQUEST       = 0x5F, //!< M->S Set an EVBME parameter (sync req)
 
 	EVBME_HOST_CONNECTED     = 0x81, //!< M->S Notification from host that connection is established
 	EVBME_HOST_DISCONNECTED  = 0x82, //!< M->S Notification from host that connection is about to be terminated
@@ -75,12 +77,28 @@ enum evbme_attribute
 	EVBME_CFGPINS  = 0x01, //!< CfgPins - Write only
 	EVBME_WAKEUPRF = 0x02, //!< Wakeup CA8211 - Write only
 
+	EVBME_UART_WINDOW = 0x40, //!< Frames in flight for windowed UART framing, 0 for stop-and-wait - Read/Write
+	EVBME_USB_PACKED  = 0x41, //!< Pack several messages into each USB HID report, 1 to enable - Read/Write
+
 	EVBME_VERSTRING   = 0x80, //!< Version string - Read only
 	EVBME_PLATSTRING  = 0x81, //!< Platform string - Read only
 	EVBME_APPSTRING   = 0x82, //!< Application string - Read only
 	EVBME_SERIALNO    = 0x83, //!< SerialNo 64 bit binary - Read only
 	EVBME_OT_EUI64    = 0x84, //!< Openthread EUI64 for commissioning - Read only
 	EVBME_OT_JOINCRED = 0x85, //!< Openthread joining credential for commissioning - Read only
+	EVBME_PIB_BATCH   = 0x86, //!< Longest EVBME_PIB_BATCH_REQUEST payload accepted, 1 byte - Read only
+};
+
+/** Longest payload of an EVBME_PIB_BATCH_REQUEST or EVBME_PIB_BATCH_CONFIRM */
+#define EVBME_PIB_BATCH_MAX_LEN 254
+
+/** Operation codes for the entries of an EVBME_PIB_BATCH_REQUEST */
+enum evbme_pib_batch_op
+{
+	EVBME_PIB_MLME_SET = 0, //!< MLME-SET of a PIB attribute
+	EVBME_PIB_MLME_GET = 1, //!< MLME-GET of a PIB attribute
+	EVBME_PIB_HWME_SET = 2, //!< HWME-SET of a HWME attribute
+	EVBME_PIB_HWME_GET = 3, //!< HWME-GET of a HWME attribute
 };
 
 /**
@@ -88,7 +106,9 @@ enum evbme_attribute
  */
 enum evbme_dfu_const
 {
-	DFU_WRITE_MAX_LEN = 244, //!< Maximum number of bytes that can be written in one command
+	DFU_WRITE_MAX_LEN  = 244,  //!< Maximum number of bytes that can be written in one command
+	DFU_ZWRITE_MAX_LEN = 234,  //!< Maximum number of compressed bytes in one DFU_ZWRITE command
+	DFU_ZBLOCK_MAX_LEN = 1024, //!< Maximum length of a DFU_ZWRITE block, both compressed and decompressed
 };
 
 /**
@@ -102,6 +122,7 @@ enum evbme_dfu_cmdid
 	DFU_CHECK    = 3, //!< Check flash checksum in given range
 	DFU_STATUS   = 4, //!< Status command returned from chili to host
 	DFU_BOOTMODE = 5, //!< Set default boot mode of device
+	DFU_ZWRITE   = 6, //!< Write a deflate compressed block of data to already erased flash
 };
 
 /**
@@ -139,6 +160,20 @@ struct evbme_dfu_write_cmd
 	uint8_t data[];       //!< Data to write, must be whole words. Max 244 bytes (DFU_WRITE_MAX_LEN)
 };
 
+/**
+ * Write command for a block of data compressed with raw deflate (no zlib or gzip header). A block that does not fit
+ * in one command is split across several, which must be sent in order. The block is decompressed and written once
+ * all of it has been received, so only the status of the last command reports the result of the write.
+ */
+struct evbme_dfu_zwrite_cmd
+{
+	uint8_t startAddr[4]; //!< Start address for writing the decompressed block - must be word aligned
+	uint8_t blockLen[2];  //!< Decompressed length of the block - must be whole words, max DFU_ZBLOCK_MAX_LEN
+	uint8_t zLen[2];      //!< Compressed length of the block, max DFU_ZBLOCK_MAX_LEN
+	uint8_t offset[2];    //!< Offset of data in the compressed block
+	uint8_t data[];       //!< Compressed data. Max 234 bytes (DFU_ZWRITE_MAX_LEN)
+};
+
 /**
  * Check command to validate flash against a checksum
  */
@@ -154,7 +189,8 @@ struct evbme_dfu_check_cmd
  */
 struct evbme_dfu_status_cmd
 {
-	uint8_t status; //!< ca_error status
+	uint8_t status;       //!< ca_error status
+	uint8_t startAddr[4]; //!< Start address of the DFU_WRITE being acknowledged. Absent (mLen 2) for other commands
 };
 
 /**
@@ -173,6 +209,7 @@ union evbme_dfu_sub_cmd
 	struct evbme_dfu_reboot_cmd   reboot_cmd;
 	struct evbme_dfu_erase_cmd    erase_cmd;
 	struct evbme_dfu_write_cmd    write_cmd;
+	struct evbme_dfu_zwrite_cmd   zwrite_cmd;
 	struct evbme_dfu_check_cmd    check_cmd;
 	struct evbme_dfu_status_cmd   status_cmd;
 	struct evbme_dfu_bootmode_cmd bootmode_cmd;
@@ -215,6 +252,39 @@ struct EVBME_SET_request
 	uint8_t mAttribute[];
 };
 
+/**
+ * Single operation of an EVBME_PIB_BATCH_REQUEST, which consists of several of these back to back.
+ */
+struct EVBME_PIB_BATCH_op
+{
+	uint8_t mOp;        //!< see evbme_pib_batch_op
+	uint8_t mAttribute; //!< PIB or HWME attribute ID
+	uint8_t mIndex;     //!< PIB attribute index, ignored for HWME attributes
+	uint8_t mLen;       //!< Length of mValue, 0 for GET operations
+	uint8_t mValue[];   //!< Value to SET
+};
+
+/**
+ * Result of a single operation of an EVBME_PIB_BATCH_REQUEST
+ */
+struct EVBME_PIB_BATCH_result
+{
+	uint8_t mStatus;  //!< MAC or HWME status of the operation
+	uint8_t mLen;     //!< Length of mValue, 0 for SET operations and failed GET operations
+	uint8_t mValue[]; //!< Value read by a GET operation
+};
+
+/**
+ * EVBME PIB batch confirm structure. Operations are applied in order, until the end of the request or until
+ * the result of the next operation would not fit in the confirm. Operations that were not reported must be
+ * sent again.
+ */
+struct EVBME_PIB_BATCH_confirm
+{
+	uint8_t mCount;     //!< Number of operations reported
+	uint8_t mResults[]; //!< mCount EVBME_PIB_BATCH_results back to back
+};
+
 /**
  * EVBME Message indication structure
  */
@@ -262,6 +332,7 @@ struct EVBME_Message
 		struct EVBME_GET_request        GET_request;
 		struct EVBME_SET_confirm        SET_confirm;
 		struct EVBME_SET_request        SET_request;
+		struct EVBME_PIB_BATCH_confirm  PIB_BATCH_confirm;
 		struct EVBME_MESSAGE_indication MESSAGE_indication;
 		struct EVBME_COMM_CHECK_request COMM_CHECK_request;
 		struct EVBME_COMM_indication    COMM_indication;
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2021, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief  CRC32 checksum
+ */
+/**
+ * @ingroup cascoda-util
+ * @defgroup ca-crc32 CRC32
+ * @brief  Standard CRC32 (as used by zlib and Ethernet), for checking the integrity of data such as firmware images
+ *
+ * The lookup table is chosen at compile time with the CASCODA_CRC32_TABLE CMake option. The default is an 8KiB table
+ * that processes 8 bytes at a time on posix, and a 64 byte table on embedded targets. Hosts with the ARMv8 CRC32
+ * instructions use those instead.
+ *
+ * @{
+ */
+
+#ifndef CASCODA_CRC32_H
+#define CASCODA_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Update a CRC32 with a block of data. The data can be split into several blocks, by passing the result for one
+ * block as the crc for the next.
+ *
+ * @param crc       The CRC32 of the data so far, 0 initially
+ * @param data_in   The data to checksum
+ * @param num_bytes The size of the data to be checksummed (in bytes)
+ *
+ * @return The CRC32 of the data so far, including data_in
+ */
+uint32_t CRC32_Update(uint32_t crc, const void *data_in, size_t num_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CASCODA_CRC32_H
+
+/**
+ * @}
+ */
@@ -68,6 +68,17 @@ uint32_t HASH_fnv1a_32(const void *data_in, size_t num_bytes);
  */
 uint64_t HASH_fnv1a_64(const void *data_in, size_t num_bytes);
 
+/**
+ * Calculate the 16-bit CRC-CCITT (polynomial 0x1021, initial value 0xFFFF) of a block of data,
+ * for detecting corruption of frames on a link.
+ *
+ * @param data_in  The data to checksum
+ * @param num_bytes The sizeof the data to be checksummed (in bytes)
+ *
+ * @return 16-bit CRC
+ */
+uint16_t HASH_crc16_ccitt(const void *data_in, size_t num_bytes);
+
 #ifdef __cplusplus
 }
 #endif
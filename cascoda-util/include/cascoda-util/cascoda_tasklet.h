@@ -61,13 +61,19 @@ typedef ca_error (*ca_tasklet_callback)(void *context);
  * Internal tasklet state structure. Must be allocated with a lifetime that exceeds the usage of
  * the tasklet, ideally statically. Do not modify this struct directly, and instead use the TASKLET_
  * functions to control it.
+ *
+ * Scheduled tasklets are kept in a sorted linked list, or in a pairing heap, depending on the
+ * CASCODA_TASKLET_QUEUE build option. The heap makes scheduling and cancelling independent of the
+ * number of scheduled tasklets, which suits applications with many periodic tasklets.
  */
 typedef struct ca_tasklet
 {
 	ca_tasklet_callback callback; //!< Internal: The callback that will be called when the tasklet is triggered
 	void *              context;  //!< Internal: The context that will be passed to the callback when it is called.
-	struct ca_tasklet * next; //!< Internal: The next tasklet in the sorted tasklet linkedlist. NULL when not queued.
-	uint32_t            fireTime;      //!< Internal: The next time at which the tasklet is due to trigger
+	struct ca_tasklet * next;     //!< Internal: The next tasklet in the sorted list, or next sibling in the heap.
+	struct ca_tasklet * prev;     //!< Internal: The previous sibling in the heap, or the parent of a first child.
+	struct ca_tasklet * child;    //!< Internal: The first child in the heap.
+	uint32_t            fireTime; //!< Internal: The next time at which the tasklet is due to trigger
 	uint8_t             scheduled : 1; //!< Internal: Is this tasklet scheduled?
 } ca_tasklet;
 
@@ -37,6 +37,24 @@ static const uint32_t basis32 = 2166136261;
 static const uint64_t prime64 = 1099511628211ULL;
 static const uint64_t basis64 = 14695981039346656037ULL;
 
+//Nibble-at-a-time table for CRC-CCITT, to keep the footprint small on embedded targets
+static const uint16_t crc16_ccitt_table[16] = {0x0000,
+                                               0x1021,
+                                               0x2042,
+                                               0x3063,
+                                               0x4084,
+                                               0x50A5,
+                                               0x60C6,
+                                               0x70E7,
+                                               0x8108,
+                                               0x9129,
+                                               0xA14A,
+                                               0xB16B,
+                                               0xC18C,
+                                               0xD1AD,
+                                               0xE1CE,
+                                               0xF1EF};
+
 uint32_t HASH_fnv1a_32(const void *data_in, size_t num_bytes)
 {
 	uint32_t       hash = basis32;
@@ -60,3 +78,16 @@ uint64_t HASH_fnv1a_64(const void *data_in, size_t num_bytes)
 	}
 	return hash;
 }
+
+uint16_t HASH_crc16_ccitt(const void *data_in, size_t num_bytes)
+{
+	uint16_t       crc  = 0xFFFF;
+	const uint8_t *data = data_in;
+
+	for (size_t i = 0; i < num_bytes; i++)
+	{
+		crc = (crc << 4) ^ crc16_ccitt_table[(crc >> 12) ^ (data[i] >> 4)];
+		crc = (crc << 4) ^ crc16_ccitt_table[(crc >> 12) ^ (data[i] & 0x0F)];
+	}
+	return crc;
+}
@@ -37,7 +37,7 @@
 #include "cascoda-util/cascoda_tasklet.h"
 #include "cascoda-util/cascoda_time.h"
 
-static ca_tasklet *sTaskletHead = NULL;
+static ca_tasklet *sTaskletHead = NULL; //Earliest scheduled tasklet, the head of the list or the root of the heap
 
 /**
  * Get how far into the future 'future' is from 'start'.
@@ -56,6 +56,152 @@ static uint32_t GetTimeToEvent(uint32_t start, uint32_t future)
 	return delta;
 }
 
+/**
+ * Check whether tasklet 'a' is due before tasklet 'b', with the same loop-around behaviour as TIME_Cmp.
+ * @param a  The first tasklet
+ * @param b  The second tasklet
+ * @return true if 'a' is due strictly before 'b'
+ */
+static bool IsBefore(const ca_tasklet *a, const ca_tasklet *b)
+{
+	return TIME_Cmp(a->fireTime, b->fireTime) < 0;
+}
+
+#if CASCODA_TASKLET_QUEUE_HEAP
+/**
+ * Meld two pairing heaps, by making the root that is due later the first child of the other.
+ * @param a  Root of the first heap, with no siblings
+ * @param b  Root of the second heap, with no siblings
+ * @return The root of the melded heap
+ */
+static ca_tasklet *HeapMeld(ca_tasklet *a, ca_tasklet *b)
+{
+	if (IsBefore(b, a))
+	{
+		ca_tasklet *tmp = a;
+
+		a = b;
+		b = tmp;
+	}
+
+	b->prev = a;
+	b->next = a->child;
+	if (a->child)
+		a->child->prev = b;
+	a->child = b;
+
+	return a;
+}
+
+/**
+ * Meld a list of sibling heaps into one, with the standard two-pass pairing.
+ * @param first  The first sibling, or NULL
+ * @return The root of the melded heap, or NULL if there were no siblings
+ */
+static ca_tasklet *HeapMergePairs(ca_tasklet *first)
+{
+	ca_tasklet *pairs = NULL; //Stack of melded pairs, linked through 'next'
+	ca_tasklet *root  = NULL;
+
+	//First pass: meld the siblings in pairs, from left to right
+	while (first)
+	{
+		ca_tasklet *a = first;
+		ca_tasklet *b = a->next;
+
+		first   = b ? b->next : NULL;
+		a->next = a->prev = NULL;
+		if (b)
+		{
+			b->next = b->prev = NULL;
+			a                 = HeapMeld(a, b);
+		}
+
+		a->next = pairs;
+		pairs   = a;
+	}
+
+	//Second pass: meld the pairs into one heap, from right to left
+	while (pairs)
+	{
+		ca_tasklet *a = pairs;
+
+		pairs   = a->next;
+		a->next = NULL;
+		root    = root ? HeapMeld(root, a) : a;
+	}
+
+	return root;
+}
+
+static void QueueInsert(ca_tasklet *aTasklet)
+{
+	aTasklet->next = aTasklet->prev = aTasklet->child = NULL;
+	sTaskletHead                                      = sTaskletHead ? HeapMeld(sTaskletHead, aTasklet) : aTasklet;
+}
+
+static void QueueRemove(ca_tasklet *aTasklet)
+{
+	ca_tasklet *children = HeapMergePairs(aTasklet->child);
+
+	if (aTasklet == sTaskletHead)
+	{
+		sTaskletHead = children;
+	}
+	else
+	{
+		//Unlink the subtree from its parent or previous sibling, then meld its children back into the heap
+		if (aTasklet->prev->child == aTasklet)
+			aTasklet->prev->child = aTasklet->next;
+		else
+			aTasklet->prev->next = aTasklet->next;
+		if (aTasklet->next)
+			aTasklet->next->prev = aTasklet->prev;
+
+		if (children)
+			sTaskletHead = HeapMeld(sTaskletHead, children);
+	}
+
+	aTasklet->next = aTasklet->prev = aTasklet->child = NULL;
+}
+#else
+static void QueueInsert(ca_tasklet *aTasklet)
+{
+	ca_tasklet * cur   = sTaskletHead;  //Current tasklet being processed
+	ca_tasklet **prevn = &sTaskletHead; //'Previous next', the pointer that points to the current tasklet
+
+	//Loop through the linked list until we find the correct place for the new tasklet
+	while (cur && IsBefore(cur, aTasklet))
+	{
+		//current tasklet is before new one, move through the list and update state.
+		prevn = &cur->next;
+		cur   = cur->next;
+	}
+
+	*prevn         = aTasklet; //Update the 'previous next' pointer to point to the new tasklet.
+	aTasklet->next = cur;      //Set the new tasklet's 'next' pointer to point to the next item in the list
+}
+
+static void QueueRemove(ca_tasklet *aTasklet)
+{
+	ca_tasklet * cur   = sTaskletHead;  //Current tasklet being processed
+	ca_tasklet **prevn = &sTaskletHead; //'Previous next', the pointer that points to the current tasklet
+
+	//Loop through the linked list until we find the tasklet
+	while (cur && cur != aTasklet)
+	{
+		//move through the list and update state.
+		prevn = &cur->next;
+		cur   = cur->next;
+	}
+	assert(cur); //Invalid internal state - hit end of list before locating
+
+	//We found the tasklet, remove it by pointing the 'previous next' to the following node
+	*prevn         = cur->next;
+	aTasklet->next = NULL;
+}
+#endif
+
 ca_error TASKLET_Init(ca_tasklet *aTasklet, ca_tasklet_callback aCallback)
 {
 	/* Note we do not check for the invalid usage of initialising a scheduled
@@ -75,9 +221,6 @@ ca_error TASKLET_ScheduleDelta(ca_tasklet *aTasklet, uint32_t aTimeDelta, void *
 
 ca_error TASKLET_ScheduleAbs(ca_tasklet *aTasklet, uint32_t aTimeNow, uint32_t aTimeAbs, void *aContext)
 {
-	ca_tasklet * cur   = sTaskletHead;  //Current tasklet being processed
-	ca_tasklet **prevn = &sTaskletHead; //'Previous next', the pointer that points to the current tasklet
-
 	if (TASKLET_IsQueued(aTasklet))
 		return CA_ERROR_ALREADY;
 
@@ -88,20 +231,7 @@ ca_error TASKLET_ScheduleAbs(ca_tasklet *aTasklet, uint32_t aTimeNow, uint32_t a
 	aTasklet->fireTime = aTimeAbs;
 	aTasklet->context  = aContext;
 
-	//Loop through the linked list until we find the correct place for the new tasklet
-	while (cur)
-	{
-		uint32_t delta = GetTimeToEvent(cur->fireTime, aTimeAbs);
-		if (!delta)
-			break; //Current tasklet is scheduled for after new one
-
-		//current tasklet is before new one, move through the list and update state.
-		prevn = &cur->next;
-		cur   = cur->next;
-	}
-
-	*prevn              = aTasklet; //Update the 'previous next' pointer to point to the new tasklet.
-	aTasklet->next      = cur;      //Set the new tasklet's 'next' pointer to point to the next item in the list
+	QueueInsert(aTasklet);
 	aTasklet->scheduled = 1;
 
 	return CA_ERROR_SUCCESS;
@@ -127,29 +257,11 @@ ca_error TASKLET_GetScheduledTimeDelta(ca_tasklet *aTasklet, uint32_t *aTimeDelt
 
 ca_error TASKLET_Cancel(ca_tasklet *aTasklet)
 {
-	ca_tasklet * cur   = sTaskletHead;  //Current tasklet being processed
-	ca_tasklet **prevn = &sTaskletHead; //'Previous next', the pointer that points to the current tasklet
-
 	if (!TASKLET_IsQueued(aTasklet))
 		return CA_ERROR_ALREADY;
 
-	//Loop through the linked list until we find the tasklet
-	while (cur)
-	{
-		if (cur == aTasklet)
-		{
-			//We found the tasklet, remove it by pointing the 'previous next' to the following node
-			*prevn         = cur->next;
-			cur->next      = NULL;
-			cur->scheduled = 0;
-			break;
-		}
-
-		//move through the list and update state.
-		prevn = &cur->next;
-		cur   = cur->next;
-	}
-	assert(cur); //Invalid internal state - hit end of list before locating
+	QueueRemove(aTasklet);
+	aTasklet->scheduled = 0;
 
 	return CA_ERROR_SUCCESS;
 }
@@ -0,0 +1,184 @@
+/*
+ *  Copyright (c) 2021, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief  Unit tests and benchmark for CRC32 module
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "cascoda-util/cascoda_crc32.h"
+
+enum
+{
+	BENCH_IMAGE_SIZE = 512 * 1024, //!< Size of the image checksummed by the benchmark, the largest application
+	BENCH_REPEATS    = 20,         //!< Number of times the image is checksummed, to get a measurable time
+};
+
+//Bit-at-a-time CRC32, to check the table driven versions against
+static uint32_t reference_crc32(const uint8_t *data, size_t num_bytes)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (size_t i = 0; i < num_bytes; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+//Nibble-at-a-time CRC32, as previously used by the flasher
+static uint32_t nibble_crc32(const uint8_t *data, size_t num_bytes)
+{
+	static const uint32_t table[16] = {0x00000000,
+	                                   0x1db71064,
+	                                   0x3b6e20c8,
+	                                   0x26d930ac,
+	                                   0x76dc4190,
+	                                   0x6b6b51f4,
+	                                   0x4db26158,
+	                                   0x5005713c,
+	                                   0xedb88320,
+	                                   0xf00f9344,
+	                                   0xd6d6a3e8,
+	                                   0xcb61b38c,
+	                                   0x9b64c2b0,
+	                                   0x86d3d2d4,
+	                                   0xa00ae278,
+	                                   0xbdbdf21c};
+	uint32_t              crc       = 0xFFFFFFFF;
+
+	for (size_t i = 0; i < num_bytes; i++)
+	{
+		crc ^= data[i];
+		crc = table[crc & 0x0F] ^ (crc >> 4);
+		crc = table[crc & 0x0F] ^ (crc >> 4);
+	}
+	return ~crc;
+}
+
+static void fill_random(uint8_t *data, size_t num_bytes)
+{
+	for (size_t i = 0; i < num_bytes; i++) data[i] = rand();
+}
+
+static void crc32_known_test(void **state)
+{
+	(void)state;
+
+	assert_int_equal(CRC32_Update(0, "", 0), 0);
+	assert_int_equal(CRC32_Update(0, "123456789", 9), 0xCBF43926);
+	assert_int_equal(CRC32_Update(0, "The quick brown fox jumps over the lazy dog", 43), 0x414FA339);
+}
+
+static void crc32_reference_test(void **state)
+{
+	uint8_t data[1024 + 8];
+
+	(void)state;
+	fill_random(data, sizeof(data));
+
+	//Every length, from every alignment, so that each path through the table lookups is used
+	for (size_t offset = 0; offset < 8; offset++)
+	{
+		for (size_t len = 0; len <= 1024; len++)
+			assert_int_equal(CRC32_Update(0, data + offset, len), reference_crc32(data + offset, len));
+	}
+}
+
+static void crc32_stream_test(void **state)
+{
+	uint8_t  data[300];
+	uint32_t whole, crc;
+
+	(void)state;
+	fill_random(data, sizeof(data));
+	whole = CRC32_Update(0, data, sizeof(data));
+
+	for (size_t split = 0; split <= sizeof(data); split++)
+	{
+		crc = CRC32_Update(0, data, split);
+		crc = CRC32_Update(crc, data + split, sizeof(data) - split);
+		assert_int_equal(crc, whole);
+	}
+
+	//Byte by byte, like reading flash a word at a time
+	crc = 0;
+	for (size_t i = 0; i < sizeof(data); i++) crc = CRC32_Update(crc, &data[i], 1);
+	assert_int_equal(crc, whole);
+}
+
+static void crc32_benchmark(void **state)
+{
+	uint8_t *         image = malloc(BENCH_IMAGE_SIZE);
+	volatile uint32_t result;
+	clock_t           start;
+	double            nibble_s, crc32_s;
+
+	(void)state;
+	assert_non_null(image);
+	fill_random(image, BENCH_IMAGE_SIZE);
+
+	start = clock();
+	for (int i = 0; i < BENCH_REPEATS; i++) result = nibble_crc32(image, BENCH_IMAGE_SIZE);
+	nibble_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (int i = 0; i < BENCH_REPEATS; i++) result = CRC32_Update(0, image, BENCH_IMAGE_SIZE);
+	crc32_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	assert_int_equal(result, nibble_crc32(image, BENCH_IMAGE_SIZE));
+
+	printf("512KiB image: nibble table %.2f ms, CRC32_Update %.2f ms (%.0f MiB/s)\n",
+	       nibble_s * 1000 / BENCH_REPEATS,
+	       crc32_s * 1000 / BENCH_REPEATS,
+	       crc32_s > 0 ? BENCH_REPEATS * (BENCH_IMAGE_SIZE / (1024.0 * 1024.0)) / crc32_s : 0);
+
+	free(image);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test(crc32_known_test),
+	    cmocka_unit_test(crc32_reference_test),
+	    cmocka_unit_test(crc32_stream_test),
+	    cmocka_unit_test(crc32_benchmark),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
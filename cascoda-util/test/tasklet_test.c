@@ -33,6 +33,9 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 //cmocka must be after system headers
 #include <cmocka.h>
@@ -41,8 +44,18 @@
 #include "cascoda-util/cascoda_time.h"
 #include "ca821x_api.h"
 
+enum
+{
+	BENCH_TASKLETS = 10000, //!< Number of tasklets scheduled by the benchmark
+	BENCH_MAX_TIME = 60000, //!< Tasklets are scheduled up to this many ms into the future, like keepalive timers
+};
+
 static uint32_t sTestTime = 0;
 
+static ca_tasklet *sBenchTasklets;
+static uint32_t    sBenchFired;
+static uint32_t    sBenchLastTime;
+
 void FastForward(uint32_t ticks)
 {
 	sTestTime += ticks;
@@ -79,6 +92,23 @@ static ca_error reschedule_callback(void *aContext)
 	return CA_ERROR_SUCCESS;
 }
 
+static ca_error bench_callback(void *aContext)
+{
+	ca_tasklet *task = aContext;
+
+	//Tasklets must fire in order of scheduled time, and none of them early
+	assert_true(TIME_Cmp(task->fireTime, sBenchLastTime) >= 0);
+	assert_true(TIME_Cmp(task->fireTime, TIME_ReadAbsoluteTime()) <= 0);
+	sBenchLastTime = task->fireTime;
+	sBenchFired++;
+	return CA_ERROR_SUCCESS;
+}
+
+static double get_seconds_since(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
 static int testSetup(void **state)
 {
 	//Reset time
@@ -581,6 +611,108 @@ static void get_scheduled_delta_test(void **state)
 	assert_int_equal(12345, timeDelta);
 }
 
+/** Test that ordering is kept when the scheduled times loop around */
+static void wrap_test(void **state)
+{
+	ca_error   status;
+	uint32_t   contextPtr  = 111;
+	uint32_t   contextPtr2 = 222;
+	uint32_t   timeDelta   = 0;
+	ca_tasklet testTasklet, testTasklet2;
+
+	sTestTime = 0xFFFFFFF0;
+	TASKLET_Init(&testTasklet, &verify_callback);
+	TASKLET_Init(&testTasklet2, &verify_callback2);
+
+	//Schedule the later one first, after the loop around, and the earlier one before it
+	status = TASKLET_ScheduleDelta(&testTasklet2, 0x20, &contextPtr2);
+	assert_int_equal(status, CA_ERROR_SUCCESS);
+	status = TASKLET_ScheduleDelta(&testTasklet, 0x08, &contextPtr);
+	assert_int_equal(status, CA_ERROR_SUCCESS);
+
+	status = TASKLET_GetTimeToNext(&timeDelta);
+	assert_int_equal(status, CA_ERROR_SUCCESS);
+	assert_int_equal(timeDelta, 0x08);
+
+	expect_value(verify_callback, *checkval, contextPtr);
+	FastForward(0x08);
+	assert_int_equal(TASKLET_Process(), CA_ERROR_SUCCESS);
+
+	status = TASKLET_GetTimeToNext(&timeDelta);
+	assert_int_equal(status, CA_ERROR_SUCCESS);
+	assert_int_equal(timeDelta, 0x18);
+
+	expect_value(verify_callback2, *checkval, contextPtr2);
+	FastForward(0x18);
+	assert_int_equal(TASKLET_Process(), CA_ERROR_SUCCESS);
+	assert_int_equal(TASKLET_Process(), CA_ERROR_NOT_FOUND);
+}
+
+/** Schedule, reschedule and cancel many tasklets, checking the order they fire in and timing the queue operations */
+static void scaling_benchmark(void **state)
+{
+	clock_t  start;
+	double   schedule_s, reschedule_s, cancel_s, process_s;
+	uint32_t expected = 0;
+
+	(void)state;
+	sBenchTasklets = calloc(BENCH_TASKLETS, sizeof(*sBenchTasklets));
+	assert_non_null(sBenchTasklets);
+	srand(1);
+
+	//Start near the loop around, so that it happens during the benchmark
+	sTestTime      = 0xFFFFFFFF - BENCH_MAX_TIME / 2;
+	sBenchFired    = 0;
+	sBenchLastTime = sTestTime;
+
+	start = clock();
+	for (int i = 0; i < BENCH_TASKLETS; i++)
+	{
+		TASKLET_Init(&sBenchTasklets[i], &bench_callback);
+		TASKLET_ScheduleDelta(&sBenchTasklets[i], rand() % BENCH_MAX_TIME, &sBenchTasklets[i]);
+	}
+	schedule_s = get_seconds_since(start);
+
+	//A rescheduling storm, such as every keepalive being pushed back
+	start = clock();
+	for (int i = 0; i < BENCH_TASKLETS; i++)
+	{
+		ca_tasklet *task = &sBenchTasklets[rand() % BENCH_TASKLETS];
+
+		TASKLET_Cancel(task);
+		TASKLET_ScheduleDelta(task, rand() % BENCH_MAX_TIME, task);
+	}
+	reschedule_s = get_seconds_since(start);
+
+	start = clock();
+	for (int i = 0; i < BENCH_TASKLETS; i += 2) TASKLET_Cancel(&sBenchTasklets[i]);
+	cancel_s = get_seconds_since(start);
+
+	for (int i = 0; i < BENCH_TASKLETS; i++) expected += TASKLET_IsQueued(&sBenchTasklets[i]);
+	assert_int_equal(expected, BENCH_TASKLETS / 2);
+
+	//Process in steps, so that the queue is drained gradually
+	start = clock();
+	for (int i = 0; i <= BENCH_MAX_TIME; i += 100)
+	{
+		TASKLET_Process();
+		FastForward(100);
+	}
+	process_s = get_seconds_since(start);
+
+	assert_int_equal(sBenchFired, expected);
+	assert_int_equal(TASKLET_Process(), CA_ERROR_NOT_FOUND);
+
+	printf("%d tasklets: schedule %.1f us, reschedule %.1f us, cancel %.1f us, process %.1f us per tasklet\n",
+	       BENCH_TASKLETS,
+	       schedule_s * 1e6 / BENCH_TASKLETS,
+	       reschedule_s * 1e6 / BENCH_TASKLETS,
+	       cancel_s * 1e6 / (BENCH_TASKLETS / 2),
+	       process_s * 1e6 / expected);
+
+	free(sBenchTasklets);
+}
+
 int main(void)
 {
 	const struct CMUnitTest tests[] = {cmocka_unit_test_setup(delta_test, testSetup),
@@ -593,7 +725,9 @@ int main(void)
 	                                   cmocka_unit_test_setup(future_test, testSetup),
 	                                   cmocka_unit_test_setup(reschedule_test, testSetup),
 	                                   cmocka_unit_test_setup(past_test, testSetup),
-	                                   cmocka_unit_test_setup(get_scheduled_delta_test, testSetup)};
+	                                   cmocka_unit_test_setup(get_scheduled_delta_test, testSetup),
+	                                   cmocka_unit_test_setup(wrap_test, testSetup),
+	                                   cmocka_unit_test_setup(scaling_benchmark, testSetup)};
 
 	//Any global init here
 
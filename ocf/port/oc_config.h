@@ -28,6 +28,16 @@ extern "C" {
 /* enable flash storage API */
 #define OC_STORAGE
 
+/* Maximum number of storage records that are indexed by name, beyond which
+ * the settings are searched */
+#define OC_STORAGE_DIRECTORY_SIZE (16)
+
+/* Number of decrypted storage records cached in RAM, 0 to disable */
+#define OC_STORAGE_CACHE_ENTRIES (2)
+
+/* Largest storage record that is cached, in bytes */
+#define OC_STORAGE_CACHE_RECORD_SIZE (512)
+
 typedef uint64_t oc_clock_time_t;
 /* 1 clock tick = 1ms */
 #define OC_CLOCK_CONF_TICKS_PER_SECOND (1000)
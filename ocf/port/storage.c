@@ -33,6 +33,192 @@
 
 extern otInstance *OT_INSTANCE;
 
+enum
+{
+	IV_SIZE  = 13, //!< Size of the CCM nonce stored after the name of each record
+	TAG_SIZE = 8,  //!< Size of the CCM authentication tag stored after the nonce
+};
+
+// Data structure of each record: null-terminated string containing the name
+// of the "file", followed by the nonce, the tag, and the encrypted contents
+// of said file.
+
+/** Hash of the name of each record, at the settings index of the record. -1 when it must be rebuilt. */
+static uint32_t sDirectory[OC_STORAGE_DIRECTORY_SIZE];
+static int      sDirectoryCount = -1;
+
+/** CCM context, kept set up with the key it was last used with */
+static mbedtls_ccm_context sCcm;
+static uint8_t             sCcmKey[16];
+static bool                sCcmReady;
+
+#if OC_STORAGE_CACHE_ENTRIES
+/** Decrypted record, identified by the location and nonce of the record in flash */
+struct storage_cache_entry
+{
+	const void *record;
+	uint8_t     iv[IV_SIZE];
+	uint16_t    len;
+	uint32_t    last_used; //!< Value of sCacheClock when last used, 0 if the entry is free
+	uint8_t     data[OC_STORAGE_CACHE_RECORD_SIZE];
+};
+
+static struct storage_cache_entry sCache[OC_STORAGE_CACHE_ENTRIES];
+static uint32_t                   sCacheClock;
+#endif
+
+// FNV-1a
+static uint32_t name_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name) hash = (hash ^ (uint8_t)*name++) * 16777619u;
+	return hash;
+}
+
+static void build_directory(void)
+{
+	void *   record;
+	uint16_t record_size;
+
+	sDirectoryCount = 0;
+
+	while (otPlatSettingsGetAddress(OC_SETTINGS_KEY, sDirectoryCount, &record, &record_size) == OT_ERROR_NONE)
+	{
+		if (sDirectoryCount == OC_STORAGE_DIRECTORY_SIZE)
+		{
+			// Too many records - fall back to searching the settings
+			sDirectoryCount = -1;
+			return;
+		}
+
+		sDirectory[sDirectoryCount++] = name_hash(record);
+	}
+}
+
+/**
+ * Find the record named store, returning its settings index and its address in flash.
+ * Only the records with a matching name hash are read, unless the directory is full.
+ */
+static otError find_record(const char *store, int *index, void **record, uint16_t *record_size)
+{
+	uint32_t hash  = name_hash(store);
+	bool     retry = true;
+	otError  error;
+
+	if (sDirectoryCount < 0)
+		build_directory();
+
+	for (int i = 0;; ++i)
+	{
+		if (sDirectoryCount >= 0)
+		{
+			while (i < sDirectoryCount && sDirectory[i] != hash) ++i;
+
+			if (i == sDirectoryCount)
+				return OT_ERROR_NOT_FOUND;
+		}
+
+		error = otPlatSettingsGetAddress(OC_SETTINGS_KEY, i, record, record_size);
+
+		if (error && sDirectoryCount >= 0 && retry)
+		{
+			// The settings changed underneath the directory, such as by a factory reset
+			build_directory();
+			retry = false;
+			i     = -1;
+			continue;
+		}
+
+		if (error)
+			return error;
+
+		if (strcmp(store, (char *)*record) == 0)
+		{
+			*index = i;
+			return OT_ERROR_NONE;
+		}
+	}
+}
+
+/** Set up sCcm with the stored encryption key, generating and storing one if create is set */
+static otError load_ccm(bool create)
+{
+	otError  error;
+	uint8_t  key[16];
+	uint16_t key_size = sizeof(key);
+
+	error = otPlatSettingsGet(OT_INSTANCE, OC_ENCRYPTION_KEY_KEY, 0, key, &key_size);
+
+	if (create && (error == OT_ERROR_NOT_FOUND || key_size != sizeof(key)))
+	{
+		// generate random key
+		if (RAND_GetCryptoBytes(sizeof(key), key) != CA_ERROR_SUCCESS)
+			return OT_ERROR_FAILED;
+
+		// store the key, which will be used to decrypt all future OCF settings
+		error = otPlatSettingsAdd(OT_INSTANCE, OC_ENCRYPTION_KEY_KEY, key, sizeof(key));
+	}
+
+	if (error)
+		return error;
+
+	// Expanding the key is the expensive part, so only do it when the key changes
+	if (!sCcmReady || memcmp(key, sCcmKey, sizeof(key)))
+	{
+		if (!sCcmReady)
+			mbedtls_ccm_init(&sCcm);
+
+		if (mbedtls_ccm_setkey(&sCcm, MBEDTLS_CIPHER_ID_AES, key, 128))
+		{
+			sCcmReady = false;
+			mbedtls_ccm_free(&sCcm);
+			return OT_ERROR_FAILED;
+		}
+
+		memcpy(sCcmKey, key, sizeof(key));
+		sCcmReady = true;
+	}
+
+	return OT_ERROR_NONE;
+}
+
+#if OC_STORAGE_CACHE_ENTRIES
+static struct storage_cache_entry *cache_find(const void *record, const uint8_t *iv)
+{
+	for (int i = 0; i < OC_STORAGE_CACHE_ENTRIES; ++i)
+	{
+		if (sCache[i].last_used && sCache[i].record == record && memcmp(sCache[i].iv, iv, IV_SIZE) == 0)
+		{
+			sCache[i].last_used = ++sCacheClock;
+			return &sCache[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void cache_insert(const void *record, const uint8_t *iv, const uint8_t *data, uint16_t len)
+{
+	struct storage_cache_entry *lru = &sCache[0];
+
+	if (len > OC_STORAGE_CACHE_RECORD_SIZE)
+		return;
+
+	for (int i = 1; i < OC_STORAGE_CACHE_ENTRIES; ++i)
+	{
+		if (sCache[i].last_used < lru->last_used)
+			lru = &sCache[i];
+	}
+
+	lru->record    = record;
+	lru->len       = len;
+	lru->last_used = ++sCacheClock;
+	memcpy(lru->iv, iv, IV_SIZE);
+	memcpy(lru->data, data, len);
+}
+#endif
+
 int oc_storage_config(const char *store)
 {
 	// In the POSIX example, `store` is the name of the folder where the
@@ -46,126 +232,109 @@ int oc_storage_config(const char *store)
 long oc_storage_read(const char *store, uint8_t *buf, size_t size)
 {
 	OC_DBG("Getting stored data with the key %s...\n", store);
-	void *              read_buffer;
-	uint16_t            read_buffer_size;
-	mbedtls_ccm_context ccm;
-	int                 error;
-
-	mbedtls_ccm_init(&ccm);
+	void *   read_buffer;
+	uint16_t read_buffer_size;
+	int      record_index;
+	int      error;
 
-	// Data structure we are looking for: null-terminated string containing
-	// the name of the "file" we are reading, followed by the data contained
-	// in said file up until read_buffer_size
+	error = find_record(store, &record_index, &read_buffer, &read_buffer_size);
 
-	for (int i = 0;; ++i)
+	if (error)
 	{
-		error = otPlatSettingsGetAddress(OC_SETTINGS_KEY, i, &read_buffer, &read_buffer_size);
-
-		if (error)
-		{
-			OC_DBG("Could not find key! Final otPlatSettingsGet returns %d\n", error);
-			goto exit;
-		}
+		OC_DBG("Could not find key! Final otPlatSettingsGet returns %d\n", error);
+		goto exit;
+	}
 
-		if (strcmp(store, (char *)read_buffer) == 0)
-		{
-			// we have found the key we are looking for, copy and return
-			uint16_t offset = strlen(store) + 1;
+	// we have found the key we are looking for, copy and return
+	uint16_t offset = strlen(store) + 1;
 
-			uint8_t  key[16];
-			uint16_t key_size = sizeof(key);
-			error             = otPlatSettingsGet(OT_INSTANCE, OC_ENCRYPTION_KEY_KEY, 0, key, &key_size);
+	uint8_t iv[IV_SIZE];
+	memcpy(iv, read_buffer + offset, sizeof(iv));
+	offset += sizeof(iv);
 
-			mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+	uint8_t tag[TAG_SIZE];
+	memcpy(tag, read_buffer + offset, sizeof(tag));
+	offset += sizeof(tag);
 
-			if (error)
-				goto exit;
+	uint16_t data_len = read_buffer_size - offset;
 
-			uint8_t iv[13];
-			memcpy(iv, read_buffer + offset, sizeof(iv));
-			offset += sizeof(iv);
+#if OC_STORAGE_CACHE_ENTRIES
+	struct storage_cache_entry *cached = cache_find(read_buffer, iv);
 
-			uint8_t tag[8];
-			memcpy(tag, read_buffer + offset, sizeof(tag));
-			offset += sizeof(tag);
+	if (cached)
+	{
+		OC_DBG("Data of size %d found in cache!\n", data_len);
+		memcpy(buf, cached->data, data_len);
+		return data_len;
+	}
+#endif
 
-			uint16_t data_len = read_buffer_size - offset;
+	error = load_ccm(false);
 
-			mbedtls_ccm_auth_decrypt(
-			    &ccm, data_len, iv, sizeof(iv), store, strlen(store) + 1, read_buffer + offset, buf, tag, sizeof(tag));
+	if (error)
+		goto exit;
 
-			OC_DBG("Data of size %d found!\n", data_len);
-			//memcpy(buf, read_buffer + offset, data_len);
-			mbedtls_ccm_free(&ccm);
-			return data_len;
-		}
+	if (mbedtls_ccm_auth_decrypt(
+	        &sCcm, data_len, iv, sizeof(iv), store, strlen(store) + 1, read_buffer + offset, buf, tag, sizeof(tag)) ==
+	    0)
+	{
+#if OC_STORAGE_CACHE_ENTRIES
+		cache_insert(read_buffer, iv, buf, data_len);
+#endif
 	}
+
+	OC_DBG("Data of size %d found!\n", data_len);
+	return data_len;
+
 exit:
-	mbedtls_ccm_free(&ccm);
 	return -error;
 }
 
 long oc_storage_write(const char *store, uint8_t *buf, size_t size)
 {
-	void *              read_buffer;
-	uint16_t            read_buffer_size;
-	mbedtls_ccm_context ccm;
-	otError             error;
-	uint8_t             key[16];
-	uint16_t            key_size = sizeof(key);
+	void *   read_buffer;
+	uint16_t read_buffer_size;
+	otError  error;
+	int      record_index;
 
 	OC_DBG("Writing data at key %s\n", store);
 	OC_DBG("Name Length: %d", strlen(store));
 	OC_DBG("Data Length: %d", size);
 
-	mbedtls_ccm_init(&ccm);
-
-	error = otPlatSettingsGet(OT_INSTANCE, OC_ENCRYPTION_KEY_KEY, 0, key, &key_size);
-
-	if (error == OT_ERROR_NOT_FOUND || key_size != sizeof(key))
-	{
-		// generate random key
-		error = RAND_GetCryptoBytes(sizeof(key), key);
+	// We either have the key from storage, or we generate one
+	error = load_ccm(true);
 
-		if (error != CA_ERROR_SUCCESS)
-			goto exit;
-
-		// store the key, which will be used to decrypt all future OCF settings
-		otPlatSettingsAdd(OT_INSTANCE, OC_ENCRYPTION_KEY_KEY, key, sizeof(key));
-	}
-
-	// We either have the key from storage, or we have just generated one
-	mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+	if (error)
+		goto exit;
 
-	for (int i = 0;; ++i)
+	// Check whether the file already exists
+	if (find_record(store, &record_index, &read_buffer, &read_buffer_size) == OT_ERROR_NONE)
 	{
-		// Check whether the file already exists
-		int error;
-		error = otPlatSettingsGetAddress(OC_SETTINGS_KEY, i, &read_buffer, &read_buffer_size);
+		// We found the key - delete it and add the new item.
+		OC_DBG("Key already exists! Deleting...\n");
+		otPlatSettingsDelete(OT_INSTANCE, OC_SETTINGS_KEY, record_index);
 
-		if (error)
-		{
-			OC_DBG("Key was not found! Error code %d. Creating new entry...\n", error);
-			break;
-		}
-
-		if (strcmp(store, (char *)read_buffer) == 0)
+		if (sDirectoryCount > record_index)
 		{
-			// We found the key - delete it and add the new item.
-			OC_DBG("Key already exists! Deleting...\n");
-			otPlatSettingsDelete(OT_INSTANCE, OC_SETTINGS_KEY, i);
-			break;
+			--sDirectoryCount;
+			memmove(&sDirectory[record_index],
+			        &sDirectory[record_index + 1],
+			        (sDirectoryCount - record_index) * sizeof(sDirectory[0]));
 		}
 	}
+	else
+	{
+		OC_DBG("Key was not found! Creating new entry...\n");
+	}
 
-	uint8_t iv[13];
-	uint8_t tag[8];
+	uint8_t iv[IV_SIZE];
+	uint8_t tag[TAG_SIZE];
 	// seed the nonce with random data
 	error = RAND_GetCryptoBytes(sizeof(iv), iv);
 	if (error != CA_ERROR_SUCCESS)
 		goto exit;
 
-	mbedtls_ccm_encrypt_and_tag(&ccm, size, iv, sizeof(iv), store, strlen(store) + 1, buf, buf, tag, sizeof(tag));
+	mbedtls_ccm_encrypt_and_tag(&sCcm, size, iv, sizeof(iv), store, strlen(store) + 1, buf, buf, tag, sizeof(tag));
 
 	// Writing new entry to flash
 	struct settingBuffer buffers[4] = {{store, strlen(store) + 1}, {iv, sizeof(iv)}, {tag, sizeof(tag)}, {buf, size}};
@@ -177,9 +346,27 @@ long oc_storage_write(const char *store, uint8_t *buf, size_t size)
 	if (error)
 		OC_DBG("Could not add new setting! otPlatSettingsAdd returned %d", error);
 
-	mbedtls_ccm_auth_decrypt(&ccm, size, iv, sizeof(iv), store, strlen(store) + 1, buf, buf, tag, sizeof(tag));
+	mbedtls_ccm_auth_decrypt(&sCcm, size, iv, sizeof(iv), store, strlen(store) + 1, buf, buf, tag, sizeof(tag));
+
+	if (error || sDirectoryCount < 0)
+		goto exit;
+
+	// The new record is added last, so check the directory agrees before updating it
+	if (sDirectoryCount < OC_STORAGE_DIRECTORY_SIZE &&
+	    otPlatSettingsGetAddress(OC_SETTINGS_KEY, sDirectoryCount, &read_buffer, &read_buffer_size) == OT_ERROR_NONE &&
+	    strcmp(store, (char *)read_buffer) == 0)
+	{
+		sDirectory[sDirectoryCount++] = name_hash(store);
+#if OC_STORAGE_CACHE_ENTRIES
+		cache_insert(read_buffer, iv, buf, size);
+#endif
+	}
+	else
+	{
+		sDirectoryCount = -1;
+	}
+
 exit:
-	mbedtls_ccm_free(&ccm);
 	return error ? -error : size;
 }
 #endif /* OC_SECURITY */
@@ -2,6 +2,7 @@
 #undef NDEBUG
 #endif
 
+#include <stdio.h>
 #include <unistd.h>
 
 #include <openthread/thread.h>
@@ -9,6 +10,7 @@
 
 #include "cascoda-bm/cascoda_evbme.h"
 #include "cascoda-bm/cascoda_interface.h"
+#include "cascoda-util/cascoda_time.h"
 #include "ca821x_api.h"
 
 #include "oc_api.h"
@@ -67,6 +69,38 @@ int main(void)
 		memset(read_data, 0, ITEM_SIZE);
 	}
 
+	// Benchmark a realistic number of security resources
+	const int RECORDS     = 8;
+	const int RECORD_SIZE = 256;
+	const int OPERATIONS  = 200;
+	char      record_name[16];
+	uint32_t  start_time, elapsed;
+
+	for (int i = 0; i < RECORDS; ++i)
+	{
+		snprintf(record_name, sizeof(record_name), "/sec_%d", i);
+		oc_storage_write(record_name, static_data, RECORD_SIZE);
+	}
+
+	start_time = TIME_ReadAbsoluteTime();
+	for (int i = 0; i < OPERATIONS; ++i)
+	{
+		snprintf(record_name, sizeof(record_name), "/sec_%d", i % RECORDS);
+		assert(oc_storage_read(record_name, read_data, ITEM_SIZE) == RECORD_SIZE);
+		assert(memcmp(static_data, read_data, RECORD_SIZE) == 0);
+	}
+	elapsed = TIME_ReadAbsoluteTime() - start_time;
+	printf("oc_storage_read: %d ops/s\n", elapsed ? (int)(OPERATIONS * 1000 / elapsed) : -1);
+
+	start_time = TIME_ReadAbsoluteTime();
+	for (int i = 0; i < OPERATIONS; ++i)
+	{
+		snprintf(record_name, sizeof(record_name), "/sec_%d", i % RECORDS);
+		assert(oc_storage_write(record_name, static_data, RECORD_SIZE) == RECORD_SIZE);
+	}
+	elapsed = TIME_ReadAbsoluteTime() - start_time;
+	printf("oc_storage_write: %d ops/s\n", elapsed ? (int)(OPERATIONS * 1000 / elapsed) : -1);
+
 	while (1)
 	{
 	}
@@ -83,6 +83,11 @@ void DNS_Init(otInstance *aInstance);
  * Resolve a hostname to an IPv6 address, running DNS queries if necessary.
  * This request is non-blocking, and results will be provided via callback.
  *
+ * Answers are cached for their TTL, and hostnames that have no address are cached for a short time, so repeated
+ * requests for the same hostname do not each cost a DNS query. A cached answer is provided from a cascoda-util tasklet,
+ * so the application must be processing tasklets (posixPlatformProcessDrivers does this on posix). Requests for a
+ * hostname that is already being resolved share the same query.
+ *
  * @param aInstance  The initialised OpenThread instance to use.
  * @param host       Host string - can be an IPv6 address, an IPv4 address, or a hostname to be resolved by DNS.
  * @param aCallback  Callback to be called when the resolution is complete (if this function returns CA_ERROR_SUCCESS)
@@ -114,7 +119,8 @@ ca_error DNS_HostToIpv6(otInstance *aInstance, char *host, dns_callback aCallbac
 ca_error DNS_AddServer(otIp6Address *aAddress, uint8_t aPreference, bool aUseDns64);
 
 /**
- * Register the fact that a DNS server returned an address that could not be contacted.
+ * Register the fact that a DNS server returned an address that could not be contacted. The cached answers from that
+ * server are discarded, so that the hostnames are resolved again.
  * @param aIndex The dns server index provided to the dns callback
  */
 void DNS_RegisterServiceFail(dns_index aIndex);
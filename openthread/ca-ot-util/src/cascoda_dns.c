@@ -34,6 +34,8 @@
 // 2. IPv4 string -> nat64 ipv6 addr -> SuccessOrFail
 // 3.a Select DNS server based on preference val. (using forced DNS64 if configured)
 // 3.b If use fails, try a new DNS server
+// Answers are cached for their TTL, and answers without an address for a minute.
+// Lookups of a name already being queried share the query.
 
 // There are 3 possible states of connectivity to consider.
 // 1. No connectivity to internet
@@ -42,11 +44,14 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "openthread/dns.h"
 
 #include "ca-ot-util/cascoda_dns.h"
+#include "cascoda-util/cascoda_tasklet.h"
+#include "cascoda-util/cascoda_time.h"
 #include "ca821x_log.h"
 
 #define NAT64_PREFIX "64:ff9b::"
@@ -61,6 +66,11 @@ enum
 	DNS_PREF_BASE    = 6,   //!< Base value for DNS preference
 	DNS_PREF_BONUS   = 1,   //!< Value to add to DNS preference upon success
 	DNS_PREF_PENALTY = 4,   //!< Value to remove from DNS preference upon service fail (if it is above base)
+
+	DNS_CACHE_SIZE         = 4,     //!< Number of hostnames to cache answers for
+	DNS_CACHE_HOSTNAME_LEN = 64,    //!< Maximum length of a cached hostname, including terminator
+	DNS_CACHE_MAX_TTL      = 86400, //!< Maximum time to cache an answer for, in seconds
+	DNS_CACHE_NEGATIVE_TTL = 60,    //!< Time to cache a hostname that could not be resolved for, in seconds
 };
 
 /**
@@ -73,20 +83,60 @@ struct dnsServer
 	bool         useDns64;   //!< True if an A request should be made instead of AAAA, and converted to IPv6 with DNS64
 };
 
+/**
+ * Answer from a DNS server, kept until its TTL expires
+ */
+struct dnsCacheEntry
+{
+	char         hostname[DNS_CACHE_HOSTNAME_LEN]; //!< Hostname that was resolved, empty if the entry is free
+	otIp6Address addr;                             //!< Resolved address, only valid if result is CA_ERROR_SUCCESS
+	dns_index    server;                           //!< DNS server that provided the answer
+	uint32_t     expiry;                           //!< Absolute time at which the entry expires, in milliseconds
+	ca_error     result;                           //!< CA_ERROR_SUCCESS, or CA_ERROR_NOT_FOUND for a negative answer
+};
+
+/**
+ * Additional request for a hostname that is already being resolved
+ */
+struct dns_waiter
+{
+	struct dns_waiter *next;     //!< Next waiter for the same query
+	dns_callback       callback; //!< User callback to call upon completion
+	void *             context;  //!< User context to be provided to the callback
+};
+
 /**
  * Dynamically allocated context structure to pass to the DNS subsystem as a context.
  */
 struct dns_context
 {
-	dns_index    server;      //!< Index of the DNS server used
-	void *       context;     //!< User context to be provided to the callback
-	otInstance * instance;    //!< Openthread instance
-	dns_callback callback;    //!< User callback to call upon completion
-	uint8_t      retry_count; //!< Number of retries left to attempt
-	char         hostname[];  //!< Variable length hostname
+	struct dns_context *next;        //!< Next query in flight
+	struct dns_waiter * waiters;     //!< Other requests for the same hostname, to complete with this one
+	dns_index           server;      //!< Index of the DNS server used
+	void *              context;     //!< User context to be provided to the callback
+	otInstance *        instance;    //!< Openthread instance
+	dns_callback        callback;    //!< User callback to call upon completion
+	uint8_t             retry_count; //!< Number of retries left to attempt
+	char                hostname[];  //!< Variable length hostname
+};
+
+/**
+ * Dynamically allocated copy of a cached answer, delivered from a tasklet so that the callback is never called
+ * from within DNS_HostToIpv6.
+ */
+struct dns_cached_result
+{
+	ca_tasklet   tasklet;  //!< Tasklet that calls the callback
+	otIp6Address addr;     //!< Resolved address, only valid if result is CA_ERROR_SUCCESS
+	dns_index    server;   //!< DNS server that provided the answer
+	ca_error     result;   //!< Result to report
+	dns_callback callback; //!< User callback to call upon completion
+	void *       context;  //!< User context to be provided to the callback
 };
 
-static struct dnsServer dns_servers[DNS_SERVER_COUNT];
+static struct dnsServer     dns_servers[DNS_SERVER_COUNT];
+static struct dnsCacheEntry dns_cache[DNS_CACHE_SIZE];
+static struct dns_context * dns_in_flight; //!< Linked list of the queries awaiting a response
 
 static ca_error dns_query_next_server(otInstance *aInstance, struct dns_context *aContext);
 
@@ -154,6 +204,162 @@ static void dns_register_timeout(dns_index aIndex)
 	}
 }
 
+/**
+ * Find the unexpired cache entry for a hostname
+ * @param aHostname The hostname to look up
+ * @return Pointer to the cache entry, or NULL if the hostname is not cached
+ */
+static struct dnsCacheEntry *dns_cache_find(const char *aHostname)
+{
+	uint32_t now = TIME_ReadAbsoluteTime();
+
+	for (int i = 0; i < DNS_CACHE_SIZE; i++)
+	{
+		struct dnsCacheEntry *entry = &dns_cache[i];
+
+		if (!entry->hostname[0])
+			continue;
+
+		if (TIME_Cmp(now, entry->expiry) >= 0)
+		{
+			entry->hostname[0] = '\0';
+			continue;
+		}
+
+		if (strcmp(entry->hostname, aHostname) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+/**
+ * Cache the result of a DNS query, replacing the entry that expires soonest if the cache is full
+ * @param aHostname The hostname that was resolved
+ * @param aResult   CA_ERROR_SUCCESS, or CA_ERROR_NOT_FOUND for a negative answer
+ * @param aAddress  The resolved address, only used if aResult is CA_ERROR_SUCCESS
+ * @param aIndex    The DNS server that provided the answer
+ * @param aTtl      Time to cache the answer for, in seconds
+ */
+static void dns_cache_insert(const char *        aHostname,
+                             ca_error            aResult,
+                             const otIp6Address *aAddress,
+                             dns_index           aIndex,
+                             uint32_t            aTtl)
+{
+	struct dnsCacheEntry *entry = dns_cache_find(aHostname);
+	uint32_t              now   = TIME_ReadAbsoluteTime();
+
+	if (aTtl == 0 || strlen(aHostname) >= DNS_CACHE_HOSTNAME_LEN)
+		return;
+
+	if (aTtl > DNS_CACHE_MAX_TTL)
+		aTtl = DNS_CACHE_MAX_TTL;
+
+	for (int i = 0; i < DNS_CACHE_SIZE && !entry; i++)
+	{
+		if (!dns_cache[i].hostname[0])
+			entry = &dns_cache[i];
+	}
+
+	if (!entry)
+	{
+		entry = &dns_cache[0];
+		for (int i = 1; i < DNS_CACHE_SIZE; i++)
+		{
+			if (TIME_Cmp(dns_cache[i].expiry, entry->expiry) < 0)
+				entry = &dns_cache[i];
+		}
+	}
+
+	strcpy(entry->hostname, aHostname);
+	entry->server = aIndex;
+	entry->result = aResult;
+	entry->expiry = now + aTtl * 1000;
+	if (aResult == CA_ERROR_SUCCESS)
+		entry->addr = *aAddress;
+}
+
+/**
+ * Deliver a cached answer (tasklet callback)
+ * @param aContext The dns_cached_result to deliver, freed in here
+ */
+static ca_error dns_cached_result_callback(void *aContext)
+{
+	struct dns_cached_result *cached = aContext;
+
+	cached->callback(
+	    cached->result, cached->result == CA_ERROR_SUCCESS ? &cached->addr : NULL, cached->server, cached->context);
+	free(cached);
+	return CA_ERROR_SUCCESS;
+}
+
+/**
+ * Complete a request from the cache. The callback is called from a tasklet, as it would be for a DNS query.
+ * @param aEntry    The cache entry for the requested hostname
+ * @param aCallback Callback to be called with the cached answer
+ * @param aContext  Context to provide to the callback
+ *
+ * @retval CA_ERROR_SUCCESS   Callback will be called with the cached answer
+ * @retval CA_ERROR_NO_BUFFER No buffer could be allocated to hold the answer
+ */
+static ca_error dns_complete_from_cache(const struct dnsCacheEntry *aEntry, dns_callback aCallback, void *aContext)
+{
+	struct dns_cached_result *cached = malloc(sizeof(*cached));
+
+	if (!cached)
+		return CA_ERROR_NO_BUFFER;
+
+	cached->addr     = aEntry->addr;
+	cached->server   = aEntry->server;
+	cached->result   = aEntry->result;
+	cached->callback = aCallback;
+	cached->context  = aContext;
+
+	ca_log_debg("DNS cache hit for %s", aEntry->hostname);
+	TASKLET_Init(&cached->tasklet, &dns_cached_result_callback);
+	TASKLET_ScheduleDelta(&cached->tasklet, 0, cached);
+	return CA_ERROR_SUCCESS;
+}
+
+/**
+ * Complete a DNS query, caching its result and calling every request that was waiting for it
+ * @param aContext dns_context of the query, freed in here
+ * @param aError   Result of the query
+ * @param aAddress Resolved address, only valid if aError is CA_ERROR_SUCCESS
+ * @param aTtl     Time to cache the result for, in seconds. 0 if it should not be cached.
+ */
+static void dns_complete(struct dns_context *aContext, ca_error aError, const otIp6Address *aAddress, uint32_t aTtl)
+{
+	struct dns_context **prevn = &dns_in_flight;
+	struct dns_waiter *  waiter;
+
+	while (*prevn && *prevn != aContext) prevn = &(*prevn)->next;
+	if (*prevn)
+		*prevn = aContext->next;
+
+	dns_cache_insert(aContext->hostname, aError, aAddress, aContext->server, aTtl);
+
+	aContext->callback(aError, aAddress, aContext->server, aContext->context);
+	while ((waiter = aContext->waiters))
+	{
+		aContext->waiters = waiter->next;
+		waiter->callback(aError, aAddress, aContext->server, waiter->context);
+		free(waiter);
+	}
+
+	free(aContext);
+}
+
+/**
+ * Reduce the preference of a DNS server whose answer could not be used
+ * @param aIndex The DNS server
+ */
+static void dns_register_fail(dns_index aIndex)
+{
+	if (aIndex->preference >= DNS_PREF_BASE)
+		aIndex->preference -= DNS_PREF_PENALTY;
+}
+
 /**
  * Handle the DNS callback from the openthread stack
  * @param aContext  dns_context pointer, must be freed in here
@@ -171,14 +377,13 @@ static void dns_handle_response(void *              aContext,
 	struct dns_context *context = aContext;
 
 	(void)aHostname;
-	(void)aTtl;
 
 	ca_log_debg("DNS Response error %s", otThreadErrorToString(aResult));
 
 	if (aResult == OT_ERROR_NONE)
 	{
 		DNS_RegisterSuccess(context->server);
-		context->callback(CA_ERROR_SUCCESS, aAddress, context->server, context->context);
+		dns_complete(context, CA_ERROR_SUCCESS, aAddress, aTtl);
 	}
 	else if (aResult == OT_ERROR_RESPONSE_TIMEOUT)
 	{
@@ -187,21 +392,20 @@ static void dns_handle_response(void *              aContext,
 		{
 			//Retry with new server
 			context->retry_count--;
-			dns_query_next_server(context->instance, context);
-			return;
-		}
-		else
-		{
-			context->callback(CA_ERROR_TIMEOUT, NULL, context->server, context->context);
+			if (dns_query_next_server(context->instance, context) == CA_ERROR_SUCCESS)
+				return;
 		}
+		dns_complete(context, CA_ERROR_TIMEOUT, NULL, 0);
 	}
 	else
 	{
-		DNS_RegisterServiceFail(context->server);
-		context->callback(CA_ERROR_NOT_FOUND, NULL, context->server, context->context);
-	}
+		// OT_ERROR_NOT_FOUND is an answer without an address, which is cached for a while. OT_ERROR_FAILED is any
+		// error response, so NXDOMAIN cannot be told apart from SERVFAIL or REFUSED and is not cached.
+		bool negative = (aResult == OT_ERROR_NOT_FOUND);
 
-	free(context);
+		dns_register_fail(context->server);
+		dns_complete(context, CA_ERROR_NOT_FOUND, NULL, negative ? DNS_CACHE_NEGATIVE_TTL : 0);
+	}
 }
 
 /**
@@ -289,8 +493,17 @@ static bool dns_is_valid_hostname(const char *host)
 
 void DNS_RegisterServiceFail(dns_index aIndex)
 {
-	if (aIndex->preference >= DNS_PREF_BASE)
-		aIndex->preference -= DNS_PREF_PENALTY;
+	if (!aIndex)
+		return;
+
+	dns_register_fail(aIndex);
+
+	// The addresses from this server could not be used, so resolve them again next time
+	for (int i = 0; i < DNS_CACHE_SIZE; i++)
+	{
+		if (dns_cache[i].server == aIndex)
+			dns_cache[i].hostname[0] = '\0';
+	}
 }
 
 void DNS_RegisterSuccess(dns_index aIndex)
@@ -357,10 +570,37 @@ ca_error DNS_HostToIpv6(otInstance *aInstance, char *host, dns_callback aCallbac
 		}
 	}
 
-	// Is the hostname a host name? If so, we do a DNS request and wait for the response.
+	// Is the hostname a host name? If so, we use the cached answer, or do a DNS request and wait for the response.
 	if (dns_is_valid_hostname(host))
 	{
-		struct dns_context *context;
+		struct dnsCacheEntry *entry = dns_cache_find(host);
+		struct dns_context *  context;
+
+		if (entry)
+		{
+			error = dns_complete_from_cache(entry, aCallback, aContext);
+			goto exit;
+		}
+
+		// Is the hostname already being resolved? If so, share the query.
+		for (context = dns_in_flight; context; context = context->next)
+		{
+			if (strcmp(context->hostname, host) == 0)
+			{
+				struct dns_waiter *waiter = malloc(sizeof(*waiter));
+
+				if (!waiter)
+				{
+					error = CA_ERROR_NO_BUFFER;
+					goto exit;
+				}
+				waiter->callback = aCallback;
+				waiter->context  = aContext;
+				waiter->next     = context->waiters;
+				context->waiters = waiter;
+				goto exit;
+			}
+		}
 
 		context = calloc(1, sizeof(struct dns_context) + hostlen + 1);
 		if (!context)
@@ -377,7 +617,14 @@ ca_error DNS_HostToIpv6(otInstance *aInstance, char *host, dns_callback aCallbac
 		error = dns_query_next_server(aInstance, context);
 
 		if (error)
+		{
 			free(context);
+		}
+		else
+		{
+			context->next = dns_in_flight;
+			dns_in_flight = context;
+		}
 	}
 	else
 	{
@@ -0,0 +1,315 @@
+/*
+ *  Copyright (c) 2021, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "bench/Bench.hpp"
+
+namespace ca {
+
+Bench::Bench()
+    : Command("bench", "Utility for measuring the throughput and latency of the link to connected chili devices")
+    , mArgParser()
+    , mHelpArg('h', "help")
+    , mSerialArg('s', "serialno", ArgOpt::MANDATORY)
+    , mBatchArg('b', "batch")
+    , mCountArg('n', "count", ArgOpt::MANDATORY)
+    , mStreamCountArg('i', "indications", ArgOpt::MANDATORY)
+    , mSizesArg('\0', "sizes", ArgOpt::MANDATORY)
+    , mCsvArg('\0', "csv")
+    , mCount(1000)
+    , mStreamCount(2000)
+    , mSizes{1, 64, 128, Bencher::kMaxSize}
+{
+	mHelpArg.SetHelpString("Print this message to stdout");
+	mHelpArg.SetCallback(&Bench::print_help_string, *this);
+	mArgParser.AddOption(mHelpArg);
+
+	mSerialArg.SetArgHint("serialno");
+	mSerialArg.SetHelpString("Benchmark the device with the given serial number.");
+	mSerialArg.SetCallback(&Bench::set_serialno_filter, *this);
+	mArgParser.AddOption(mSerialArg);
+
+	mBatchArg.SetHelpString("Permit the benchmarking of multiple devices, which are measured in parallel.");
+	mArgParser.AddOption(mBatchArg);
+
+	mCountArg.SetArgHint("count");
+	mCountArg.SetHelpString("Number of round trips for each latency measurement. Defaults to 1000.");
+	mCountArg.SetCallback(&Bench::set_count, *this);
+	mArgParser.AddOption(mCountArg);
+
+	mStreamCountArg.SetArgHint("count");
+	mStreamCountArg.SetHelpString("Number of indications for each throughput measurement. Defaults to 2000.");
+	mStreamCountArg.SetCallback(&Bench::set_stream_count, *this);
+	mArgParser.AddOption(mStreamCountArg);
+
+	mSizesArg.SetArgHint("size,...");
+	mSizesArg.SetHelpString("Comma separated payload sizes to measure, from 1 to 250 bytes. Defaults to 1,64,128,250.");
+	mSizesArg.SetCallback(&Bench::set_sizes, *this);
+	mArgParser.AddOption(mSizesArg);
+
+	mCsvArg.SetHelpString("Print the results as CSV rather than JSON.");
+	mArgParser.AddOption(mCsvArg);
+}
+
+ca_error Bench::Process(int argc, const char *argv[])
+{
+	ca_error error    = CA_ERROR_SUCCESS;
+	int      argi     = 1;
+	size_t   devcount = 0;
+
+	while (argi < argc)
+	{
+		error = mArgParser.ProcessOption(argi, argc, argv);
+
+		if (error)
+		{
+			//Something went wrong, abort.
+			fprintf(stderr, "Error: %s\n", ca_error_str(error));
+			exit(-1);
+		}
+	}
+
+	if (mHelpArg.GetCallCount())
+		goto exit;
+
+	mDeviceListFilter.SetAvailable(true);
+	mDeviceList.Refresh(mDeviceListFilter);
+
+	devcount = mDeviceList.Get().size();
+
+	fprintf(stderr, "%u devices found.\n", static_cast<unsigned>(devcount));
+	if (devcount == 0)
+	{
+		error = CA_ERROR_NOT_FOUND;
+		goto exit;
+	}
+
+	if (devcount > 1 && !mBatchArg.GetCallCount())
+	{
+		fprintf(stderr, "Error: Multiple devices found, but '--batch' not specified.");
+		error = CA_ERROR_INVALID_STATE;
+		goto exit;
+	}
+
+	{
+		const std::vector<DeviceInfo> &devices = mDeviceList.Get();
+		std::vector<DeviceResults>     results(devcount);
+		std::vector<std::thread>       workers;
+
+		//Each device has its own link, so they are all measured at once
+		for (size_t i = 0; i < devcount; ++i)
+			workers.emplace_back([&, i]() { results[i].mError = bench_device(devices[i], results[i]); });
+		for (std::thread &t : workers) t.join();
+
+		if (mCsvArg.GetCallCount())
+			print_csv(stdout, results);
+		else
+			print_json(stdout, results);
+
+		for (size_t i = 0; i < devcount && !error; ++i) error = results[i].mError;
+	}
+
+exit:
+	return error;
+}
+
+ca_error Bench::print_help_string(const char *aArg)
+{
+	(void)aArg;
+
+	fprintf(stdout, "--- Chili Control: Benchmarking Sub-Application ---\n");
+	fprintf(stdout, "SYNOPSIS\n");
+	fprintf(stdout, "\tchilictl [options] bench [command options]\n");
+	fprintf(stdout, "COMMAND OPTIONS\n");
+	mArgParser.PrintOptionHelpStrings(stdout);
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bench::set_serialno_filter(const char *aArg)
+{
+	mDeviceListFilter.AddSerialNo(aArg);
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bench::set_count(const char *aArg)
+{
+	return parse_count(aArg, mCount);
+}
+
+ca_error Bench::set_stream_count(const char *aArg)
+{
+	return parse_count(aArg, mStreamCount);
+}
+
+ca_error Bench::set_sizes(const char *aArg)
+{
+	const char *  next = aArg;
+	char *        end;
+	unsigned long size;
+
+	mSizes.clear();
+	do
+	{
+		size = strtoul(next, &end, 10);
+		if (end == next || (*end != ',' && *end != '\0') || size == 0 || size > Bencher::kMaxSize)
+		{
+			fprintf(stderr, "Error: Invalid size list \"%s\"\n", aArg);
+			return CA_ERROR_INVALID_ARGS;
+		}
+
+		mSizes.push_back(static_cast<unsigned>(size));
+		next = end + 1;
+	} while (*end == ',');
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bench::parse_count(const char *aArg, unsigned &aCount)
+{
+	char *        end;
+	unsigned long count = strtoul(aArg, &end, 10);
+
+	if (*aArg == '\0' || *end != '\0' || count == 0 || count > UINT_MAX)
+	{
+		fprintf(stderr, "Error: Invalid count \"%s\"\n", aArg);
+		return CA_ERROR_INVALID_ARGS;
+	}
+
+	aCount = static_cast<unsigned>(count);
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bench::bench_device(const DeviceInfo &aDeviceInfo, DeviceResults &aResults)
+{
+	Bencher         b{aDeviceInfo};
+	Bencher::Result result;
+	ca_error        error;
+
+	error = b.Open();
+	if (error)
+		return error;
+
+	fprintf(stderr, "Bench [%s]: Measuring EVBME GET latency\n", aDeviceInfo.GetSerialNo());
+	error = b.MeasureGetLatency(mCount, result);
+	if (error)
+		return error;
+	aResults.mResults.push_back(result);
+
+	for (unsigned size : mSizes)
+	{
+		fprintf(stderr,
+		        "Bench [%s]: Measuring %u byte COMM CHECK latency and throughput\n",
+		        aDeviceInfo.GetSerialNo(),
+		        size);
+
+		error = b.MeasureEchoLatency(size, mCount, result);
+		if (error)
+			return error;
+		aResults.mResults.push_back(result);
+
+		error = b.MeasureStream(size, mStreamCount, result);
+		if (error)
+			return error;
+		aResults.mResults.push_back(result);
+	}
+
+	return CA_ERROR_SUCCESS;
+}
+
+void Bench::print_json(FILE *aOut, const std::vector<DeviceResults> &aResults)
+{
+	const std::vector<DeviceInfo> &devices = mDeviceList.Get();
+
+	fprintf(aOut, "{\n\t\"devices\": [");
+	for (size_t i = 0; i < aResults.size(); ++i)
+	{
+		fprintf(aOut, "%s\n\t\t{\n", i ? "," : "");
+		fprintf(aOut, "\t\t\t\"serialno\": \"%s\",\n", devices[i].GetSerialNo());
+		fprintf(aOut, "\t\t\t\"app\": \"%s\",\n", devices[i].GetAppName());
+		fprintf(aOut, "\t\t\t\"version\": \"%s\",\n", devices[i].GetVersion());
+		fprintf(aOut, "\t\t\t\"status\": \"%s\",\n", ca_error_str(aResults[i].mError));
+		fprintf(aOut, "\t\t\t\"results\": [");
+
+		for (size_t j = 0; j < aResults[i].mResults.size(); ++j)
+		{
+			const Bencher::Result &r = aResults[i].mResults[j];
+
+			fprintf(aOut,
+			        "%s\n\t\t\t\t{\"test\": \"%s\", \"size\": %u, \"samples\": %u, \"lost\": %u, ",
+			        j ? "," : "",
+			        r.mTest,
+			        r.mSize,
+			        r.mSamples,
+			        r.mLost);
+			if (strcmp(r.mTest, "stream") == 0)
+			{
+				fprintf(aOut, "\"msgs_per_s\": %.1f, \"bytes_per_s\": %.1f}", r.mMsgsPerSec, r.mBytesPerSec);
+			}
+			else
+			{
+				fprintf(aOut,
+				        "\"min_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+				        r.mMinUs,
+				        r.mP50Us,
+				        r.mP99Us,
+				        r.mP999Us,
+				        r.mMaxUs);
+			}
+		}
+
+		fprintf(aOut, "%s]\n\t\t}", aResults[i].mResults.empty() ? "" : "\n\t\t\t");
+	}
+	fprintf(aOut, "\n\t]\n}\n");
+}
+
+void Bench::print_csv(FILE *aOut, const std::vector<DeviceResults> &aResults)
+{
+	const std::vector<DeviceInfo> &devices = mDeviceList.Get();
+
+	fprintf(aOut, "serialno,test,size,samples,lost,min_us,p50_us,p99_us,p999_us,max_us,msgs_per_s,bytes_per_s\n");
+	for (size_t i = 0; i < aResults.size(); ++i)
+	{
+		for (const Bencher::Result &r : aResults[i].mResults)
+		{
+			fprintf(aOut, "%s,%s,%u,%u,%u,", devices[i].GetSerialNo(), r.mTest, r.mSize, r.mSamples, r.mLost);
+			if (strcmp(r.mTest, "stream") == 0)
+				fprintf(aOut, ",,,,,%.1f,%.1f\n", r.mMsgsPerSec, r.mBytesPerSec);
+			else
+				fprintf(aOut, "%.1f,%.1f,%.1f,%.1f,%.1f,,\n", r.mMinUs, r.mP50Us, r.mP99Us, r.mP999Us, r.mMaxUs);
+		}
+	}
+}
+
+} /* namespace ca */
@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2021, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POSIX_APP_CHILICTL_BENCH_BENCH_HPP_
+#define POSIX_APP_CHILICTL_BENCH_BENCH_HPP_
+
+#include <cstdio>
+#include <vector>
+
+#include "ca821x_error.h"
+
+#include "bench/Bencher.hpp"
+#include "common/Args.hpp"
+#include "common/Command.hpp"
+#include "common/DeviceList.hpp"
+
+namespace ca {
+
+class Bench : public Command
+{
+public:
+	Bench();
+
+	/**
+	 * @copydoc Command::Process
+	 */
+	ca_error Process(int argc, const char *argv[]);
+
+private:
+	/** Results of benchmarking a single device */
+	struct DeviceResults
+	{
+		ca_error                     mError;
+		std::vector<Bencher::Result> mResults;
+	};
+
+	Args                  mArgParser;
+	ArgOpt                mHelpArg;
+	ArgOpt                mSerialArg;
+	ArgOpt                mBatchArg;
+	ArgOpt                mCountArg;
+	ArgOpt                mStreamCountArg;
+	ArgOpt                mSizesArg;
+	ArgOpt                mCsvArg;
+	DeviceList            mDeviceList;
+	DeviceListFilter      mDeviceListFilter;
+	unsigned              mCount;
+	unsigned              mStreamCount;
+	std::vector<unsigned> mSizes;
+
+	ca_error print_help_string(const char *aArg);
+	ca_error set_serialno_filter(const char *aArg);
+	ca_error set_count(const char *aArg);
+	ca_error set_stream_count(const char *aArg);
+	ca_error set_sizes(const char *aArg);
+
+	ca_error bench_device(const DeviceInfo &aDeviceInfo, DeviceResults &aResults);
+
+	void print_json(FILE *aOut, const std::vector<DeviceResults> &aResults);
+	void print_csv(FILE *aOut, const std::vector<DeviceResults> &aResults);
+
+	static ca_error parse_count(const char *aArg, unsigned &aCount);
+};
+
+} /* namespace ca */
+
+#endif /* POSIX_APP_CHILICTL_BENCH_BENCH_HPP_ */
@@ -0,0 +1,240 @@
+/*
+ *  Copyright (c) 2021, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "ca821x-posix/ca821x-posix.h"
+
+#include "bench/Bencher.hpp"
+
+namespace ca {
+
+Bencher::Bencher(const DeviceInfo &aDeviceInfo)
+    : mDeviceRef()
+    , mDeviceInfo(aDeviceInfo)
+    , mOpen(false)
+    , mHandle(0)
+    , mIndications(0)
+{
+}
+
+Bencher::~Bencher()
+{
+	if (mOpen)
+		ca821x_util_deinit(&mDeviceRef);
+}
+
+ca_error Bencher::Open()
+{
+	ca_error status;
+
+	status = ca821x_util_init_path(&mDeviceRef, nullptr, mDeviceInfo.GetExchangeType(), mDeviceInfo.GetPath());
+	if (status)
+	{
+		fprintf(stderr, "Error: Failed to open [%s] - %s\n", mDeviceInfo.GetSerialNo(), ca_error_str(status));
+		return status;
+	}
+
+	mOpen                                                       = true;
+	mDeviceRef.context                                          = this;
+	EVBME_GetCallbackStruct(&mDeviceRef)->EVBME_COMM_indication = &comm_indication;
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bencher::MeasureGetLatency(unsigned aCount, Result &aResult)
+{
+	std::vector<double> samples;
+	uint8_t             buf[sizeof(EVBME_Message::EVBME)];
+	uint8_t             len = 0;
+	ca_error            status;
+	Clock::time_point   start;
+
+	for (unsigned i = 0; i < aCount; ++i)
+	{
+		start  = Clock::now();
+		status = EVBME_GET_request_sync(EVBME_VERSTRING, sizeof(buf), buf, &len, &mDeviceRef);
+		if (status)
+		{
+			fprintf(stderr, "Error: EVBME GET to [%s] failed - %s\n", mDeviceInfo.GetSerialNo(), ca_error_str(status));
+			return status;
+		}
+		samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+
+	aResult       = Result();
+	aResult.mTest = "get";
+	aResult.mSize = len;
+	fill_latency(samples, aResult);
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bencher::MeasureEchoLatency(unsigned aSize, unsigned aCount, Result &aResult)
+{
+	std::vector<double> samples;
+	unsigned            lost = 0;
+	ca_error            status;
+	uint8_t             handle;
+	Clock::time_point   start, end;
+
+	for (unsigned i = 0; i < aCount; ++i)
+	{
+		handle = next_handle();
+		start  = Clock::now();
+		status = EVBME_COMM_CHECK_request(handle, 0, 1, aSize, aSize, &mDeviceRef);
+		if (status)
+			return status;
+
+		if (wait_for_indications(1, end) < 1)
+			lost++;
+		else
+			samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+	}
+
+	aResult       = Result();
+	aResult.mTest = "echo";
+	aResult.mSize = aSize;
+	aResult.mLost = lost;
+	fill_latency(samples, aResult);
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bencher::MeasureStream(unsigned aSize, unsigned aCount, Result &aResult)
+{
+	uint8_t           handle = next_handle();
+	unsigned          received;
+	unsigned          count;
+	double            seconds;
+	ca_error          status;
+	Clock::time_point start, end;
+
+	// The device sends the indications of each request as fast as it can, so queue all of the requests at once
+	start = Clock::now();
+	for (unsigned sent = 0; sent < aCount; sent += count)
+	{
+		count  = std::min<unsigned>(aCount - sent, kMaxIndPerRequest);
+		status = EVBME_COMM_CHECK_request(handle, 0, count, aSize, 0, &mDeviceRef);
+		if (status)
+			return status;
+	}
+
+	received = wait_for_indications(aCount, end);
+	seconds  = std::chrono::duration<double>(end - start).count();
+
+	aResult          = Result();
+	aResult.mTest    = "stream";
+	aResult.mSize    = aSize;
+	aResult.mSamples = received;
+	aResult.mLost    = aCount - received;
+	if (received && seconds > 0)
+	{
+		aResult.mMsgsPerSec  = received / seconds;
+		aResult.mBytesPerSec = received * aSize / seconds;
+	}
+
+	return CA_ERROR_SUCCESS;
+}
+
+uint8_t Bencher::next_handle()
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	mHandle++;
+	mIndications    = 0;
+	mLastIndication = Clock::now();
+
+	return mHandle;
+}
+
+unsigned Bencher::wait_for_indications(unsigned aCount, Clock::time_point &aLastIndication)
+{
+	std::unique_lock<std::mutex> guard(mMutex);
+
+	// Give up once the device has been quiet for a while, rather than after a fixed time, as streams can be long
+	while (mIndications < aCount)
+	{
+		Clock::time_point deadline = mLastIndication + std::chrono::milliseconds(kTimeoutMs);
+
+		if (mIndicationCond.wait_until(guard, deadline) == std::cv_status::timeout && Clock::now() >= deadline &&
+		    mIndications < aCount)
+			break;
+	}
+
+	aLastIndication = mLastIndication;
+	return mIndications;
+}
+
+void Bencher::fill_latency(std::vector<double> &aSamplesUs, Result &aResult)
+{
+	size_t n = aSamplesUs.size();
+
+	// Nearest rank percentile of the sorted samples
+	auto percentile = [&](double p) {
+		size_t rank = static_cast<size_t>(std::ceil(p * n));
+
+		return aSamplesUs[rank ? rank - 1 : 0];
+	};
+
+	aResult.mSamples = n;
+	if (n == 0)
+		return;
+
+	std::sort(aSamplesUs.begin(), aSamplesUs.end());
+	aResult.mMinUs  = aSamplesUs.front();
+	aResult.mP50Us  = percentile(0.5);
+	aResult.mP99Us  = percentile(0.99);
+	aResult.mP999Us = percentile(0.999);
+	aResult.mMaxUs  = aSamplesUs.back();
+}
+
+ca_error Bencher::comm_indication(EVBME_Message *params)
+{
+	std::unique_lock<std::mutex> guard(mMutex);
+
+	if (params->mLen && params->EVBME.COMM_indication.mHandle == mHandle)
+	{
+		mIndications++;
+		mLastIndication = Clock::now();
+	}
+
+	guard.unlock();
+	mIndicationCond.notify_all();
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Bencher::comm_indication(EVBME_Message *params, ca821x_dev *pDeviceRef)
+{
+	return static_cast<Bencher *>(pDeviceRef->context)->comm_indication(params);
+}
+
+} /* namespace ca */
@@ -0,0 +1,144 @@
+/*
+ *  Copyright (c) 2021, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POSIX_APP_CHILICTL_BENCH_BENCHER_HPP_
+#define POSIX_APP_CHILICTL_BENCH_BENCHER_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "ca821x-posix/ca821x-posix.h"
+
+#include "common/DeviceInfo.hpp"
+
+namespace ca {
+
+/**
+ * Measures the performance of the link to a single device, using EVBME messages that every application handles.
+ */
+class Bencher
+{
+public:
+	enum
+	{
+		kMaxSize = 250, //!< Largest payload that fits in both a COMM CHECK request and a COMM indication
+	};
+
+	/**
+	 * Result of a single measurement. The latency fields are only set by the latency measurements, and the rate
+	 * fields only by the stream measurement.
+	 */
+	struct Result
+	{
+		const char *mTest;        //!< Name of the measurement: "get", "echo" or "stream"
+		unsigned    mSize;        //!< Size of each measured EVBME message payload, in bytes
+		unsigned    mSamples;     //!< Number of messages that were measured
+		unsigned    mLost;        //!< Number of messages that were expected, but not received in time
+		double      mMinUs;       //!< Minimum round trip time in microseconds
+		double      mP50Us;       //!< Median round trip time in microseconds
+		double      mP99Us;       //!< 99th percentile round trip time in microseconds
+		double      mP999Us;      //!< 99.9th percentile round trip time in microseconds
+		double      mMaxUs;       //!< Maximum round trip time in microseconds
+		double      mMsgsPerSec;  //!< Rate of received messages
+		double      mBytesPerSec; //!< Rate of received payload bytes
+	};
+
+	/**
+	 * Construct a bencher instance
+	 * @param aDeviceInfo Reference to a deviceInfo struct of the device to be measured
+	 */
+	Bencher(const DeviceInfo &aDeviceInfo);
+
+	~Bencher();
+
+	/**
+	 * Open the device, which must be done before measuring anything
+	 * @return Status of the device initialisation
+	 */
+	ca_error Open();
+
+	/**
+	 * Measure the round trip time of synchronous EVBME GET requests for the version string.
+	 * @param aCount       Number of requests to send
+	 * @param[out] aResult The result of the measurement
+	 * @return CA_ERROR_SUCCESS, or the error of the first failed request
+	 */
+	ca_error MeasureGetLatency(unsigned aCount, Result &aResult);
+
+	/**
+	 * Measure the round trip time of COMM CHECK requests, each carrying aSize bytes of payload and answered by one
+	 * indication of aSize bytes. Requests are sent one at a time.
+	 * @param aSize        Payload size of the request and the indication, max kMaxSize
+	 * @param aCount       Number of requests to send
+	 * @param[out] aResult The result of the measurement
+	 * @return CA_ERROR_SUCCESS, or the error if a request could not be sent
+	 */
+	ca_error MeasureEchoLatency(unsigned aSize, unsigned aCount, Result &aResult);
+
+	/**
+	 * Measure the rate at which the device can send indications of aSize bytes, timed from the first request being
+	 * sent until the last indication is received.
+	 * @param aSize        Size of each indication, max kMaxSize
+	 * @param aCount       Number of indications to request
+	 * @param[out] aResult The result of the measurement
+	 * @return CA_ERROR_SUCCESS, or the error if a request could not be sent
+	 */
+	ca_error MeasureStream(unsigned aSize, unsigned aCount, Result &aResult);
+
+private:
+	enum
+	{
+		kMaxIndPerRequest = 250,  //!< Number of indications requested by each COMM CHECK request while streaming
+		kTimeoutMs        = 1000, //!< Time without any indication after which the rest are considered lost
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	std::mutex              mMutex;
+	std::condition_variable mIndicationCond;
+	ca821x_dev              mDeviceRef;
+	DeviceInfo              mDeviceInfo;
+	bool                    mOpen;
+	uint8_t                 mHandle;         //!< Handle of the current COMM CHECK, others are ignored
+	unsigned                mIndications;    //!< Number of indications received with mHandle
+	Clock::time_point       mLastIndication; //!< Time that the last indication with mHandle was received
+
+	uint8_t  next_handle();
+	unsigned wait_for_indications(unsigned aCount, Clock::time_point &aLastIndication);
+
+	static void fill_latency(std::vector<double> &aSamplesUs, Result &aResult);
+
+	ca_error        comm_indication(EVBME_Message *params);
+	static ca_error comm_indication(EVBME_Message *params, ca821x_dev *pDeviceRef);
+};
+
+} /* namespace ca */
+
+#endif /* POSIX_APP_CHILICTL_BENCH_BENCHER_HPP_ */
@@ -39,6 +39,7 @@
 #include "ca821x_error.h"
 #include "ca821x_log.h"
 
+#include "bench/Bench.hpp"
 #include "common/Args.hpp"
 #include "flash/Flash.hpp"
 #include "list/List.hpp"
@@ -129,12 +130,14 @@ int main(int argc, const char *argv[])
 	versOpt.SetCallback(&opt_print_version);
 	sArgParser.AddOption(versOpt);
 
+	ca::Bench benchCmd{};
 	ca::Flash flashCmd{};
 	ca::List  listCmd{};
 	ca::Pipe  pipeCmd{};
 	sCommands.push_back(&listCmd);
 	sCommands.push_back(&flashCmd);
 	sCommands.push_back(&pipeCmd);
+	sCommands.push_back(&benchCmd);
 
 	ca821x_util_start_downstream_dispatch_worker();
 
@@ -26,11 +26,16 @@
  *  POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include "Flash.hpp"
 #include "Flasher.hpp"
@@ -46,6 +51,9 @@ Flash::Flash()
     , mFileArg('f', "file", ArgOpt::MANDATORY)
     , mDfuUpdateArg('d', "dfu-update")
     , mIgnoreVersionArg('\0', "ignore-version")
+    , mJobsArg('j', "jobs", ArgOpt::MANDATORY)
+    , mDeltaArg('\0', "delta")
+    , mJobs(1)
 {
 	mHelpArg.SetHelpString("Print this message to stdout");
 	mHelpArg.SetCallback(&Flash::print_help_string, *this);
@@ -70,6 +78,15 @@ Flash::Flash()
 	mIgnoreVersionArg.SetHelpString(
 	    "Ignore the version check on the device to be flashed. Warning: Flashing will not work if device firmware is older than v0.14.");
 	mArgParser.AddOption(mIgnoreVersionArg);
+
+	mJobsArg.SetArgHint("count");
+	mJobsArg.SetHelpString("Flash up to <count> devices at the same time when used with '--batch'. Defaults to 1.");
+	mJobsArg.SetCallback(&Flash::set_jobs, *this);
+	mArgParser.AddOption(mJobsArg);
+
+	mDeltaArg.SetHelpString(
+	    "Compare the device with the file first, and only erase and write the pages that differ. Reduces flash wear and time for small changes.");
+	mArgParser.AddOption(mDeltaArg);
 }
 
 ca_error Flash::Process(int argc, const char *argv[])
@@ -112,32 +129,66 @@ ca_error Flash::Process(int argc, const char *argv[])
 		goto exit;
 	}
 
-	//TODO: Expand this to be parallel, and have a non-polling mechanism to call 'process'
-	for (const DeviceInfo &di : mDeviceList.Get())
 	{
-		Flasher::FlashType flashType =
-		    mDfuUpdateArg.GetCallCount() ? Flasher::FlashType::DFU : Flasher::FlashType::APROM;
-		Flasher f{mFilePath.c_str(), di, flashType};
+		const std::vector<DeviceInfo> &devices = mDeviceList.Get();
+		std::vector<ca_error>          results(devcount, CA_ERROR_SUCCESS);
+		std::vector<std::thread>       workers;
+		std::atomic<size_t>            next{0};
+		std::atomic<bool>              abort{false};
+		std::mutex                     progressMutex;
+		size_t                         finished = 0;
+		size_t                         flashed  = 0;
 
-		if (mIgnoreVersionArg.GetCallCount())
-			f.SetIgnoreVersion(true);
+		// Each worker takes the next device from the list until there are none left, or until a flash has failed
+		auto worker = [&]() {
+			size_t i;
 
-		do
-		{
-			error = f.Process();
-			if (!error)
-				std::this_thread::sleep_for(std::chrono::milliseconds(500));
-		} while (!error);
+			while (!abort && (i = next++) < devcount)
+			{
+				ca_error                    result = flash_device(devices[i]);
+				std::lock_guard<std::mutex> guard(progressMutex);
 
-		if (f.IsComplete())
-		{
-			error = CA_ERROR_SUCCESS;
-		}
-		else
-		{
-			//Exit early if fail
-			fprintf(stderr, "Error: Early termination - %s\n", ca_error_str(error));
+				results[i] = result;
+				finished++;
+				if (result)
+				{
+					abort = true;
+					printf("[%u/%u] Flashing [%s] failed - %s\n",
+					       static_cast<unsigned>(finished),
+					       static_cast<unsigned>(devcount),
+					       devices[i].GetSerialNo(),
+					       ca_error_str(result));
+				}
+				else
+				{
+					flashed++;
+					printf("[%u/%u] Flashing [%s] complete\n",
+					       static_cast<unsigned>(finished),
+					       static_cast<unsigned>(devcount),
+					       devices[i].GetSerialNo());
+				}
+			}
+		};
+
+		for (size_t i = 0; i < std::min<size_t>(mJobs, devcount); ++i) workers.emplace_back(worker);
+		for (std::thread &t : workers) t.join();
+
+		if (flashed == devcount)
 			goto exit;
+
+		//Report everything that went wrong, including the devices that were not attempted
+		fprintf(stderr, "Error: Early termination - %u of %u devices flashed\n",
+		        static_cast<unsigned>(flashed),
+		        static_cast<unsigned>(devcount));
+		for (size_t i = 0; i < devcount; ++i)
+		{
+			if (i >= next)
+				fprintf(stderr, "\t[%s]: not attempted\n", devices[i].GetSerialNo());
+			else if (results[i])
+				fprintf(stderr, "\t[%s]: %s\n", devices[i].GetSerialNo(), ca_error_str(results[i]));
+
+			if (results[i] && !error)
+				error = results[i];
 		}
 	}
 
@@ -176,4 +227,41 @@ ca_error Flash::set_file(const char *aArg)
 	return CA_ERROR_SUCCESS;
 }
 
+ca_error Flash::set_jobs(const char *aArg)
+{
+	char *        end;
+	unsigned long jobs = strtoul(aArg, &end, 10);
+
+	if (*aArg == '\0' || *end != '\0' || jobs == 0 || jobs > UINT_MAX)
+	{
+		fprintf(stderr, "Error: Invalid job count \"%s\"\n", aArg);
+		return CA_ERROR_INVALID_ARGS;
+	}
+
+	mJobs = static_cast<unsigned>(jobs);
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Flash::flash_device(const DeviceInfo &aDeviceInfo)
+{
+	ca_error           error;
+	Flasher::FlashType flashType = mDfuUpdateArg.GetCallCount() ? Flasher::FlashType::DFU : Flasher::FlashType::APROM;
+	Flasher            f{mFilePath.c_str(), aDeviceInfo, flashType};
+
+	if (mIgnoreVersionArg.GetCallCount())
+		f.SetIgnoreVersion(true);
+	if (mDeltaArg.GetCallCount())
+		f.SetDelta(true);
+
+	//The DFU status callback wakes the wait, so the timeout only matters while polling for the rebooted device
+	do
+	{
+		error = f.Process();
+		if (!error)
+			f.WaitForEvent(std::chrono::milliseconds(kPollIntervalMs));
+	} while (!error);
+
+	return f.IsComplete() ? CA_ERROR_SUCCESS : error;
+}
+
 } /* namespace ca */
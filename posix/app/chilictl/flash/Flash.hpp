@@ -36,6 +36,7 @@
 #include "common/Args.hpp"
 #include "common/Command.hpp"
 #include "common/DeviceList.hpp"
+#include "flash/Flasher.hpp"
 
 namespace ca {
 
@@ -50,6 +51,11 @@ public:
 	ca_error Process(int argc, const char *argv[]);
 
 private:
+	enum
+	{
+		kPollIntervalMs = 500, //!< Interval between checks while waiting for a device to reboot
+	};
+
 	Args             mArgParser;
 	ArgOpt           mHelpArg;
 	ArgOpt           mSerialArg;
@@ -57,13 +63,19 @@ private:
 	ArgOpt           mFileArg;
 	ArgOpt           mDfuUpdateArg;
 	ArgOpt           mIgnoreVersionArg;
+	ArgOpt           mJobsArg;
+	ArgOpt           mDeltaArg;
 	DeviceList       mDeviceList;
 	DeviceListFilter mDeviceListFilter;
 	std::string      mFilePath;
+	unsigned         mJobs;
 
 	ca_error print_help_string(const char *aArg);
 	ca_error set_serialno_filter(const char *aArg);
 	ca_error set_file(const char *aArg);
+	ca_error set_jobs(const char *aArg);
+
+	ca_error flash_device(const DeviceInfo &aDeviceInfo);
 };
 
 } /* namespace ca */
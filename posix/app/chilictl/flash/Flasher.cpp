@@ -28,57 +28,51 @@
 
 #include <algorithm>
 #include <cstring>
+#include <fstream>
 #include <limits>
 
 #include "ca821x-posix/ca821x-posix.h"
+#include "cascoda-util/cascoda_crc32.h"
+// uzlib does not declare all of its compression functions as C linkage
+extern "C" {
+#include "uzlib.h"
+}
 
 #include "common/DeviceList.hpp"
 #include "flash/Flasher.hpp"
 
 namespace ca {
 
-/*
- * CRC32 algorithm taken from the zlib source, which is
- * Copyright (C) 1995-1998 Jean-loup Gailly and Mark Adler
- */
-static const unsigned int tinf_crc32tab[16] = {0x00000000,
-                                               0x1db71064,
-                                               0x3b6e20c8,
-                                               0x26d930ac,
-                                               0x76dc4190,
-                                               0x6b6b51f4,
-                                               0x4db26158,
-                                               0x5005713c,
-                                               0xedb88320,
-                                               0xf00f9344,
-                                               0xd6d6a3e8,
-                                               0xcb61b38c,
-                                               0x9b64c2b0,
-                                               0x86d3d2d4,
-                                               0xa00ae278,
-                                               0xbdbdf21c};
-
 Flasher::Flasher(const char *aFilePath, const DeviceInfo &aDeviceInfo, FlashType aFlashType)
-    : mFile(aFilePath, std::ios::in | std::ios::binary | std::ios::ate)
+    : mFileSize()
     , mPageSize()
     , mDeviceInfo(aDeviceInfo)
+    , mEventCount(0)
+    , mEventsSeen(0)
+    , mZBlockLen(0)
+    , mZOffset(0)
+    , mBytesSent(0)
     , mState(INIT)
     , mFlashType(aFlashType)
     , mIgnoreVersion(false)
+    , mDelta(false)
+    , mCompress(aFlashType == DFU)
+    , mCompressKnown(false)
 {
-	if (!mFile.is_open())
+	std::ifstream file(aFilePath, std::ios::in | std::ios::binary | std::ios::ate);
+
+	if (!file.is_open())
 	{
 		fprintf(stderr, "Error: File \"%s\" could not be opened\n", aFilePath);
 		return;
 	}
 
-	mFileSize = mFile.tellg();
-	mFile.seekg(0, std::ios::beg);
+	mFileSize = file.tellg();
+	file.seekg(0, std::ios::beg);
 
 	if (mFileSize == 0)
 	{
 		fprintf(stderr, "Error: File \"%s\" appears to be empty\n", aFilePath);
-		mFile.close();
 		return;
 	}
 
@@ -87,9 +81,14 @@ Flasher::Flasher(const char *aFilePath, const DeviceInfo &aDeviceInfo, FlashType
 	if (mPageSize == 0)
 	{
 		fprintf(stderr, "Error: Device page size unknown\n");
-		mFile.close();
+		mFileSize = 0;
 		return;
 	}
+
+	//Keep the whole image in memory, as it is compared, written and checked in pages
+	mImage.assign(get_page_count() * mPageSize, 0xFF);
+	mDirtyPages.assign(get_page_count(), true);
+	file.read(reinterpret_cast<char *>(mImage.data()), mFileSize);
 }
 
 Flasher::~Flasher()
@@ -107,6 +106,8 @@ ca_error Flasher::Process()
 		return init();
 	case REBOOT:
 		return reboot();
+	case COMPARE:
+		return compare();
 	case ERASE:
 		return erase();
 	case FLASH:
@@ -126,6 +127,15 @@ ca_error Flasher::Process()
 	return CA_ERROR_INVALID_STATE;
 }
 
+void Flasher::WaitForEvent(std::chrono::milliseconds aTimeout)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	// Events received since the last wait are not lost, as they are counted rather than only signalled
+	mEventCond.wait_for(lock, aTimeout, [this] { return mEventCount != mEventsSeen; });
+	mEventsSeen = mEventCount;
+}
+
 ca_error Flasher::init()
 {
 	ca_error status = CA_ERROR_SUCCESS;
@@ -272,35 +282,89 @@ ca_error Flasher::reboot()
 	return status;
 }
 
-ca_error Flasher::erase()
+ca_error Flasher::compare()
 {
 	ca_error status;
 
 	if (mCounter)
 		return CA_ERROR_SUCCESS;
 
-	size_t reqPageErase = get_page_count();
+	mChecks.clear();
+	for (size_t page = 0; page < get_page_count(); ++page) mChecks.push_back(page);
 
-	status = EVBME_DFU_ERASE_request(mStartAddr, mPageSize * reqPageErase, &mDeviceRef);
-	mCounter++;
+	status = send_checks();
+	if (status)
+	{
+		fprintf(stderr, "Error: Compare failed - %s\n", ca_error_str(status));
+		set_state(FAIL);
+	}
+
+	return status;
+}
+
+ca_error Flasher::erase()
+{
+	ca_error status;
+
+	if (mCounter)
+		return CA_ERROR_SUCCESS;
+
+	status = erase_next_run();
+	if (status)
+	{
+		fprintf(stderr, "Error: Erase failed - %s\n", ca_error_str(status));
+		set_state(FAIL);
+	}
 
 	return status;
 }
 
 ca_error Flasher::flash()
 {
+	ca_error status;
+
 	if (mCounter)
 		return CA_ERROR_SUCCESS;
 
-	return flash_done(CA_ERROR_SUCCESS);
+	mFlashStart = Clock::now();
+	mBytesSent  = 0;
+	mZBlock.clear();
+
+	//Fill the window, after which each acknowledgement sends the next write
+	status = send_writes();
+	if (status)
+	{
+		fprintf(stderr, "Error: Flash failed at address 0x%x - %s\n", mStartAddr + mCounter, ca_error_str(status));
+		set_state(FAIL);
+	}
+
+	return status;
 }
 
 ca_error Flasher::verify()
 {
+	ca_error status;
+
 	if (mCounter)
 		return CA_ERROR_SUCCESS;
 
-	return verify_done(CA_ERROR_SUCCESS);
+	//Check the rewritten pages on their own when only some were, so a failure can be located, then the whole image
+	mChecks.clear();
+	for (size_t page = 0; mDelta && page < get_page_count(); ++page)
+	{
+		if (mDirtyPages[page])
+			mChecks.push_back(page);
+	}
+	mChecks.push_back(get_page_count());
+
+	status = send_checks();
+	if (status)
+	{
+		fprintf(stderr, "Error: Verification of [%s] failed - %s\n", mDeviceInfo.GetSerialNo(), ca_error_str(status));
+		set_state(FAIL);
+	}
+
+	return status;
 }
 
 ca_error Flasher::validate()
@@ -408,7 +472,7 @@ ca_error Flasher::reboot_done(ca_error status)
 {
 	if (status == CA_ERROR_SUCCESS)
 	{
-		set_state(ERASE);
+		set_state(mDelta ? COMPARE : ERASE);
 	}
 	else
 	{
@@ -418,110 +482,315 @@ ca_error Flasher::reboot_done(ca_error status)
 	return status;
 }
 
+ca_error Flasher::compare_done(ca_error status)
+{
+	size_t dirtyCount;
+
+	// CA_ERROR_FAIL is the reply for a page that differs
+	if (status && status != CA_ERROR_FAIL)
+		goto exit;
+
+	if (mPendingChecks.empty())
+	{
+		status = CA_ERROR_INVALID_STATE;
+		goto exit;
+	}
+
+	mDirtyPages[mPendingChecks.front()] = (status == CA_ERROR_FAIL);
+	mPendingChecks.pop_front();
+
+	status = send_checks();
+	if (status || !mPendingChecks.empty())
+		goto exit;
+
+	dirtyCount = std::count(mDirtyPages.begin(), mDirtyPages.end(), true);
+	printf("Flasher [%s]: %u of %u pages differ\n",
+	       mDeviceInfo.GetSerialNo(),
+	       static_cast<unsigned>(dirtyCount),
+	       static_cast<unsigned>(get_page_count()));
+	set_state(dirtyCount ? ERASE : VERIFY);
+
+exit:
+	if (status)
+	{
+		fprintf(stderr, "Error: Compare failed - %s\n", ca_error_str(status));
+		set_state(FAIL);
+	}
+	return status;
+}
+
 ca_error Flasher::erase_done(ca_error status)
 {
 	if (status == CA_ERROR_SUCCESS)
+		status = erase_next_run();
+
+	if (status)
+	{
+		fprintf(stderr, "Error: Erase failed - %s\n", ca_error_str(status));
+		set_state(FAIL);
+	}
+	return status;
+}
+
+ca_error Flasher::erase_next_run()
+{
+	size_t first = mCounter;
+	size_t end;
+
+	// mCounter is the first page that has not been considered yet
+	while (first < get_page_count() && !mDirtyPages[first]) ++first;
+
+	if (first == get_page_count())
 	{
 		set_state(FLASH);
+		return CA_ERROR_SUCCESS;
 	}
-	else
+
+	for (end = first; end < get_page_count() && mDirtyPages[end]; ++end)
+		;
+
+	mCounter = end;
+	return EVBME_DFU_ERASE_request(mStartAddr + first * mPageSize, (end - first) * mPageSize, &mDeviceRef);
+}
+
+ca_error Flasher::send_writes()
+{
+	ca_error status = CA_ERROR_SUCCESS;
+	size_t   page, pageEnd, writeLen, written;
+	double   seconds;
+
+	// Until the device has acknowledged a compressed write, only send one at a time, as older firmware rejects them
+	size_t window = (mCompress && !mCompressKnown) ? 1 : kWriteWindow;
+
+	// Keep several writes outstanding, so the device always has the next one to program
+	while (mPendingWrites.size() < window && mCounter < mFileSize)
 	{
-		fprintf(stderr, "Error: Erase failed - %s\n", ca_error_str(status));
-		set_state(FAIL);
+		if (!mZBlock.empty())
+		{
+			status = send_zwrite();
+			if (status)
+				return status;
+			continue;
+		}
+
+		page    = mCounter / mPageSize;
+		pageEnd = (page + 1) * mPageSize;
+
+		if (!mDirtyPages[page])
+		{
+			mCounter = pageEnd;
+			continue;
+		}
+
+		writeLen = std::min<size_t>(mFileSize - mCounter, mCompress ? DFU_ZBLOCK_MAX_LEN : DFU_WRITE_MAX_LEN);
+		if (mCounter + writeLen > pageEnd && !mDirtyPages[page + 1])
+			writeLen = pageEnd - mCounter; //The next page was not erased, so must not be written
+		writeLen = (writeLen + 3) & (~0x3); //Writes must be whole words, the image is padded as erased flash
+
+		if (mCompress && compress_block(writeLen))
+			continue;
+
+		writeLen = std::min<size_t>(writeLen, DFU_WRITE_MAX_LEN);
+		status   = EVBME_DFU_WRITE_request(mStartAddr + mCounter, writeLen, &mImage[mCounter], &mDeviceRef);
+		if (status)
+			return status;
+
+		mPendingWrites.push_back({mStartAddr + mCounter, false});
+		mCounter += writeLen;
+		mBytesSent += writeLen;
+	}
+
+	if (!mPendingWrites.empty())
+		return status;
+
+	written = 0;
+	for (page = 0; page < get_page_count(); ++page)
+	{
+		if (mDirtyPages[page])
+			written += std::min(mPageSize, mFileSize - page * mPageSize);
 	}
+	seconds = std::chrono::duration<double>(Clock::now() - mFlashStart).count();
+	printf("Flasher [%s]: Sent %u bytes to write %u bytes in %.2f s\n",
+	       mDeviceInfo.GetSerialNo(),
+	       static_cast<unsigned>(mBytesSent),
+	       static_cast<unsigned>(written),
+	       seconds);
+	set_state(VERIFY);
+
 	return status;
 }
 
-ca_error Flasher::flash_done(ca_error status)
+ca_error Flasher::send_zwrite()
 {
-	size_t writeLen;
-	char * buffer = nullptr;
+	uint32_t addr     = mStartAddr + mCounter;
+	size_t   chunkLen = std::min<size_t>(mZBlock.size() - mZOffset, DFU_ZWRITE_MAX_LEN);
+	ca_error status;
 
+	status = EVBME_DFU_ZWRITE_request(
+	    addr, mZBlockLen, mZBlock.size(), mZOffset, chunkLen, &mZBlock[mZOffset], &mDeviceRef);
 	if (status)
-		goto exit;
+		return status;
 
-	if (mCounter >= mFileSize)
+	// Every piece of the block is acknowledged, but the block is only written after the last one
+	mPendingWrites.push_back({addr, true});
+	mBytesSent += chunkLen;
+	mZOffset += chunkLen;
+
+	if (mZOffset == mZBlock.size())
 	{
-		mFile.seekg(0, std::ios::beg);
-		set_state(VERIFY);
-		goto exit;
+		mCounter += mZBlockLen;
+		mZBlock.clear();
 	}
 
-	writeLen = std::min<size_t>(mFileSize - mCounter, DFU_WRITE_MAX_LEN);
-	writeLen = (writeLen + 3) & (~0x3); //Align it (probably not necessary)
-	buffer   = new char[writeLen];
+	return CA_ERROR_SUCCESS;
+}
+
+bool Flasher::compress_block(size_t aLen)
+{
+	std::vector<uzlib_hash_entry_t> hashTable(1 << kCompressHashBits);
+	struct uzlib_comp               comp = {};
+
+	comp.hash_table = hashTable.data();
+	comp.hash_bits  = kCompressHashBits;
+	comp.dict_size  = 32768;
+
+	zlib_start_block(&comp.out);
+	uzlib_compress(&comp, &mImage[mCounter], aLen);
+	zlib_finish_block(&comp.out);
+
+	// Blocks that do not get smaller are sent as they are
+	if (static_cast<size_t>(comp.out.outlen) < aLen)
+	{
+		mZBlock.assign(comp.out.outbuf, comp.out.outbuf + comp.out.outlen);
+		mZBlockLen = aLen;
+		mZOffset   = 0;
+	}
+
+	free(comp.out.outbuf);
+	return !mZBlock.empty();
+}
 
-	mFile.read(buffer, writeLen);
+ca_error Flasher::send_checks()
+{
+	size_t   page, offset, len;
+	ca_error status;
+
+	while (mPendingChecks.size() < kWriteWindow && mCounter < mChecks.size())
+	{
+		page   = mChecks[mCounter];
+		offset = (page == get_page_count()) ? 0 : page * mPageSize;
+		len    = (page == get_page_count()) ? mImage.size() : mPageSize;
+
+		status = EVBME_DFU_CHECK_request(mStartAddr + offset, len, CRC32_Update(0, &mImage[offset], len), &mDeviceRef);
+		if (status)
+			return status;
+
+		mPendingChecks.push_back(page);
+		mCounter++;
+	}
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error Flasher::flash_done(ca_error status, const uint8_t *ackAddr)
+{
+	uint32_t addr       = mStartAddr + mCounter;
+	bool     compressed = false;
+
+	if (mCompress && !mCompressKnown && status == CA_ERROR_INVALID_STATE && mPendingWrites.size() == 1 &&
+	    mPendingWrites.front().compressed)
+	{
+		// The first compressed write was rejected, so the device does not support them. Resend it uncompressed.
+		printf("Flasher [%s]: Device does not support compressed writes\n", mDeviceInfo.GetSerialNo());
+		mCompress = false;
+		mCounter  = mPendingWrites.front().addr - mStartAddr;
+		mPendingWrites.clear();
+		mZBlock.clear();
+		status = send_writes();
+		goto exit;
+	}
 
-	status = EVBME_DFU_WRITE_request(mStartAddr + mCounter, writeLen, buffer, &mDeviceRef);
 	if (status)
 		goto exit;
-	mCounter += writeLen;
+
+	if (mPendingWrites.empty())
+	{
+		status = CA_ERROR_INVALID_STATE;
+		goto exit;
+	}
+
+	// Acknowledgements are in order. Devices that report the address are also checked against it.
+	addr       = mPendingWrites.front().addr;
+	compressed = mPendingWrites.front().compressed;
+	mPendingWrites.pop_front();
+	if (ackAddr && GETLE32(ackAddr) != addr)
+	{
+		status = CA_ERROR_INVALID_STATE;
+		goto exit;
+	}
+
+	// Only an acknowledged DFU_ZWRITE shows that the device supports them, plain writes are always accepted
+	if (compressed)
+		mCompressKnown = true;
+	status = send_writes();
 
 exit:
 	if (status)
 	{
-		fprintf(stderr, "Error: Flash failed at address 0x%x - %s\n", mStartAddr + mCounter, ca_error_str(status));
+		fprintf(stderr, "Error: Flash failed at address 0x%x - %s\n", addr, ca_error_str(status));
 		set_state(FAIL);
 	}
-	delete[] buffer;
 	return status;
 }
 
 ca_error Flasher::verify_done(ca_error status)
 {
-	size_t   dataLen;
-	uint32_t crc = 0xFFFFFFFF;
+	size_t page = mPendingChecks.empty() ? get_page_count() : mPendingChecks.front();
 
 	if (status)
 		goto exit;
 
-	if (mCounter >= mFileSize)
+	if (mPendingChecks.empty())
 	{
-		mFile.seekg(0, std::ios::beg);
-
-		//Reboot device into newly flashed area
-		if (mFlashType == APROM)
-			EVBME_DFU_REBOOT_request(evbme_dfu_rebootmode::EVBME_DFU_REBOOT_APROM, &mDeviceRef);
-		else //DFU
-			EVBME_DFU_REBOOT_request(evbme_dfu_rebootmode::EVBME_DFU_REBOOT_DFU, &mDeviceRef);
-		if (exchange_wait_send_complete(kMsgSendTimeout, &mDeviceRef) == CA_ERROR_SUCCESS)
-		{
-			ca821x_util_deinit(&mDeviceRef);
-			memset(&mDeviceRef, 0, sizeof(mDeviceRef));
-			set_state(VALIDATE);
-		}
-		else
-		{
-			set_state(FAIL);
-			fprintf(stderr, "Error: Failed to send reboot to aprom command\n");
-		}
+		status = CA_ERROR_INVALID_STATE;
 		goto exit;
 	}
 
-	//Verify one page at a time
-	dataLen = std::min<size_t>(mFileSize - mCounter, mPageSize);
+	mPendingChecks.pop_front();
+	status = send_checks();
+	if (status || !mPendingChecks.empty())
+		goto exit;
 
-	// CRC algorithm adapted from zlib source, which is
-	// Copyright (C) 1995-1998 Jean-loup Gailly and Mark Adler
-	for (size_t i = 0; i < mPageSize; ++i)
+	//Reboot device into newly flashed area
+	if (mFlashType == APROM)
+		EVBME_DFU_REBOOT_request(evbme_dfu_rebootmode::EVBME_DFU_REBOOT_APROM, &mDeviceRef);
+	else //DFU
+		EVBME_DFU_REBOOT_request(evbme_dfu_rebootmode::EVBME_DFU_REBOOT_DFU, &mDeviceRef);
+	if (exchange_wait_send_complete(kMsgSendTimeout, &mDeviceRef) == CA_ERROR_SUCCESS)
 	{
-		uint8_t newByte = (i < dataLen) ? mFile.get() : 0xFF;
-		crc ^= newByte;
-		crc = tinf_crc32tab[crc & 0x0f] ^ (crc >> 4);
-		crc = tinf_crc32tab[crc & 0x0f] ^ (crc >> 4);
+		ca821x_util_deinit(&mDeviceRef);
+		memset(&mDeviceRef, 0, sizeof(mDeviceRef));
+		set_state(VALIDATE);
+	}
+	else
+	{
+		set_state(FAIL);
+		fprintf(stderr, "Error: Failed to send reboot to aprom command\n");
 	}
-	crc = ~crc;
-
-	status = EVBME_DFU_CHECK_request(mCounter + mStartAddr, mPageSize, crc, &mDeviceRef);
-	if (status)
-		goto exit;
-	mCounter += mPageSize;
 
 exit:
-	if (status)
+	if (status && page == get_page_count())
 	{
-		fprintf(stderr, "Error: verify failed at address 0x%x - %s\n", mCounter + mStartAddr, ca_error_str(status));
+		fprintf(stderr, "Error: Verification of [%s] failed - %s\n", mDeviceInfo.GetSerialNo(), ca_error_str(status));
+		set_state(FAIL);
+	}
+	else if (status)
+	{
+		fprintf(stderr,
+		        "Error: Verification of [%s] failed at address 0x%x - %s\n",
+		        mDeviceInfo.GetSerialNo(),
+		        static_cast<unsigned>(mStartAddr + page * mPageSize),
+		        ca_error_str(status));
 		set_state(FAIL);
 	}
 	return status;
@@ -569,8 +838,13 @@ void Flasher::configure_max_binsize()
 
 ca_error Flasher::dfu_callback(EVBME_Message *params)
 {
-	ca_error                    status = static_cast<ca_error>(params->EVBME.DFU_cmd.mSubCmd.status_cmd.status);
-	std::lock_guard<std::mutex> guard(mMutex);
+	ca_error                     status  = static_cast<ca_error>(params->EVBME.DFU_cmd.mSubCmd.status_cmd.status);
+	const uint8_t *              ackAddr = nullptr;
+	std::unique_lock<std::mutex> guard(mMutex);
+
+	// Only newer firmware says which write is being acknowledged
+	if (params->mLen >= sizeof(params->EVBME.DFU_cmd.mDfuSubCmdId) + sizeof(params->EVBME.DFU_cmd.mSubCmd.status_cmd))
+		ackAddr = params->EVBME.DFU_cmd.mSubCmd.status_cmd.startAddr;
 
 	if (params->EVBME.DFU_cmd.mDfuSubCmdId != DFU_STATUS)
 	{
@@ -584,11 +858,14 @@ ca_error Flasher::dfu_callback(EVBME_Message *params)
 	case REBOOT:
 		reboot_done(status);
 		break;
+	case COMPARE:
+		compare_done(status);
+		break;
 	case ERASE:
 		erase_done(status);
 		break;
 	case FLASH:
-		flash_done(status);
+		flash_done(status, ackAddr);
 		break;
 	case VERIFY:
 		verify_done(status);
@@ -602,6 +879,10 @@ ca_error Flasher::dfu_callback(EVBME_Message *params)
 		break;
 	}
 
+	mEventCount++;
+	guard.unlock();
+	mEventCond.notify_all();
+
 	return CA_ERROR_SUCCESS;
 }
 
@@ -618,6 +899,8 @@ const char *Flasher::state_string(State aState)
 		return "INIT";
 	case REBOOT:
 		return "REBOOT";
+	case COMPARE:
+		return "COMPARE";
 	case ERASE:
 		return "ERASE";
 	case FLASH:
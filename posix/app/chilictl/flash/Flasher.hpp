@@ -29,8 +29,11 @@
 #ifndef POSIX_APP_CHILICTL_FLASH_FLASHER_HPP_
 #define POSIX_APP_CHILICTL_FLASH_FLASHER_HPP_
 
-#include <fstream>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <vector>
 
 #include "common/DeviceInfo.hpp"
 
@@ -58,7 +61,11 @@ public:
 	 * [*] -> INIT
 	 * INIT -> REBOOT
 	 * REBOOT -> ERASE
+	 * REBOOT -> COMPARE
 	 * REBOOT --> FAIL
+	 * COMPARE -> ERASE
+	 * COMPARE -> VERIFY
+	 * COMPARE --> FAIL
 	 * ERASE -> FLASH
 	 * ERASE --> FAIL
 	 * FLASH -> VERIFY
@@ -74,6 +81,7 @@ public:
 	{
 		INIT,     /**< Initial state */
 		REBOOT,   /**< Rebooted into DFU mode */
+		COMPARE,  /**< Comparing flash with the file, to find the pages that differ */
 		ERASE,    /**< Erasing flash */
 		FLASH,    /**< Flashing program */
 		VERIFY,   /**< Verifying correct flashing */
@@ -101,6 +109,13 @@ public:
 	 */
 	ca_error Process();
 
+	/**
+	 * Wait until the device reports progress, or until the timeout expires. Call this between calls to Process, so
+	 * that the next step is taken as soon as the device has responded to the previous one.
+	 * @param aTimeout Maximum time to wait, which is the polling interval while the device is rebooting
+	 */
+	void WaitForEvent(std::chrono::milliseconds aTimeout);
+
 	/**
 	 * Is the instance in a valid state (with successfully loaded file and
 	 * configured device info).
@@ -130,41 +145,85 @@ public:
 	 */
 	void SetIgnoreVersion(bool aIgnoreVersion) { mIgnoreVersion = aIgnoreVersion; }
 
+	/**
+	 * Enable/Disable differential flashing.
+	 *
+	 * When enabled, the flash is compared with the file page by page first, and only the pages that differ are
+	 * erased, written and verified on their own. The whole image is always verified at the end. Defaults to false.
+	 *
+	 * @param aDelta Set to true to only rewrite the pages that differ, Set to false to rewrite the whole image
+	 */
+	void SetDelta(bool aDelta) { mDelta = aDelta; }
+
 private:
 	enum
 	{
 		kMaxRebootDiscoverAttempts = 10,
 		kMsgSendTimeout            = 5,
 		kWriteLen                  = 244,
+		kWriteWindow               = 4,  //!< Maximum number of writes awaiting acknowledgement
+		kCompressHashBits          = 12, //!< Size of the hash table used to find repeats when compressing
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	/** A write awaiting acknowledgement */
+	struct PendingWrite
+	{
+		uint32_t addr;       //!< Start address of the write, or of the compressed block it is a piece of
+		bool     compressed; //!< Is it a DFU_ZWRITE?
 	};
 
-	std::mutex    mMutex;
-	std::ifstream mFile;
-	size_t        mFileSize;
-	size_t        mMaxFileSize;
-	size_t        mPageSize;
-	uint32_t      mStartAddr;
-	ca821x_dev    mDeviceRef;
-	DeviceInfo    mDeviceInfo;
-	uint32_t      mCounter;
-	State         mState;
-	FlashType     mFlashType;
-	bool          mIgnoreVersion;
+	std::mutex               mMutex;
+	std::condition_variable  mEventCond;
+	std::vector<uint8_t>     mImage;      //!< Contents of the file, padded with 0xFF to a whole number of pages
+	std::vector<bool>        mDirtyPages; //!< Pages that are erased and written, all of them unless mDelta is set
+	std::vector<size_t>      mChecks;     //!< Pages to check in the current state, get_page_count() for the whole image
+	size_t                   mFileSize;
+	size_t                   mMaxFileSize;
+	size_t                   mPageSize;
+	uint32_t                 mStartAddr;
+	ca821x_dev               mDeviceRef;
+	DeviceInfo               mDeviceInfo;
+	uint32_t                 mCounter;
+	uint32_t                 mEventCount;    //!< Number of DFU status callbacks received
+	uint32_t                 mEventsSeen;    //!< Value of mEventCount when WaitForEvent last returned
+	std::deque<PendingWrite> mPendingWrites; //!< Writes awaiting acknowledgement, oldest first
+	std::deque<size_t>       mPendingChecks; //!< Pages of the checks awaiting their status, oldest first
+	std::vector<uint8_t>     mZBlock;        //!< Compressed block being sent, empty when there is none
+	size_t                   mZBlockLen;     //!< Decompressed length of mZBlock
+	size_t                   mZOffset;       //!< Number of bytes of mZBlock already sent
+	size_t                   mBytesSent;     //!< Number of bytes of (possibly compressed) data sent while flashing
+	Clock::time_point        mFlashStart;
+	State                    mState;
+	FlashType                mFlashType;
+	bool                     mIgnoreVersion;
+	bool                     mDelta;
+	bool                     mCompress;      //!< Send compressed writes, unless the device does not support them
+	bool                     mCompressKnown; //!< The device has acknowledged a compressed write
 
 	void     set_state(State aNextState);
 	ca_error init();
 	ca_error reboot();
+	ca_error compare();
 	ca_error erase();
 	ca_error flash();
 	ca_error verify();
 	ca_error validate();
 
 	ca_error reboot_done(ca_error status);
+	ca_error compare_done(ca_error status);
 	ca_error erase_done(ca_error status);
-	ca_error flash_done(ca_error status);
+	ca_error flash_done(ca_error status, const uint8_t *ackAddr);
 	ca_error verify_done(ca_error status);
 	ca_error validate_done(ca_error status);
 
+	ca_error send_writes();
+	ca_error send_zwrite();
+	bool     compress_block(size_t aLen);
+	ca_error send_checks();
+	ca_error erase_next_run();
+
 	ca_error        dfu_callback(EVBME_Message *params);
 	static ca_error dfu_callback(EVBME_Message *params, ca821x_dev *pDeviceRef);
 
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+/**
+ * @file
+ * @brief Measures the idle wakeups and request latency of the exchange with and without the reactor
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ca821x-posix/ca821x-posix-evbme.h"
+#include "ca821x-posix/ca821x-posix.h"
+#include "evbme_messages.h"
+
+#define MAX_DEVICES 32
+#define LATENCY_ITERATIONS 200
+
+static struct ca821x_dev sDevices[MAX_DEVICES];
+static unsigned int      sDeviceCount;
+
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static long get_context_switches(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static void print_help(const char *program)
+{
+	printf("Usage: %s <reactor threads> [idle seconds]\n", program);
+	printf("\tA reactor thread count of 0 uses a dedicated io thread per device.\n");
+}
+
+static void measure_idle(unsigned int seconds)
+{
+	long start = get_context_switches();
+
+	sleep(seconds);
+	printf("Idle context switches/s: %.1f\n", (double)(get_context_switches() - start) / seconds);
+}
+
+static void measure_latency(void)
+{
+	uint64_t total = 0, max = 0;
+	unsigned count = 0;
+
+	for (unsigned int i = 0; i < LATENCY_ITERATIONS; i++)
+	{
+		struct ca821x_dev *pDeviceRef = &sDevices[i % sDeviceCount];
+		uint8_t            buffer[50];
+		uint8_t            len   = 0;
+		uint64_t           start = get_time_us();
+		uint64_t           elapsed;
+
+		if (EVBME_GET_request_sync(EVBME_VERSTRING, sizeof(buffer), buffer, &len, pDeviceRef))
+			continue;
+
+		elapsed = get_time_us() - start;
+		total += elapsed;
+		if (elapsed > max)
+			max = elapsed;
+		count++;
+	}
+
+	if (count)
+		printf("Request latency: avg %lluus, max %lluus (%u/%u)\n",
+		       (unsigned long long)(total / count),
+		       (unsigned long long)max,
+		       count,
+		       LATENCY_ITERATIONS);
+	else
+		printf("No requests succeeded\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int                threads = 0, seconds = 5;
+	struct ca821x_reactor_stats stats;
+
+	if (argc < 2)
+	{
+		print_help(argv[0]);
+		return -1;
+	}
+
+	threads = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		seconds = strtoul(argv[2], NULL, 10);
+	if (!seconds)
+		seconds = 1;
+
+	if (threads && ca821x_util_start_reactor(threads))
+	{
+		printf("Failed to start reactor\n");
+		return -1;
+	}
+
+	while (sDeviceCount < MAX_DEVICES && !ca821x_util_init(&sDevices[sDeviceCount], NULL)) sDeviceCount++;
+
+	if (!sDeviceCount)
+	{
+		printf("No devices found\n");
+		if (threads)
+			ca821x_util_stop_reactor();
+		return -1;
+	}
+	printf("Opened %u devices\n", sDeviceCount);
+
+	measure_idle(seconds);
+	measure_latency();
+
+	if (threads && !ca821x_util_get_reactor_stats(&stats))
+	{
+		printf("Reactor: %u threads, %u devices, %llu wakeups, %llu events, %llu signals, %llu timeouts\n",
+		       stats.threads,
+		       stats.devices,
+		       (unsigned long long)stats.wakeups,
+		       (unsigned long long)stats.events,
+		       (unsigned long long)stats.signals,
+		       (unsigned long long)stats.timeouts);
+	}
+
+	while (sDeviceCount) ca821x_util_deinit(&sDevices[--sDeviceCount]);
+	if (threads)
+		ca821x_util_stop_reactor();
+
+	return 0;
+}
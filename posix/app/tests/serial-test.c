@@ -58,15 +58,20 @@ uint8_t           previousHandle = 0;
 uint8_t           count          = 0;
 int               missedHandles  = 0;
 char *            resultsOption;
+uint64_t          numberOfIndicationBytes = 0;
 
 #ifndef _WIN32
 struct timespec *start;
 struct timespec *end;
+struct timespec  firstIndication;
+struct timespec  lastIndication;
 // POSIX
 #elif defined(_WIN32)
 LARGE_INTEGER  frequency;
 LARGE_INTEGER *start;
 LARGE_INTEGER *end;
+LARGE_INTEGER  firstIndication;
+LARGE_INTEGER  lastIndication;
 #endif // _WIN32
 
 static void displayHelp()
@@ -143,6 +148,26 @@ static void getEndTime()
 #endif // _WIN32
 }
 
+static void getIndicationTime()
+{
+#ifndef _WIN32
+	if (clock_gettime(CLOCK_MONOTONIC, &lastIndication) == -1)
+	{
+		perror("clock gettime");
+		exit(EXIT_FAILURE);
+	}
+// POSIX
+#elif defined(_WIN32)
+	if (QueryPerformanceCounter(&lastIndication) == 0)
+	{
+		perror("QueryPerformanceTimer");
+		exit(EXIT_FAILURE);
+	}
+#endif // _WIN32
+	if (numberOfIndicationsReceived == 0)
+		firstIndication = lastIndication;
+}
+
 static ca_error handleEvbmeMessage(struct EVBME_Message *params, struct ca821x_dev *pDeviceRef)
 {
 	fprintf(stderr, "IN: %.*s\r\n", params->mLen, params->EVBME.MESSAGE_indication.mMessage);
@@ -167,6 +192,8 @@ static ca_error handleCommIndication(struct EVBME_Message *params, struct ca821x
 	{
 		getEndTime();
 	}
+	getIndicationTime();
+	numberOfIndicationBytes += params->mLen;
 	numberOfIndicationsReceived++;
 	mReceivedIndications[count]++;
 	count++;
@@ -208,6 +235,30 @@ static void fillElapsedTimeArray(double *timeArray, int index)
 #endif // _WIN32
 }
 
+static void throughputAnalysis()
+{
+	double elapsedSeconds;
+
+#ifndef _WIN32
+	elapsedSeconds = (timeSpecToMilliseconds(&lastIndication) - timeSpecToMilliseconds(&firstIndication)) / 1000.0;
+// POSIX
+#elif defined(_WIN32)
+	elapsedSeconds = (lastIndication.QuadPart - firstIndication.QuadPart) / (double)frequency.QuadPart;
+#endif // _WIN32
+
+	if (numberOfIndicationsReceived < 2 || elapsedSeconds <= 0.0)
+		return;
+
+	// The first indication starts the clock, so is not counted
+	printf("Indication throughput (first to last indication over %f s):\n", elapsedSeconds);
+	printf("\t%-21s%11f msg/s \n\t%-21s%11f B/s\n\n",
+	       "messages:",
+	       (numberOfIndicationsReceived - 1) / elapsedSeconds,
+	       "bytes:",
+	       numberOfIndicationBytes * (numberOfIndicationsReceived - 1) / (double)numberOfIndicationsReceived /
+	           elapsedSeconds);
+}
+
 static void resultsAnalysis()
 {
 	double *elapsedMilliseconds, *elapsedMillisecondsReduced;
@@ -354,6 +405,7 @@ static void displayResults(uint32_t expectedIndications, struct EVBME_COMM_CHECK
 
 	// Analyse the results
 	resultsAnalysis();
+	throughputAnalysis();
 
 	if (numberOfMessagesSent == missedHandles)
 		printf("No indications were received\n");
@@ -0,0 +1,261 @@
+/*
+ *  Copyright (c) 2021, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Measures the latency and throughput of TCP through a Thread network, using the echo mode of ot-cli-lwip
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ECHO_PORT 51700
+#define LATENCY_ITERATIONS 20
+#define LATENCY_LEN 32
+#define DEFAULT_TOTAL_LEN 20000
+#define CHUNK_LEN 512
+#define TIMEOUT_MS 10000
+
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void print_help(const char *program)
+{
+	printf("Usage: %s <device ipv6 address> [bytes]\n", program);
+	printf("       %s -s\n", program);
+	printf("\tRun 'lwip tcp echo' on the device first. With -s, this program is a stand-in for the device,\n");
+	printf("\techoing the data received on port %d, so that the test can be run without one.\n", ECHO_PORT);
+}
+
+//Data sent by the test, so that the echo can be checked
+static uint8_t pattern(size_t offset)
+{
+	return (uint8_t)(offset * 7 + (offset >> 8));
+}
+
+static int run_standin(void)
+{
+	struct sockaddr_in6 addr = {0};
+	int                 one  = 1;
+	int                 sock = socket(AF_INET6, SOCK_STREAM, 0);
+
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port   = htons(ECHO_PORT);
+	addr.sin6_addr   = in6addr_any;
+
+	if (sock < 0 || setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+	    bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock, 1))
+	{
+		perror("Failed to listen");
+		return EXIT_FAILURE;
+	}
+
+	printf("Echoing TCP data on port %d\n", ECHO_PORT);
+
+	for (;;)
+	{
+		uint8_t buf[CHUNK_LEN];
+		ssize_t len;
+		int     conn = accept(sock, NULL, NULL);
+
+		if (conn < 0)
+			continue;
+
+		while ((len = recv(conn, buf, sizeof(buf), 0)) > 0)
+		{
+			if (send(conn, buf, len, 0) != len)
+				break;
+		}
+		close(conn);
+	}
+}
+
+//Wait for any of events on the socket, returning those that occurred, or 0 on timeout
+static short wait_for(int sock, short events)
+{
+	struct pollfd pfd = {.fd = sock, .events = events};
+
+	if (poll(&pfd, 1, TIMEOUT_MS) <= 0)
+		return 0;
+	return pfd.revents;
+}
+
+//Receive and check the echo of len bytes, starting from offset in the pattern. Returns the number of bytes received.
+static ssize_t recv_echo(int sock, size_t offset, size_t len)
+{
+	uint8_t buf[CHUNK_LEN];
+	ssize_t rxlen = recv(sock, buf, len < sizeof(buf) ? len : sizeof(buf), MSG_DONTWAIT);
+
+	for (ssize_t i = 0; i < rxlen; i++)
+	{
+		if (buf[i] != pattern(offset + i))
+		{
+			printf("Echo mismatch at byte %zu\n", offset + i);
+			return -1;
+		}
+	}
+
+	return rxlen;
+}
+
+static int measure_latency(int sock)
+{
+	uint64_t total = 0, max = 0;
+
+	for (int i = 0; i < LATENCY_ITERATIONS; i++)
+	{
+		uint8_t  buf[LATENCY_LEN];
+		size_t   received = 0;
+		uint64_t start, time;
+
+		for (size_t j = 0; j < sizeof(buf); j++) buf[j] = pattern(j);
+
+		start = get_time_us();
+		if (send(sock, buf, sizeof(buf), 0) != sizeof(buf))
+			return -1;
+
+		while (received < sizeof(buf))
+		{
+			ssize_t rxlen;
+
+			if (!(wait_for(sock, POLLIN) & POLLIN))
+			{
+				printf("Timed out waiting for echo\n");
+				return -1;
+			}
+			if ((rxlen = recv_echo(sock, received, sizeof(buf) - received)) <= 0)
+				return -1;
+			received += rxlen;
+		}
+
+		time = get_time_us() - start;
+		total += time;
+		if (time > max)
+			max = time;
+	}
+
+	printf("Round trip (%d bytes): avg %llums, max %llums\n",
+	       LATENCY_LEN,
+	       (unsigned long long)(total / LATENCY_ITERATIONS / 1000),
+	       (unsigned long long)(max / 1000));
+	return 0;
+}
+
+static int measure_throughput(int sock, size_t total)
+{
+	size_t   sent = 0, received = 0;
+	uint64_t start = get_time_us();
+	double   seconds;
+
+	//Keep sending while there is room, so that the device always has data to echo
+	while (received < total)
+	{
+		short events = wait_for(sock, sent < total ? POLLIN | POLLOUT : POLLIN);
+
+		if (!events || (events & (POLLERR | POLLHUP)))
+		{
+			printf("Connection failed after echoing %zu of %zu bytes\n", received, total);
+			return -1;
+		}
+
+		if (events & POLLOUT)
+		{
+			uint8_t buf[CHUNK_LEN];
+			size_t  len = total - sent < sizeof(buf) ? total - sent : sizeof(buf);
+			ssize_t txlen;
+
+			for (size_t i = 0; i < len; i++) buf[i] = pattern(sent + i);
+			if ((txlen = send(sock, buf, len, MSG_DONTWAIT)) > 0)
+				sent += txlen;
+		}
+
+		if (events & POLLIN)
+		{
+			ssize_t rxlen = recv_echo(sock, received, total - received);
+
+			if (rxlen <= 0)
+			{
+				printf("Connection closed after echoing %zu of %zu bytes\n", received, total);
+				return -1;
+			}
+			received += rxlen;
+		}
+	}
+
+	seconds = (get_time_us() - start) / 1e6;
+	printf("Echoed %zu bytes in %.2fs: %.0f bytes/s each way\n", total, seconds, total / seconds);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in6 addr  = {0};
+	size_t              total = DEFAULT_TOTAL_LEN;
+	int                 sock;
+	int                 rval;
+
+	if (argc == 2 && strcmp(argv[1], "-s") == 0)
+		return run_standin();
+
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port   = htons(ECHO_PORT);
+
+	if (argc < 2 || inet_pton(AF_INET6, argv[1], &addr.sin6_addr) != 1)
+	{
+		print_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc > 2)
+		total = strtoul(argv[2], NULL, 0);
+
+	sock = socket(AF_INET6, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)))
+	{
+		perror("Failed to connect");
+		return EXIT_FAILURE;
+	}
+
+	rval = measure_latency(sock);
+	if (!rval)
+		rval = measure_throughput(sock, total);
+
+	close(sock);
+	return rval ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -29,64 +29,138 @@
 
 #include "ca821x-posix-thread/posix-platform.h"
 
-//This define enables pread and pwrite
-#define _XOPEN_SOURCE 500
-
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "code_utils.h"
 #include "flash.h"
 #include "openthread-core-config.h"
 
+/*
+ * The emulated flash is a file mapped into memory, so reads and writes are plain memory accesses.
+ * Changes reach the file through the page cache as soon as they are made, so they survive the process
+ * crashing. msync is only needed to make them durable against power loss, and is done according to
+ * the CASCODA_FLASH_SYNC environment variable:
+ *   0       - immediately, before every write or erase returns
+ *   N > 0   - at most every N milliseconds while there are unsynced changes (default 1000)
+ *   N < 0   - only on shutdown
+ */
+
 static const char flashFileName[] = "otConfig";
 
-static int sFlashFd;
-uint32_t   sEraseAddress;
+static uint8_t *sFlash   = MAP_FAILED;
+static int      sFlashFd = -1;
+static int32_t  sSyncPeriodMs;
+static bool     sDirty;
+static uint64_t sLastSyncMs;
+static bool     sAtExit;
 
 enum
 {
-	FLASH_SIZE      = 0x40000,
-	FLASH_PAGE_SIZE = 0x800,
-	FLASH_PAGE_NUM  = 128,
+	FLASH_SIZE           = 0x40000,
+	FLASH_PAGE_SIZE      = 0x800,
+	FLASH_PAGE_NUM       = 128,
+	FLASH_SYNC_PERIOD_MS = 1000,
 };
 
+static uint64_t getMonotonicMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void flashSync(void)
+{
+	if (sDirty && msync(sFlash, FLASH_SIZE, MS_SYNC) == 0)
+	{
+		sDirty      = false;
+		sLastSyncMs = getMonotonicMs();
+	}
+}
+
+/** Record a change to the flash, syncing it if the policy requires */
+static void flashChanged(void)
+{
+	sDirty = true;
+
+	if (sSyncPeriodMs == 0 || (sSyncPeriodMs > 0 && getMonotonicMs() - sLastSyncMs >= (uint64_t)sSyncPeriodMs))
+		flashSync();
+}
+
 otError utilsFlashInit(void)
 {
 	otError     error       = OT_ERROR_NONE;
-	bool        create      = false;
 	const char *dataDir     = posixGetDataDir();
+	const char *syncEnv     = getenv("CASCODA_FLASH_SYNC");
 	size_t      fileNameLen = sizeof(flashFileName) + strlen(dataDir) + 1; //"datadir/filename"
 	char        fileName[fileNameLen];
+	struct stat st;
 
-	snprintf(fileName, fileNameLen, "%s/%s", dataDir, flashFileName);
+	otEXPECT(sFlash == MAP_FAILED);
 
-	if (access(fileName, 0))
-	{
-		create = true;
-	}
+	snprintf(fileName, fileNameLen, "%s/%s", dataDir, flashFileName);
+	sSyncPeriodMs = syncEnv ? atoi(syncEnv) : FLASH_SYNC_PERIOD_MS;
 
 	sFlashFd = open(fileName, O_RDWR | O_CREAT, 0666);
-	lseek(sFlashFd, 0, SEEK_SET);
-
 	otEXPECT_ACTION(sFlashFd >= 0, error = OT_ERROR_FAILED);
+	otEXPECT_ACTION(fstat(sFlashFd, &st) == 0, error = OT_ERROR_FAILED);
+
+	// Any part of the flash missing from the file is erased, rather than zero-filled
+	if (st.st_size < FLASH_SIZE)
+		otEXPECT_ACTION(ftruncate(sFlashFd, FLASH_SIZE) == 0, error = OT_ERROR_FAILED);
 
-	if (create)
+	sFlash = mmap(NULL, FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, sFlashFd, 0);
+	otEXPECT_ACTION(sFlash != MAP_FAILED, error = OT_ERROR_FAILED);
+
+	if (st.st_size < FLASH_SIZE)
 	{
-		for (uint16_t index = 0; index < FLASH_PAGE_NUM; index++)
-		{
-			otEXPECT(error = utilsFlashErasePage(index * FLASH_PAGE_SIZE));
-		}
+		memset(sFlash + st.st_size, 0xFF, FLASH_SIZE - st.st_size);
+		flashChanged();
 	}
 
+	sLastSyncMs = getMonotonicMs();
+	if (!sAtExit)
+		sAtExit = (atexit(utilsFlashDeinit) == 0);
+
 exit:
+	if (error && sFlashFd >= 0)
+	{
+		close(sFlashFd);
+		sFlashFd = -1;
+	}
 	return error;
 }
 
+void utilsFlashDeinit(void)
+{
+	if (sFlash == MAP_FAILED)
+		return;
+
+	flashSync();
+	munmap(sFlash, FLASH_SIZE);
+	close(sFlashFd);
+	sFlash   = MAP_FAILED;
+	sFlashFd = -1;
+}
+
+void platformFlashProcess(void)
+{
+	if (sFlash != MAP_FAILED && sDirty && sSyncPeriodMs > 0 &&
+	    getMonotonicMs() - sLastSyncMs >= (uint64_t)sSyncPeriodMs)
+	{
+		flashSync();
+	}
+}
+
 uint32_t utilsFlashGetSize(void)
 {
 	return FLASH_SIZE;
@@ -95,29 +169,13 @@ uint32_t utilsFlashGetSize(void)
 otError utilsFlashErasePage(uint32_t aAddress)
 {
 	otError error = OT_ERROR_NONE;
-	//TODO: Improve this quick fix for slow startup due to looping single character file writes
-	static uint8_t buf[FLASH_PAGE_SIZE] = {0};
-	uint32_t       address;
-
-	//TODO: improve Quick-fix
-	if (buf[0] == 0)
-	{
-		memset(buf, 0xFF, FLASH_PAGE_SIZE);
-	}
 
-	otEXPECT_ACTION(sFlashFd >= 0, error = OT_ERROR_FAILED);
+	otEXPECT_ACTION(sFlash != MAP_FAILED, error = OT_ERROR_FAILED);
 	otEXPECT_ACTION(aAddress < FLASH_SIZE, error = OT_ERROR_INVALID_ARGS);
 
-	// Get start address of the flash page that includes aAddress
-	address = aAddress & (~(uint32_t)(FLASH_PAGE_SIZE - 1));
-
-	/*
-    for (uint16_t offset = 0; offset < FLASH_PAGE_SIZE; offset++)
-    {
-        otEXPECT_ACTION(pwrite(sFlashFd, &buf, 1, address + offset) == 1, error = kThreadError_Failed);
-    }
-    */
-	otEXPECT_ACTION(pwrite(sFlashFd, buf, FLASH_PAGE_SIZE, address) == 1, error = OT_ERROR_FAILED);
+	// Erase the flash page that includes aAddress
+	memset(sFlash + (aAddress & ~(uint32_t)(FLASH_PAGE_SIZE - 1)), 0xFF, FLASH_PAGE_SIZE);
+	flashChanged();
 
 exit:
 	return error;
@@ -131,19 +189,17 @@ otError utilsFlashStatusWait(uint32_t aTimeout)
 
 uint32_t utilsFlashWrite(uint32_t aAddress, uint8_t *aData, uint32_t aSize)
 {
-	uint32_t ret   = 0;
 	uint32_t index = 0;
-	uint8_t  byte;
 
-	otEXPECT_ACTION(sFlashFd >= 0 && aAddress < FLASH_SIZE, ;);
+	otEXPECT(sFlash != MAP_FAILED && aAddress < FLASH_SIZE);
 
-	for (index = 0; index < aSize; index++)
-	{
-		otEXPECT_ACTION((ret = utilsFlashRead(aAddress + index, &byte, 1)) == 1, ;);
-		// Use bitwise AND to emulate the behavior of flash memory
-		byte &= aData[index];
-		otEXPECT_ACTION((ret = (uint32_t)pwrite(sFlashFd, &byte, 1, aAddress + index)) == 1, ;);
-	}
+	if (aSize > FLASH_SIZE - aAddress)
+		aSize = FLASH_SIZE - aAddress;
+
+	// Use bitwise AND to emulate the behavior of flash memory
+	for (index = 0; index < aSize; index++) sFlash[aAddress + index] &= aData[index];
+
+	flashChanged();
 
 exit:
 	return index;
@@ -151,11 +207,13 @@ exit:
 
 uint32_t utilsFlashRead(uint32_t aAddress, uint8_t *aData, uint32_t aSize)
 {
-	uint32_t ret = 0;
+	otEXPECT_ACTION(sFlash != MAP_FAILED && aAddress < FLASH_SIZE, aSize = 0);
+
+	if (aSize > FLASH_SIZE - aAddress)
+		aSize = FLASH_SIZE - aAddress;
 
-	otEXPECT_ACTION(sFlashFd >= 0 && aAddress < FLASH_SIZE, ;);
-	ret = (uint32_t)pread(sFlashFd, aData, aSize, aAddress);
+	memcpy(aData, sFlash + aAddress, aSize);
 
 exit:
-	return ret;
+	return aSize;
 }
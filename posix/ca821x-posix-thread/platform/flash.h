@@ -49,6 +49,11 @@ extern "C" {
  */
 otError utilsFlashInit(void);
 
+/**
+ * \brief Flush any unsynced changes to the flash and release the flash driver.
+ */
+void utilsFlashDeinit(void);
+
 /**
  * Get the size of flash that can be read/write by the caller.
  * The usable flash size is always the multiple of flash page size.
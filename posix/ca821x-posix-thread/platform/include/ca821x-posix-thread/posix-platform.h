@@ -73,13 +73,14 @@ int posixPlatformInit(void);
 void posixPlatformSetOrigArgs(int argc, char *argv[]);
 
 /**
- * This method performs all platform-specific processing.
+ * This method performs all platform-specific processing, including the cascoda-util tasklets.
  *
  */
 void posixPlatformProcessDrivers(otInstance *aInstance);
 
 /**
- * This method performs all platform-specific processing without sleeping at the end.
+ * This method performs all platform-specific processing, including the cascoda-util tasklets, without sleeping
+ * at the end.
  * Should be used in conjunction with posixPlatformSleep.
  */
 void posixPlatformProcessDriversQuick(otInstance *aInstance);
@@ -95,6 +96,56 @@ void posixPlatformGetTimeout(otInstance *aInstance, struct timeval *timeout);
  */
 void posixPlatformSleep(otInstance *aInstance, struct timeval *timeout);
 
+/**
+ * Events that a file descriptor registered with posixPlatformRegisterFd can wait for.
+ */
+enum posixPlatformFdEvents
+{
+	POSIX_PLATFORM_FD_READ  = 0x1, //!< The file descriptor is readable
+	POSIX_PLATFORM_FD_WRITE = 0x2, //!< The file descriptor is writable
+	POSIX_PLATFORM_FD_ERROR = 0x4, //!< The file descriptor has an error or was hung up (reported only)
+};
+
+/**
+ * Callback for a file descriptor registered with posixPlatformRegisterFd, called from posixPlatformSleep on the
+ * thread running openthread.
+ *
+ * @param aFd      The file descriptor
+ * @param aEvents  The posixPlatformFdEvents that are ready
+ * @param aContext The context pointer given at registration
+ */
+typedef void (*posixPlatformFdCallback)(int aFd, uint32_t aEvents, void *aContext);
+
+/**
+ * This method registers a file descriptor to wake posixPlatformSleep, so that applications can wait on their own
+ * sockets in the same loop as openthread. The registration persists until posixPlatformUnregisterFd.
+ *
+ * @param aFd       The file descriptor
+ * @param aEvents   Bitmask of the posixPlatformFdEvents to wait for
+ * @param aCallback Callback called when any of aEvents is ready, or NULL to only wake up
+ * @param aContext  Context pointer passed to aCallback
+ * @return 0 on success, or -1 with errno set
+ */
+int posixPlatformRegisterFd(int aFd, uint32_t aEvents, posixPlatformFdCallback aCallback, void *aContext);
+
+/**
+ * This method changes the events waited for on a file descriptor registered with posixPlatformRegisterFd.
+ *
+ * @param aFd      The file descriptor
+ * @param aEvents  Bitmask of the posixPlatformFdEvents to wait for, 0 to temporarily wait for none
+ * @return 0 on success, or -1 with errno set
+ */
+int posixPlatformSetFdEvents(int aFd, uint32_t aEvents);
+
+/**
+ * This method unregisters a file descriptor registered with posixPlatformRegisterFd. It must be called before the
+ * file descriptor is closed.
+ *
+ * @param aFd  The file descriptor
+ * @return 0 on success, or -1 with errno set
+ */
+int posixPlatformUnregisterFd(int aFd);
+
 /**
  * This method initializes the alarm service used by OpenThread.
  *
@@ -156,6 +207,9 @@ void posixPlatformRandomInit(void);
 /**
  * This method updates the file descriptor sets with file descriptors used by the serial driver.
  *
+ * @deprecated posixPlatformSleep already waits on the serial driver, so this is only kept for applications
+ *             that run their own select loop, and will be removed in a future release.
+ *
  * @param[inout]  aReadFdSet   A pointer to the read file descriptors.
  * @param[inout]  aWriteFdSet  A pointer to the write file descriptors.
  * @param[inout]  aMaxFd       A pointer to the max file descriptor.
@@ -169,6 +223,12 @@ void platformUartUpdateFdSet(fd_set *aReadFdSet, fd_set *aWriteFdSet, int *aMaxF
  */
 void platformUartProcess(void);
 
+/**
+ * This method performs periodic syncing of the emulated flash to its file.
+ *
+ */
+void platformFlashProcess(void);
+
 /**
  * This method gets the directory in which all the generated non-volatile data files should be placed.
  *
@@ -0,0 +1,271 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief
+ *   The file descriptor event loop used to sleep the posix platform between events. Linux uses epoll, with
+ *   persistent registrations; other systems fall back to rebuilding the select() sets on each wait.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
+#include "ca821x-posix-thread/posix-platform.h"
+#include "mainloop.h"
+
+#ifndef MAINLOOP_MAX_FDS
+#define MAINLOOP_MAX_FDS 32 //!< Maximum number of registered file descriptors
+#endif
+
+struct mainloop_fd
+{
+	int                     fd;
+	uint32_t                events;
+	posixPlatformFdCallback callback;
+	void *                  context;
+	bool                    always_ready; //!< The file descriptor cannot be waited on (such as a regular file)
+};
+
+static struct mainloop_fd sFds[MAINLOOP_MAX_FDS];
+static int                sFdCount;
+
+#ifdef __linux__
+static int sEpollFd = -1;
+
+static uint32_t to_epoll_events(uint32_t aEvents)
+{
+	return ((aEvents & POSIX_PLATFORM_FD_READ) ? EPOLLIN : 0) | ((aEvents & POSIX_PLATFORM_FD_WRITE) ? EPOLLOUT : 0);
+}
+#endif
+
+static struct mainloop_fd *find_fd(int aFd)
+{
+	for (int i = 0; i < sFdCount; i++)
+	{
+		if (sFds[i].fd == aFd)
+			return &sFds[i];
+	}
+
+	return NULL;
+}
+
+static void dispatch(int aFd, uint32_t aEvents)
+{
+	struct mainloop_fd *entry = find_fd(aFd);
+
+	// The entry may have been unregistered by an earlier callback
+	if (entry && entry->callback)
+		entry->callback(aFd, aEvents, entry->context);
+}
+
+int posixPlatformRegisterFd(int aFd, uint32_t aEvents, posixPlatformFdCallback aCallback, void *aContext)
+{
+	struct mainloop_fd *entry;
+
+	if (find_fd(aFd) || sFdCount == MAINLOOP_MAX_FDS)
+	{
+		errno = find_fd(aFd) ? EEXIST : ENOMEM;
+		return -1;
+	}
+
+	entry               = &sFds[sFdCount];
+	entry->fd           = aFd;
+	entry->events       = aEvents;
+	entry->callback     = aCallback;
+	entry->context      = aContext;
+	entry->always_ready = false;
+
+#ifdef __linux__
+	if (sEpollFd < 0 && (sEpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return -1;
+
+	struct epoll_event event = {.events = to_epoll_events(aEvents), .data.fd = aFd};
+
+	if (epoll_ctl(sEpollFd, EPOLL_CTL_ADD, aFd, &event))
+	{
+		if (errno != EPERM)
+			return -1;
+
+		// Regular files are always ready, as they would be for select()
+		entry->always_ready = true;
+	}
+#endif
+
+	sFdCount++;
+	return 0;
+}
+
+int posixPlatformSetFdEvents(int aFd, uint32_t aEvents)
+{
+	struct mainloop_fd *entry = find_fd(aFd);
+
+	if (!entry)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (entry->events == aEvents)
+		return 0;
+
+	entry->events = aEvents;
+
+#ifdef __linux__
+	if (!entry->always_ready)
+	{
+		struct epoll_event event = {.events = to_epoll_events(aEvents), .data.fd = aFd};
+
+		return epoll_ctl(sEpollFd, EPOLL_CTL_MOD, aFd, &event);
+	}
+#endif
+
+	return 0;
+}
+
+int posixPlatformUnregisterFd(int aFd)
+{
+	struct mainloop_fd *entry = find_fd(aFd);
+
+	if (!entry)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+#ifdef __linux__
+	if (!entry->always_ready)
+		epoll_ctl(sEpollFd, EPOLL_CTL_DEL, aFd, NULL);
+#endif
+
+	*entry = sFds[--sFdCount];
+	return 0;
+}
+
+int mainloop_wait(const struct timeval *aTimeout)
+{
+	int ready = 0;
+
+#ifdef __linux__
+	struct epoll_event events[MAINLOOP_MAX_FDS];
+	int                timeout_ms = -1;
+	struct mainloop_fd always[MAINLOOP_MAX_FDS];
+	int                always_count = 0;
+
+	for (int i = 0; i < sFdCount; i++)
+	{
+		if (sFds[i].always_ready && sFds[i].events)
+			always[always_count++] = sFds[i];
+	}
+
+	if (always_count)
+		timeout_ms = 0;
+	else if (aTimeout && aTimeout->tv_sec >= INT_MAX / 1000)
+		timeout_ms = INT_MAX; //Clamp rather than overflow
+	else if (aTimeout)
+		timeout_ms = aTimeout->tv_sec * 1000 + (aTimeout->tv_usec + 999) / 1000;
+
+	if (sEpollFd >= 0)
+		ready = epoll_wait(sEpollFd, events, MAINLOOP_MAX_FDS, timeout_ms);
+	else if (timeout_ms)
+		ready = poll(NULL, 0, timeout_ms);
+
+	if (ready < 0)
+		return (errno == EINTR) ? 0 : -1;
+
+	for (int i = 0; i < ready; i++)
+	{
+		uint32_t revents = 0;
+
+		revents |= (events[i].events & EPOLLIN) ? POSIX_PLATFORM_FD_READ : 0;
+		revents |= (events[i].events & EPOLLOUT) ? POSIX_PLATFORM_FD_WRITE : 0;
+		revents |= (events[i].events & (EPOLLERR | EPOLLHUP)) ? POSIX_PLATFORM_FD_ERROR : 0;
+		dispatch(events[i].data.fd, revents);
+	}
+
+	for (int i = 0; i < always_count; i++) dispatch(always[i].fd, always[i].events);
+
+	return ready + always_count;
+#else
+	fd_set         read_fds, write_fds, error_fds;
+	int            max_fd = -1;
+	int            fds[MAINLOOP_MAX_FDS];
+	int            fd_count = sFdCount;
+	struct timeval timeout;
+
+	FD_ZERO(&read_fds);
+	FD_ZERO(&write_fds);
+	FD_ZERO(&error_fds);
+
+	for (int i = 0; i < fd_count; i++)
+	{
+		fds[i] = sFds[i].fd;
+
+		if (sFds[i].events & POSIX_PLATFORM_FD_READ)
+			FD_SET(fds[i], &read_fds);
+		if (sFds[i].events & POSIX_PLATFORM_FD_WRITE)
+			FD_SET(fds[i], &write_fds);
+		FD_SET(fds[i], &error_fds);
+
+		if (fds[i] > max_fd)
+			max_fd = fds[i];
+	}
+
+	if (aTimeout)
+		timeout = *aTimeout;
+
+	ready = select(max_fd + 1, &read_fds, &write_fds, &error_fds, aTimeout ? &timeout : NULL);
+
+	if (ready < 0)
+		return (errno == EINTR) ? 0 : -1;
+
+	for (int i = 0; i < fd_count && ready; i++)
+	{
+		uint32_t revents = 0;
+
+		revents |= FD_ISSET(fds[i], &read_fds) ? POSIX_PLATFORM_FD_READ : 0;
+		revents |= FD_ISSET(fds[i], &write_fds) ? POSIX_PLATFORM_FD_WRITE : 0;
+		revents |= FD_ISSET(fds[i], &error_fds) ? POSIX_PLATFORM_FD_ERROR : 0;
+
+		if (revents)
+			dispatch(fds[i], revents);
+	}
+
+	return ready;
+#endif
+}
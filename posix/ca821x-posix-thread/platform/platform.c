@@ -42,17 +42,16 @@
 #include <sys/time.h>
 
 #include "ca821x-posix-thread/posix-platform.h"
+#include "cascoda-util/cascoda_tasklet.h"
 #include "openthread/platform/alarm-milli.h"
 #include "openthread/platform/uart.h"
 #include "openthread/tasklet.h"
+#include "mainloop.h"
 #include "selfpipe.h"
 
 uint32_t NODE_ID           = 1;
 uint32_t WELLKNOWN_NODE_ID = 34;
 
-static fd_set      read_fds;
-static fd_set      write_fds;
-static int         max_fd  = -1;
 static const char *dataDir = NULL;
 
 int    gArgumentsCount = 0;
@@ -83,21 +82,24 @@ void otTaskletsSignalPending(otInstance *aInstance)
 
 void posixPlatformGetTimeout(otInstance *aInstance, struct timeval *timeout)
 {
-	FD_ZERO(&read_fds);
-	FD_ZERO(&write_fds);
+	uint32_t taskletDelta;
 
-	platformUartUpdateFdSet(&read_fds, &write_fds, &max_fd);
-	selfpipe_UpdateFdSet(&read_fds, &write_fds, &max_fd);
 	posixPlatformAlarmUpdateTimeout(timeout);
+
+	//Also wake up for the cascoda-util tasklets, such as those delivering cached DNS answers
+	if (TASKLET_GetTimeToNext(&taskletDelta) == CA_ERROR_SUCCESS &&
+	    (uint64_t)taskletDelta * 1000 < (uint64_t)timeout->tv_sec * 1000000 + timeout->tv_usec)
+	{
+		timeout->tv_sec  = taskletDelta / 1000;
+		timeout->tv_usec = (taskletDelta % 1000) * 1000;
+	}
 }
 
 void posixPlatformSleep(otInstance *aInstance, struct timeval *timeout)
 {
-	int rval;
-
 	if (!otTaskletsArePending(aInstance))
 	{
-		rval = select(max_fd + 1, &read_fds, &write_fds, NULL, timeout);
+		mainloop_wait(timeout);
 		selfpipe_pop();
 	}
 }
@@ -107,6 +109,8 @@ void posixPlatformProcessDriversQuick(otInstance *aInstance)
 	platformUartProcess();
 	PlatformRadioProcess();
 	posixPlatformAlarmProcess(aInstance);
+	platformFlashProcess();
+	TASKLET_Process();
 }
 
 void posixPlatformProcessDrivers(otInstance *aInstance)
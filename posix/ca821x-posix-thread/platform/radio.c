@@ -60,24 +60,59 @@
 
 #define ARRAY_LENGTH(array) (sizeof((array)) / sizeof((array)[0]))
 
-//BARRIER
+//RADIO QUEUE
 /*
- * The following functions create a thread safe system for allowing the worker
- * thread to access openthread functions safely. The main thread always has
- * priority and must explicitly give control to the worker thread while locking
- * itself. This has ONLY been designed to work with ONE worker and ONE main, in
- * a way that causes the worker thread to run one operation per poll cycle as
- * openthread was designed for.
+ * Indications and confirms arrive on the ca821x-posix dispatch worker thread,
+ * but openthread must only be called from the main thread. The worker copies
+ * each one into a single producer, single consumer ring which the main thread
+ * drains in PlatformRadioProcess. Each ring index is only written by one side,
+ * so no lock is taken unless the ring is full, when the worker waits for space
+ * rather than lose a confirm.
  */
-static pthread_mutex_t barrier_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  barrier_cond  = PTHREAD_COND_INITIALIZER;
+#ifndef RADIO_QUEUE_DEPTH
+#define RADIO_QUEUE_DEPTH 32 //!< Number of records in the radio queue, must be a power of two
+#endif
+
+enum radio_record_type
+{
+	RADIO_DATA_INDICATION,
+	RADIO_POLL_INDICATION,
+	RADIO_COMM_STATUS_INDICATION,
+	RADIO_DATA_CONFIRM,
+	RADIO_BEACON_NOTIFY,
+	RADIO_SCAN_CONFIRM,
+};
+
+struct radio_record
+{
+	enum radio_record_type type;
+	union
+	{
+		otDataIndication       dataInd;
+		otPollIndication       pollInd;
+		otCommStatusIndication commInd;
+		otBeaconNotify         beaconNotify;
+		otScanConfirm          scanConf;
+		struct
+		{
+			uint8_t msduHandle;
+			otError error;
+		} dataConf;
+	} data;
+};
 
-static enum barrier_waiting { NOT_WAITING, WAITING, GREENLIGHT, DONE } mbarrier_waiting;
+static struct radio_record sRadioQueue[RADIO_QUEUE_DEPTH];
+static uint32_t            sRadioQueueHead;   //!< Next record to be written, only written by the worker
+static uint32_t            sRadioQueueTail;   //!< Next record to be read, only written by the main thread
+static bool                sRadioQueueWakeup; //!< Set when the main thread has been woken to drain the queue
 
-static inline void barrier_main_letWorkerWork(void);
-static inline void barrier_worker_waitForMain(void);
-static inline void barrier_worker_endWork(void);
-//END BARRIER
+//Only used when the queue is full
+static pthread_mutex_t sRadioQueueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sRadioQueueCond  = PTHREAD_COND_INITIALIZER;
+
+static struct radio_record *radio_queue_reserve(enum radio_record_type type);
+static void                 radio_queue_commit(void);
+//END RADIO QUEUE
 
 static const char IeeeEuiFile[] = "otEui";
 static uint8_t    sIeeeEui64[8];
@@ -384,54 +419,50 @@ otError otPlatMcpsPurge(otInstance *aInstance, uint8_t aMsduHandle)
 
 static ca_error handleDataIndication(struct MCPS_DATA_indication_pset *params, struct ca821x_dev *pDeviceRef)
 {
-	int16_t rssi;
-	//TODO: Move this off the stack
-	otDataIndication dataInd = {0};
+	int16_t           rssi;
+	otDataIndication *dataInd = &radio_queue_reserve(RADIO_DATA_INDICATION)->data.dataInd;
 
-	dataInd.mSrc             = *((struct otFullAddr *)&(params->Src));
-	dataInd.mDst             = *((struct otFullAddr *)&(params->Dst));
-	dataInd.mMsduLength      = params->MsduLength;
-	rssi                     = ((int16_t)params->MpduLinkQuality - 256) / 2; //convert to rssi
-	dataInd.mMpduLinkQuality = rssi;
-	dataInd.mDSN             = params->DSN;
-	memcpy(dataInd.mMsdu, params->Msdu, dataInd.mMsduLength);
-	memcpy(&(dataInd.mSecurity), params->Msdu + params->MsduLength, sizeof(dataInd.mSecurity));
+	memset(dataInd, 0, sizeof(*dataInd));
+	dataInd->mSrc             = *((struct otFullAddr *)&(params->Src));
+	dataInd->mDst             = *((struct otFullAddr *)&(params->Dst));
+	dataInd->mMsduLength      = params->MsduLength;
+	rssi                      = ((int16_t)params->MpduLinkQuality - 256) / 2; //convert to rssi
+	dataInd->mMpduLinkQuality = rssi;
+	dataInd->mDSN             = params->DSN;
+	memcpy(dataInd->mMsdu, params->Msdu, dataInd->mMsduLength);
+	memcpy(&(dataInd->mSecurity), params->Msdu + params->MsduLength, sizeof(dataInd->mSecurity));
 
 #if CASCODA_CA_VER == 8211
-	dataInd.mIsFramePending = params->FramePending;
+	dataInd->mIsFramePending = params->FramePending;
 #endif
 
-	if (dataInd.mSecurity.mSecurityLevel == 0)
+	if (dataInd->mSecurity.mSecurityLevel == 0)
 	{
-		memset(&(dataInd.mSecurity), 0, sizeof(dataInd.mSecurity));
+		memset(&(dataInd->mSecurity), 0, sizeof(dataInd->mSecurity));
 	}
 
-	barrier_worker_waitForMain();
-	otPlatMcpsDataIndication(OT_INSTANCE, &dataInd);
-	barrier_worker_endWork();
+	radio_queue_commit();
 
 	return CA_ERROR_SUCCESS;
 }
 
 static ca_error handlePollIndication(struct MLME_POLL_indication_pset *params, struct ca821x_dev *pDeviceRef)
 {
-	//TODO: Move this off the stack
-	otPollIndication pollInd = {0};
+	otPollIndication *pollInd = &radio_queue_reserve(RADIO_POLL_INDICATION)->data.pollInd;
 
-	pollInd.mSrc = *((struct otFullAddr *)&(params->Src));
-	pollInd.mDst = *((struct otFullAddr *)&(params->Dst));
-	pollInd.mLQI = params->LQI;
-	pollInd.mDSN = params->DSN;
-	memcpy(&(pollInd.mSecurity), &(params->Security), sizeof(pollInd.mSecurity));
+	memset(pollInd, 0, sizeof(*pollInd));
+	pollInd->mSrc = *((struct otFullAddr *)&(params->Src));
+	pollInd->mDst = *((struct otFullAddr *)&(params->Dst));
+	pollInd->mLQI = params->LQI;
+	pollInd->mDSN = params->DSN;
+	memcpy(&(pollInd->mSecurity), &(params->Security), sizeof(pollInd->mSecurity));
 
-	if (pollInd.mSecurity.mSecurityLevel == 0)
+	if (pollInd->mSecurity.mSecurityLevel == 0)
 	{
-		memset(&(pollInd.mSecurity), 0, sizeof(pollInd.mSecurity));
+		memset(&(pollInd->mSecurity), 0, sizeof(pollInd->mSecurity));
 	}
 
-	barrier_worker_waitForMain();
-	otPlatMlmePollIndication(OT_INSTANCE, &pollInd);
-	barrier_worker_endWork();
+	radio_queue_commit();
 
 	return CA_ERROR_SUCCESS;
 }
@@ -439,39 +470,37 @@ static ca_error handlePollIndication(struct MLME_POLL_indication_pset *params, s
 static ca_error handleCommStatusIndication(struct MLME_COMM_STATUS_indication_pset *params,
                                            struct ca821x_dev *                      pDeviceRef)
 {
-	//TODO: Move this off the stack
-	otCommStatusIndication commInd = {0};
+	otCommStatusIndication *commInd = &radio_queue_reserve(RADIO_COMM_STATUS_INDICATION)->data.commInd;
 
-	memcpy(commInd.mPanId, params->PANId, sizeof(commInd.mPanId));
-	commInd.mDstAddrMode = params->DstAddrMode;
-	commInd.mSrcAddrMode = params->SrcAddrMode;
-	memcpy(commInd.mDstAddr, params->DstAddr, sizeof(commInd.mDstAddr));
-	memcpy(commInd.mSrcAddr, params->SrcAddr, sizeof(commInd.mSrcAddr));
-	memcpy(&commInd.mSecurity, &params->Security, sizeof(commInd.mSecurity));
+	memset(commInd, 0, sizeof(*commInd));
+	memcpy(commInd->mPanId, params->PANId, sizeof(commInd->mPanId));
+	commInd->mDstAddrMode = params->DstAddrMode;
+	commInd->mSrcAddrMode = params->SrcAddrMode;
+	memcpy(commInd->mDstAddr, params->DstAddr, sizeof(commInd->mDstAddr));
+	memcpy(commInd->mSrcAddr, params->SrcAddr, sizeof(commInd->mSrcAddr));
+	memcpy(&commInd->mSecurity, &params->Security, sizeof(commInd->mSecurity));
 
-	commInd.mStatus = params->Status;
+	commInd->mStatus = params->Status;
 
-	if (commInd.mSecurity.mSecurityLevel == 0)
+	if (commInd->mSecurity.mSecurityLevel == 0)
 	{
-		memset(&(commInd.mSecurity), 0, sizeof(commInd.mSecurity));
+		memset(&(commInd->mSecurity), 0, sizeof(commInd->mSecurity));
 	}
 
-	barrier_worker_waitForMain();
-	otPlatMlmeCommStatusIndication(OT_INSTANCE, &commInd);
-	barrier_worker_endWork();
+	radio_queue_commit();
 
 	return CA_ERROR_SUCCESS;
 }
 
 static ca_error handleDataConfirm(struct MCPS_DATA_confirm_pset *params, struct ca821x_dev *pDeviceRef) //Async
 {
-	otError error = ConvertErrorMacToOt((ca_mac_status)params->Status);
+	struct radio_record *record = radio_queue_reserve(RADIO_DATA_CONFIRM);
 
 	ca_log_debg("Data Confirm handle %x, status %x", params->MsduHandle, params->Status);
 
-	barrier_worker_waitForMain();
-	otPlatMcpsDataConfirm(OT_INSTANCE, params->MsduHandle, error);
-	barrier_worker_endWork();
+	record->data.dataConf.msduHandle = params->MsduHandle;
+	record->data.dataConf.error      = ConvertErrorMacToOt((ca_mac_status)params->Status);
+	radio_queue_commit();
 
 	return CA_ERROR_SUCCESS;
 }
@@ -479,9 +508,8 @@ static ca_error handleDataConfirm(struct MCPS_DATA_confirm_pset *params, struct
 static ca_error handleBeaconNotify(struct MLME_BEACON_NOTIFY_indication_pset *params,
                                    struct ca821x_dev *                        pDeviceRef) //Async
 {
-	//TODO: Move this off the stack
-	otBeaconNotify beaconNotify = {0};
-	uint8_t        sduLenOffset;
+	otBeaconNotify *beaconNotify = &radio_queue_reserve(RADIO_BEACON_NOTIFY)->data.beaconNotify;
+	uint8_t         sduLenOffset;
 
 	{
 		uint8_t addrField  = ((uint8_t *)params)[23];
@@ -490,23 +518,24 @@ static ca_error handleBeaconNotify(struct MLME_BEACON_NOTIFY_indication_pset *pa
 		sduLenOffset       = (24 + (2 * shortaddrs) + (8 * extaddrs));
 	}
 
-	beaconNotify.BSN            = params->BSN;
-	beaconNotify.mPanDescriptor = *((struct otPanDescriptor *)&(params->PanDescriptor));
-	beaconNotify.mSduLength     = ((uint8_t *)params)[sduLenOffset];
-	memcpy(beaconNotify.mSdu, &(((uint8_t *)params)[sduLenOffset + 1]), beaconNotify.mSduLength);
+	memset(beaconNotify, 0, sizeof(*beaconNotify));
+	beaconNotify->BSN            = params->BSN;
+	beaconNotify->mPanDescriptor = *((struct otPanDescriptor *)&(params->PanDescriptor));
+	beaconNotify->mSduLength     = ((uint8_t *)params)[sduLenOffset];
+	memcpy(beaconNotify->mSdu, &(((uint8_t *)params)[sduLenOffset + 1]), beaconNotify->mSduLength);
 
-	barrier_worker_waitForMain();
-	otPlatMlmeBeaconNotifyIndication(OT_INSTANCE, &beaconNotify);
-	barrier_worker_endWork();
+	radio_queue_commit();
 
 	return CA_ERROR_SUCCESS;
 }
 
 static ca_error handleScanConfirm(struct MLME_SCAN_confirm_pset *params, struct ca821x_dev *pDeviceRef) //Async
 {
-	barrier_worker_waitForMain();
-	otPlatMlmeScanConfirm(OT_INSTANCE, (otScanConfirm *)params);
-	barrier_worker_endWork();
+	otScanConfirm *scanConf = &radio_queue_reserve(RADIO_SCAN_CONFIRM)->data.scanConf;
+
+	memset(scanConf, 0, sizeof(*scanConf));
+	memcpy(scanConf, params, sizeof(*scanConf) < sizeof(*params) ? sizeof(*scanConf) : sizeof(*params));
+	radio_queue_commit();
 
 	return CA_ERROR_SUCCESS;
 }
@@ -614,6 +643,9 @@ int PlatformRadioInitWithDev(struct ca821x_dev *apDeviceRef)
 	pDeviceRef->callbacks.MLME_POLL_indication = &handlePollIndication;
 #endif
 
+	//OpenThread reads the same PIB attributes repeatedly, so answer those from the host where possible
+	ca821x_util_enable_pib_cache(true, pDeviceRef);
+
 	//Reset the MAC to a default state
 	otPlatMlmeReset(NULL, true);
 
@@ -666,7 +698,52 @@ bool otPlatRadioIsEnabled(otInstance *aInstance)
 
 int PlatformRadioProcess(void)
 {
-	barrier_main_letWorkerWork();
+	uint32_t head;
+	bool     drained = false;
+
+	//Clear the wakeup first, so that anything queued from now on wakes the main thread again
+	__atomic_store_n(&sRadioQueueWakeup, false, __ATOMIC_SEQ_CST);
+	head = __atomic_load_n(&sRadioQueueHead, __ATOMIC_ACQUIRE);
+
+	//Only drain the records already queued, so that a constant stream cannot starve the main loop
+	while (sRadioQueueTail != head)
+	{
+		struct radio_record *record = &sRadioQueue[sRadioQueueTail % RADIO_QUEUE_DEPTH];
+
+		switch (record->type)
+		{
+		case RADIO_DATA_INDICATION:
+			otPlatMcpsDataIndication(OT_INSTANCE, &record->data.dataInd);
+			break;
+		case RADIO_POLL_INDICATION:
+			otPlatMlmePollIndication(OT_INSTANCE, &record->data.pollInd);
+			break;
+		case RADIO_COMM_STATUS_INDICATION:
+			otPlatMlmeCommStatusIndication(OT_INSTANCE, &record->data.commInd);
+			break;
+		case RADIO_DATA_CONFIRM:
+			otPlatMcpsDataConfirm(OT_INSTANCE, record->data.dataConf.msduHandle, record->data.dataConf.error);
+			break;
+		case RADIO_BEACON_NOTIFY:
+			otPlatMlmeBeaconNotifyIndication(OT_INSTANCE, &record->data.beaconNotify);
+			break;
+		case RADIO_SCAN_CONFIRM:
+			otPlatMlmeScanConfirm(OT_INSTANCE, &record->data.scanConf);
+			break;
+		}
+
+		__atomic_store_n(&sRadioQueueTail, sRadioQueueTail + 1, __ATOMIC_RELEASE);
+		drained = true;
+	}
+
+	if (drained)
+	{
+		//Release the worker if it is waiting for space
+		pthread_mutex_lock(&sRadioQueueMutex);
+		pthread_cond_signal(&sRadioQueueCond);
+		pthread_mutex_unlock(&sRadioQueueMutex);
+	}
+
 	return 0;
 }
 
@@ -686,49 +763,30 @@ otError otPlatRadioSetCcaEnergyDetectThreshold(otInstance *aInstance, int8_t aTh
 	return OT_ERROR_NOT_IMPLEMENTED;
 }
 
-//Lets the worker thread work synchronously if there is synchronous work to do
-static inline void barrier_main_letWorkerWork()
+//Reserve the next record to pass from the worker thread to the main thread, waiting if the queue is full
+static struct radio_record *radio_queue_reserve(enum radio_record_type type)
 {
-	pthread_mutex_lock(&barrier_mutex);
+	struct radio_record *record;
 
-	if (mbarrier_waiting == WAITING)
+	//Blocks only if the main thread has fallen a whole queue behind
+	if (sRadioQueueHead - __atomic_load_n(&sRadioQueueTail, __ATOMIC_ACQUIRE) == RADIO_QUEUE_DEPTH)
 	{
-		mbarrier_waiting = GREENLIGHT;
-		pthread_cond_broadcast(&barrier_cond);
-
-		while (mbarrier_waiting != DONE)
-		{
-			pthread_cond_wait(&barrier_cond, &barrier_mutex); //The worker thread does work now
-		}
+		pthread_mutex_lock(&sRadioQueueMutex);
+		while (sRadioQueueHead - __atomic_load_n(&sRadioQueueTail, __ATOMIC_ACQUIRE) == RADIO_QUEUE_DEPTH)
+			pthread_cond_wait(&sRadioQueueCond, &sRadioQueueMutex);
+		pthread_mutex_unlock(&sRadioQueueMutex);
 	}
 
-	mbarrier_waiting = NOT_WAITING;
-	pthread_cond_broadcast(&barrier_cond);
-	pthread_mutex_unlock(&barrier_mutex);
+	record       = &sRadioQueue[sRadioQueueHead % RADIO_QUEUE_DEPTH];
+	record->type = type;
+	return record;
 }
 
-static inline void barrier_worker_waitForMain()
+static void radio_queue_commit(void)
 {
-	pthread_mutex_lock(&barrier_mutex);
+	__atomic_store_n(&sRadioQueueHead, sRadioQueueHead + 1, __ATOMIC_RELEASE);
 
-	while (mbarrier_waiting != NOT_WAITING)
-	{
-		pthread_cond_wait(&barrier_cond, &barrier_mutex);
-	}
-
-	selfpipe_push();
-	mbarrier_waiting = WAITING;
-	pthread_cond_broadcast(&barrier_cond);
-
-	while (mbarrier_waiting != GREENLIGHT)
-	{
-		pthread_cond_wait(&barrier_cond, &barrier_mutex); //wait for the main thread to signal worker to run
-	}
-}
-
-static inline void barrier_worker_endWork()
-{
-	mbarrier_waiting = DONE;
-	pthread_cond_broadcast(&barrier_cond);
-	pthread_mutex_unlock(&barrier_mutex);
+	//Only wake the main thread once per drain
+	if (!__atomic_exchange_n(&sRadioQueueWakeup, true, __ATOMIC_SEQ_CST))
+		selfpipe_push();
 }
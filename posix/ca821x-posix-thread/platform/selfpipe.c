@@ -32,37 +32,46 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "ca821x-posix-thread/posix-platform.h"
 #include "selfpipe.h"
 
+//On linux, an eventfd is used for both ends, so that any number of pushes are cleared by a single read
 static int fd[2];
 
 void selfpipe_init(void)
 {
+#ifdef __linux__
+	fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
 	pipe(fd);
 	fcntl(fd[0], F_SETFL, O_NONBLOCK);
 	fcntl(fd[1], F_SETFL, O_NONBLOCK);
+#endif
+	posixPlatformRegisterFd(fd[0], POSIX_PLATFORM_FD_READ, NULL, NULL);
 }
 
 void selfpipe_push(void)
 {
+#ifdef __linux__
+	uint64_t count = 1;
+	write(fd[1], &count, sizeof(count));
+#else
 	write(fd[1], "a", 1);
+#endif
 }
 
 void selfpipe_pop(void)
 {
-	uint8_t junkBuf;
-	read(fd[0], &junkBuf, 1);
-}
-
-void selfpipe_UpdateFdSet(fd_set *aReadFdSet, fd_set *aWriteFdSet, int *aMaxFd)
-{
-	if (aReadFdSet != NULL)
-	{
-		FD_SET(fd[0], aReadFdSet);
-
-		if (aMaxFd != NULL && *aMaxFd < fd[0])
-		{
-			*aMaxFd = fd[0];
-		}
-	}
+#ifdef __linux__
+	uint64_t count;
+	read(fd[0], &count, sizeof(count));
+#else
+	uint8_t junkBuf[64];
+	while (read(fd[0], junkBuf, sizeof(junkBuf)) == sizeof(junkBuf))
+		;
+#endif
 }
@@ -29,8 +29,6 @@
 #ifndef PLATFORM_SELFPIPE_H_
 #define PLATFORM_SELFPIPE_H_
 
-#include <sys/select.h>
-
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,8 +38,6 @@ void selfpipe_init(void);
 void selfpipe_push(void);
 void selfpipe_pop(void);
 
-void selfpipe_UpdateFdSet(fd_set *aReadFdSet, fd_set *aWriteFdSet, int *aMaxFd);
-
 #ifdef __cplusplus
 }
 #endif
@@ -168,7 +168,11 @@ otError otPlatUartEnable(void)
 	}
 
 	if (error == OT_ERROR_NONE)
+	{
 		s_enabled = true;
+		posixPlatformRegisterFd(s_in_fd, POSIX_PLATFORM_FD_READ, NULL, NULL);
+		posixPlatformRegisterFd(s_out_fd, 0, NULL, NULL);
+	}
 	return error;
 
 exit:
@@ -183,6 +187,8 @@ otError otPlatUartDisable(void)
 {
 	otError error = OT_ERROR_NONE;
 
+	posixPlatformUnregisterFd(s_in_fd);
+	posixPlatformUnregisterFd(s_out_fd);
 	close(s_in_fd);
 	close(s_out_fd);
 
@@ -198,6 +204,7 @@ otError otPlatUartSend(const uint8_t *aBuf, uint16_t aBufLength)
 
 	s_write_buffer = aBuf;
 	s_write_length = aBufLength;
+	posixPlatformSetFdEvents(s_out_fd, POSIX_PLATFORM_FD_WRITE);
 
 exit:
 	return error;
@@ -298,6 +305,7 @@ void platformUartProcess(void)
 
 			if (s_write_length == 0)
 			{
+				posixPlatformSetFdEvents(s_out_fd, 0);
 				otPlatUartSendDone();
 			}
 		}
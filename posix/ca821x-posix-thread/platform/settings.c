@@ -101,6 +101,17 @@ struct settingsBlock
 #define SETTINGS_CONFIG_PAGE_NUM 2
 #endif // SETTINGS_CONFIG_PAGE_NUM
 
+/**
+ * @def SETTINGS_CONFIG_INDEX_SIZE
+ *
+ * The number of live settings blocks that can be indexed in RAM. If there are more, lookups fall back to
+ * scanning the settings in flash until the settings are next reinitialised or swapped.
+ *
+ */
+#ifndef SETTINGS_CONFIG_INDEX_SIZE
+#define SETTINGS_CONFIG_INDEX_SIZE 64
+#endif // SETTINGS_CONFIG_INDEX_SIZE
+
 static uint32_t sSettingsBaseAddress;
 static uint32_t sSettingsUsedSize;
 
@@ -109,6 +120,138 @@ static uint16_t getAlignLength(uint16_t length)
 	return (length + 3) & 0xfffc;
 }
 
+/**
+ * Index entry for a live settings block. The entries are kept in the order of the blocks in flash, so the
+ * entries for a key are its values in index order.
+ */
+struct settingsIndexEntry
+{
+	uint16_t key;
+	uint16_t offset; //!< Offset of the block from sSettingsBaseAddress
+	uint16_t length; //!< Length of the value
+};
+
+static struct settingsIndexEntry sIndex[SETTINGS_CONFIG_INDEX_SIZE];
+static uint16_t                  sIndexCount;
+static bool                      sIndexValid;
+
+static void indexReset(void)
+{
+	sIndexCount = 0;
+	sIndexValid = true;
+}
+
+static struct settingsIndexEntry *indexFind(uint16_t aKey, int aIndex)
+{
+	int index = 0;
+
+	for (uint16_t i = 0; i < sIndexCount; i++)
+	{
+		if (sIndex[i].key == aKey && index++ == aIndex)
+			return &sIndex[i];
+	}
+
+	return NULL;
+}
+
+// Remove the aIndex-th value of aKey from the index, or all of them if aIndex is -1
+static void indexRemove(uint16_t aKey, int aIndex)
+{
+	uint16_t kept  = 0;
+	int      index = 0;
+
+	for (uint16_t i = 0; i < sIndexCount; i++)
+	{
+		if (sIndex[i].key == aKey && (aIndex == -1 || index++ == aIndex))
+			continue;
+		sIndex[kept++] = sIndex[i];
+	}
+
+	sIndexCount = kept;
+}
+
+// Update the index with the block at aOffset, which must be the last block in the settings
+static void indexRecord(const struct settingsBlock *aBlock, uint32_t aOffset)
+{
+	if (!sIndexValid)
+		return;
+
+	// A block marked as index 0 supersedes every earlier value of its key, whatever its state
+	if (!(aBlock->flag & kBlockIndex0Flag))
+		indexRemove(aBlock->key, -1);
+
+	if ((aBlock->flag & kBlockAddCompleteFlag) || !(aBlock->flag & kBlockDeleteFlag))
+		return;
+
+	if (sIndexCount == SETTINGS_CONFIG_INDEX_SIZE || aOffset > UINT16_MAX)
+	{
+		sIndexValid = false;
+		return;
+	}
+
+	sIndex[sIndexCount].key    = aBlock->key;
+	sIndex[sIndexCount].offset = aOffset;
+	sIndex[sIndexCount].length = aBlock->length;
+	sIndexCount++;
+}
+
+// Rebuild the index by scanning the settings in flash
+static void indexBuild(void)
+{
+	uint32_t offset = kSettingsFlagSize;
+
+	indexReset();
+
+	while (offset < sSettingsUsedSize)
+	{
+		struct settingsBlock block;
+
+		utilsFlashRead(sSettingsBaseAddress + offset, (uint8_t *)(&block), sizeof(block));
+		indexRecord(&block, offset);
+		offset += (getAlignLength(block.length) + sizeof(struct settingsBlock));
+	}
+}
+
+static void clearBlockFlag(uint32_t aOffset, uint16_t aFlag)
+{
+	struct settingsBlock block;
+
+	utilsFlashRead(sSettingsBaseAddress + aOffset, (uint8_t *)(&block), sizeof(block));
+	block.flag &= (~aFlag);
+	utilsFlashWrite(sSettingsBaseAddress + aOffset, (uint8_t *)(&block), sizeof(block));
+}
+
+// Delete values of a key using the index, with the same effect as scanning the settings in otPlatSettingsDelete
+static otError indexDelete(uint16_t aKey, int aIndex)
+{
+	otError error = OT_ERROR_NOT_FOUND;
+	int     index = 0;
+
+	for (uint16_t i = 0; i < sIndexCount; i++)
+	{
+		if (sIndex[i].key != aKey)
+			continue;
+
+		if (aIndex == index || aIndex == -1)
+		{
+			error = OT_ERROR_NONE;
+			clearBlockFlag(sIndex[i].offset, kBlockDeleteFlag);
+		}
+
+		if (index == 1 && aIndex == 0)
+		{
+			clearBlockFlag(sIndex[i].offset, kBlockIndex0Flag);
+		}
+
+		index++;
+	}
+
+	if (error == OT_ERROR_NONE)
+		indexRemove(aKey, aIndex);
+
+	return error;
+}
+
 static void setSettingsFlag(uint32_t aBase, uint32_t aFlag)
 {
 	utilsFlashWrite(aBase, (uint8_t *)(&aFlag), sizeof(aFlag));
@@ -137,6 +280,7 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 	uint32_t usedSize     = sSettingsUsedSize;
 	uint8_t  pageNum      = SETTINGS_CONFIG_PAGE_NUM;
 	uint32_t settingsSize = pageNum > 1 ? SETTINGS_CONFIG_PAGE_SIZE * pageNum / 2 : SETTINGS_CONFIG_PAGE_SIZE;
+	uint16_t cursor       = 0;
 
 	(void)aInstance;
 
@@ -166,14 +310,20 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 		{
 			uint32_t address = swapAddress + getAlignLength(addBlock.block.length);
 
-			while (address < (oldBase + usedSize))
+			if (sIndexValid)
+			{
+				// The index holds exactly the live blocks, in the order they are stored
+				valid = (cursor < sIndexCount) &&
+				        (sIndex[cursor].offset == swapAddress - oldBase - sizeof(struct settingsBlock));
+			}
+
+			while (!sIndexValid && address < (oldBase + usedSize))
 			{
 				struct settingsBlock block;
 
 				utilsFlashRead(address, (uint8_t *)(&block), sizeof(block));
 
-				if (!(block.flag & kBlockAddCompleteFlag) && (block.flag & kBlockDeleteFlag) &&
-				    !(block.flag & kBlockIndex0Flag) && (block.key == addBlock.block.key))
+				if (!(block.flag & kBlockIndex0Flag) && (block.key == addBlock.block.key))
 				{
 					valid = false;
 					break;
@@ -184,6 +334,9 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 
 			if (valid)
 			{
+				if (sIndexValid)
+					sIndex[cursor++].offset = sSettingsUsedSize;
+
 				utilsFlashRead(swapAddress, addBlock.data, getAlignLength(addBlock.block.length));
 				utilsFlashWrite(sSettingsBaseAddress + sSettingsUsedSize,
 				                (uint8_t *)(&addBlock),
@@ -202,6 +355,9 @@ static uint32_t swapSettingsBlock(otInstance *aInstance)
 	setSettingsFlag(sSettingsBaseAddress, (uint32_t)(kSettingsInUse));
 	setSettingsFlag(oldBase, (uint32_t)(kSettingsNotUse));
 
+	if (!sIndexValid)
+		indexBuild();
+
 exit:
 	return settingsSize - sSettingsUsedSize;
 }
@@ -253,6 +409,7 @@ static otError addSetting(otInstance *   aInstance,
 	addBlock.block.flag &= (~kBlockAddCompleteFlag);
 	utilsFlashWrite(
 	    sSettingsBaseAddress + sSettingsUsedSize, (uint8_t *)(&addBlock.block), sizeof(struct settingsBlock));
+	indexRecord(&addBlock.block, sSettingsUsedSize);
 	sSettingsUsedSize += (sizeof(struct settingsBlock) + getAlignLength(addBlock.block.length));
 
 exit:
@@ -291,6 +448,7 @@ void otPlatSettingsInit(otInstance *aInstance)
 	}
 
 	sSettingsUsedSize = kSettingsFlagSize;
+	indexReset();
 
 	while (sSettingsUsedSize < settingsSize)
 	{
@@ -300,6 +458,7 @@ void otPlatSettingsInit(otInstance *aInstance)
 
 		if (!(block.flag & kBlockAddBeginFlag))
 		{
+			indexRecord(&block, sSettingsUsedSize);
 			sSettingsUsedSize += (getAlignLength(block.length) + sizeof(struct settingsBlock));
 		}
 		else
@@ -330,16 +489,25 @@ otError otPlatSettingsAbandonChange(otInstance *aInstance)
 void otPlatSettingsDeinit(otInstance *aInstance)
 {
 	OT_UNUSED_VARIABLE(aInstance);
+	utilsFlashDeinit();
 }
 
-otError otPlatSettingsGet(otInstance *aInstance, uint16_t aKey, int aIndex, uint8_t *aValue, uint16_t *aValueLength)
+static otError getRelativeAddress(uint16_t aKey, int aIndex, uint32_t *aAddress, uint16_t *aValueLength)
 {
-	otError  error       = OT_ERROR_NOT_FOUND;
-	uint32_t address     = sSettingsBaseAddress + kSettingsFlagSize;
-	uint16_t valueLength = 0;
-	int      index       = 0;
+	otError  error   = OT_ERROR_NOT_FOUND;
+	uint32_t address = sSettingsBaseAddress + kSettingsFlagSize;
+	int      index   = 0;
 
-	(void)aInstance;
+	if (sIndexValid)
+	{
+		struct settingsIndexEntry *entry = indexFind(aKey, aIndex);
+
+		otEXPECT(entry != NULL);
+		*aAddress     = sSettingsBaseAddress + entry->offset + sizeof(struct settingsBlock);
+		*aValueLength = entry->length;
+		error         = OT_ERROR_NONE;
+		goto exit;
+	}
 
 	while (address < (sSettingsBaseAddress + sSettingsUsedSize))
 	{
@@ -352,28 +520,16 @@ otError otPlatSettingsGet(otInstance *aInstance, uint16_t aKey, int aIndex, uint
 			if (!(block.flag & kBlockIndex0Flag))
 			{
 				index = 0;
+				error = OT_ERROR_NOT_FOUND;
 			}
 
 			if (!(block.flag & kBlockAddCompleteFlag) && (block.flag & kBlockDeleteFlag))
 			{
 				if (index == aIndex)
 				{
-					uint16_t readLength = block.length;
-
-					// only perform read if an input buffer was passed in
-					if (aValue != NULL && aValueLength != NULL)
-					{
-						// adjust read length if input buffer length is smaller
-						if (readLength > *aValueLength)
-						{
-							readLength = *aValueLength;
-						}
-
-						utilsFlashRead(address + sizeof(struct settingsBlock), aValue, readLength);
-					}
-
-					valueLength = readLength;
-					error       = OT_ERROR_NONE;
+					*aAddress     = address + sizeof(struct settingsBlock);
+					*aValueLength = block.length;
+					error         = OT_ERROR_NONE;
 				}
 
 				index++;
@@ -383,6 +539,38 @@ otError otPlatSettingsGet(otInstance *aInstance, uint16_t aKey, int aIndex, uint
 		address += (getAlignLength(block.length) + sizeof(struct settingsBlock));
 	}
 
+exit:
+	return error;
+}
+
+otError otPlatSettingsGet(otInstance *aInstance, uint16_t aKey, int aIndex, uint8_t *aValue, uint16_t *aValueLength)
+{
+	otError  error;
+	uint32_t address     = 0;
+	uint16_t readLength  = 0;
+	uint16_t valueLength = 0;
+
+	(void)aInstance;
+
+	error = getRelativeAddress(aKey, aIndex, &address, &readLength);
+
+	if (error == OT_ERROR_NONE)
+	{
+		// only perform read if an input buffer was passed in
+		if (aValue != NULL && aValueLength != NULL)
+		{
+			// adjust read length if input buffer length is smaller
+			if (readLength > *aValueLength)
+			{
+				readLength = *aValueLength;
+			}
+
+			utilsFlashRead(address, aValue, readLength);
+		}
+
+		valueLength = readLength;
+	}
+
 	if (aValueLength != NULL)
 	{
 		*aValueLength = valueLength;
@@ -413,6 +601,9 @@ otError otPlatSettingsDelete(otInstance *aInstance, uint16_t aKey, int aIndex)
 
 	(void)aInstance;
 
+	if (sIndexValid)
+		return indexDelete(aKey, aIndex);
+
 	while (address < (sSettingsBaseAddress + sSettingsUsedSize))
 	{
 		struct settingsBlock block;
@@ -424,6 +615,7 @@ otError otPlatSettingsDelete(otInstance *aInstance, uint16_t aKey, int aIndex)
 			if (!(block.flag & kBlockIndex0Flag))
 			{
 				index = 0;
+				error = OT_ERROR_NOT_FOUND;
 			}
 
 			if (!(block.flag & kBlockAddCompleteFlag) && (block.flag & kBlockDeleteFlag))
@@ -0,0 +1,364 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief  Unit tests and benchmarks for the posix emulated flash and the settings stored in it
+ */
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-posix-thread/posix-platform.h"
+#include "openthread/platform/settings.h"
+#include "flash.h"
+
+enum
+{
+	FLASH_SIZE       = 0x40000, //!< Size of the emulated flash
+	FLASH_PAGE_SIZE  = 0x800,   //!< Size of an emulated flash page
+	SETTINGS_COUNT   = 2000,    //!< Number of settings written by the benchmark
+	SETTINGS_KEYS    = 6,       //!< Number of distinct keys written by the benchmark, which must all fit
+	SETTINGS_LEN     = 255,     //!< Length of each setting, the longest a settings block can hold
+	COLD_START_COUNT = 100,     //!< Number of cold starts timed by the benchmark
+	MODEL_KEYS       = 8,       //!< Number of keys exercised by the settings consistency test
+	MODEL_VALUES     = 4,       //!< Maximum number of values per key in the settings consistency test
+	MODEL_LEN        = 24,      //!< Maximum length of a value in the settings consistency test
+	MODEL_OPS        = 3000,    //!< Number of changes made by the settings consistency test
+	LOOKUP_KEYS      = 64,      //!< Number of settings populated for the lookup benchmark, which all fit the index
+	LOOKUP_LEN       = 12,      //!< Length of each setting populated for the lookup benchmark
+	LOOKUP_COUNT     = 100000,  //!< Number of lookups timed by the benchmark
+};
+
+/** Expected contents of the settings, as OpenThread sees them */
+struct settings_model
+{
+	uint8_t count[MODEL_KEYS];
+	uint8_t len[MODEL_KEYS][MODEL_VALUES];
+	uint8_t value[MODEL_KEYS][MODEL_VALUES][MODEL_LEN];
+};
+
+static char sDataDir[] = "/tmp/flash_testXXXXXX";
+static char sFlashPath[sizeof(sDataDir) + 16];
+
+const char *posixGetDataDir(void)
+{
+	return sDataDir;
+}
+
+static uint64_t get_monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int group_setup(void **state)
+{
+	(void)state;
+	if (!mkdtemp(sDataDir))
+		return -1;
+	snprintf(sFlashPath, sizeof(sFlashPath), "%s/otConfig", sDataDir);
+	return 0;
+}
+
+static int group_teardown(void **state)
+{
+	(void)state;
+	unlink(sFlashPath);
+	return rmdir(sDataDir);
+}
+
+static int flash_teardown(void **state)
+{
+	(void)state;
+	utilsFlashDeinit();
+	return unlink(sFlashPath);
+}
+
+static void flash_semantics_test(void **state)
+{
+	uint8_t data[4] = {0xF0, 0xF0, 0xF0, 0xF0}, read[4];
+	int     fd;
+
+	(void)state;
+
+	//A file left short, such as by an older version, is extended with erased flash
+	fd = open(sFlashPath, O_RDWR | O_CREAT, 0666);
+	assert_true(fd >= 0);
+	assert_int_equal(pwrite(fd, data, sizeof(data), 0), sizeof(data));
+	close(fd);
+
+	assert_int_equal(utilsFlashInit(), OT_ERROR_NONE);
+	assert_int_equal(utilsFlashRead(0, read, sizeof(read)), sizeof(read));
+	assert_memory_equal(read, data, sizeof(data));
+	assert_int_equal(utilsFlashRead(FLASH_SIZE - 2, read, sizeof(read)), 2);
+	assert_int_equal(read[0], 0xFF);
+	assert_int_equal(read[1], 0xFF);
+
+	//Writes only clear bits
+	memset(data, 0x0F, sizeof(data));
+	assert_int_equal(utilsFlashWrite(0, data, sizeof(data)), sizeof(data));
+	assert_int_equal(utilsFlashRead(0, read, sizeof(read)), sizeof(read));
+	assert_int_equal(read[0], 0x00);
+
+	//Erasing sets every bit of the page containing the address
+	assert_int_equal(utilsFlashErasePage(FLASH_PAGE_SIZE - 1), OT_ERROR_NONE);
+	assert_int_equal(utilsFlashStatusWait(0), OT_ERROR_NONE);
+	assert_int_equal(utilsFlashRead(0, read, sizeof(read)), sizeof(read));
+	assert_int_equal(read[3], 0xFF);
+	assert_int_equal(utilsFlashErasePage(FLASH_SIZE), OT_ERROR_INVALID_ARGS);
+	assert_int_equal(utilsFlashWrite(FLASH_SIZE, data, sizeof(data)), 0);
+
+	//Changes persist in the file
+	assert_int_equal(utilsFlashWrite(FLASH_PAGE_SIZE, data, sizeof(data)), sizeof(data));
+	utilsFlashDeinit();
+	assert_int_equal(utilsFlashInit(), OT_ERROR_NONE);
+	assert_int_equal(utilsFlashRead(FLASH_PAGE_SIZE, read, sizeof(read)), sizeof(read));
+	assert_memory_equal(read, data, sizeof(data));
+}
+
+/** Time SETTINGS_COUNT settings writes and COLD_START_COUNT cold starts, with the given CASCODA_FLASH_SYNC policy */
+static void run_settings(const char *sync)
+{
+	uint8_t  value[SETTINGS_LEN], read[SETTINGS_LEN];
+	uint16_t len;
+	uint64_t start_us, set_us, total_us = 0;
+
+	setenv("CASCODA_FLASH_SYNC", sync, 1);
+	otPlatSettingsInit(NULL);
+
+	start_us = get_monotonic_us();
+	for (uint32_t i = 0; i < SETTINGS_COUNT; i++)
+	{
+		memset(value, i, sizeof(value));
+		assert_int_equal(otPlatSettingsSet(NULL, i % SETTINGS_KEYS, value, sizeof(value)), OT_ERROR_NONE);
+	}
+	set_us = get_monotonic_us() - start_us;
+
+	//Time a cold start of the full image, including the scan of the settings
+	for (uint32_t i = 0; i < COLD_START_COUNT; i++)
+	{
+		otPlatSettingsDeinit(NULL);
+		start_us = get_monotonic_us();
+		otPlatSettingsInit(NULL);
+		total_us += get_monotonic_us() - start_us;
+	}
+
+	for (uint32_t i = SETTINGS_COUNT - SETTINGS_KEYS; i < SETTINGS_COUNT; i++)
+	{
+		memset(value, i, sizeof(value));
+		len = sizeof(read);
+		assert_int_equal(otPlatSettingsGet(NULL, i % SETTINGS_KEYS, 0, read, &len), OT_ERROR_NONE);
+		assert_int_equal(len, sizeof(value));
+		assert_memory_equal(read, value, sizeof(value));
+	}
+
+	otPlatSettingsDeinit(NULL);
+	unlink(sFlashPath);
+	unsetenv("CASCODA_FLASH_SYNC");
+
+	printf("CASCODA_FLASH_SYNC=%s: otPlatSettingsSet of %u byte values %.0f sets/s, cold start of %u KiB image mean "
+	       "%.1f us\n",
+	       sync,
+	       SETTINGS_LEN,
+	       SETTINGS_COUNT * 1000000.0 / set_us,
+	       FLASH_SIZE / 1024,
+	       (double)total_us / COLD_START_COUNT);
+}
+
+static void settings_benchmark(void **state)
+{
+	(void)state;
+
+	run_settings("0");    //Sync every change immediately
+	run_settings("1000"); //The default
+}
+
+static void check_model(const struct settings_model *model)
+{
+	uint8_t  read[MODEL_LEN];
+	uint16_t len;
+
+	for (uint16_t key = 0; key < MODEL_KEYS; key++)
+	{
+		for (int i = 0; i < model->count[key]; i++)
+		{
+			len = sizeof(read);
+			assert_int_equal(otPlatSettingsGet(NULL, key, i, read, &len), OT_ERROR_NONE);
+			assert_int_equal(len, model->len[key][i]);
+			assert_memory_equal(read, model->value[key][i], len);
+		}
+		len = sizeof(read);
+		assert_int_equal(otPlatSettingsGet(NULL, key, model->count[key], read, &len), OT_ERROR_NOT_FOUND);
+	}
+}
+
+/** Make pseudo-random changes to the settings, checking every value after each change and across restarts */
+static void settings_index_test(void **state)
+{
+	struct settings_model model = {0};
+	uint32_t              rand  = 1;
+
+	(void)state;
+
+	otPlatSettingsInit(NULL);
+
+	for (uint32_t op = 0; op < MODEL_OPS; op++)
+	{
+		uint16_t key, index;
+		uint8_t  len, value[MODEL_LEN];
+
+		rand  = rand * 1103515245 + 12345;
+		key   = (rand >> 8) % MODEL_KEYS;
+		len   = 1 + (rand >> 12) % MODEL_LEN;
+		index = model.count[key] ? (rand >> 20) % model.count[key] : 0;
+		memset(value, op, sizeof(value));
+
+		switch ((rand >> 16) % 4)
+		{
+		case 0: //Set
+			assert_int_equal(otPlatSettingsSet(NULL, key, value, len), OT_ERROR_NONE);
+			model.count[key] = 1;
+			index            = 0;
+			break;
+		case 1: //Add
+			if (model.count[key] < MODEL_VALUES)
+			{
+				assert_int_equal(otPlatSettingsAdd(NULL, key, value, len), OT_ERROR_NONE);
+				index = model.count[key]++;
+				break;
+			}
+			//fall through
+		case 2: //Delete one value
+			assert_int_equal(otPlatSettingsDelete(NULL, key, model.count[key] ? index : 0),
+			                 model.count[key] ? OT_ERROR_NONE : OT_ERROR_NOT_FOUND);
+			if (model.count[key])
+			{
+				model.count[key]--;
+				memmove(model.len[key] + index, model.len[key] + index + 1, model.count[key] - index);
+				memmove(model.value[key][index],
+				        model.value[key][index + 1],
+				        (model.count[key] - index) * sizeof(model.value[key][0]));
+			}
+			len = 0;
+			break;
+		default: //Delete every value
+			assert_int_equal(otPlatSettingsDelete(NULL, key, -1),
+			                 model.count[key] ? OT_ERROR_NONE : OT_ERROR_NOT_FOUND);
+			model.count[key] = 0;
+			len              = 0;
+			break;
+		}
+
+		if (len)
+		{
+			model.len[key][index] = len;
+			memcpy(model.value[key][index], value, len);
+		}
+
+		check_model(&model);
+
+		//The index must describe the settings exactly as a fresh scan of the flash would
+		if (op % 500 == 0)
+		{
+			otPlatSettingsDeinit(NULL);
+			otPlatSettingsInit(NULL);
+			check_model(&model);
+		}
+	}
+
+	otPlatSettingsDeinit(NULL);
+	unlink(sFlashPath);
+}
+
+static double time_lookups(void)
+{
+	uint8_t  read[LOOKUP_LEN];
+	uint16_t len;
+	uint64_t start_us;
+
+	start_us = get_monotonic_us();
+	for (uint32_t i = 0; i < LOOKUP_COUNT; i++)
+	{
+		len = sizeof(read);
+		assert_int_equal(otPlatSettingsGet(NULL, i % LOOKUP_KEYS, 0, read, &len), OT_ERROR_NONE);
+	}
+
+	return LOOKUP_COUNT * 1000000.0 / (get_monotonic_us() - start_us);
+}
+
+/** Time otPlatSettingsGet on a populated store, with the RAM index and after it overflows to scanning the flash */
+static void settings_lookup_benchmark(void **state)
+{
+	uint8_t value[LOOKUP_LEN] = {0};
+	double  indexed, scanned;
+
+	(void)state;
+
+	otPlatSettingsInit(NULL);
+	for (uint16_t key = 0; key < LOOKUP_KEYS; key++)
+	{
+		assert_int_equal(otPlatSettingsSet(NULL, key, value, sizeof(value)), OT_ERROR_NONE);
+	}
+	indexed = time_lookups();
+
+	//One more live block than the index holds
+	assert_int_equal(otPlatSettingsAdd(NULL, 0, value, sizeof(value)), OT_ERROR_NONE);
+	scanned = time_lookups();
+
+	otPlatSettingsDeinit(NULL);
+	unlink(sFlashPath);
+
+	printf("otPlatSettingsGet with %u settings: RAM index %.0f gets/s, flash scan %.0f gets/s\n",
+	       LOOKUP_KEYS,
+	       indexed,
+	       scanned);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test_teardown(flash_semantics_test, flash_teardown),
+	    cmocka_unit_test(settings_benchmark),
+	    cmocka_unit_test(settings_index_test),
+	    cmocka_unit_test(settings_lookup_benchmark),
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
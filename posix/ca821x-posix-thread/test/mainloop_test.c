@@ -0,0 +1,305 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief  Unit tests and benchmarks for the posix platform event loop
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-posix-thread/posix-platform.h"
+#include "mainloop.h"
+#include "selfpipe.h"
+
+enum
+{
+	IDLE_FDS      = 24,     //!< Number of idle file descriptors registered during the benchmark, like sockets
+	SIGNAL_COUNT  = 200000, //!< Number of wakeups signalled by the benchmark's worker thread
+	IDLE_PERIOD_S = 1,      //!< Length of the idle part of the benchmark
+};
+
+static int      sEvents;
+static int      sCalls;
+static int      sIdleFds[IDLE_FDS][2];
+static int      sOldPipe[2];
+static bool     sProducerDone;
+
+static void record_callback(int aFd, uint32_t aEvents, void *aContext)
+{
+	(void)aFd;
+	assert_ptr_equal(aContext, &sEvents);
+	sEvents |= aEvents;
+	sCalls++;
+}
+
+static struct timeval ms_timeout(int ms)
+{
+	struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+
+	return tv;
+}
+
+static uint64_t get_monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint64_t get_cpu_us(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec +
+	       usage.ru_stime.tv_usec;
+}
+
+static void mainloop_register_test(void **state)
+{
+	int            fds[2];
+	FILE *         file = tmpfile();
+	struct timeval timeout;
+
+	(void)state;
+
+	assert_int_equal(pipe(fds), 0);
+	assert_int_equal(posixPlatformRegisterFd(fds[0], POSIX_PLATFORM_FD_READ, record_callback, &sEvents), 0);
+	assert_int_equal(posixPlatformRegisterFd(fds[0], POSIX_PLATFORM_FD_READ, record_callback, &sEvents), -1);
+	assert_int_equal(errno, EEXIST);
+
+	//Nothing ready
+	timeout = ms_timeout(0);
+	assert_int_equal(mainloop_wait(&timeout), 0);
+	assert_int_equal(sCalls, 0);
+
+	//Readable
+	assert_int_equal(write(fds[1], "a", 1), 1);
+	timeout = ms_timeout(1000);
+	assert_int_equal(mainloop_wait(&timeout), 1);
+	assert_int_equal(sEvents, POSIX_PLATFORM_FD_READ);
+
+	//Not waiting for anything, although still readable
+	sCalls = 0;
+	assert_int_equal(posixPlatformSetFdEvents(fds[0], 0), 0);
+	timeout = ms_timeout(10);
+	assert_int_equal(mainloop_wait(&timeout), 0);
+	assert_int_equal(sCalls, 0);
+
+	//Writable
+	sEvents = 0;
+	assert_int_equal(posixPlatformRegisterFd(fds[1], POSIX_PLATFORM_FD_WRITE, record_callback, &sEvents), 0);
+	timeout = ms_timeout(1000);
+	assert_int_equal(mainloop_wait(&timeout), 1);
+	assert_int_equal(sEvents, POSIX_PLATFORM_FD_WRITE);
+
+	//Hung up
+	sEvents = 0;
+	assert_int_equal(posixPlatformUnregisterFd(fds[1]), 0);
+	assert_int_equal(posixPlatformSetFdEvents(fds[0], POSIX_PLATFORM_FD_READ), 0);
+	close(fds[1]);
+	assert_int_equal(mainloop_wait(&timeout), 1);
+	assert_true(sEvents & POSIX_PLATFORM_FD_READ);
+
+	assert_int_equal(posixPlatformUnregisterFd(fds[0]), 0);
+	assert_int_equal(posixPlatformUnregisterFd(fds[0]), -1);
+	assert_int_equal(errno, ENOENT);
+	close(fds[0]);
+
+	//A regular file is always ready
+	sEvents = 0;
+	assert_non_null(file);
+	assert_int_equal(posixPlatformRegisterFd(fileno(file), POSIX_PLATFORM_FD_READ, record_callback, &sEvents), 0);
+	timeout = ms_timeout(10000);
+	assert_int_equal(mainloop_wait(&timeout), 1);
+	assert_int_equal(sEvents, POSIX_PLATFORM_FD_READ);
+	assert_int_equal(posixPlatformUnregisterFd(fileno(file)), 0);
+	fclose(file);
+}
+
+static void *producer(void *arg)
+{
+	bool old = *(bool *)arg;
+
+	for (int i = 0; i < SIGNAL_COUNT; i++)
+	{
+		if (old)
+			write(sOldPipe[1], "a", 1);
+		else
+			selfpipe_push();
+	}
+
+	__atomic_store_n(&sProducerDone, true, __ATOMIC_RELEASE);
+	if (old)
+		write(sOldPipe[1], "a", 1);
+	else
+		selfpipe_push();
+
+	return NULL;
+}
+
+/** The loop as it was: rebuild the select() sets every time and consume one byte of the self pipe per wakeup */
+static int old_wait(struct timeval *timeout)
+{
+	fd_set  read_fds, write_fds;
+	int     max_fd = sOldPipe[0];
+	uint8_t junk;
+	int     rval;
+
+	FD_ZERO(&read_fds);
+	FD_ZERO(&write_fds);
+	FD_SET(sOldPipe[0], &read_fds);
+	for (int i = 0; i < IDLE_FDS; i++)
+	{
+		FD_SET(sIdleFds[i][0], &read_fds);
+		if (sIdleFds[i][0] > max_fd)
+			max_fd = sIdleFds[i][0];
+	}
+
+	rval = select(max_fd + 1, &read_fds, &write_fds, NULL, timeout);
+	read(sOldPipe[0], &junk, 1);
+	return rval;
+}
+
+static void run_signals(bool old)
+{
+	pthread_t      thread;
+	uint32_t       wakeups = 0;
+	uint64_t       start_us, cpu_us;
+	struct timeval timeout;
+
+	sProducerDone = false;
+	start_us      = get_monotonic_us();
+	cpu_us        = get_cpu_us();
+	pthread_create(&thread, NULL, producer, &old);
+
+	while (!__atomic_load_n(&sProducerDone, __ATOMIC_ACQUIRE))
+	{
+		timeout = ms_timeout(1000);
+		if (old)
+		{
+			old_wait(&timeout);
+		}
+		else
+		{
+			mainloop_wait(&timeout);
+			selfpipe_pop();
+		}
+		wakeups++;
+	}
+
+	pthread_join(thread, NULL);
+	start_us = get_monotonic_us() - start_us;
+	cpu_us   = get_cpu_us() - cpu_us;
+
+	printf("%s: %u signals caused %u wakeups (%.0f wakeups/s), %.1f ms CPU\n",
+	       old ? "select & pipe" : "epoll & eventfd",
+	       SIGNAL_COUNT,
+	       wakeups,
+	       wakeups * 1000000.0 / start_us,
+	       cpu_us / 1000.0);
+}
+
+static void run_idle(void)
+{
+	uint32_t       wakeups = 0;
+	uint64_t       end_us  = get_monotonic_us() + IDLE_PERIOD_S * 1000000;
+	uint64_t       now_us, cpu_us = get_cpu_us();
+	struct timeval timeout;
+
+	//Nothing to do until an alarm at the end of the period
+	while ((now_us = get_monotonic_us()) < end_us)
+	{
+		timeout.tv_sec  = (end_us - now_us) / 1000000;
+		timeout.tv_usec = (end_us - now_us) % 1000000;
+		mainloop_wait(&timeout);
+		wakeups++;
+	}
+
+	cpu_us = get_cpu_us() - cpu_us;
+	printf("idle with %u sockets: %u wakeups in %u s, %.3f%% CPU\n",
+	       IDLE_FDS,
+	       wakeups,
+	       IDLE_PERIOD_S,
+	       cpu_us * 100.0 / (IDLE_PERIOD_S * 1000000.0));
+}
+
+static void mainloop_benchmark(void **state)
+{
+	(void)state;
+
+	assert_int_equal(pipe(sOldPipe), 0);
+	fcntl(sOldPipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(sOldPipe[1], F_SETFL, O_NONBLOCK);
+	selfpipe_init();
+
+	for (int i = 0; i < IDLE_FDS; i++)
+	{
+		assert_int_equal(pipe(sIdleFds[i]), 0);
+		assert_int_equal(posixPlatformRegisterFd(sIdleFds[i][0], POSIX_PLATFORM_FD_READ, NULL, NULL), 0);
+	}
+
+	run_signals(true);
+	run_signals(false);
+	run_idle();
+
+	for (int i = 0; i < IDLE_FDS; i++)
+	{
+		posixPlatformUnregisterFd(sIdleFds[i][0]);
+		close(sIdleFds[i][0]);
+		close(sIdleFds[i][1]);
+	}
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test(mainloop_register_test),
+	    cmocka_unit_test(mainloop_benchmark),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -157,6 +157,8 @@ ca_error EVBME_DFU_ERASE_request(uint32_t aStartAddr, uint32_t aEraseLen, struct
 /**
  * Send a DFU request for Write to a given device. Causes the given flash to be written.
  * This command is processed asynchronously and the EVBME_DFU_STATUS_indication will indicate completion.
+ * Several writes may be sent before their status is received. They are acknowledged in order, and newer
+ * firmware includes the start address of the acknowledged write in the status (evbme_dfu_status_cmd).
  *
  * EVBME_DFU_STATUS       | Status code meaning
  * ---------------------- | -------------------
@@ -178,6 +180,41 @@ ca_error EVBME_DFU_WRITE_request(uint32_t           aStartAddr,
                                  void *             aWriteData,
                                  struct ca821x_dev *pDeviceRef);
 
+/**
+ * Send part of a deflate compressed block to be written to the flash of a given device. The block is split into
+ * pieces of at most DFU_ZWRITE_MAX_LEN bytes, which must be sent in order, and is decompressed and written once the
+ * last piece has been received. This command is processed asynchronously and the EVBME_DFU_STATUS_indication will
+ * indicate completion. Like DFU writes, several may be sent before their status is received.
+ *
+ * Firmware built without CASCODA_BM_DFU_COMPRESSION, and the bootloader, do not support this command.
+ *
+ * EVBME_DFU_STATUS       | Status code meaning
+ * ---------------------- | -------------------
+ * CA_ERROR_SUCCESS       | Command was successful
+ * CA_ERROR_INVALID_ARGS  | Lengths are invalid, aStartAddr is not aligned or the piece is out of order
+ * CA_ERROR_INVALID_STATE | Device is not in DFU mode, or does not support compressed writes
+ * CA_ERROR_FAIL          | The block could not be decompressed
+ *
+ * @param aStartAddr The start address of the decompressed block, must be word-aligned
+ * @param aBlockLen  The decompressed length of the block, must be word-aligned and max DFU_ZBLOCK_MAX_LEN
+ * @param aZLen      The compressed length of the block, max DFU_ZBLOCK_MAX_LEN
+ * @param aOffset    The offset of this piece in the compressed block
+ * @param aDataLen   The length of this piece, max DFU_ZWRITE_MAX_LEN
+ * @param aData      The compressed data of this piece
+ * @param pDeviceRef The device struct for the device this message is to be sent to
+ *
+ * @return Status of the command
+ * @retval CA_ERROR_SUCCESS       Success
+ * @retval CA_ERROR_INVALID_ARGS  aDataLen is too long
+ */
+ca_error EVBME_DFU_ZWRITE_request(uint32_t           aStartAddr,
+                                  uint16_t           aBlockLen,
+                                  uint16_t           aZLen,
+                                  uint16_t           aOffset,
+                                  size_t             aDataLen,
+                                  const void *       aData,
+                                  struct ca821x_dev *pDeviceRef);
+
 /**
  * Send a DFU request to verify a flash range of a given device.
  * This command is processed asynchronously and the EVBME_DFU_STATUS_indication will indicate completion.
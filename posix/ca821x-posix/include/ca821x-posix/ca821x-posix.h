@@ -165,7 +165,8 @@ ca_error ca821x_util_dispatch_poll();
 /**
  * Start the downstream_dispatch worker, which asynchronously calls the message callbacks
  * (such as MCPS_DATA_indication) as they are received. These callbacks will be triggered
- * from a separate posix thread. Appropriate pthread locking should be used by the application
+ * from a separate posix thread, or one thread per device if ca821x_util_set_dispatch_mode
+ * has selected ca821x_dispatch_per_device. Appropriate pthread locking should be used by the application
  * or else the application logic could suffer from threading related issues.
  *
  * This should not be used in conjunction with ca821x_util_dispatch_poll. Use
@@ -179,6 +180,35 @@ ca_error ca821x_util_dispatch_poll();
  */
 ca_error ca821x_util_start_downstream_dispatch_worker();
 
+/**
+ * Set the mode of the downstream dispatch worker. In ca821x_dispatch_global mode (the default),
+ * a single thread calls the message callbacks for every device. In ca821x_dispatch_per_device
+ * mode, every device has its own dispatch thread, so a slow callback for one device does not
+ * delay the callbacks of the others. Callbacks for a single device are always called in order,
+ * but callbacks for different devices may be called concurrently, so they must be thread-safe.
+ *
+ * The mode can only be changed when no devices are initialised and the worker is stopped.
+ *
+ * @param mode The dispatch mode to use
+ *
+ * @retval CA_ERROR_SUCCESS Mode set
+ * @retval CA_ERROR_INVALID_STATE Devices are initialised or the dispatch worker is running
+ */
+ca_error ca821x_util_set_dispatch_mode(enum ca821x_dispatch_mode mode);
+
+/**
+ * Get the statistics of a downstream dispatch worker, including the depth of the queue feeding it
+ * and the time spent in the message callbacks.
+ *
+ * @param[out] aStats     The statistics of the worker
+ * @param[in]  pDeviceRef The device whose worker to query. Ignored in ca821x_dispatch_global mode,
+ *                        where the single shared worker is queried.
+ *
+ * @retval CA_ERROR_SUCCESS Statistics retrieved
+ * @retval CA_ERROR_INVALID_ARGS No device reference in ca821x_dispatch_per_device mode
+ */
+ca_error ca821x_util_get_dispatch_stats(struct ca821x_dispatch_stats *aStats, struct ca821x_dev *pDeviceRef);
+
 /**
  * Stop the downstream_dispatch worker, so callbacks will no longer be triggered
  * from a separate thread.
@@ -190,6 +220,44 @@ ca_error ca821x_util_start_downstream_dispatch_worker();
  */
 ca_error ca821x_util_stop_downstream_dispatch_worker();
 
+/**
+ * Start the exchange reactor. Devices that are initialised while the reactor is running, and whose
+ * exchange can be driven by a file descriptor (currently UART and kernel), are serviced by one of
+ * aNumThreads shared epoll threads instead of getting a dedicated io thread each. Write wakeups use
+ * an eventfd, and every device is also serviced periodically so that exchange timeouts are handled.
+ * Other exchanges (such as USB) keep their own io thread. Only available on Linux.
+ *
+ * This should be called before initialising the devices that should use it.
+ *
+ * @param aNumThreads The number of reactor threads to service the devices with
+ *
+ * @retval CA_ERROR_SUCCESS Reactor started
+ * @retval CA_ERROR_ALREADY Reactor already running
+ * @retval CA_ERROR_INVALID_ARGS aNumThreads is zero or too large
+ * @retval CA_ERROR_NOT_HANDLED Not supported on this platform
+ * @retval CA_ERROR_FAIL Failed to start the reactor threads
+ */
+ca_error ca821x_util_start_reactor(unsigned int aNumThreads);
+
+/**
+ * Stop the exchange reactor. All devices serviced by the reactor must be deinitialised first.
+ *
+ * @retval CA_ERROR_SUCCESS Reactor stopped
+ * @retval CA_ERROR_ALREADY Reactor not running
+ * @retval CA_ERROR_INVALID_STATE Devices are still being serviced by the reactor
+ */
+ca_error ca821x_util_stop_reactor(void);
+
+/**
+ * Get the statistics of the exchange reactor threads, summed across all threads.
+ *
+ * @param[out] aStats The reactor statistics
+ *
+ * @retval CA_ERROR_SUCCESS Statistics retrieved
+ * @retval CA_ERROR_INVALID_STATE Reactor not running
+ */
+ca_error ca821x_util_get_reactor_stats(struct ca821x_reactor_stats *aStats);
+
 /**
  * Registers the callback to call for any non-ca821x commands that are sent over
  * the interface. Commands are still limited to the cascoda tlv format, and must
@@ -230,6 +298,206 @@ ca_error exchange_wait_send_complete(time_t timeout_s, struct ca821x_dev *pDevic
  */
 ca_error exchange_user_command(uint8_t cmdid, uint8_t cmdlen, uint8_t *payload, struct ca821x_dev *pDeviceRef);
 
+/**
+ * Send a synchronous ca821x-api command without blocking. This is the non-blocking equivalent of the
+ * ca821x_api_downstream call made by the *_request_sync functions. The command is queued for sending and the
+ * call returns immediately. The callback is called from the thread servicing the exchange when the matching
+ * synchronous response arrives, or with CA_ERROR_TIMEOUT if it does not arrive in time. Several requests
+ * can be outstanding at once, and are completed in the order that the device responds to them.
+ *
+ * The response is passed to the callback unprocessed, so (unlike the *_request_sync functions) any state
+ * normally cached in the device reference on success is not updated.
+ *
+ * @param[in]  buf        The Cascoda TLV command to send, which must be a synchronous command.
+ *                        It is copied before returning.
+ * @param[in]  callback   Callback to call with the response
+ * @param[in]  context    Context pointer to pass to the callback
+ * @param[in]  pDeviceRef The device reference to communicate with
+ *
+ * @retval CA_ERROR_SUCCESS The command was queued, and the callback will be called exactly once
+ * @retval CA_ERROR_INVALID_ARGS The command is not synchronous, or there is no callback
+ * @retval CA_ERROR_INVALID_STATE The device is not initialised
+ * @retval CA_ERROR_NO_BUFFER Too many requests are pending, or the send queue is full
+ */
+ca_error ca821x_api_downstream_async(const uint8_t *       buf,
+                                     ca821x_async_callback callback,
+                                     void *                context,
+                                     struct ca821x_dev *   pDeviceRef);
+
+/**
+ * Non-blocking variant of MLME_GET_request_sync. The callback receives the MLME-GET confirm, laid out as a
+ * struct MAC_Message.
+ *
+ * @param[in]  PIBAttribute      Attribute Number
+ * @param[in]  PIBAttributeIndex Index within an Attribute if an Array
+ * @param[in]  callback          Callback to call with the confirm
+ * @param[in]  context           Context pointer to pass to the callback
+ * @param[in]  pDeviceRef        The device reference to communicate with
+ *
+ * @returns As ca821x_api_downstream_async
+ */
+ca_error MLME_GET_request_async(uint8_t               PIBAttribute,
+                                uint8_t               PIBAttributeIndex,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef);
+
+/**
+ * Non-blocking variant of MLME_SET_request_sync. The callback receives the MLME-SET confirm, laid out as a
+ * struct MAC_Message.
+ *
+ * @param[in]  PIBAttribute       Attribute Number
+ * @param[in]  PIBAttributeIndex  Index within an Attribute if an Array
+ * @param[in]  PIBAttributeLength Attribute Length
+ * @param[in]  pPIBAttributeValue Pointer to Attribute Value, copied before returning
+ * @param[in]  callback           Callback to call with the confirm
+ * @param[in]  context            Context pointer to pass to the callback
+ * @param[in]  pDeviceRef         The device reference to communicate with
+ *
+ * @returns As ca821x_api_downstream_async
+ */
+ca_error MLME_SET_request_async(uint8_t               PIBAttribute,
+                                uint8_t               PIBAttributeIndex,
+                                uint8_t               PIBAttributeLength,
+                                const void *          pPIBAttributeValue,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef);
+
+/**
+ * Non-blocking variant of HWME_GET_request_sync. The callback receives the HWME-GET confirm, laid out as a
+ * struct MAC_Message.
+ *
+ * @param[in]  HWAttribute Attribute Number
+ * @param[in]  callback    Callback to call with the confirm
+ * @param[in]  context     Context pointer to pass to the callback
+ * @param[in]  pDeviceRef  The device reference to communicate with
+ *
+ * @returns As ca821x_api_downstream_async
+ */
+ca_error HWME_GET_request_async(uint8_t               HWAttribute,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef);
+
+/**
+ * Non-blocking variant of HWME_SET_request_sync. The callback receives the HWME-SET confirm, laid out as a
+ * struct MAC_Message.
+ *
+ * @param[in]  HWAttribute       Attribute Number
+ * @param[in]  HWAttributeLength Attribute Length
+ * @param[in]  pHWAttributeValue Pointer to Attribute Value, copied before returning
+ * @param[in]  callback          Callback to call with the confirm
+ * @param[in]  context           Context pointer to pass to the callback
+ * @param[in]  pDeviceRef        The device reference to communicate with
+ *
+ * @returns As ca821x_api_downstream_async
+ */
+ca_error HWME_SET_request_async(uint8_t               HWAttribute,
+                                uint8_t               HWAttributeLength,
+                                const uint8_t *       pHWAttributeValue,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef);
+
+/**
+ * Apply a list of PIB and HWME SET and GET operations to a device, and report the status of each one. The
+ * operations are applied in order. If the device is a Chili running firmware that supports EVBME_PIB_BATCH,
+ * they are sent to it in as few EVBME_PIB_BATCH_REQUESTs as possible and applied locally over SPI. Otherwise
+ * they are pipelined as individual requests, so the whole list costs little more than a single round trip.
+ * GETs of attributes held in the PIB cache are answered without being sent.
+ *
+ * For GET operations, length must be set to the size of the value buffer, and is set to the length read.
+ * A value that does not fit is reported with MAC_INVALID_PARAMETER. Operations that could not be carried
+ * out report MAC_SYSTEM_ERROR.
+ *
+ * @param[in,out] aOps       The operations to apply, which are updated with their results
+ * @param[in]     aCount     The number of operations in aOps
+ * @param[in]     pDeviceRef The device reference to communicate with
+ *
+ * @retval CA_ERROR_SUCCESS Every operation was carried out, check their status for the result
+ * @retval CA_ERROR_INVALID_ARGS An operation is invalid or has a value that is too long, nothing was sent
+ * @retval CA_ERROR_INVALID_STATE The device is not initialised
+ * @retval CA_ERROR_TIMEOUT The device did not respond to some of the operations
+ */
+ca_error ca821x_util_pib_batch(struct ca821x_pib_op *aOps, size_t aCount, struct ca821x_dev *pDeviceRef);
+
+/**
+ * Enable or disable the PIB cache of a device. While enabled, the values of PIB and HWME attributes are
+ * remembered as they are set (MLME_SET_request_sync, HWME_SET_request_sync) and read, so that repeated
+ * MLME_GET_request_sync and HWME_GET_request_sync calls for them are answered without a round trip to the
+ * device. The cache is invalidated when the device is reset by MLME_RESET_request_sync, reports a wakeup, or
+ * changes its association, and when the exchange reports an error. Attributes that the device changes on its
+ * own (such as macDSN and HWME_EDVALUE) are never cached, see ca821x_util_set_pib_cacheable.
+ *
+ * The cache is disabled by default, unless the CASCODA_PIB_CACHE environment variable is set to 1.
+ *
+ * @param[in]  aEnable    true to enable the cache, false to disable and empty it
+ * @param[in]  pDeviceRef The device reference to configure
+ *
+ * @retval CA_ERROR_SUCCESS Success
+ * @retval CA_ERROR_INVALID_STATE The device is not initialised
+ */
+ca_error ca821x_util_enable_pib_cache(bool aEnable, struct ca821x_dev *pDeviceRef);
+
+/**
+ * Configure whether an attribute may be held in the PIB cache of a device.
+ *
+ * @param[in]  aType      The namespace of the attribute
+ * @param[in]  aAttribute The attribute ID
+ * @param[in]  aCacheable false if the attribute must always be read from the device
+ * @param[in]  pDeviceRef The device reference to configure
+ *
+ * @retval CA_ERROR_SUCCESS Success
+ * @retval CA_ERROR_INVALID_ARGS Invalid attribute namespace
+ * @retval CA_ERROR_INVALID_STATE The device is not initialised
+ */
+ca_error ca821x_util_set_pib_cacheable(enum ca821x_pib_cache_type aType,
+                                       uint8_t                    aAttribute,
+                                       bool                       aCacheable,
+                                       struct ca821x_dev *        pDeviceRef);
+
+/**
+ * Discard every value in the PIB cache of a device. This is only needed if the device has been reconfigured
+ * by means that the exchange cannot see.
+ *
+ * @param[in]  pDeviceRef The device reference whose cache to invalidate
+ *
+ * @retval CA_ERROR_SUCCESS Success
+ * @retval CA_ERROR_INVALID_STATE The device is not initialised
+ */
+ca_error ca821x_util_invalidate_pib_cache(struct ca821x_dev *pDeviceRef);
+
+/**
+ * Get the hit and miss statistics of the PIB cache of a device.
+ *
+ * @param[out] aStats     The PIB cache statistics
+ * @param[in]  pDeviceRef The device reference to query
+ *
+ * @retval CA_ERROR_SUCCESS Statistics retrieved
+ * @retval CA_ERROR_INVALID_STATE The device is not initialised
+ */
+ca_error ca821x_util_get_pib_cache_stats(struct ca821x_pib_cache_stats *aStats, struct ca821x_dev *pDeviceRef);
+
+/**
+ * Get the statistics of the message queues used by the exchange, such as the number of messages
+ * currently queued, the high water mark and the number of messages dropped due to a full queue.
+ * Any of the output pointers may be NULL if those statistics are not required.
+ *
+ * @param[out] in_stats   Statistics for the synchronous requests awaiting a response from the device
+ * @param[out] out_stats  Statistics for the host to device queue
+ * @param[out] dd_stats   Statistics for the downstream dispatch queue used by the device
+ * @param[in]  pDeviceRef The device reference to get queue statistics of. May be NULL if only
+ *                        dd_stats is requested in ca821x_dispatch_global mode.
+ *
+ * @retval CA_ERROR_SUCCESS Statistics retrieved
+ * @retval CA_ERROR_INVALID_ARGS Device statistics requested with no device reference
+ */
+ca_error exchange_get_queue_stats(struct buffer_queue_stats *in_stats,
+                                  struct buffer_queue_stats *out_stats,
+                                  struct buffer_queue_stats *dd_stats,
+                                  struct ca821x_dev *        pDeviceRef);
+
 #ifdef __cplusplus
 }
 #endif
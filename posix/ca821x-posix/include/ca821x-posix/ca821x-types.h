@@ -74,6 +74,28 @@ typedef ca_error (*ca821x_errorhandler)(ca_error error, struct ca821x_dev *pDevi
  */
 typedef ca_error (*exchange_user_callback)(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef);
 
+/**
+ * \brief Asynchronous request completion callback
+ *
+ * Called when the synchronous response to a request sent with
+ * ca821x_api_downstream_async arrives, or when the request fails. It is
+ * called from the thread servicing the exchange, so must not block, and
+ * must not make synchronous requests to the same device.
+ *
+ * \param status CA_ERROR_SUCCESS if the response was received,
+ *               CA_ERROR_TIMEOUT if it did not arrive in time, or
+ *               CA_ERROR_INVALID_STATE if the device was deinitialised
+ * \param response The response message (command ID, length and payload), or
+ *                 NULL if status is not CA_ERROR_SUCCESS. Only valid for the
+ *                 duration of the callback.
+ * \param context The context pointer passed with the request
+ * \param pDeviceRef a Pointer to the relevant pDeviceRef struct
+ */
+typedef void (*ca821x_async_callback)(ca_error           status,
+                                      const uint8_t *    response,
+                                      void *             context,
+                                      struct ca821x_dev *pDeviceRef);
+
 /**
  *  \brief Exchange write function
  *
@@ -111,7 +133,9 @@ typedef ca_error (*exchange_write_isready)(struct ca821x_dev *pDeviceRef);
  * a length of zero is still functionally correct).
  *
  * If the function does block, it must be able to be woken by a call
- * to the associated exchange_signal_read implementation.
+ * to the associated exchange_signal_read implementation. Alternatively,
+ * an exchange that sets split_io may block for a bounded time without
+ * being woken, as writes are then handled by a separate thread.
  *
  * \param buf buffer containing the message read from the ca821x
  * \param pDeviceRef a Pointer to the relevant pDeviceRef struct
@@ -146,6 +170,21 @@ typedef void (*exchange_signal_read)(struct ca821x_dev *pDeviceRef);
  */
 typedef void (*exchange_flush_unread)(struct ca821x_dev *pDeviceRef);
 
+/**
+ *  \brief Exchange file descriptor function
+ *
+ * Optional function for the exchange to implement. The implementation should
+ * return a file descriptor that becomes readable (in the epoll sense) when the
+ * associated exchange_read function has data to return. Exchanges that provide
+ * this can be serviced by a shared reactor thread instead of a dedicated io
+ * thread, in which case exchange_read must not block.
+ *
+ * \param pDeviceRef a Pointer to the relevant pDeviceRef struct
+ *
+ * \returns The file descriptor, or -1 if not available
+ */
+typedef int (*exchange_get_fd)(struct ca821x_dev *pDeviceRef);
+
 /** Enumeration for identifying the underlying exchange interface type */
 enum ca821x_exchange_type
 {
@@ -154,23 +193,184 @@ enum ca821x_exchange_type
 	ca821x_exchange_uart,       //!< UART device
 };
 
-/** Single item in a singly-linked list of data buffers */
+/** Maximum size of a single buffer held in a buffer_queue */
+#define CA821X_QUEUE_BUF_SIZE 256
+
+/** Padding used to keep the producer and consumer indices of a buffer_queue on separate cache lines */
+#define CA821X_QUEUE_CACHE_LINE 64
+
+/** Single preallocated slot in the ring of data buffers */
 struct buffer_queue_item
 {
-	size_t                    len;        //!< Length of buffer
-	uint8_t *                 buf;        //!< Buffer pointer
-	struct ca821x_dev *       pDeviceRef; //!< Data's target/originating device
-	struct buffer_queue_item *next;       //!< Next queue item
+	size_t             len;                        //!< Length of buffer
+	struct ca821x_dev *pDeviceRef;                 //!< Data's target/originating device
+	uint8_t            buf[CA821X_QUEUE_BUF_SIZE]; //!< Buffer storage
+};
+
+/** Statistics for a single buffer_queue */
+struct buffer_queue_stats
+{
+	size_t   depth;      //!< Number of slots in the queue (CASCODA_POSIX_QUEUE_DEPTH)
+	size_t   count;      //!< Number of buffers currently queued
+	size_t   high_water; //!< Highest number of buffers that have been queued at once
+	uint32_t overflows;  //!< Number of buffers that could not be queued because the queue was full
 };
 
-/** Queue struct for singly-linked list of buffer_queue_items */
+/**
+ * Fixed-capacity ring of buffer_queue_items. Producers are serialised by p_mutex, the single
+ * consumer is lock-free. q_mutex and q_cond are only used to block while waiting for the ring
+ * to become non-empty or empty.
+ */
 struct buffer_queue
 {
-	struct buffer_queue_item *head;
-	pthread_mutex_t           q_mutex;
-	pthread_cond_t            q_cond;
+	size_t  head;                                               //!< Consumer index (free-running)
+	uint8_t head_pad[CA821X_QUEUE_CACHE_LINE - sizeof(size_t)]; //!< Keep head and tail on separate cache lines
+	size_t  tail;                                               //!< Producer index (free-running)
+	uint8_t tail_pad[CA821X_QUEUE_CACHE_LINE - sizeof(size_t)]; //!< Keep tail and the shared fields apart
+	int     waiters;                                            //!< Number of threads blocked on q_cond
+
+	size_t   high_water; //!< Highest number of buffers queued at once (protected by p_mutex)
+	uint32_t overflows;  //!< Number of failed add_to_queue calls (protected by p_mutex)
+
+	pthread_mutex_t p_mutex; //!< Serialises producers
+	pthread_mutex_t q_mutex; //!< Mutex for q_cond
+	pthread_cond_t  q_cond;  //!< Signalled when the queue changes and there are waiters
+
+	struct buffer_queue_item items[CASCODA_POSIX_QUEUE_DEPTH]; //!< Preallocated ring storage
+};
+
+/** A synchronous request that has been sent to the device and is waiting for its response */
+struct ca821x_pending_request
+{
+	ca821x_async_callback callback;    //!< Completion callback, NULL if the slot is free
+	void *                context;     //!< Context pointer passed to the callback
+	uint64_t              seq;         //!< Sequence number, identifying the request within its slot
+	uint64_t              deadline_us; //!< Monotonic time at which the request times out, in microseconds
+	uint8_t               rsp_id;      //!< Command ID of the expected response, 0 to accept any response
+};
+
+/**
+ * Ring of the synchronous requests of a device that are waiting for their responses, in the order
+ * that they were sent. Responses are matched to the oldest pending request expecting that command ID.
+ */
+struct ca821x_pending_requests
+{
+	size_t          head;       //!< Index of the oldest slot that may be in use (free-running)
+	size_t          tail;       //!< Index of the next slot to use (free-running)
+	uint64_t        next_seq;   //!< Sequence number for the next request
+	size_t          count;      //!< Number of requests currently pending, including timed out ones
+	size_t          high_water; //!< Highest number of requests pending at once
+	uint32_t        overflows;  //!< Number of requests rejected because the ring was full
+	pthread_mutex_t mutex;      //!< Protects the ring, and is used with sync_cond
+
+	struct ca821x_pending_request slots[CASCODA_POSIX_QUEUE_DEPTH]; //!< Request slots
+};
+
+/** Number of attribute values held by the PIB cache of each device */
+#define CA821X_PIB_CACHE_ENTRIES 32
+
+/** Longest attribute value held by the PIB cache, longer attributes are never cached */
+#define CA821X_PIB_CACHE_MAX_LEN 16
+
+/** Attribute namespaces held by the PIB cache */
+enum ca821x_pib_cache_type
+{
+	ca821x_pib_cache_mlme = 0, //!< MLME PIB attributes (MLME-GET/MLME-SET)
+	ca821x_pib_cache_hwme,     //!< HWME attributes (HWME-GET/HWME-SET)
+	ca821x_pib_cache_types     //!< Number of attribute namespaces
+};
+
+/** A single operation of a PIB batch, see ca821x_util_pib_batch */
+struct ca821x_pib_op
+{
+	uint8_t  op;        //!< enum evbme_pib_batch_op
+	uint8_t  attribute; //!< PIB or HWME attribute ID
+	uint8_t  index;     //!< PIB attribute index, ignored for HWME attributes
+	uint8_t  length;    //!< SET: length of value. GET: size of value on input, length read on output
+	uint8_t *value;     //!< SET: value to write. GET: buffer for the value read
+	uint8_t  status;    //!< Output: MAC status of the operation
+};
+
+/** Statistics for the PIB cache of a device */
+struct ca821x_pib_cache_stats
+{
+	uint64_t hits;          //!< Number of GET requests answered from the cache
+	uint64_t misses;        //!< Number of GET requests sent to the device while the cache was enabled
+	uint64_t invalidations; //!< Number of times the whole cache has been invalidated
+	uint32_t entries;       //!< Number of attribute values currently cached
+};
+
+/** A single cached attribute value */
+struct ca821x_pib_cache_entry
+{
+	uint8_t valid;                           //!< Is the entry in use?
+	uint8_t type;                            //!< enum ca821x_pib_cache_type of the attribute
+	uint8_t attribute;                       //!< Attribute ID
+	uint8_t index;                           //!< Attribute index (always 0 for HWME attributes)
+	uint8_t length;                          //!< Length of the value
+	uint8_t value[CA821X_PIB_CACHE_MAX_LEN]; //!< Attribute value
+};
+
+/** Write-through cache of the PIB and HWME attributes of a device, kept by the exchange */
+struct ca821x_pib_cache
+{
+	pthread_mutex_t mutex;       //!< Protects the cache
+	int             enabled;     //!< Is the cache in use?
+	size_t          next_victim; //!< Entry to replace next when the cache is full
+
+	uint8_t  nocache[ca821x_pib_cache_types][32]; //!< Bitmaps of the attributes that must not be cached
+	uint64_t hits;                                //!< Number of GET requests answered from the cache
+	uint64_t misses;                              //!< Number of GET requests sent to the device
+	uint64_t invalidations;                       //!< Number of times the whole cache has been invalidated
+
+	uint64_t generation;                           //!< Incremented by every change to the cached attributes
+	uint64_t invalidated;                          //!< Generation at which the whole cache was last invalidated
+	uint64_t changed[ca821x_pib_cache_types][256]; //!< Generation at which each attribute was last set
+
+	struct ca821x_pib_cache_entry entries[CA821X_PIB_CACHE_ENTRIES]; //!< Cached attribute values
+};
+
+/** Mode of operation for the downstream dispatch worker */
+enum ca821x_dispatch_mode
+{
+	ca821x_dispatch_global = 0, //!< A single worker thread dispatches the messages of every device
+	ca821x_dispatch_per_device, //!< Each device has its own worker thread, so devices are dispatched in parallel
 };
 
+/** Statistics for a downstream dispatch worker */
+struct ca821x_dispatch_stats
+{
+	struct buffer_queue_stats queue;            //!< Statistics of the queue feeding the worker
+	uint64_t                  dispatched;       //!< Number of messages dispatched
+	uint64_t                  latency_total_us; //!< Total time spent in dispatch handlers, in microseconds
+	uint64_t                  latency_max_us;   //!< Longest time spent in a single dispatch handler, in microseconds
+};
+
+/** A downstream dispatch queue, and the worker thread that services it */
+struct ca821x_dispatcher
+{
+	struct buffer_queue queue;            //!< Queue of buffers waiting to be dispatched
+	pthread_t           thread;           //!< Worker thread
+	int                 run_flag;         //!< Is the worker thread supposed to be running? (protected by s_flag_mutex)
+	pthread_mutex_t     stats_mutex;      //!< Mutex protecting the statistics
+	uint64_t            dispatched;       //!< Number of messages dispatched
+	uint64_t            latency_total_us; //!< Total time spent in dispatch handlers
+	uint64_t            latency_max_us;   //!< Longest time spent in a single dispatch handler
+};
+
+/** Statistics for the exchange reactor threads, summed across all threads */
+struct ca821x_reactor_stats
+{
+	uint32_t threads;  //!< Number of reactor threads running
+	uint32_t devices;  //!< Number of devices being serviced by the reactor threads
+	uint64_t wakeups;  //!< Number of times a reactor thread has returned from epoll_wait
+	uint64_t events;   //!< Number of device readiness events handled
+	uint64_t signals;  //!< Number of write wakeups handled
+	uint64_t timeouts; //!< Number of periodic timeout ticks handled
+};
+
+struct ca821x_reactor;
+
 /** Base structure for exchange private data collections */
 struct ca821x_exchange_base
 {
@@ -183,17 +383,31 @@ struct ca821x_exchange_base
 	exchange_signal_read   signal_func;        //!< Exchange write signalling callback
 	exchange_read          read_func;          //!< Exchange read callback
 	exchange_flush_unread  flush_func;         //!< Exchange flush callback
+	exchange_get_fd        get_fd_func;        //!< Exchange file descriptor callback (optional)
 
 	//Synchronous queue
-	pthread_t       io_thread;         //!< Thread for io handling
-	int             io_thread_runflag; //!< flag to shutdown io thread
-	pthread_mutex_t flag_mutex;        //!< mutex for generic flag handling
-	pthread_cond_t  sync_cond;         //!< condition variable for synchronous exchanges
-	pthread_mutex_t sync_mutex;        //!< mutex for synchronous exchanges
+	pthread_t              io_thread;         //!< Thread for io handling
+	pthread_t              io_write_thread;   //!< Thread for writes, if split_io is set
+	int                    io_thread_runflag; //!< flag to shutdown io thread
+	int                    split_io;          //!< read_func blocks, so io_thread only reads and io_write_thread writes
+	struct ca821x_reactor *reactor;           //!< Reactor servicing this device instead of io_thread, or NULL
+	pthread_mutex_t        flag_mutex;        //!< mutex for generic flag handling
+	pthread_cond_t         sync_cond;         //!< signalled when a synchronous exchange completes
+	pthread_mutex_t        sync_mutex;        //!< keeps pending requests in the order they are queued for sending
+
+	//Synchronous requests awaiting responses from the device
+	struct ca821x_pending_requests pending; //!< pending requests
 
-	//In queue = Device to host(us)
 	//Out queue = Host(us) to device
-	struct buffer_queue in_buffer_queue, out_buffer_queue; //!< queues
+	struct buffer_queue out_buffer_queue; //!< queue
+
+	//Shadow copies of device attributes, to avoid GET round trips
+	struct ca821x_pib_cache pib_cache;       //!< PIB cache
+	int                     pib_batch_limit; //!< Longest EVBME_PIB_BATCH_REQUEST, 0 if unsupported, -1 if not probed
+
+	//Downstream dispatch for ca821x_dispatch_per_device mode
+	struct ca821x_dispatcher dispatcher; //!< Per-device dispatch queue & worker
+	struct ca821x_dev *      next_dev;   //!< Next device in the list of initialised devices
 
 	struct EVBME_callbacks evbme_callbacks; //!< EVBME Callback struct
 };
@@ -34,17 +34,22 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "ca821x-posix/ca821x-posix.h"
 #include "ca821x-generic-exchange.h"
+#include "ca821x-pib-cache.h"
 #include "ca821x-posix-evbme-internal.h"
 #include "ca821x-queue.h"
+#include "ca821x-reactor.h"
 #include "ca821x_api.h"
+#include "evbme_messages.h"
 
 enum
 {
-	SYNC_TIMEOUT_S = 5
+	SYNC_TIMEOUT_S = 5, //!< Time to wait for the response to a synchronous request
+	LATE_TIMEOUT_S = 5, //!< Time to keep discarding the response to a request that has timed out
 };
 
 /** Is the downstream dispatch thread supposed to be running? */
@@ -56,31 +61,83 @@ static int generic_initialised = 0;
 /** Mutex for protecting static flags */
 static pthread_mutex_t s_flag_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/** Queue of buffers to be processed by downstream dispatch */
-static struct buffer_queue downstream_dispatch_queue = {NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+/** Dispatch mode, can only be changed when no devices are initialised */
+static enum ca821x_dispatch_mode dd_mode = ca821x_dispatch_global;
 
-/** Thread for running the downstream dispatch functions on the dd queue */
-static pthread_t dd_thread;
+/** Dispatcher used by every device in ca821x_dispatch_global mode */
+static struct ca821x_dispatcher downstream_dispatcher;
+
+/** Once control for initialising the global dispatcher */
+static pthread_once_t dd_once = PTHREAD_ONCE_INIT;
+
+/** List of initialised devices, for starting and stopping the per-device workers */
+static struct ca821x_dev *dev_list = NULL;
+
+/** Mutex protecting dev_list, and serialising the starting & stopping of workers */
+static pthread_mutex_t s_dev_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void (*wake_hw_worker)(void);
 
 static void     init_generic_statics(void);
 static ca_error deinit_generic_statics(void);
+static void     fail_pending(ca_error status, uint64_t before_us, struct ca821x_dev *pDeviceRef);
 
-static int ca821x_run_downstream_dispatch()
+static void init_dispatcher(struct ca821x_dispatcher *dispatcher)
+{
+	init_queue(&dispatcher->queue);
+	pthread_mutex_init(&dispatcher->stats_mutex, NULL);
+	dispatcher->run_flag         = 0;
+	dispatcher->dispatched       = 0;
+	dispatcher->latency_total_us = 0;
+	dispatcher->latency_max_us   = 0;
+}
+
+static void deinit_dispatcher(struct ca821x_dispatcher *dispatcher)
+{
+	flush_queue(&dispatcher->queue);
+	deinit_queue(&dispatcher->queue);
+	pthread_mutex_destroy(&dispatcher->stats_mutex);
+}
+
+static void init_global_dispatcher(void)
+{
+	init_dispatcher(&downstream_dispatcher);
+}
+
+static struct ca821x_dispatcher *get_dispatcher(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+
+	if (dd_mode == ca821x_dispatch_per_device)
+		return &priv->dispatcher;
+
+	return &downstream_dispatcher;
+}
+
+static uint64_t get_monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int ca821x_run_downstream_dispatch(struct ca821x_dispatcher *dispatcher)
 {
 	struct ca821x_dev *          pDeviceRef;
 	struct ca821x_exchange_base *priv;
 	uint8_t                      buffer[MAX_BUF_SIZE];
 	ca_error                     rval;
 	int                          len;
+	uint64_t                     start_us, latency_us;
 
-	len = pop_from_queue(&downstream_dispatch_queue, buffer, MAX_BUF_SIZE, &pDeviceRef);
+	len = pop_from_queue(&dispatcher->queue, buffer, MAX_BUF_SIZE, &pDeviceRef);
 
 	if (len > 0)
 	{
-		priv = pDeviceRef->exchange_context;
-		rval = ca821x_downstream_dispatch((struct MAC_Message *)buffer, pDeviceRef);
+		start_us = get_monotonic_us();
+		priv     = pDeviceRef->exchange_context;
+		rval     = ca821x_downstream_dispatch((struct MAC_Message *)buffer, pDeviceRef);
 
 		if (rval != CA_ERROR_SUCCESS)
 		{
@@ -91,6 +148,14 @@ static int ca821x_run_downstream_dispatch()
 		{
 			priv->user_callback(buffer, len, pDeviceRef);
 		}
+
+		latency_us = get_monotonic_us() - start_us;
+		pthread_mutex_lock(&dispatcher->stats_mutex);
+		dispatcher->dispatched++;
+		dispatcher->latency_total_us += latency_us;
+		if (latency_us > dispatcher->latency_max_us)
+			dispatcher->latency_max_us = latency_us;
+		pthread_mutex_unlock(&dispatcher->stats_mutex);
 	}
 
 	return len;
@@ -98,7 +163,10 @@ static int ca821x_run_downstream_dispatch()
 
 ca_error ca821x_util_dispatch_poll()
 {
-	int is_async;
+	int                          is_async;
+	struct ca821x_dev *          dev;
+	struct ca821x_exchange_base *priv;
+	int                          len = 0;
 
 	pthread_mutex_lock(&s_flag_mutex);
 	is_async = dd_run_flag;
@@ -107,7 +175,23 @@ ca_error ca821x_util_dispatch_poll()
 	if (is_async)
 		return CA_ERROR_INVALID_STATE;
 
-	if (ca821x_run_downstream_dispatch())
+	if (dd_mode == ca821x_dispatch_global)
+	{
+		len = ca821x_run_downstream_dispatch(&downstream_dispatcher);
+	}
+	else
+	{
+		//Dispatch the first pending message, favouring devices at the head of the list
+		pthread_mutex_lock(&s_dev_list_mutex);
+		for (dev = dev_list; dev && !len; dev = priv->next_dev)
+		{
+			priv = dev->exchange_context;
+			len  = ca821x_run_downstream_dispatch(&priv->dispatcher);
+		}
+		pthread_mutex_unlock(&s_dev_list_mutex);
+	}
+
+	if (len)
 		return CA_ERROR_SUCCESS;
 	else
 		return CA_ERROR_NOT_FOUND;
@@ -115,16 +199,16 @@ ca_error ca821x_util_dispatch_poll()
 
 static void *ca821x_downstream_dispatch_worker(void *arg)
 {
-	(void)arg;
+	struct ca821x_dispatcher *dispatcher = arg;
 
 	pthread_mutex_lock(&s_flag_mutex);
-	while (dd_run_flag)
+	while (dispatcher->run_flag)
 	{
 		pthread_mutex_unlock(&s_flag_mutex);
 
-		wait_on_queue(&downstream_dispatch_queue, 0);
+		wait_on_queue(&dispatcher->queue, 0);
 
-		ca821x_run_downstream_dispatch();
+		ca821x_run_downstream_dispatch(dispatcher);
 
 		pthread_mutex_lock(&s_flag_mutex);
 	}
@@ -133,55 +217,164 @@ static void *ca821x_downstream_dispatch_worker(void *arg)
 	return 0;
 }
 
-ca_error ca821x_util_start_downstream_dispatch_worker()
+static ca_error start_dispatcher(struct ca821x_dispatcher *dispatcher)
+{
+	pthread_mutex_lock(&s_flag_mutex);
+	dispatcher->run_flag = 1;
+	pthread_mutex_unlock(&s_flag_mutex);
+
+	if (pthread_create(&dispatcher->thread, NULL, &ca821x_downstream_dispatch_worker, dispatcher))
+	{
+		pthread_mutex_lock(&s_flag_mutex);
+		dispatcher->run_flag = 0;
+		pthread_mutex_unlock(&s_flag_mutex);
+		return CA_ERROR_FAIL;
+	}
+
+	return CA_ERROR_SUCCESS;
+}
+
+static ca_error stop_dispatcher(struct ca821x_dispatcher *dispatcher)
 {
-	int rval = 0;
 	int old_runflag;
 
 	pthread_mutex_lock(&s_flag_mutex);
-	old_runflag = dd_run_flag;
+	old_runflag          = dispatcher->run_flag;
+	dispatcher->run_flag = 0;
 	pthread_mutex_unlock(&s_flag_mutex);
 
-	if (old_runflag)
-		return CA_ERROR_ALREADY;
+	if (!old_runflag)
+		return CA_ERROR_SUCCESS;
+
+	//Wake the downstream dispatch thread up so that it dies cleanly
+	add_to_queue(&dispatcher->queue, NULL, 0, NULL);
+
+	return pthread_join(dispatcher->thread, NULL) ? CA_ERROR_FAIL : CA_ERROR_SUCCESS;
+}
+
+ca_error ca821x_util_set_dispatch_mode(enum ca821x_dispatch_mode mode)
+{
+	ca_error error = CA_ERROR_SUCCESS;
+
+	pthread_mutex_lock(&s_dev_list_mutex);
+	pthread_mutex_lock(&s_flag_mutex);
+	if (dd_run_flag || dev_list)
+		error = CA_ERROR_INVALID_STATE;
+	else
+		dd_mode = mode;
+	pthread_mutex_unlock(&s_flag_mutex);
+	pthread_mutex_unlock(&s_dev_list_mutex);
 
+	return error;
+}
+
+ca_error ca821x_util_start_downstream_dispatch_worker()
+{
+	ca_error                     error = CA_ERROR_SUCCESS;
+	struct ca821x_dev *          dev;
+	struct ca821x_exchange_base *priv;
+	int                          old_runflag;
+
+	pthread_once(&dd_once, &init_global_dispatcher);
+
+	pthread_mutex_lock(&s_dev_list_mutex);
 	pthread_mutex_lock(&s_flag_mutex);
+	old_runflag = dd_run_flag;
 	dd_run_flag = 1;
 	pthread_mutex_unlock(&s_flag_mutex);
 
-	rval = pthread_create(&dd_thread, NULL, &ca821x_downstream_dispatch_worker, NULL);
+	if (old_runflag)
+	{
+		error = CA_ERROR_ALREADY;
+		goto exit;
+	}
+
+	if (dd_mode == ca821x_dispatch_global)
+	{
+		error = start_dispatcher(&downstream_dispatcher);
+	}
+	else
+	{
+		//Devices initialised later start their own worker in init_generic
+		for (dev = dev_list; dev && !error; dev = priv->next_dev)
+		{
+			priv  = dev->exchange_context;
+			error = start_dispatcher(&priv->dispatcher);
+		}
+	}
 
-	return rval ? CA_ERROR_FAIL : CA_ERROR_SUCCESS;
+exit:
+	pthread_mutex_unlock(&s_dev_list_mutex);
+	return error;
 }
 
 ca_error ca821x_util_stop_downstream_dispatch_worker()
 {
-	int rval = 0;
-	int old_runflag;
+	ca_error                     error = CA_ERROR_SUCCESS;
+	struct ca821x_dev *          dev;
+	struct ca821x_exchange_base *priv;
+	int                          old_runflag;
 
+	pthread_mutex_lock(&s_dev_list_mutex);
 	pthread_mutex_lock(&s_flag_mutex);
 	old_runflag = dd_run_flag;
+	dd_run_flag = 0;
 	pthread_mutex_unlock(&s_flag_mutex);
 
 	if (!old_runflag)
-		return CA_ERROR_ALREADY;
+	{
+		error = CA_ERROR_ALREADY;
+		goto exit;
+	}
 
-	pthread_mutex_lock(&s_flag_mutex);
-	dd_run_flag = 0;
-	pthread_mutex_unlock(&s_flag_mutex);
+	if (dd_mode == ca821x_dispatch_global)
+	{
+		error = stop_dispatcher(&downstream_dispatcher);
+	}
+	else
+	{
+		for (dev = dev_list; dev; dev = priv->next_dev)
+		{
+			priv = dev->exchange_context;
+			if (stop_dispatcher(&priv->dispatcher))
+				error = CA_ERROR_FAIL;
+		}
+	}
 
-	//Wake the downstream dispatch thread up so that it dies cleanly
-	add_to_queue(&downstream_dispatch_queue, NULL, 0, NULL);
+exit:
+	pthread_mutex_unlock(&s_dev_list_mutex);
+	return error;
+}
+
+ca_error ca821x_util_get_dispatch_stats(struct ca821x_dispatch_stats *aStats, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_dispatcher *dispatcher;
+
+	pthread_once(&dd_once, &init_global_dispatcher);
 
-	rval = pthread_join(dd_thread, NULL);
+	if (dd_mode == ca821x_dispatch_global)
+		dispatcher = &downstream_dispatcher;
+	else if (pDeviceRef)
+		dispatcher = get_dispatcher(pDeviceRef);
+	else
+		return CA_ERROR_INVALID_ARGS;
 
-	return rval ? CA_ERROR_FAIL : CA_ERROR_SUCCESS;
+	get_queue_stats(&dispatcher->queue, &aStats->queue);
+
+	pthread_mutex_lock(&dispatcher->stats_mutex);
+	aStats->dispatched       = dispatcher->dispatched;
+	aStats->latency_total_us = dispatcher->latency_total_us;
+	aStats->latency_max_us   = dispatcher->latency_max_us;
+	pthread_mutex_unlock(&dispatcher->stats_mutex);
+
+	return CA_ERROR_SUCCESS;
 }
 
 ca_error init_generic(struct ca821x_dev *pDeviceRef)
 {
 	ca_error                     error = CA_ERROR_SUCCESS;
 	struct ca821x_exchange_base *base  = pDeviceRef->exchange_context;
+	int                          start_dd;
 
 	ca_log_debg("Initialising generic part of exchange...");
 
@@ -189,16 +382,49 @@ ca_error init_generic(struct ca821x_dev *pDeviceRef)
 
 	pthread_mutex_init(&(base->flag_mutex), NULL);
 	pthread_mutex_init(&(base->sync_mutex), NULL);
-	pthread_mutex_init(&(base->in_buffer_queue.q_mutex), NULL);
-	pthread_mutex_init(&(base->out_buffer_queue.q_mutex), NULL);
-	pthread_cond_init(&(base->in_buffer_queue.q_cond), NULL);
-	pthread_cond_init(&(base->out_buffer_queue.q_cond), NULL);
 	pthread_cond_init(&(base->sync_cond), NULL);
+	pthread_mutex_init(&(base->pending.mutex), NULL);
+	init_queue(&(base->out_buffer_queue));
+	pib_cache_init(&(base->pib_cache));
+	base->pib_batch_limit = -1;
+	init_dispatcher(&(base->dispatcher));
+
+	pthread_mutex_lock(&s_dev_list_mutex);
+	base->next_dev = dev_list;
+	dev_list       = pDeviceRef;
+	pthread_mutex_lock(&s_flag_mutex);
+	start_dd = dd_run_flag && (dd_mode == ca821x_dispatch_per_device);
+	pthread_mutex_unlock(&s_flag_mutex);
+	if (start_dd && start_dispatcher(&(base->dispatcher)))
+	{
+		error = CA_ERROR_FAIL;
+		ca_log_warn("Failed to start dispatch thread!");
+	}
+	pthread_mutex_unlock(&s_dev_list_mutex);
+
+	//Use a shared reactor thread if one is running and the exchange supports it
+	if (reactor_register(pDeviceRef) == CA_ERROR_SUCCESS)
+	{
+		ca_log_debg("Device registered with reactor.");
+		return error;
+	}
 
 	pthread_mutex_lock(&base->flag_mutex);
 	base->io_thread_runflag = 1;
 	pthread_mutex_unlock(&base->flag_mutex);
 
+	if (base->split_io)
+	{
+		//Flush before anything can be written, so that no responses are discarded
+		base->flush_func(pDeviceRef);
+
+		if (pthread_create(&(base->io_write_thread), NULL, &ca821x_io_write_worker, pDeviceRef))
+		{
+			error = CA_ERROR_FAIL;
+			ca_log_warn("Failed to start io write thread!");
+		}
+	}
+
 	ca_log_debg("Initialising io thread.");
 	if (pthread_create(&(base->io_thread), NULL, &ca821x_io_worker, pDeviceRef))
 	{
@@ -213,23 +439,50 @@ ca_error deinit_generic(struct ca821x_dev *pDeviceRef)
 {
 	ca_error                     error = CA_ERROR_SUCCESS;
 	struct ca821x_exchange_base *priv  = pDeviceRef->exchange_context;
+	struct ca821x_dev **         dev;
 
-	pthread_mutex_lock(&priv->flag_mutex);
-	priv->io_thread_runflag = 0;
-	pthread_mutex_unlock(&priv->flag_mutex);
+	if (priv->reactor)
+	{
+		reactor_unregister(pDeviceRef);
+	}
+	else
+	{
+		pthread_mutex_lock(&priv->flag_mutex);
+		priv->io_thread_runflag = 0;
+		pthread_mutex_unlock(&priv->flag_mutex);
+
+		pthread_join(priv->io_thread, NULL);
+
+		if (priv->split_io)
+		{
+			//Wake the write thread up so that it dies cleanly
+			add_to_queue(&priv->out_buffer_queue, NULL, 0, NULL);
+			pthread_join(priv->io_write_thread, NULL);
+		}
+	}
 
-	pthread_join(priv->io_thread, NULL);
+	pthread_mutex_lock(&s_dev_list_mutex);
+	for (dev = &dev_list; *dev; dev = &(((struct ca821x_exchange_base *)(*dev)->exchange_context)->next_dev))
+	{
+		if (*dev == pDeviceRef)
+		{
+			*dev = priv->next_dev;
+			break;
+		}
+	}
+	stop_dispatcher(&(priv->dispatcher));
+	pthread_mutex_unlock(&s_dev_list_mutex);
+	deinit_dispatcher(&(priv->dispatcher));
 
-	flush_queue(&priv->in_buffer_queue);
 	flush_queue(&priv->out_buffer_queue);
+	fail_pending(CA_ERROR_INVALID_STATE, 0, pDeviceRef);
 
 	pthread_mutex_destroy(&(priv->flag_mutex));
 	pthread_mutex_destroy(&(priv->sync_mutex));
-	pthread_mutex_destroy(&(priv->in_buffer_queue.q_mutex));
-	pthread_mutex_destroy(&(priv->in_buffer_queue.q_mutex));
-	pthread_cond_destroy(&(priv->in_buffer_queue.q_cond));
-	pthread_cond_destroy(&(priv->in_buffer_queue.q_cond));
 	pthread_cond_destroy(&(priv->sync_cond));
+	pthread_mutex_destroy(&(priv->pending.mutex));
+	deinit_queue(&(priv->out_buffer_queue));
+	pib_cache_deinit(&(priv->pib_cache));
 
 	priv->error_callback = NULL;
 
@@ -240,6 +493,7 @@ ca_error deinit_generic(struct ca821x_dev *pDeviceRef)
 
 static void init_generic_statics()
 {
+	pthread_once(&dd_once, &init_global_dispatcher);
 	generic_initialised++;
 }
 
@@ -247,17 +501,268 @@ static ca_error deinit_generic_statics()
 {
 	ca_error error = CA_ERROR_SUCCESS;
 
-	if (!(--generic_initialised))
+	//Only tear down once the last device has been deinitialised. The dispatch worker is left running, as it is
+	//started and stopped by the application, which may initialise more devices later.
+	if (--generic_initialised)
 		goto exit;
 
-	error = ca821x_util_stop_downstream_dispatch_worker();
+	flush_queue(&downstream_dispatcher.queue);
 
-	flush_queue(&downstream_dispatch_queue);
+exit:
+	return error;
+}
+
+/**
+ * Wake whatever is servicing the io of a device, so that it sends the queued messages.
+ */
+static void signal_write(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+
+	if (priv->reactor)
+		reactor_signal(pDeviceRef);
+	else if (priv->signal_func)
+		priv->signal_func(pDeviceRef);
+}
+
+/**
+ * Add a buffer to the out queue of a device. If the queue is full, wait for the io thread
+ * to drain it before trying again.
+ */
+static ca_error queue_for_send(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv  = pDeviceRef->exchange_context;
+	ca_error                     error = add_to_queue(&(priv->out_buffer_queue), buf, len, pDeviceRef);
+
+	if (error == CA_ERROR_NO_BUFFER)
+	{
+		signal_write(pDeviceRef);
+
+		if (wait_on_queue_empty(&(priv->out_buffer_queue), SYNC_TIMEOUT_S) == CA_ERROR_SUCCESS)
+			error = add_to_queue(&(priv->out_buffer_queue), buf, len, pDeviceRef);
+	}
+
+	return error;
+}
+
+/**
+ * Get the command ID of the response to a synchronous request, or 0 if it is not known, in which case
+ * any synchronous response is accepted.
+ */
+static uint8_t get_response_id(uint8_t cmdid)
+{
+	switch (cmdid)
+	{
+	case EVBME_GET_REQUEST:
+		return EVBME_GET_CONFIRM;
+	case EVBME_SET_REQUEST:
+		return EVBME_SET_CONFIRM;
+	case EVBME_PIB_BATCH_REQUEST:
+		return EVBME_PIB_BATCH_CONFIRM;
+	default:
+		return ca821x_get_sync_response_id(cmdid);
+	}
+}
+
+/** Move the head of the pending ring past the slots that have been freed. Must hold pending->mutex. */
+static void advance_pending(struct ca821x_pending_requests *pending)
+{
+	while (pending->head != pending->tail && !pending->slots[pending->head % CASCODA_POSIX_QUEUE_DEPTH].callback)
+		pending->head++;
+}
+
+/**
+ * Add a request to the end of the pending ring, before it is queued for sending.
+ * @param[out] aSlot The slot index of the request, for cancel_pending
+ * @param[out] aSeq  The sequence number of the request, for cancel_pending
+ */
+static ca_error add_pending(uint8_t               cmdid,
+                            ca821x_async_callback callback,
+                            void *                context,
+                            size_t *              aSlot,
+                            uint64_t *            aSeq,
+                            struct ca821x_dev *   pDeviceRef)
+{
+	struct ca821x_exchange_base *   priv    = pDeviceRef->exchange_context;
+	struct ca821x_pending_requests *pending = &priv->pending;
+	struct ca821x_pending_request * slot;
+	ca_error                        error = CA_ERROR_SUCCESS;
+
+	pthread_mutex_lock(&pending->mutex);
+	advance_pending(pending);
+	if (pending->tail - pending->head >= CASCODA_POSIX_QUEUE_DEPTH)
+	{
+		pending->overflows++;
+		error = CA_ERROR_NO_BUFFER;
+		goto exit;
+	}
+
+	*aSlot = pending->tail++;
+	*aSeq  = pending->next_seq++;
+
+	slot              = &pending->slots[*aSlot % CASCODA_POSIX_QUEUE_DEPTH];
+	slot->callback    = callback;
+	slot->context     = context;
+	slot->seq         = *aSeq;
+	slot->deadline_us = get_monotonic_us() + (SYNC_TIMEOUT_S * 1000000ULL);
+	slot->rsp_id      = get_response_id(cmdid);
+
+	if (++pending->count > pending->high_water)
+		pending->high_water = pending->count;
 
 exit:
+	pthread_mutex_unlock(&pending->mutex);
 	return error;
 }
 
+static void discard_complete(ca_error status, const uint8_t *response, void *context, struct ca821x_dev *pDeviceRef)
+{
+	(void)response;
+	(void)context;
+	(void)pDeviceRef;
+
+	if (status)
+		ca_log_warn("Discarded synchronous response failed: %s", ca_error_str(status));
+}
+
+/**
+ * Turn a timed out request into a tombstone that discards its response, so that a late response is not
+ * matched to a later request expecting the same command ID. Must hold pending->mutex.
+ */
+static void abandon_pending(struct ca821x_pending_request *slot)
+{
+	slot->callback    = &discard_complete;
+	slot->context     = NULL;
+	slot->deadline_us = get_monotonic_us() + (LATE_TIMEOUT_S * 1000000ULL);
+}
+
+/**
+ * Remove a request from the pending ring without calling its callback.
+ * @retval CA_ERROR_SUCCESS The request was removed
+ * @retval CA_ERROR_NOT_FOUND The request has already been completed, or is being completed
+ */
+static ca_error cancel_pending(size_t aSlot, uint64_t aSeq, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *   priv    = pDeviceRef->exchange_context;
+	struct ca821x_pending_requests *pending = &priv->pending;
+	struct ca821x_pending_request * slot    = &pending->slots[aSlot % CASCODA_POSIX_QUEUE_DEPTH];
+	ca_error                        error   = CA_ERROR_NOT_FOUND;
+
+	pthread_mutex_lock(&pending->mutex);
+	if (slot->callback && slot->seq == aSeq)
+	{
+		slot->callback = NULL;
+		pending->count--;
+		advance_pending(pending);
+		error = CA_ERROR_SUCCESS;
+	}
+	pthread_mutex_unlock(&pending->mutex);
+
+	return error;
+}
+
+/**
+ * Complete the oldest pending request that expects this response.
+ * @retval CA_ERROR_SUCCESS The response completed a request
+ * @retval CA_ERROR_NOT_FOUND No request was waiting for the response
+ */
+static ca_error complete_pending(const uint8_t *response, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *   priv     = pDeviceRef->exchange_context;
+	struct ca821x_pending_requests *pending  = &priv->pending;
+	ca821x_async_callback           callback = NULL;
+	void *                          context  = NULL;
+
+	pthread_mutex_lock(&pending->mutex);
+	for (size_t i = pending->head; i != pending->tail; i++)
+	{
+		struct ca821x_pending_request *slot = &pending->slots[i % CASCODA_POSIX_QUEUE_DEPTH];
+
+		if (slot->callback && (!slot->rsp_id || slot->rsp_id == response[0]))
+		{
+			callback       = slot->callback;
+			context        = slot->context;
+			slot->callback = NULL;
+			pending->count--;
+			break;
+		}
+	}
+	advance_pending(pending);
+	pthread_mutex_unlock(&pending->mutex);
+
+	if (!callback)
+		return CA_ERROR_NOT_FOUND;
+
+	callback(CA_ERROR_SUCCESS, response, context, pDeviceRef);
+	return CA_ERROR_SUCCESS;
+}
+
+/**
+ * Fail the pending requests that were due to time out before the given time, oldest first. Requests that
+ * time out are left as tombstones until their responses arrive or LATE_TIMEOUT_S passes.
+ * @param status     The status to complete the requests with
+ * @param before_us  Monotonic time in microseconds, or 0 to fail every pending request
+ */
+static void fail_pending(ca_error status, uint64_t before_us, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *   priv    = pDeviceRef->exchange_context;
+	struct ca821x_pending_requests *pending = &priv->pending;
+
+	while (1)
+	{
+		struct ca821x_pending_request *slot = NULL;
+		ca821x_async_callback          callback;
+		void *                         context;
+
+		pthread_mutex_lock(&pending->mutex);
+		//Tombstones outlive the requests sent after them, so the ring is not in deadline order
+		for (size_t i = pending->head; i != pending->tail; i++)
+		{
+			struct ca821x_pending_request *candidate = &pending->slots[i % CASCODA_POSIX_QUEUE_DEPTH];
+
+			if (candidate->callback && (!before_us || candidate->deadline_us <= before_us))
+			{
+				slot = candidate;
+				break;
+			}
+		}
+		if (!slot)
+		{
+			pthread_mutex_unlock(&pending->mutex);
+			break;
+		}
+		callback = slot->callback;
+		context  = slot->context;
+		if (before_us && callback != &discard_complete)
+		{
+			abandon_pending(slot);
+		}
+		else
+		{
+			slot->callback = NULL;
+			pending->count--;
+			advance_pending(pending);
+		}
+		pthread_mutex_unlock(&pending->mutex);
+
+		callback(status, NULL, context, pDeviceRef);
+	}
+}
+
+/** Time out any pending requests whose responses are overdue */
+static void expire_pending(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+	size_t                       count;
+
+	pthread_mutex_lock(&priv->pending.mutex);
+	count = priv->pending.count;
+	pthread_mutex_unlock(&priv->pending.mutex);
+
+	if (count)
+		fail_pending(CA_ERROR_TIMEOUT, get_monotonic_us(), pDeviceRef);
+}
+
 ca_error exchange_register_user_callback(exchange_user_callback callback, struct ca821x_dev *pDeviceRef)
 {
 	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
@@ -292,9 +797,8 @@ ca_error exchange_wait_send_complete(time_t timeout_s, struct ca821x_dev *pDevic
 
 ca_error exchange_user_command(uint8_t cmdid, uint8_t cmdlen, uint8_t *payload, struct ca821x_dev *pDeviceRef)
 {
-	struct ca821x_exchange_base *priv  = pDeviceRef->exchange_context;
-	ca_error                     error = CA_ERROR_SUCCESS;
-	uint8_t                      buf[(size_t)cmdlen + 2];
+	ca_error error = CA_ERROR_SUCCESS;
+	uint8_t  buf[(size_t)cmdlen + 2];
 
 	if (cmdid & SPI_SYN)
 	{
@@ -306,10 +810,11 @@ ca_error exchange_user_command(uint8_t cmdid, uint8_t cmdlen, uint8_t *payload,
 	buf[1] = cmdlen;
 	memcpy(buf + 2, payload, cmdlen);
 
-	add_to_queue(&(priv->out_buffer_queue), buf, cmdlen + 2, pDeviceRef);
+	error = queue_for_send(buf, cmdlen + 2, pDeviceRef);
+	if (error)
+		goto exit;
 
-	if (priv->signal_func)
-		priv->signal_func(pDeviceRef);
+	signal_write(pDeviceRef);
 
 exit:
 	return error;
@@ -321,6 +826,9 @@ ca_error exchange_handle_error(ca_error error, struct ca821x_dev *pDeviceRef)
 
 	ca_log_crit("Cascoda exchange failed with error %s", ca_error_str(error));
 
+	//The device may have been reset, so nothing cached can be trusted
+	pib_cache_invalidate(&priv->pib_cache);
+
 	if (priv->error_callback)
 		priv->error_callback(error, pDeviceRef);
 	else
@@ -342,21 +850,30 @@ static inline ca_error ca821x_try_read(struct ca821x_dev *pDeviceRef)
 	assert(len < MAX_BUF_SIZE);
 	if (len > 0)
 	{
+		ca_error error;
+
 		if (buffer[0] & SPI_SYN)
 		{
-			//Add to queue for synchronous processing
-			add_to_queue(&(priv->in_buffer_queue), buffer, len, pDeviceRef);
+			//Complete the request that was waiting for this response
+			error = complete_pending(buffer, pDeviceRef);
 		}
 		else
 		{
+			pib_cache_received(buffer, &priv->pib_cache);
+
 			//Add to queue for dispatching downstream
-			add_to_queue(&downstream_dispatch_queue, buffer, len, pDeviceRef);
+			error = add_to_queue(&get_dispatcher(pDeviceRef)->queue, buffer, len, pDeviceRef);
 		}
+
+		if (error)
+			ca_log_warn("Dropped received command 0x%02x: %s", buffer[0], ca_error_str(error));
+
 		return CA_ERROR_SUCCESS;
 	}
 	else if (len < 0)
 	{
 		exchange_handle_error(CA_ERROR_FAIL, pDeviceRef);
+		return CA_ERROR_FAIL;
 	}
 	return CA_ERROR_NOT_FOUND;
 }
@@ -390,24 +907,59 @@ static inline ca_error ca821x_try_write(struct ca821x_dev *pDeviceRef)
 	return CA_ERROR_NOT_FOUND;
 }
 
+void ca821x_io_service(struct ca821x_dev *pDeviceRef)
+{
+	int idle = 0;
+
+	//Some reads (such as UART acks) return nothing but may leave more data buffered, so only
+	//stop once both reading and writing have made no progress twice in a row.
+	//After an error, the error callback may have deinitialised the device, so it must not be touched again.
+	while (idle < 2)
+	{
+		ca_error error;
+
+		idle++;
+		error = ca821x_try_read(pDeviceRef);
+		if (error == CA_ERROR_FAIL)
+			return;
+		if (error == CA_ERROR_SUCCESS)
+			idle = 0;
+		error = ca821x_try_write(pDeviceRef);
+		if (error == CA_ERROR_FAIL)
+			return;
+		if (error == CA_ERROR_SUCCESS)
+			idle = 0;
+	}
+
+	expire_pending(pDeviceRef);
+}
+
 void *ca821x_io_worker(void *arg)
 {
 	struct ca821x_dev *          pDeviceRef = arg;
 	struct ca821x_exchange_base *priv       = pDeviceRef->exchange_context;
 
-	priv->flush_func(pDeviceRef);
+	if (!priv->split_io)
+		priv->flush_func(pDeviceRef);
 
 	pthread_mutex_lock(&priv->flag_mutex);
 	while (priv->io_thread_runflag)
 	{
 		pthread_mutex_unlock(&priv->flag_mutex);
 
-		if (ca821x_try_read(pDeviceRef) == CA_ERROR_NOT_FOUND)
+		if (priv->split_io)
+		{
+			//The read blocks until data arrives, writes are handled by io_write_thread.
+			ca821x_try_read(pDeviceRef);
+		}
+		else if (ca821x_try_read(pDeviceRef) == CA_ERROR_NOT_FOUND)
 		{
 			//If no reads left, we can start writing.
 			ca821x_try_write(pDeviceRef);
 		}
 
+		expire_pending(pDeviceRef);
+
 		pthread_mutex_lock(&priv->flag_mutex);
 	}
 
@@ -415,48 +967,293 @@ void *ca821x_io_worker(void *arg)
 	return 0;
 }
 
+/**
+ * Queue a synchronous request for sending, after adding it to the pending ring so that its response can be
+ * matched to it however quickly it arrives.
+ */
+static ca_error send_pending(const uint8_t *       buf,
+                             size_t                len,
+                             ca821x_async_callback callback,
+                             void *                context,
+                             size_t *              aSlot,
+                             uint64_t *            aSeq,
+                             struct ca821x_dev *   pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+	ca_error                     error;
+
+	pib_cache_sent(buf, &priv->pib_cache);
+
+	//Requests must be queued in the same order that they are added to the pending ring
+	pthread_mutex_lock(&(priv->sync_mutex));
+	error = add_pending(buf[0], callback, context, aSlot, aSeq, pDeviceRef);
+	if (!error && queue_for_send(buf, len, pDeviceRef))
+	{
+		cancel_pending(*aSlot, *aSeq, pDeviceRef);
+		error = CA_ERROR_NO_BUFFER;
+	}
+	pthread_mutex_unlock(&(priv->sync_mutex));
+
+	if (!error)
+		signal_write(pDeviceRef);
+
+	return error;
+}
+
+ca_error ca821x_exchange_commands_async(const uint8_t *       buf,
+                                        size_t                len,
+                                        ca821x_async_callback callback,
+                                        void *                context,
+                                        struct ca821x_dev *   pDeviceRef)
+{
+	size_t   slot;
+	uint64_t seq;
+
+	if (!generic_initialised)
+		return CA_ERROR_INVALID_STATE;
+	if (!(buf[0] & SPI_SYN) || !callback)
+		return CA_ERROR_INVALID_ARGS;
+
+	return send_pending(buf, len, callback, context, &slot, &seq, pDeviceRef);
+}
+
+/** State of a synchronous exchange waiting for its response */
+struct sync_wait
+{
+	uint8_t *response; //!< Buffer for the response, or NULL to discard it
+	ca_error status;   //!< Completion status
+	int      done;     //!< Set once the exchange has completed (protected by pending.mutex)
+};
+
+static void sync_complete(ca_error status, const uint8_t *response, void *context, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+	struct sync_wait *           wait = context;
+
+	if (response && wait->response)
+	{
+		size_t len = (size_t)response[1] + 2;
+
+		memcpy(wait->response, response, len < sizeof(struct MAC_Message) ? len : sizeof(struct MAC_Message));
+	}
+
+	pthread_mutex_lock(&priv->pending.mutex);
+	wait->status = status;
+	wait->done   = 1;
+	pthread_cond_broadcast(&priv->sync_cond);
+	pthread_mutex_unlock(&priv->pending.mutex);
+}
+
 ca_error ca821x_exchange_commands(const uint8_t *buf, size_t len, uint8_t *response, struct ca821x_dev *pDeviceRef)
 {
-	const uint8_t                isSynchronous = ((buf[0] & SPI_SYN) && response);
-	struct ca821x_exchange_base *priv          = pDeviceRef->exchange_context;
-	struct ca821x_dev *          ref_out       = pDeviceRef;
-	size_t                       success       = 0;
+	struct ca821x_exchange_base *  priv = pDeviceRef->exchange_context;
+	struct ca821x_pending_request *request;
+	struct sync_wait               wait = {response, CA_ERROR_SUCCESS, 0};
+	struct timespec                deadline;
+	size_t                         slot;
+	uint64_t                       seq;
+	uint64_t                       generation;
 
 	if (!generic_initialised)
 		return CA_ERROR_INVALID_STATE;
-	//Synchronous must execute synchronously
-	//Get sync responses from the in queue
-	//Send messages by adding them to the out queue
 
-	if (isSynchronous)
-		pthread_mutex_lock(&(priv->sync_mutex));
+	if (!(buf[0] & SPI_SYN))
+	{
+		if (queue_for_send(buf, len, pDeviceRef))
+			return CA_ERROR_NO_BUFFER;
 
-	add_to_queue(&(priv->out_buffer_queue), buf, len, pDeviceRef);
+		signal_write(pDeviceRef);
+		return CA_ERROR_SUCCESS;
+	}
 
-	if (priv->signal_func)
-		priv->signal_func(pDeviceRef);
+	if (!response)
+	{
+		//Nobody is waiting, but the response must still be consumed so it isn't matched to another request
+		return send_pending(buf, len, &discard_complete, NULL, &slot, &seq, pDeviceRef) ? CA_ERROR_NO_BUFFER
+		                                                                                : CA_ERROR_SUCCESS;
+	}
 
-	if (!isSynchronous)
+	if (pib_cache_lookup(buf, response, &priv->pib_cache) == CA_ERROR_SUCCESS)
 		return CA_ERROR_SUCCESS;
 
-	//Wait for message to be sent
-	wait_on_queue_empty(&priv->out_buffer_queue, 0);
+	generation = pib_cache_generation(buf, &priv->pib_cache);
+	if (send_pending(buf, len, &sync_complete, &wait, &slot, &seq, pDeviceRef))
+		return CA_ERROR_NO_BUFFER;
+	request = &priv->pending.slots[slot % CASCODA_POSIX_QUEUE_DEPTH];
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += SYNC_TIMEOUT_S;
 
-	//A rval of zero here is an indication of timeout
-	success = wait_on_queue(&(priv->in_buffer_queue), SYNC_TIMEOUT_S);
+	pthread_mutex_lock(&priv->pending.mutex);
+	while (!wait.done)
+	{
+		if (pthread_cond_timedwait(&priv->sync_cond, &priv->pending.mutex, &deadline) != ETIMEDOUT)
+			continue;
 
-	pop_from_queue(&(priv->in_buffer_queue), response, sizeof(struct MAC_Message), &ref_out);
+		//The response may still arrive, so leave a tombstone to consume it
+		if (request->callback == &sync_complete && request->seq == seq)
+		{
+			abandon_pending(request);
+			pthread_mutex_unlock(&priv->pending.mutex);
+			return CA_ERROR_TIMEOUT;
+		}
 
-	assert(ref_out == pDeviceRef);
-	pthread_mutex_unlock(&(priv->sync_mutex));
+		//Already being completed by the io thread, so wait for it to finish with wait
+		while (!wait.done) pthread_cond_wait(&priv->sync_cond, &priv->pending.mutex);
+	}
+	pthread_mutex_unlock(&priv->pending.mutex);
 
-	if (success)
-		return CA_ERROR_SUCCESS;
-	else
-		return CA_ERROR_TIMEOUT;
+	if (wait.status == CA_ERROR_SUCCESS)
+		pib_cache_confirmed(buf, response, generation, &priv->pib_cache);
+
+	return wait.status;
 }
 
 ca_error ca821x_api_downstream(const uint8_t *buf, uint8_t *response, struct ca821x_dev *pDeviceRef)
 {
 	return ca821x_exchange_commands(buf, buf[1] + 2, response, pDeviceRef);
 }
+
+ca_error ca821x_api_downstream_async(const uint8_t *       buf,
+                                     ca821x_async_callback callback,
+                                     void *                context,
+                                     struct ca821x_dev *   pDeviceRef)
+{
+	return ca821x_exchange_commands_async(buf, buf[1] + 2, callback, context, pDeviceRef);
+}
+
+ca_error exchange_get_queue_stats(struct buffer_queue_stats *in_stats,
+                                  struct buffer_queue_stats *out_stats,
+                                  struct buffer_queue_stats *dd_stats,
+                                  struct ca821x_dev *        pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef ? pDeviceRef->exchange_context : NULL;
+
+	if ((in_stats || out_stats) && !priv)
+		return CA_ERROR_INVALID_ARGS;
+
+	if (in_stats)
+	{
+		pthread_mutex_lock(&priv->pending.mutex);
+		in_stats->depth      = CASCODA_POSIX_QUEUE_DEPTH;
+		in_stats->count      = priv->pending.count;
+		in_stats->high_water = priv->pending.high_water;
+		in_stats->overflows  = priv->pending.overflows;
+		pthread_mutex_unlock(&priv->pending.mutex);
+	}
+	if (out_stats)
+		get_queue_stats(&(priv->out_buffer_queue), out_stats);
+	if (dd_stats)
+	{
+		pthread_once(&dd_once, &init_global_dispatcher);
+		if (dd_mode == ca821x_dispatch_per_device && !priv)
+			return CA_ERROR_INVALID_ARGS;
+		get_queue_stats(dd_mode == ca821x_dispatch_per_device ? &priv->dispatcher.queue : &downstream_dispatcher.queue,
+		                dd_stats);
+	}
+
+	return CA_ERROR_SUCCESS;
+}
+
+void *ca821x_io_write_worker(void *arg)
+{
+	struct ca821x_dev *          pDeviceRef = arg;
+	struct ca821x_exchange_base *priv       = pDeviceRef->exchange_context;
+
+	pthread_mutex_lock(&priv->flag_mutex);
+	while (priv->io_thread_runflag)
+	{
+		pthread_mutex_unlock(&priv->flag_mutex);
+
+		//Woken as soon as something is queued for sending
+		wait_on_queue(&priv->out_buffer_queue, 0);
+		while (ca821x_try_write(pDeviceRef) == CA_ERROR_SUCCESS)
+			;
+
+		pthread_mutex_lock(&priv->flag_mutex);
+	}
+
+	pthread_mutex_unlock(&priv->flag_mutex);
+	return 0;
+}
+
+ca_error ca821x_util_enable_pib_cache(bool aEnable, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+
+	if (!priv)
+		return CA_ERROR_INVALID_STATE;
+
+	pthread_mutex_lock(&priv->pib_cache.mutex);
+	if (priv->pib_cache.enabled && !aEnable)
+	{
+		for (size_t i = 0; i < CA821X_PIB_CACHE_ENTRIES; i++) priv->pib_cache.entries[i].valid = 0;
+	}
+	priv->pib_cache.enabled = aEnable;
+	pthread_mutex_unlock(&priv->pib_cache.mutex);
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error ca821x_util_set_pib_cacheable(enum ca821x_pib_cache_type aType,
+                                       uint8_t                    aAttribute,
+                                       bool                       aCacheable,
+                                       struct ca821x_dev *        pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+	uint8_t                      mask = 1 << (aAttribute % 8);
+
+	if (!priv)
+		return CA_ERROR_INVALID_STATE;
+	if (aType >= ca821x_pib_cache_types)
+		return CA_ERROR_INVALID_ARGS;
+
+	pthread_mutex_lock(&priv->pib_cache.mutex);
+	if (aCacheable)
+	{
+		priv->pib_cache.nocache[aType][aAttribute / 8] &= ~mask;
+	}
+	else
+	{
+		priv->pib_cache.nocache[aType][aAttribute / 8] |= mask;
+		for (size_t i = 0; i < CA821X_PIB_CACHE_ENTRIES; i++)
+		{
+			struct ca821x_pib_cache_entry *entry = &priv->pib_cache.entries[i];
+
+			if (entry->type == aType && entry->attribute == aAttribute)
+				entry->valid = 0;
+		}
+	}
+	pthread_mutex_unlock(&priv->pib_cache.mutex);
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error ca821x_util_invalidate_pib_cache(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+
+	if (!priv)
+		return CA_ERROR_INVALID_STATE;
+
+	pib_cache_invalidate(&priv->pib_cache);
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error ca821x_util_get_pib_cache_stats(struct ca821x_pib_cache_stats *aStats, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+
+	if (!priv)
+		return CA_ERROR_INVALID_STATE;
+
+	pthread_mutex_lock(&priv->pib_cache.mutex);
+	aStats->hits          = priv->pib_cache.hits;
+	aStats->misses        = priv->pib_cache.misses;
+	aStats->invalidations = priv->pib_cache.invalidations;
+	aStats->entries       = 0;
+	for (size_t i = 0; i < CA821X_PIB_CACHE_ENTRIES; i++) aStats->entries += priv->pib_cache.entries[i].valid;
+	pthread_mutex_unlock(&priv->pib_cache.mutex);
+
+	return CA_ERROR_SUCCESS;
+}
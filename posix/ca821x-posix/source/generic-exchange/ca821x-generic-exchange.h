@@ -35,7 +35,7 @@
 
 #include "ca821x-posix/ca821x-types.h"
 
-#define MAX_BUF_SIZE 256
+#define MAX_BUF_SIZE CA821X_QUEUE_BUF_SIZE
 
 /**
  * Initialise the generic part of a pDeviceRef.
@@ -59,13 +59,29 @@ ca_error deinit_generic(struct ca821x_dev *pDeviceRef);
  */
 ca_error exchange_handle_error(ca_error error, struct ca821x_dev *pDeviceRef);
 
+/**
+ * Service the reads and writes of a device until neither can make progress. Used by the reactor
+ * threads, which require the exchange read function not to block.
+ * @param pDeviceRef an initialised pDeviceRef struct.
+ */
+void ca821x_io_service(struct ca821x_dev *pDeviceRef);
+
 /**
  * io worker thread function. Handles reads/writes to the exchange, buffering and debuffering messages as required.
+ * If the exchange has split_io set, this thread only reads.
  * @param arg an initialised pDeviceRef struct.
  * @return 0
  */
 void *ca821x_io_worker(void *arg);
 
+/**
+ * io write worker thread function, used alongside ca821x_io_worker for exchanges with split_io set. Sleeps
+ * until messages are queued for sending, then writes them to the exchange.
+ * @param arg an initialised pDeviceRef struct.
+ * @return 0
+ */
+void *ca821x_io_write_worker(void *arg);
+
 /**
  * Handle an exchange with the ca821x. Used as the downstream function for ca821x-api.
  * @param buf The buffer to send
@@ -76,7 +92,28 @@ void *ca821x_io_worker(void *arg);
  * @retval CA_ERROR_SUCCESS Success
  * @retval CA_ERROR_INVALID_STATE Invalid state, such as uninitialised.
  * @retval CA_ERROR_TIMEOUT Response was not received to synchronous command in reasonable timeframe.
+ * @retval CA_ERROR_NO_BUFFER Too many requests pending, or the send queue is full
  */
 ca_error ca821x_exchange_commands(const uint8_t *buf, size_t len, uint8_t *response, struct ca821x_dev *pDeviceRef);
 
+/**
+ * Send a synchronous command to the ca821x without waiting for the response. The callback is called from the
+ * io thread when the matching response arrives, or when the request times out.
+ * @param buf The buffer to send, which must be a synchronous command
+ * @param len The length of the buffer to send, including header bytes
+ * @param callback The callback to complete the request with
+ * @param context Context pointer passed to the callback
+ * @param pDeviceRef an initialised pDeviceRef struct.
+ * @return status
+ * @retval CA_ERROR_SUCCESS The command was queued, and the callback will be called exactly once
+ * @retval CA_ERROR_INVALID_ARGS The command is not synchronous, or there is no callback
+ * @retval CA_ERROR_INVALID_STATE Invalid state, such as uninitialised.
+ * @retval CA_ERROR_NO_BUFFER Too many requests pending, or the send queue is full
+ */
+ca_error ca821x_exchange_commands_async(const uint8_t *       buf,
+                                        size_t                len,
+                                        ca821x_async_callback callback,
+                                        void *                context,
+                                        struct ca821x_dev *   pDeviceRef);
+
 #endif
@@ -0,0 +1,371 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Write-through cache of device PIB & HWME attributes
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ca821x-pib-cache.h"
+#include "hwme_tdme.h"
+#include "ieee_802_15_4.h"
+#include "mac_messages.h"
+
+/** Attributes that the device can change of its own accord, which must always be read from the device */
+static const uint8_t s_default_nocache[ca821x_pib_cache_types][8] = {
+    [ca821x_pib_cache_mlme] = {macBeaconTxTime, macBSN, macDSN, macDeviceTable, macFrameCounter},
+    [ca821x_pib_cache_hwme] = {HWME_EDVALUE,
+                               HWME_CSVALUE,
+                               HWME_EDVALLP,
+                               HWME_CSVALLP,
+                               HWME_FREQOFFS,
+                               HWME_MACTIMER,
+                               HWME_RANDOMNUM,
+                               HWME_TEMPERATURE},
+};
+
+/** Attributes that are views of the same hardware setting, so setting one must invalidate the other */
+static const uint8_t s_aliases[][2] = {
+    {phyTransmitPower, HWME_TXPOWER},
+    {phyCCAMode, HWME_CCAMODE},
+};
+
+static int is_cacheable(struct ca821x_pib_cache *cache, uint8_t type, uint8_t attribute)
+{
+	return !(cache->nocache[type][attribute / 8] & (1 << (attribute % 8)));
+}
+
+static struct ca821x_pib_cache_entry *find_entry(struct ca821x_pib_cache *cache,
+                                                 uint8_t                  type,
+                                                 uint8_t                  attribute,
+                                                 uint8_t                  index)
+{
+	for (size_t i = 0; i < CA821X_PIB_CACHE_ENTRIES; i++)
+	{
+		struct ca821x_pib_cache_entry *entry = &cache->entries[i];
+
+		if (entry->valid && entry->type == type && entry->attribute == attribute && entry->index == index)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/**
+ * Remove every cached index of an attribute, and of any attribute aliasing it, marking them as changed in
+ * the current generation. Must hold cache->mutex.
+ */
+static void remove_attribute(struct ca821x_pib_cache *cache, uint8_t type, uint8_t attribute)
+{
+	cache->changed[type][attribute] = cache->generation;
+	for (size_t i = 0; i < CA821X_PIB_CACHE_ENTRIES; i++)
+	{
+		struct ca821x_pib_cache_entry *entry = &cache->entries[i];
+
+		if (entry->valid && entry->type == type && entry->attribute == attribute)
+			entry->valid = 0;
+	}
+
+	for (size_t i = 0; i < sizeof(s_aliases) / sizeof(s_aliases[0]); i++)
+	{
+		if (s_aliases[i][type] != attribute)
+			continue;
+
+		type                                     = !type;
+		cache->changed[type][s_aliases[i][type]] = cache->generation;
+		for (size_t j = 0; j < CA821X_PIB_CACHE_ENTRIES; j++)
+		{
+			struct ca821x_pib_cache_entry *entry = &cache->entries[j];
+
+			if (entry->valid && entry->type == type && entry->attribute == s_aliases[i][type])
+				entry->valid = 0;
+		}
+		type = !type;
+	}
+}
+
+/**
+ * Store an attribute value, replacing the oldest entry if the cache is full. The value is dropped if the
+ * attribute has changed since the generation that it was read or written in. Must hold cache->mutex.
+ */
+static void store_attribute(struct ca821x_pib_cache *cache,
+                            uint64_t                 generation,
+                            uint8_t                  type,
+                            uint8_t                  attribute,
+                            uint8_t                  index,
+                            uint8_t                  length,
+                            const uint8_t *          value)
+{
+	struct ca821x_pib_cache_entry *entry;
+
+	if (!cache->enabled || !is_cacheable(cache, type, attribute) || length > CA821X_PIB_CACHE_MAX_LEN)
+		return;
+	if (generation < cache->invalidated || generation < cache->changed[type][attribute])
+		return;
+
+	entry = find_entry(cache, type, attribute, index);
+	for (size_t i = 0; !entry && i < CA821X_PIB_CACHE_ENTRIES; i++)
+	{
+		if (!cache->entries[i].valid)
+			entry = &cache->entries[i];
+	}
+	if (!entry)
+	{
+		entry              = &cache->entries[cache->next_victim];
+		cache->next_victim = (cache->next_victim + 1) % CA821X_PIB_CACHE_ENTRIES;
+	}
+
+	entry->valid     = 1;
+	entry->type      = type;
+	entry->attribute = attribute;
+	entry->index     = index;
+	entry->length    = length;
+	memcpy(entry->value, value, length);
+}
+
+/** Discard every cached value. Must hold cache->mutex. */
+static void invalidate_all(struct ca821x_pib_cache *cache)
+{
+	for (size_t i = 0; i < CA821X_PIB_CACHE_ENTRIES; i++) cache->entries[i].valid = 0;
+	cache->invalidated = ++cache->generation;
+	cache->invalidations++;
+}
+
+void pib_cache_init(struct ca821x_pib_cache *cache)
+{
+	const char *env = getenv("CASCODA_PIB_CACHE");
+
+	memset(cache, 0, sizeof(*cache));
+	pthread_mutex_init(&cache->mutex, NULL);
+	cache->enabled = env && atoi(env);
+
+	for (int type = 0; type < ca821x_pib_cache_types; type++)
+	{
+		for (size_t i = 0; i < sizeof(s_default_nocache[type]) && s_default_nocache[type][i]; i++)
+		{
+			uint8_t attribute = s_default_nocache[type][i];
+
+			cache->nocache[type][attribute / 8] |= 1 << (attribute % 8);
+		}
+	}
+}
+
+void pib_cache_deinit(struct ca821x_pib_cache *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+}
+
+void pib_cache_invalidate(struct ca821x_pib_cache *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	invalidate_all(cache);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+ca_error pib_cache_lookup(const uint8_t *buf, uint8_t *response, struct ca821x_pib_cache *cache)
+{
+	struct MAC_Message *           rsp   = (struct MAC_Message *)response;
+	ca_error                       error = CA_ERROR_NOT_FOUND;
+	struct ca821x_pib_cache_entry *entry;
+
+	if (buf[0] != SPI_MLME_GET_REQUEST && buf[0] != SPI_HWME_GET_REQUEST)
+		return CA_ERROR_NOT_FOUND;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (!cache->enabled)
+		goto exit;
+
+	if (buf[0] == SPI_MLME_GET_REQUEST)
+	{
+		entry = find_entry(cache, ca821x_pib_cache_mlme, buf[2], buf[3]);
+		if (entry)
+		{
+			rsp->CommandId                       = SPI_MLME_GET_CONFIRM;
+			rsp->Length                          = 4 + entry->length;
+			rsp->PData.GetCnf.Status             = MAC_SUCCESS;
+			rsp->PData.GetCnf.PIBAttribute       = entry->attribute;
+			rsp->PData.GetCnf.PIBAttributeIndex  = entry->index;
+			rsp->PData.GetCnf.PIBAttributeLength = entry->length;
+			memcpy(rsp->PData.GetCnf.PIBAttributeValue, entry->value, entry->length);
+		}
+	}
+	else
+	{
+		entry = find_entry(cache, ca821x_pib_cache_hwme, buf[2], 0);
+		if (entry)
+		{
+			rsp->CommandId                          = SPI_HWME_GET_CONFIRM;
+			rsp->Length                             = 3 + entry->length;
+			rsp->PData.HWMEGetCnf.Status            = HWME_SUCCESS;
+			rsp->PData.HWMEGetCnf.HWAttribute       = entry->attribute;
+			rsp->PData.HWMEGetCnf.HWAttributeLength = entry->length;
+			memcpy(rsp->PData.HWMEGetCnf.HWAttributeValue, entry->value, entry->length);
+		}
+	}
+
+	if (entry)
+	{
+		cache->hits++;
+		error = CA_ERROR_SUCCESS;
+	}
+	else
+	{
+		cache->misses++;
+	}
+
+exit:
+	pthread_mutex_unlock(&cache->mutex);
+	return error;
+}
+
+/** Does sending a request reconfigure the device wholesale? */
+static int changes_all(const uint8_t *buf)
+{
+	switch (buf[0])
+	{
+	case SPI_MLME_RESET_REQUEST:
+	case SPI_MLME_START_REQUEST:
+	case SPI_TDME_SETSFR_REQUEST:
+	case SPI_TDME_TESTMODE_REQUEST:
+	case SPI_TDME_SET_REQUEST:
+	case SPI_TDME_LOTLK_REQUEST:
+		return 1;
+	}
+
+	return 0;
+}
+
+uint64_t pib_cache_generation(const uint8_t *buf, struct ca821x_pib_cache *cache)
+{
+	uint64_t generation;
+
+	pthread_mutex_lock(&cache->mutex);
+	generation = cache->generation;
+	if (buf[0] == SPI_MLME_SET_REQUEST || buf[0] == SPI_HWME_SET_REQUEST || changes_all(buf))
+		generation++;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return generation;
+}
+
+uint64_t pib_cache_sent(const uint8_t *buf, struct ca821x_pib_cache *cache)
+{
+	uint64_t generation;
+
+	pthread_mutex_lock(&cache->mutex);
+	switch (buf[0])
+	{
+	case SPI_MLME_SET_REQUEST:
+		cache->generation++;
+		remove_attribute(cache, ca821x_pib_cache_mlme, buf[2]);
+		break;
+	case SPI_HWME_SET_REQUEST:
+		cache->generation++;
+		remove_attribute(cache, ca821x_pib_cache_hwme, buf[2]);
+		break;
+	case SPI_MLME_RESET_REQUEST:
+	case SPI_MLME_START_REQUEST:
+	case SPI_TDME_SETSFR_REQUEST:
+	case SPI_TDME_TESTMODE_REQUEST:
+	case SPI_TDME_SET_REQUEST:
+	case SPI_TDME_LOTLK_REQUEST:
+		//These reconfigure the device wholesale
+		invalidate_all(cache);
+		break;
+	}
+	generation = cache->generation;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return generation;
+}
+
+void pib_cache_confirmed(const uint8_t *          buf,
+                         const uint8_t *          response,
+                         uint64_t                 generation,
+                         struct ca821x_pib_cache *cache)
+{
+	const struct MAC_Message *rsp = (const struct MAC_Message *)response;
+
+	pthread_mutex_lock(&cache->mutex);
+	switch (rsp->CommandId)
+	{
+	case SPI_MLME_GET_CONFIRM:
+		if (buf[0] == SPI_MLME_GET_REQUEST && rsp->PData.GetCnf.Status == MAC_SUCCESS)
+		{
+			store_attribute(cache,
+			                generation,
+			                ca821x_pib_cache_mlme,
+			                rsp->PData.GetCnf.PIBAttribute,
+			                rsp->PData.GetCnf.PIBAttributeIndex,
+			                rsp->PData.GetCnf.PIBAttributeLength,
+			                rsp->PData.GetCnf.PIBAttributeValue);
+		}
+		break;
+	case SPI_MLME_SET_CONFIRM:
+		//Write-through: the confirm only has a status, so the value comes from the request
+		if (buf[0] == SPI_MLME_SET_REQUEST && rsp->PData.Status == MAC_SUCCESS)
+			store_attribute(cache, generation, ca821x_pib_cache_mlme, buf[2], buf[3], buf[4], buf + 5);
+		break;
+	case SPI_HWME_GET_CONFIRM:
+		if (buf[0] == SPI_HWME_GET_REQUEST && rsp->PData.HWMEGetCnf.Status == HWME_SUCCESS)
+		{
+			store_attribute(cache,
+			                generation,
+			                ca821x_pib_cache_hwme,
+			                rsp->PData.HWMEGetCnf.HWAttribute,
+			                0,
+			                rsp->PData.HWMEGetCnf.HWAttributeLength,
+			                rsp->PData.HWMEGetCnf.HWAttributeValue);
+		}
+		break;
+	case SPI_HWME_SET_CONFIRM:
+		if (buf[0] == SPI_HWME_SET_REQUEST && rsp->PData.HWMESetCnf.Status == HWME_SUCCESS)
+			store_attribute(cache, generation, ca821x_pib_cache_hwme, buf[2], 0, buf[3], buf + 4);
+		break;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+void pib_cache_received(const uint8_t *buf, struct ca821x_pib_cache *cache)
+{
+	switch (buf[0])
+	{
+	case SPI_HWME_WAKEUP_INDICATION:
+	case SPI_MLME_ASSOCIATE_CONFIRM:
+	case SPI_MLME_DISASSOCIATE_CONFIRM:
+	case SPI_MLME_SYNC_LOSS_INDICATION:
+	case SPI_MLME_SCAN_CONFIRM:
+		//Reset, or a change of association that the MAC applies to the PIB itself
+		pib_cache_invalidate(cache);
+		break;
+	}
+}
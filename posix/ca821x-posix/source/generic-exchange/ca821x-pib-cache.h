@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * Write-through cache of device PIB & HWME attributes, which answers repeated GET requests without a round trip
+ */
+
+#ifndef CA821X_PIB_CACHE_H
+#define CA821X_PIB_CACHE_H
+
+#include "ca821x-posix/ca821x-types.h"
+
+/**
+ * Initialise the PIB cache of a device. The cache starts disabled, unless the CASCODA_PIB_CACHE
+ * environment variable is set to a nonzero value.
+ * @param cache The PIB cache to initialise
+ */
+void pib_cache_init(struct ca821x_pib_cache *cache);
+
+/**
+ * Deinitialise the PIB cache of a device.
+ * @param cache The PIB cache to deinitialise
+ */
+void pib_cache_deinit(struct ca821x_pib_cache *cache);
+
+/**
+ * Discard every cached value, such as after the device has been reset.
+ * @param cache The PIB cache to invalidate
+ */
+void pib_cache_invalidate(struct ca821x_pib_cache *cache);
+
+/**
+ * Answer a synchronous request from the cache, if it is a GET request for a cached attribute.
+ * @param buf       The request to be sent
+ * @param response  Buffer to populate with the confirm if the attribute is cached
+ * @param cache     The PIB cache of the device
+ * @retval CA_ERROR_SUCCESS The response was populated from the cache, so the request must not be sent
+ * @retval CA_ERROR_NOT_FOUND The request must be sent to the device
+ */
+ca_error pib_cache_lookup(const uint8_t *buf, uint8_t *response, struct ca821x_pib_cache *cache);
+
+/**
+ * Get the generation that pib_cache_sent would return for a request, if it were sent now. For requests that
+ * are sent by another layer, which calls pib_cache_sent itself. If the cache changes before the request is
+ * sent, its confirm is conservatively dropped.
+ * @param buf   The request about to be sent
+ * @param cache The PIB cache of the device
+ * @returns The generation to pass to pib_cache_confirmed with the confirm for the request
+ */
+uint64_t pib_cache_generation(const uint8_t *buf, struct ca821x_pib_cache *cache);
+
+/**
+ * Invalidate the cached values that a request is about to change. Must be called before the request is sent.
+ * @param buf   The request being sent
+ * @param cache The PIB cache of the device
+ * @returns The generation to pass to pib_cache_confirmed with the confirm for the request
+ */
+uint64_t pib_cache_sent(const uint8_t *buf, struct ca821x_pib_cache *cache);
+
+/**
+ * Update the cache with the result of a successful GET or SET request. The result is dropped if another
+ * request has changed the attribute since this one was sent, as the confirm may hold an old value.
+ * @param buf        The request that was sent
+ * @param response   The confirm received for the request
+ * @param generation The generation returned by pib_cache_sent or pib_cache_generation for the request
+ * @param cache      The PIB cache of the device
+ */
+void pib_cache_confirmed(const uint8_t *          buf,
+                         const uint8_t *          response,
+                         uint64_t                 generation,
+                         struct ca821x_pib_cache *cache);
+
+/**
+ * Invalidate the cache if an asynchronous message from the device indicates that it has changed attributes
+ * of its own accord, such as after a reset or association.
+ * @param buf   The message received
+ * @param cache The PIB cache of the device
+ */
+void pib_cache_received(const uint8_t *buf, struct ca821x_pib_cache *cache);
+
+#endif
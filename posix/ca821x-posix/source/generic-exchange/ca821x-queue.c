@@ -34,58 +34,119 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <string.h>
 #include <time.h>
 
 #include "ca821x-queue.h"
 
-void add_to_queue(struct buffer_queue *buffer_queue, const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+#define QUEUE_MASK (CASCODA_POSIX_QUEUE_DEPTH - 1)
+
+#if (CASCODA_POSIX_QUEUE_DEPTH & QUEUE_MASK) != 0
+#error "CASCODA_POSIX_QUEUE_DEPTH must be a power of two"
+#endif
+
+//The producer publishes tail and the consumer publishes head with sequentially consistent
+//stores, then checks 'waiters'. A waiter increments 'waiters' before checking the indices
+//under q_mutex, so either it sees the update or the updater sees it and broadcasts.
+static void wake_waiters(struct buffer_queue *buffer_queue)
 {
-	if (pthread_mutex_lock(&buffer_queue->q_mutex) == 0)
+	if (__atomic_load_n(&buffer_queue->waiters, __ATOMIC_SEQ_CST))
 	{
-		struct buffer_queue_item *nextbuf = buffer_queue->head;
-		if (nextbuf == NULL)
-		{
-			//queue empty -> start new queue
-			buffer_queue->head = malloc(sizeof(struct buffer_queue_item));
-			memset(buffer_queue->head, 0, sizeof(struct buffer_queue_item));
-			nextbuf = buffer_queue->head;
-		}
-		else
-		{
-			while (nextbuf->next != NULL)
-			{
-				nextbuf = nextbuf->next;
-			}
-			//allocate new buffer cell
-			nextbuf->next = malloc(sizeof(struct buffer_queue_item));
-			memset(nextbuf->next, 0, sizeof(struct buffer_queue_item));
-			nextbuf = nextbuf->next;
-		}
-
-		nextbuf->len = len;
-		nextbuf->buf = malloc(len);
-		memcpy(nextbuf->buf, buf, len);
-		nextbuf->pDeviceRef = pDeviceRef;
+		pthread_mutex_lock(&buffer_queue->q_mutex);
 		pthread_cond_broadcast(&buffer_queue->q_cond);
 		pthread_mutex_unlock(&buffer_queue->q_mutex);
 	}
 }
 
+static bool queue_has_item(struct buffer_queue *buffer_queue)
+{
+	size_t head = __atomic_load_n(&buffer_queue->head, __ATOMIC_SEQ_CST);
+	size_t tail = __atomic_load_n(&buffer_queue->tail, __ATOMIC_SEQ_CST);
+
+	return head != tail;
+}
+
+//Returns the length of the buffer at the head of the queue, which must be non-empty
+static size_t queue_head_len(struct buffer_queue *buffer_queue)
+{
+	size_t head, len;
+
+	//The slot at head cannot be rewritten until head moves on, so retry if it does
+	do
+	{
+		head = __atomic_load_n(&buffer_queue->head, __ATOMIC_ACQUIRE);
+		len  = buffer_queue->items[head & QUEUE_MASK].len;
+	} while (head != __atomic_load_n(&buffer_queue->head, __ATOMIC_ACQUIRE));
+
+	return len;
+}
+
+void init_queue(struct buffer_queue *buffer_queue)
+{
+	buffer_queue->head       = 0;
+	buffer_queue->tail       = 0;
+	buffer_queue->waiters    = 0;
+	buffer_queue->high_water = 0;
+	buffer_queue->overflows  = 0;
+	pthread_mutex_init(&buffer_queue->p_mutex, NULL);
+	pthread_mutex_init(&buffer_queue->q_mutex, NULL);
+	pthread_cond_init(&buffer_queue->q_cond, NULL);
+}
+
+void deinit_queue(struct buffer_queue *buffer_queue)
+{
+	pthread_mutex_destroy(&buffer_queue->p_mutex);
+	pthread_mutex_destroy(&buffer_queue->q_mutex);
+	pthread_cond_destroy(&buffer_queue->q_cond);
+}
+
+ca_error add_to_queue(struct buffer_queue *buffer_queue, const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	struct buffer_queue_item *nextbuf;
+	size_t                    head, tail;
+
+	if (len > CA821X_QUEUE_BUF_SIZE)
+		return CA_ERROR_INVALID_ARGS;
+
+	if (pthread_mutex_lock(&buffer_queue->p_mutex))
+		return CA_ERROR_FAIL;
+
+	tail = buffer_queue->tail;
+	head = __atomic_load_n(&buffer_queue->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head >= CASCODA_POSIX_QUEUE_DEPTH)
+	{
+		buffer_queue->overflows++;
+		pthread_mutex_unlock(&buffer_queue->p_mutex);
+		return CA_ERROR_NO_BUFFER;
+	}
+
+	nextbuf             = &buffer_queue->items[tail & QUEUE_MASK];
+	nextbuf->len        = len;
+	nextbuf->pDeviceRef = pDeviceRef;
+	if (len)
+		memcpy(nextbuf->buf, buf, len);
+
+	__atomic_store_n(&buffer_queue->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+	if (tail + 1 - head > buffer_queue->high_water)
+		buffer_queue->high_water = tail + 1 - head;
+
+	pthread_mutex_unlock(&buffer_queue->p_mutex);
+
+	wake_waiters(buffer_queue);
+	return CA_ERROR_SUCCESS;
+}
+
 void flush_queue(struct buffer_queue *buffer_queue)
 {
 	struct ca821x_dev *junkDev = NULL;
 
-	pthread_mutex_lock(&buffer_queue->q_mutex);
-	while (buffer_queue->head != NULL)
+	while (queue_has_item(buffer_queue))
 	{
-		pthread_mutex_unlock(&buffer_queue->q_mutex);
-
 		pop_from_queue(buffer_queue, NULL, 0, &junkDev);
-
-		pthread_mutex_lock(&buffer_queue->q_mutex);
 	}
-	pthread_mutex_unlock(&buffer_queue->q_mutex);
 }
 
 size_t pop_from_queue(struct buffer_queue *buffer_queue,
@@ -93,48 +154,39 @@ size_t pop_from_queue(struct buffer_queue *buffer_queue,
                       size_t               maxlen,
                       struct ca821x_dev ** pDeviceRef_out)
 {
-	if (pthread_mutex_lock(&buffer_queue->q_mutex) == 0)
-	{
-		struct buffer_queue_item *current = buffer_queue->head;
-		size_t                    len     = 0;
+	struct buffer_queue_item *current;
+	size_t                    head, tail;
+	size_t                    len = 0;
 
-		if (buffer_queue->head != NULL)
-		{
-			buffer_queue->head = current->next;
-			len                = current->len;
+	head = __atomic_load_n(&buffer_queue->head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&buffer_queue->tail, __ATOMIC_ACQUIRE);
 
-			if (len > maxlen || !destBuf)
-				len = 0; //Invalid
-			else
-				memcpy(destBuf, current->buf, len);
+	if (head == tail)
+		return 0;
 
-			*pDeviceRef_out = current->pDeviceRef;
+	current = &buffer_queue->items[head & QUEUE_MASK];
+	len     = current->len;
 
-			pthread_cond_broadcast(&buffer_queue->q_cond);
-			free(current->buf);
-			free(current);
-		}
+	if (len > maxlen || !destBuf)
+		len = 0; //Invalid
+	else
+		memcpy(destBuf, current->buf, len);
 
-		pthread_mutex_unlock(&buffer_queue->q_mutex);
-		return len;
-	}
-	return 0;
+	*pDeviceRef_out = current->pDeviceRef;
+
+	__atomic_store_n(&buffer_queue->head, head + 1, __ATOMIC_SEQ_CST);
+
+	wake_waiters(buffer_queue);
+	return len;
 }
 
 //return the length of the next buffer in the queue if it exists, otherwise 0
 size_t peek_queue(struct buffer_queue *buffer_queue)
 {
-	size_t next_len = 0;
+	if (!queue_has_item(buffer_queue))
+		return 0;
 
-	if (pthread_mutex_lock(&buffer_queue->q_mutex) == 0)
-	{
-		if (buffer_queue->head != NULL)
-		{
-			next_len = buffer_queue->head->len;
-		}
-		pthread_mutex_unlock(&buffer_queue->q_mutex);
-	}
-	return next_len;
+	return queue_head_len(buffer_queue);
 }
 
 //return the length of the next buffer in the queue, blocking until
@@ -144,19 +196,24 @@ size_t wait_on_queue(struct buffer_queue *buffer_queue, time_t timeout_s)
 	size_t          in_queue = -1;
 	struct timespec ts;
 
+	//Fast path, no locking required
+	if (queue_has_item(buffer_queue))
+		return queue_head_len(buffer_queue);
+
 	if (timeout_s)
 	{
 		clock_gettime(CLOCK_REALTIME, &ts);
 		ts.tv_sec += timeout_s;
 	}
 
+	__atomic_add_fetch(&buffer_queue->waiters, 1, __ATOMIC_SEQ_CST);
 	if (pthread_mutex_lock(&buffer_queue->q_mutex) == 0)
 	{
 		do
 		{
-			if (buffer_queue->head != NULL)
+			if (queue_has_item(buffer_queue))
 			{
-				in_queue = buffer_queue->head->len;
+				in_queue = queue_head_len(buffer_queue);
 			}
 			else if (!timeout_s)
 			{
@@ -170,6 +227,7 @@ size_t wait_on_queue(struct buffer_queue *buffer_queue, time_t timeout_s)
 		} while (in_queue == ((size_t)-1));
 		pthread_mutex_unlock(&buffer_queue->q_mutex);
 	}
+	__atomic_sub_fetch(&buffer_queue->waiters, 1, __ATOMIC_SEQ_CST);
 	return in_queue;
 }
 
@@ -178,17 +236,22 @@ ca_error wait_on_queue_empty(struct buffer_queue *buffer_queue, time_t timeout_s
 	ca_error        error = CA_ERROR_FAIL;
 	struct timespec ts;
 
+	//Fast path, no locking required
+	if (!queue_has_item(buffer_queue))
+		return CA_ERROR_SUCCESS;
+
 	if (timeout_s)
 	{
 		clock_gettime(CLOCK_REALTIME, &ts);
 		ts.tv_sec += timeout_s;
 	}
 
+	__atomic_add_fetch(&buffer_queue->waiters, 1, __ATOMIC_SEQ_CST);
 	if (pthread_mutex_lock(&buffer_queue->q_mutex) == 0)
 	{
 		do
 		{
-			if (buffer_queue->head == NULL)
+			if (!queue_has_item(buffer_queue))
 			{
 				error = CA_ERROR_SUCCESS;
 			}
@@ -204,5 +267,16 @@ ca_error wait_on_queue_empty(struct buffer_queue *buffer_queue, time_t timeout_s
 		} while (error != CA_ERROR_SUCCESS && error != CA_ERROR_TIMEOUT);
 		pthread_mutex_unlock(&buffer_queue->q_mutex);
 	}
+	__atomic_sub_fetch(&buffer_queue->waiters, 1, __ATOMIC_SEQ_CST);
 	return error;
 }
+
+void get_queue_stats(struct buffer_queue *buffer_queue, struct buffer_queue_stats *stats)
+{
+	pthread_mutex_lock(&buffer_queue->p_mutex);
+	stats->depth      = CASCODA_POSIX_QUEUE_DEPTH;
+	stats->count      = buffer_queue->tail - __atomic_load_n(&buffer_queue->head, __ATOMIC_ACQUIRE);
+	stats->high_water = buffer_queue->high_water;
+	stats->overflows  = buffer_queue->overflows;
+	pthread_mutex_unlock(&buffer_queue->p_mutex);
+}
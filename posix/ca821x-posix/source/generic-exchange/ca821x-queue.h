@@ -43,13 +43,28 @@
 #include "ca821x-posix/ca821x-types.h"
 
 /**
- * Add a buffer onto the end of a queue
+ * Initialise a queue, must be called before any other use of the queue
+ * @param buffer_queue A pointer to the queue
+ */
+void init_queue(struct buffer_queue *buffer_queue);
+
+/**
+ * Release the resources of a queue that was initialised with init_queue
+ * @param buffer_queue A pointer to the queue
+ */
+void deinit_queue(struct buffer_queue *buffer_queue);
+
+/**
+ * Copy a buffer onto the end of a queue. Safe to call from multiple threads.
  * @param buffer_queue A pointer to the queue
  * @param buf The buffer to queue
  * @param len The length in bytes of the buffer
  * @param pDeviceRef The pDeviceRef that the buffer is relevant to
+ * @retval CA_ERROR_SUCCESS Buffer queued
+ * @retval CA_ERROR_NO_BUFFER The queue is full, the overflow count has been incremented
+ * @retval CA_ERROR_INVALID_ARGS len is larger than CA821X_QUEUE_BUF_SIZE
  */
-void add_to_queue(struct buffer_queue *buffer_queue, const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef);
+ca_error add_to_queue(struct buffer_queue *buffer_queue, const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef);
 
 /**
  * Empty a queue into nothing
@@ -58,7 +73,7 @@ void add_to_queue(struct buffer_queue *buffer_queue, const uint8_t *buf, size_t
 void flush_queue(struct buffer_queue *buffer_queue);
 
 /**
- * Pop a buffer off a queue
+ * Pop a buffer off a queue. Only a single thread may consume from a given queue at a time.
  * @param buffer_queue A pointer to the queue
  * @param[out] destBuf A pointer to a buffer to accept the dequeued data
  * @param maxlen The max size of the destBuf
@@ -93,4 +108,11 @@ size_t wait_on_queue(struct buffer_queue *buffer_queue, time_t timeout_s);
  */
 ca_error wait_on_queue_empty(struct buffer_queue *buffer_queue, time_t timeout_s);
 
+/**
+ * Get a snapshot of the statistics of a queue
+ * @param buffer_queue A pointer to the queue
+ * @param[out] stats The statistics of the queue
+ */
+void get_queue_stats(struct buffer_queue *buffer_queue, struct buffer_queue_stats *stats);
+
 #endif
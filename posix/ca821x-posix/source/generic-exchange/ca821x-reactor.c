@@ -0,0 +1,488 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Shared epoll reactor for ca821x-posix exchanges
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "ca821x-posix/ca821x-posix.h"
+#include "ca821x-generic-exchange.h"
+#include "ca821x-queue.h"
+#include "ca821x-reactor.h"
+
+#if defined(__linux__)
+
+enum
+{
+	REACTOR_MAX_EVENTS = 16,  //!< Max events handled per epoll_wait
+	REACTOR_TICK_MS    = 200, //!< Period at which every device is serviced, so that exchange timeouts are handled
+	REACTOR_MAX_THREADS = 64, //!< Upper limit on the number of reactor threads
+};
+
+/** A single reactor thread and the devices it services */
+struct ca821x_reactor
+{
+	pthread_t           thread;    //!< Reactor thread
+	int                 epfd;      //!< epoll instance
+	int                 evfd;      //!< eventfd used to wake the thread for writing
+	int                 run_flag;  //!< Is the thread supposed to be running? (protected by mutex)
+	pthread_mutex_t     mutex;     //!< Protects devs, servicing and the statistics
+	pthread_cond_t      cond;      //!< Signalled when the thread finishes servicing a device
+	struct ca821x_dev * servicing; //!< Device being serviced by the thread without the mutex held, or NULL
+	struct ca821x_dev **devs;      //!< Devices serviced by this reactor
+	size_t              devcount;  //!< Number of devices in devs
+	size_t              maxdevs;   //!< Allocated size of devs
+	uint64_t            wakeups;   //!< Number of returns from epoll_wait
+	uint64_t            events;    //!< Number of device readiness events
+	uint64_t            signals;   //!< Number of eventfd wakeups
+	uint64_t            timeouts;  //!< Number of timeout ticks
+};
+
+static struct ca821x_reactor *s_reactors      = NULL;
+static unsigned int           s_reactor_count = 0;
+
+/** Protects s_reactors and s_reactor_count */
+static pthread_mutex_t s_reactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool reactor_has_dev(struct ca821x_reactor *reactor, struct ca821x_dev *pDeviceRef)
+{
+	for (size_t i = 0; i < reactor->devcount; i++)
+	{
+		if (reactor->devs[i] == pDeviceRef)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Service a device with the reactor mutex released, so that callbacks run by the exchange can deinitialise
+ * the device (or another one) without deadlocking. Must be called with the mutex held.
+ */
+static void reactor_service(struct ca821x_reactor *reactor, struct ca821x_dev *pDeviceRef)
+{
+	reactor->servicing = pDeviceRef;
+	pthread_mutex_unlock(&reactor->mutex);
+
+	ca821x_io_service(pDeviceRef);
+
+	pthread_mutex_lock(&reactor->mutex);
+	reactor->servicing = NULL;
+	pthread_cond_broadcast(&reactor->cond);
+}
+
+/** Read the eventfd, returning true if the reactor was signalled */
+static bool reactor_clear_signal(struct ca821x_reactor *reactor)
+{
+	uint64_t count;
+
+	if (read(reactor->evfd, &count, sizeof(count)) == sizeof(count))
+		return true;
+	if (errno != EAGAIN)
+		ca_log_warn("Reactor eventfd read failed: %s", strerror(errno));
+	return false;
+}
+
+static void reactor_write_signal(struct ca821x_reactor *reactor)
+{
+	const uint64_t one = 1;
+
+	//The only expected failure is EAGAIN, if the counter is already saturated, in which case the thread is woken anyway
+	if (write(reactor->evfd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+		ca_log_crit("Reactor eventfd write failed: %s", strerror(errno));
+}
+
+static void *ca821x_reactor_worker(void *arg)
+{
+	struct ca821x_reactor *reactor = arg;
+	struct epoll_event     events[REACTOR_MAX_EVENTS];
+	int                    nevents;
+
+	pthread_mutex_lock(&reactor->mutex);
+	while (reactor->run_flag)
+	{
+		pthread_mutex_unlock(&reactor->mutex);
+
+		nevents = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, REACTOR_TICK_MS);
+
+		pthread_mutex_lock(&reactor->mutex);
+		reactor->wakeups++;
+
+		if (nevents == 0)
+		{
+			//Tick: service everything so that partial receives and missing acks time out
+			reactor->timeouts++;
+			//devcount is reread every iteration, as devices can be unregistered while the mutex is released
+			for (size_t i = 0; i < reactor->devcount; i++) reactor_service(reactor, reactor->devs[i]);
+		}
+
+		for (int i = 0; i < nevents; i++)
+		{
+			struct ca821x_dev *pDeviceRef = events[i].data.ptr;
+
+			if (pDeviceRef == NULL)
+			{
+				struct ca821x_exchange_base *priv;
+
+				//Write wakeup, service every device with something to send
+				if (!reactor_clear_signal(reactor))
+					continue;
+				reactor->signals++;
+				for (size_t j = 0; j < reactor->devcount; j++)
+				{
+					priv = reactor->devs[j]->exchange_context;
+					if (peek_queue(&priv->out_buffer_queue))
+						reactor_service(reactor, reactor->devs[j]);
+				}
+			}
+			else if (reactor_has_dev(reactor, pDeviceRef))
+			{
+				//Check membership, as the device may have been unregistered since epoll_wait returned
+				reactor->events++;
+				reactor_service(reactor, pDeviceRef);
+			}
+		}
+	}
+	pthread_mutex_unlock(&reactor->mutex);
+
+	return 0;
+}
+
+static ca_error reactor_init(struct ca821x_reactor *reactor)
+{
+	struct epoll_event ev = {0};
+
+	memset(reactor, 0, sizeof(*reactor));
+	reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+	reactor->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (reactor->epfd < 0 || reactor->evfd < 0)
+		goto fail;
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->evfd, &ev))
+		goto fail;
+
+	pthread_mutex_init(&reactor->mutex, NULL);
+	pthread_cond_init(&reactor->cond, NULL);
+	reactor->run_flag = 1;
+
+	if (pthread_create(&reactor->thread, NULL, &ca821x_reactor_worker, reactor))
+	{
+		pthread_mutex_destroy(&reactor->mutex);
+		pthread_cond_destroy(&reactor->cond);
+		goto fail;
+	}
+
+	return CA_ERROR_SUCCESS;
+
+fail:
+	if (reactor->epfd >= 0)
+		close(reactor->epfd);
+	if (reactor->evfd >= 0)
+		close(reactor->evfd);
+	return CA_ERROR_FAIL;
+}
+
+static void reactor_deinit(struct ca821x_reactor *reactor)
+{
+	pthread_mutex_lock(&reactor->mutex);
+	reactor->run_flag = 0;
+	pthread_mutex_unlock(&reactor->mutex);
+
+	//If this fails, the thread still exits on its next tick
+	reactor_write_signal(reactor);
+	pthread_join(reactor->thread, NULL);
+
+	close(reactor->epfd);
+	close(reactor->evfd);
+	pthread_mutex_destroy(&reactor->mutex);
+	pthread_cond_destroy(&reactor->cond);
+	free(reactor->devs);
+}
+
+ca_error ca821x_util_start_reactor(unsigned int aNumThreads)
+{
+	ca_error error = CA_ERROR_SUCCESS;
+
+	if (aNumThreads == 0 || aNumThreads > REACTOR_MAX_THREADS)
+		return CA_ERROR_INVALID_ARGS;
+
+	pthread_mutex_lock(&s_reactor_mutex);
+
+	if (s_reactor_count)
+	{
+		error = CA_ERROR_ALREADY;
+		goto exit;
+	}
+
+	s_reactors = calloc(aNumThreads, sizeof(*s_reactors));
+	if (!s_reactors)
+	{
+		error = CA_ERROR_NO_BUFFER;
+		goto exit;
+	}
+
+	for (unsigned int i = 0; i < aNumThreads; i++)
+	{
+		error = reactor_init(&s_reactors[i]);
+		if (error)
+		{
+			while (i--) reactor_deinit(&s_reactors[i]);
+			free(s_reactors);
+			s_reactors = NULL;
+			goto exit;
+		}
+	}
+
+	s_reactor_count = aNumThreads;
+
+exit:
+	pthread_mutex_unlock(&s_reactor_mutex);
+	return error;
+}
+
+ca_error ca821x_util_stop_reactor(void)
+{
+	ca_error error = CA_ERROR_SUCCESS;
+
+	pthread_mutex_lock(&s_reactor_mutex);
+
+	if (!s_reactor_count)
+	{
+		error = CA_ERROR_ALREADY;
+		goto exit;
+	}
+
+	for (unsigned int i = 0; i < s_reactor_count; i++)
+	{
+		if (s_reactors[i].devcount)
+		{
+			error = CA_ERROR_INVALID_STATE;
+			goto exit;
+		}
+	}
+
+	for (unsigned int i = 0; i < s_reactor_count; i++) reactor_deinit(&s_reactors[i]);
+
+	free(s_reactors);
+	s_reactors      = NULL;
+	s_reactor_count = 0;
+
+exit:
+	pthread_mutex_unlock(&s_reactor_mutex);
+	return error;
+}
+
+ca_error ca821x_util_get_reactor_stats(struct ca821x_reactor_stats *aStats)
+{
+	memset(aStats, 0, sizeof(*aStats));
+
+	pthread_mutex_lock(&s_reactor_mutex);
+	aStats->threads = s_reactor_count;
+	for (unsigned int i = 0; i < s_reactor_count; i++)
+	{
+		struct ca821x_reactor *reactor = &s_reactors[i];
+
+		pthread_mutex_lock(&reactor->mutex);
+		aStats->devices += reactor->devcount;
+		aStats->wakeups += reactor->wakeups;
+		aStats->events += reactor->events;
+		aStats->signals += reactor->signals;
+		aStats->timeouts += reactor->timeouts;
+		pthread_mutex_unlock(&reactor->mutex);
+	}
+	pthread_mutex_unlock(&s_reactor_mutex);
+
+	return s_reactor_count ? CA_ERROR_SUCCESS : CA_ERROR_INVALID_STATE;
+}
+
+ca_error reactor_register(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv    = pDeviceRef->exchange_context;
+	struct ca821x_reactor *      reactor = NULL;
+	struct epoll_event           ev      = {0};
+	ca_error                     error   = CA_ERROR_SUCCESS;
+	int                          fd;
+
+	if (!priv->get_fd_func || (fd = priv->get_fd_func(pDeviceRef)) < 0)
+		return CA_ERROR_NOT_HANDLED;
+
+	pthread_mutex_lock(&s_reactor_mutex);
+
+	if (!s_reactor_count)
+	{
+		error = CA_ERROR_NOT_HANDLED;
+		goto exit;
+	}
+
+	//Pick the least loaded reactor
+	for (unsigned int i = 0; i < s_reactor_count; i++)
+	{
+		if (!reactor || s_reactors[i].devcount < reactor->devcount)
+			reactor = &s_reactors[i];
+	}
+
+	priv->flush_func(pDeviceRef);
+
+	pthread_mutex_lock(&reactor->mutex);
+	if (reactor->devcount == reactor->maxdevs)
+	{
+		size_t              newmax  = reactor->maxdevs ? reactor->maxdevs * 2 : 8;
+		struct ca821x_dev **newdevs = realloc(reactor->devs, newmax * sizeof(*newdevs));
+
+		if (!newdevs)
+		{
+			error = CA_ERROR_NO_BUFFER;
+			goto exit_unlock;
+		}
+		reactor->devs    = newdevs;
+		reactor->maxdevs = newmax;
+	}
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = pDeviceRef;
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev))
+	{
+		error = CA_ERROR_FAIL;
+		goto exit_unlock;
+	}
+
+	reactor->devs[reactor->devcount++] = pDeviceRef;
+	priv->reactor                      = reactor;
+
+exit_unlock:
+	pthread_mutex_unlock(&reactor->mutex);
+exit:
+	pthread_mutex_unlock(&s_reactor_mutex);
+	return error;
+}
+
+void reactor_unregister(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv    = pDeviceRef->exchange_context;
+	struct ca821x_reactor *      reactor = priv->reactor;
+
+	pthread_mutex_lock(&reactor->mutex);
+	epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, priv->get_fd_func(pDeviceRef), NULL);
+	for (size_t i = 0; i < reactor->devcount; i++)
+	{
+		if (reactor->devs[i] == pDeviceRef)
+		{
+			reactor->devs[i] = reactor->devs[--reactor->devcount];
+			break;
+		}
+	}
+	priv->reactor = NULL;
+
+	//Wait for the thread to finish with the device, unless this was called from the thread itself by a callback,
+	//in which case the thread does not touch the device again after servicing returns.
+	if (!pthread_equal(pthread_self(), reactor->thread))
+	{
+		while (reactor->servicing == pDeviceRef) pthread_cond_wait(&reactor->cond, &reactor->mutex);
+	}
+	pthread_mutex_unlock(&reactor->mutex);
+}
+
+void reactor_update_fd(struct ca821x_dev *pDeviceRef, int aOldFd, int aNewFd)
+{
+	struct ca821x_exchange_base *priv    = pDeviceRef->exchange_context;
+	struct ca821x_reactor *      reactor = priv->reactor;
+	struct epoll_event           ev      = {0};
+
+	if (aOldFd >= 0)
+		epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, aOldFd, NULL);
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = pDeviceRef;
+	if (aNewFd >= 0 && epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, aNewFd, &ev))
+		ca_log_crit("Failed to register new file descriptor with reactor: %s", strerror(errno));
+}
+
+void reactor_signal(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+
+	reactor_write_signal(priv->reactor);
+}
+
+#else //defined(__linux__)
+
+ca_error ca821x_util_start_reactor(unsigned int aNumThreads)
+{
+	(void)aNumThreads;
+	return CA_ERROR_NOT_HANDLED;
+}
+
+ca_error ca821x_util_stop_reactor(void)
+{
+	return CA_ERROR_ALREADY;
+}
+
+ca_error ca821x_util_get_reactor_stats(struct ca821x_reactor_stats *aStats)
+{
+	memset(aStats, 0, sizeof(*aStats));
+	return CA_ERROR_INVALID_STATE;
+}
+
+ca_error reactor_register(struct ca821x_dev *pDeviceRef)
+{
+	(void)pDeviceRef;
+	return CA_ERROR_NOT_HANDLED;
+}
+
+void reactor_unregister(struct ca821x_dev *pDeviceRef)
+{
+	(void)pDeviceRef;
+}
+
+void reactor_update_fd(struct ca821x_dev *pDeviceRef, int aOldFd, int aNewFd)
+{
+	(void)pDeviceRef;
+	(void)aOldFd;
+	(void)aNewFd;
+}
+
+void reactor_signal(struct ca821x_dev *pDeviceRef)
+{
+	(void)pDeviceRef;
+}
+
+#endif //defined(__linux__)
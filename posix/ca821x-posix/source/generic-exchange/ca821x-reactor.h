@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * Shared epoll reactor that services the io of many exchanges from a small number of threads
+ */
+
+#ifndef CA821X_REACTOR_H
+#define CA821X_REACTOR_H
+
+#include "ca821x-posix/ca821x-types.h"
+
+/**
+ * Register a device with the least loaded reactor thread, if the reactor is running and the
+ * exchange of the device provides a file descriptor.
+ * @param pDeviceRef An initialised pDeviceRef struct
+ * @retval CA_ERROR_SUCCESS The device is now serviced by a reactor thread
+ * @retval CA_ERROR_NOT_HANDLED The reactor is not running, or the exchange cannot be used with it
+ * @retval CA_ERROR_FAIL Failed to register the device
+ */
+ca_error reactor_register(struct ca821x_dev *pDeviceRef);
+
+/**
+ * Remove a device from its reactor thread. Once this returns, the reactor will not touch the device. This may
+ * be called from a callback running on the reactor thread.
+ * @param pDeviceRef A pDeviceRef struct that was successfully registered with reactor_register
+ */
+void reactor_unregister(struct ca821x_dev *pDeviceRef);
+
+/**
+ * Replace the file descriptor watched for a device, for exchanges that reopen their device after an error.
+ * @param pDeviceRef A pDeviceRef struct that was successfully registered with reactor_register
+ * @param aOldFd The file descriptor to stop watching, which must not be closed yet, or -1 for none
+ * @param aNewFd The file descriptor to start watching, or -1 for none
+ */
+void reactor_update_fd(struct ca821x_dev *pDeviceRef, int aOldFd, int aNewFd);
+
+/**
+ * Wake the reactor thread of a device so that it writes any queued messages.
+ * @param pDeviceRef A pDeviceRef struct that was successfully registered with reactor_register
+ */
+void reactor_signal(struct ca821x_dev *pDeviceRef);
+
+#endif
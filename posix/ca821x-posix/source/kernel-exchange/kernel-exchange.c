@@ -127,7 +127,8 @@ ssize_t kernel_exchange_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 
 	assert_kernel_exchange(pDeviceRef);
 
-	if (!peek_queue(&(priv->base.out_buffer_queue)))
+	//When serviced by a reactor, the read must not block
+	if (!priv->base.reactor && !peek_queue(&(priv->base.out_buffer_queue)))
 	{
 		fd_set  rx_block_fd_set;
 		int     nfds;
@@ -169,6 +170,13 @@ void unblock_read(struct ca821x_dev *pDeviceRef)
 	write(DriverFDPipe[1], &dummybyte, 1);
 }
 
+static int get_fd_ke(struct ca821x_dev *pDeviceRef)
+{
+	assert_kernel_exchange(pDeviceRef);
+
+	return DriverFileDescriptor;
+}
+
 static int init_statics()
 {
 	DriverFileDescriptor = -1;
@@ -218,6 +226,7 @@ ca_error kernel_exchange_init(ca821x_errorhandler callback, struct ca821x_dev *p
 	priv->base.signal_func       = unblock_read;
 	priv->base.read_func         = kernel_exchange_try_read;
 	priv->base.flush_func        = flush_unread_ke;
+	priv->base.get_fd_func       = get_fd_ke;
 
 	error = init_generic(pDeviceRef) ? CA_ERROR_NOT_FOUND : CA_ERROR_SUCCESS;
 
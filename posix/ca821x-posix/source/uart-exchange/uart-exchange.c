@@ -43,24 +43,75 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "ca821x-posix/ca821x-posix-evbme.h"
+#include "cascoda-util/cascoda_hash.h"
 #include "ca821x-generic-exchange.h"
 #include "ca821x-posix-util-internal.h"
 #include "ca821x-queue.h"
+#include "ca821x-reactor.h"
 #include "ca821x_api.h"
+#include "evbme_messages.h"
 #include "uart-exchange.h"
 
+/*
+ * Windowed framing, negotiated with EVBME_UART_WINDOW. Frames are sent without waiting for the
+ * previous one to be acknowledged, up to the window size, and are held in a ring until acknowledged.
+ *
+ * Data frame: SOM(0xDF) | Seq | Ack | CmdId | CmdLen | Data... | CRC16 (LE, over Seq..Data)
+ * ACK frame:  CmdId = EVBME_RXRDY, CmdLen = 0, Ack = next sequence number expected
+ * NACK frame: CmdId = EVBME_RXFAIL, CmdLen = 0, Ack = sequence number missing (resent selectively)
+ *
+ * The Ack field of every frame is a cumulative acknowledgement. Stop-and-wait frames (SOM 0xDE) are
+ * always accepted, so that devices without windowed framing keep working.
+ */
+
+//! Maximum number of frames in flight the host supports in windowed mode
+#define UART_WINDOW_MAX 8
+//! Windowed framing overhead (SOM, Seq, Ack, 16-bit CRC)
+#define UART_WIN_OVERHEAD 5
+//! Largest frame on the wire
+#define UART_FRAME_MAX (MAX_BUF_SIZE + UART_WIN_OVERHEAD)
+//! Number of consecutive ack timeouts before windowed framing is abandoned
+#define UART_WIN_MAX_TIMEOUTS 5
+
+/** A transmitted frame, held until it is acknowledged */
+struct uart_tx_frame
+{
+	uint8_t frame[UART_FRAME_MAX]; //!< Frame as sent on the wire
+	size_t  len;                   //!< Length of frame
+};
+
+/** A received frame, held until the frames before it have been received */
+struct uart_rx_frame
+{
+	bool    valid;             //!< True if buf holds a frame waiting to be delivered
+	uint8_t buf[MAX_BUF_SIZE]; //!< Received command (CmdId, CmdLen, Data)
+};
+
 /** Private data for the UART Exchange */
 struct uart_exchange_priv
 {
 	struct ca821x_exchange_base base;       //!< Exchange base structure
 	int                         fd;         //!< UART device file descriptor
+	char *                      device;     //!< Path of the UART device, for reopening it
+	int                         baud;       //!< Baudrate of the UART device, for reopening it
 	uint8_t                     tx_stalled; //!< True if transmissions are stalled waiting for ack
-	uint8_t         rx_buf[MAX_BUF_SIZE];   //!< Private buffer for buffering read data before full packet is received
+	uint8_t         rx_buf[UART_FRAME_MAX]; //!< Private buffer for buffering read data before full packet is received
 	uint8_t         tx_buf[MAX_BUF_SIZE];   //!< Private buffer for buffering tx data (in case retransmit is required)
 	size_t          offset;                 //!< Current offset for reading into buf
 	struct timespec prev_send;              //!< Time that previous message was sent (for timing out ack)
 	struct timespec rx_start;               //!< Time that current message receive started (for timing out receive)
 	int             dummyPipe[2];           //!< Dummy pipe to release from select() call when write is due
+
+	uint8_t              win_size;                //!< Negotiated transmit window, 0 for stop-and-wait
+	uint8_t              win_tx_seq;              //!< Sequence number of the next frame to transmit
+	uint8_t              win_tx_acked;            //!< Sequence number of the oldest unacknowledged frame
+	uint8_t              win_rx_seq;              //!< Sequence number of the next frame to deliver
+	uint8_t              win_timeouts;            //!< Number of consecutive ack timeouts
+	bool                 win_nack_sent;           //!< True if win_rx_seq has already been NACKed
+	struct timespec      win_tx_time;             //!< Time that the oldest unacknowledged frame was sent
+	struct uart_tx_frame win_tx[UART_WINDOW_MAX]; //!< Ring of unacknowledged frames, indexed by sequence number
+	struct uart_rx_frame win_rx[UART_WINDOW_MAX]; //!< Frames received ahead of sequence, indexed by sequence number
 };
 
 /** struct for representing the contents of CASCODA_UART environment variable */
@@ -72,12 +123,15 @@ struct uart_device
 };
 
 static int                 s_devcount         = 0;
+static uint8_t             s_window_max       = UART_WINDOW_MAX;
 static int                 s_initialised      = 0;
 static char *              s_CASCODA_UART     = NULL;
 static struct uart_device *s_uart_device_head = NULL;
 
 //! Start of frame delimiter
 static const uint8_t UART_SOM = 0xDE;
+//! Start of frame delimiter for windowed frames
+static const uint8_t UART_WIN_SOM = 0xDF;
 
 //! Timeout for waiting for ack = 1 second
 static const struct timespec ack_timeout = {1, 0};
@@ -89,6 +143,8 @@ static const struct timespec select_timeout = {0, 500000000ULL};
 static pthread_mutex_t devs_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  devs_cond  = PTHREAD_COND_INITIALIZER;
 
+static ca_error reopen_uart_device(struct ca821x_dev *pDeviceRef);
+
 static void assert_uart_exchange(struct ca821x_dev *pDeviceRef)
 {
 	struct uart_exchange_priv *priv = pDeviceRef->exchange_context;
@@ -98,16 +154,16 @@ static void assert_uart_exchange(struct ca821x_dev *pDeviceRef)
 }
 
 /**
- * Get the amount of time that has passed since the last transmission.
- * @param priv exchange private state
- * @return the time that has passed since last UART transmission.
+ * Get the amount of time that has passed since a point in time.
+ * @param since The time to measure from
+ * @return the time that has passed since 'since'.
  */
-static struct timespec get_tx_time_passed(const struct uart_exchange_priv *priv)
+static struct timespec get_time_passed(const struct timespec *since)
 {
 	struct timespec curTime;
 	if (!clock_gettime(CLOCK_REALTIME, &curTime))
 	{
-		curTime = time_sub(&curTime, &priv->prev_send);
+		curTime = time_sub(&curTime, since);
 	}
 	else
 	{
@@ -116,6 +172,16 @@ static struct timespec get_tx_time_passed(const struct uart_exchange_priv *priv)
 	return curTime;
 }
 
+/**
+ * Get the amount of time that has passed since the last transmission.
+ * @param priv exchange private state
+ * @return the time that has passed since last UART transmission.
+ */
+static struct timespec get_tx_time_passed(const struct uart_exchange_priv *priv)
+{
+	return get_time_passed(&priv->prev_send);
+}
+
 /**
  * Get the amount of time that has passed since the last receive started.
  * @param priv exchange private state
@@ -123,16 +189,28 @@ static struct timespec get_tx_time_passed(const struct uart_exchange_priv *priv)
  */
 static struct timespec get_rx_time_passed(const struct uart_exchange_priv *priv)
 {
-	struct timespec curTime;
-	if (!clock_gettime(CLOCK_REALTIME, &curTime))
-	{
-		curTime = time_sub(&curTime, &priv->rx_start);
-	}
-	else
+	return get_time_passed(&priv->rx_start);
+}
+
+/**
+ * Write a complete buffer to the UART, retrying partial writes.
+ * @param fd The UART device to write to
+ * @param buf The data to write
+ * @param len The length of the data
+ * @return ca_error value
+ */
+static ca_error uart_write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len)
 	{
-		memset(&curTime, 0, sizeof(curTime));
+		ssize_t rval = write(fd, buf, len);
+
+		if (rval < 0)
+			return CA_ERROR_FAIL;
+		len -= rval;
+		buf += rval;
 	}
-	return curTime;
+	return CA_ERROR_SUCCESS;
 }
 
 /**
@@ -143,79 +221,347 @@ static struct timespec get_rx_time_passed(const struct uart_exchange_priv *priv)
  */
 static ca_error send_uart_ack(int fd, bool rx_success)
 {
-	ca_error error = CA_ERROR_SUCCESS;
-	uint8_t  ack[] = {UART_SOM, EVBME_RXRDY, 0};
-	int      rval, len;
+	uint8_t ack[] = {UART_SOM, EVBME_RXRDY, 0};
 
 	if (!rx_success)
 		ack[1] = EVBME_RXFAIL;
 
-	len = sizeof(ack);
+	return uart_write_all(fd, ack, sizeof(ack));
+}
+
+/**
+ * Build a windowed frame around a command.
+ * @param frame Buffer of at least len + UART_WIN_OVERHEAD bytes to build the frame in
+ * @param seq Sequence number of the frame
+ * @param ack Cumulative acknowledgement (next sequence number expected)
+ * @param cmd The command to frame (CmdId, CmdLen, Data)
+ * @param len The length of the command
+ * @return The length of the frame
+ */
+static size_t build_win_frame(uint8_t *frame, uint8_t seq, uint8_t ack, const uint8_t *cmd, size_t len)
+{
+	frame[0] = UART_WIN_SOM;
+	frame[1] = seq;
+	frame[2] = ack;
+	memcpy(frame + 3, cmd, len);
+	PUTLE16(HASH_crc16_ccitt(frame + 1, len + 2), frame + 3 + len);
+
+	return len + UART_WIN_OVERHEAD;
+}
+
+/**
+ * Send a windowed ACK or NACK frame over the interface
+ * @param fd The UART device to use to send the ACK
+ * @param cmdid EVBME_RXRDY for an ACK, EVBME_RXFAIL for a NACK
+ * @param ack The next sequence number expected (which is the missing one for a NACK)
+ * @return ca_error value
+ */
+static ca_error send_uart_win_ack(int fd, uint8_t cmdid, uint8_t ack)
+{
+	const uint8_t cmd[] = {cmdid, 0};
+	uint8_t       frame[sizeof(cmd) + UART_WIN_OVERHEAD];
+	size_t        len = build_win_frame(frame, 0, ack, cmd, sizeof(cmd));
+
+	return uart_write_all(fd, frame, len);
+}
+
+/**
+ * Abandon windowed framing, because the device has stopped using it. The unacknowledged frames are kept, and
+ * resent with stop-and-wait framing by uart_write_isready before anything new is sent.
+ * @param priv exchange private state
+ * @param reason Reason to log
+ */
+static void uart_win_fallback(struct uart_exchange_priv *priv, const char *reason)
+{
+	ca_log_warn("%s, reverting to stop-and-wait framing", reason);
+	__atomic_store_n(&priv->win_size, 0, __ATOMIC_RELEASE);
+	priv->win_timeouts = 0;
+}
+
+/**
+ * Process a cumulative acknowledgement of transmitted windowed frames.
+ * @param priv exchange private state
+ * @param ack The next sequence number the device expects
+ */
+static void uart_win_handle_ack(struct uart_exchange_priv *priv, uint8_t ack)
+{
+	uint8_t in_flight = priv->win_tx_seq - priv->win_tx_acked;
+	uint8_t acked     = ack - priv->win_tx_acked;
+
+	//Ignore stale and out of range acknowledgements
+	if (!acked || acked > in_flight)
+		return;
+
+	priv->win_tx_acked = ack;
+	priv->win_timeouts = 0;
+	clock_gettime(CLOCK_REALTIME, &(priv->win_tx_time));
+}
+
+/**
+ * Resend a single unacknowledged windowed frame.
+ * @param priv exchange private state
+ * @param seq The sequence number of the frame to resend
+ * @return ca_error value
+ */
+static ca_error uart_win_resend(struct uart_exchange_priv *priv, uint8_t seq)
+{
+	struct uart_tx_frame *tx = &priv->win_tx[seq % UART_WINDOW_MAX];
+
+	if ((uint8_t)(seq - priv->win_tx_acked) >= (uint8_t)(priv->win_tx_seq - priv->win_tx_acked))
+		return CA_ERROR_SUCCESS;
 
-	while (len > 0)
+	ca_log_debg("UART resending frame %d", seq);
+	if (seq == priv->win_tx_acked)
+		clock_gettime(CLOCK_REALTIME, &(priv->win_tx_time));
+
+	return uart_write_all(priv->fd, tx->frame, tx->len);
+}
+
+static ca_error uart_write_legacy(const uint8_t *buffer, size_t len, struct uart_exchange_priv *priv)
+{
+	ca_error error;
+
+	//store sent message
+	if (buffer != priv->tx_buf)
+		memcpy(priv->tx_buf, buffer, len);
+
+	error = uart_write_all(priv->fd, &UART_SOM, 1);
+	if (!error)
+		error = uart_write_all(priv->fd, buffer, len);
+
+	if (!error)
 	{
-		rval = write(fd, ack, len);
-		if (rval < 0)
-		{
-			error = CA_ERROR_FAIL;
-			break;
-		}
-		len -= rval;
+		//Wait for ack
+		priv->tx_stalled = 1;
+		clock_gettime(CLOCK_REALTIME, &(priv->prev_send));
 	}
-
 	return error;
 }
 
+/**
+ * Resend the oldest unacknowledged windowed frame with stop-and-wait framing, after falling back to it.
+ * @param priv exchange private state
+ * @return ca_error value
+ */
+static ca_error uart_win_resend_legacy(struct uart_exchange_priv *priv)
+{
+	struct uart_tx_frame *tx = &priv->win_tx[priv->win_tx_acked++ % UART_WINDOW_MAX];
+
+	ca_log_debg("UART resending frame %d without windowing", (uint8_t)(priv->win_tx_acked - 1));
+	//CmdId, CmdLen and Data follow the SOM, Seq and Ack of the windowed frame
+	return uart_write_legacy(tx->frame + 3, tx->frame[4] + 2, priv);
+}
+
+static ca_error uart_write_windowed(const uint8_t *buffer, size_t len, struct uart_exchange_priv *priv)
+{
+	struct uart_tx_frame *tx = &priv->win_tx[priv->win_tx_seq % UART_WINDOW_MAX];
+
+	tx->len = build_win_frame(tx->frame, priv->win_tx_seq, priv->win_rx_seq, buffer, len);
+
+	//The ack timeout runs from the oldest unacknowledged frame
+	if (priv->win_tx_seq == priv->win_tx_acked)
+		clock_gettime(CLOCK_REALTIME, &(priv->win_tx_time));
+	priv->win_tx_seq++;
+
+	return uart_write_all(priv->fd, tx->frame, tx->len);
+}
+
 static ca_error uart_try_write(const uint8_t *buffer, size_t len, struct ca821x_dev *pDeviceRef)
 {
-	int                        rval  = 0;
 	ca_error                   error = CA_ERROR_SUCCESS;
 	struct uart_exchange_priv *priv  = pDeviceRef->exchange_context;
 
 	assert_uart_exchange(pDeviceRef);
 	assert(len == (size_t)(buffer[1] + 2));
 
-	//send SOM byte
-	do
+	if (__atomic_load_n(&priv->win_size, __ATOMIC_ACQUIRE))
+		error = uart_write_windowed(buffer, len, priv);
+	else
+		error = uart_write_legacy(buffer, len, priv);
+
+	if (error)
 	{
-		rval = write(priv->fd, &UART_SOM, 1);
-		if (rval < 0)
-		{
-			error = CA_ERROR_FAIL;
-			break;
-		}
-	} while (rval != 1);
+		ca_log_crit("UART Send error!");
+		error = CA_ERROR_FAIL;
+	}
+	else
+	{
+		ca_log_debg("Wrote to UART");
+	}
+	return error;
+}
 
-	//send message
-	while (len)
+/**
+ * Remove bytes from the start of the receive buffer.
+ * @param priv exchange private state
+ * @param len Number of bytes to remove
+ */
+static void uart_rx_discard(struct uart_exchange_priv *priv, size_t len)
+{
+	memmove(priv->rx_buf, priv->rx_buf + len, priv->offset - len);
+	priv->offset -= len;
+}
+
+/**
+ * Check that the start of the receive buffer looks like the start of a frame.
+ * @param priv exchange private state
+ * @return true if there is a SOM, and the length (if received yet) is possible
+ */
+static bool uart_rx_header_valid(const struct uart_exchange_priv *priv)
+{
+	size_t lenpos;
+
+	if (priv->rx_buf[0] == UART_SOM)
+		lenpos = 2;
+	else if (priv->rx_buf[0] == UART_WIN_SOM)
+		lenpos = 4;
+	else
+		return false;
+
+	return priv->offset <= lenpos || priv->rx_buf[lenpos] <= (MAX_BUF_SIZE - 2);
+}
+
+/**
+ * Get the length of the frame at the start of the receive buffer.
+ * @param priv exchange private state
+ * @return Length of the frame including framing, or 0 if it has not been completely received
+ */
+static size_t uart_rx_frame_len(const struct uart_exchange_priv *priv)
+{
+	size_t framelen;
+
+	if (priv->rx_buf[0] == UART_WIN_SOM)
 	{
-		rval = write(priv->fd, buffer, len);
-		if (rval < 0)
+		if (priv->offset < 5)
+			return 0;
+		framelen = priv->rx_buf[4] + 2 + UART_WIN_OVERHEAD;
+	}
+	else
+	{
+		if (priv->offset < 3)
+			return 0;
+		framelen = priv->rx_buf[2] + 3;
+	}
+
+	return (priv->offset >= framelen) ? framelen : 0;
+}
+
+/**
+ * Acknowledge the windowed frames delivered so far. If frames after the next expected one have
+ * already arrived, then the next one has been lost, so NACK it to have it resent immediately.
+ * @param priv exchange private state
+ * @return ca_error value
+ */
+static ca_error uart_win_ack(struct uart_exchange_priv *priv)
+{
+	if (!priv->win_nack_sent)
+	{
+		for (uint8_t i = 1; i < UART_WINDOW_MAX; i++)
 		{
-			error = CA_ERROR_FAIL;
-			break;
+			if (priv->win_rx[(uint8_t)(priv->win_rx_seq + i) % UART_WINDOW_MAX].valid)
+			{
+				priv->win_nack_sent = true;
+				return send_uart_win_ack(priv->fd, EVBME_RXFAIL, priv->win_rx_seq);
+			}
 		}
-		len -= len;
-		buffer += rval;
 	}
+	return send_uart_win_ack(priv->fd, EVBME_RXRDY, priv->win_rx_seq);
+}
 
-	//store sent message
-	if (buffer != priv->tx_buf)
-		memcpy(priv->tx_buf, buffer, len);
+/**
+ * Deliver a windowed frame that arrived ahead of sequence, if it is now the next one expected.
+ * @param priv exchange private state
+ * @param buf Buffer to deliver the command into
+ * @return Length of the delivered command, 0 if none, negative on error
+ */
+static ssize_t uart_win_pop(struct uart_exchange_priv *priv, uint8_t *buf)
+{
+	struct uart_rx_frame *rx = &priv->win_rx[priv->win_rx_seq % UART_WINDOW_MAX];
+	ssize_t               len;
 
-	if (error < 0)
+	if (!rx->valid)
+		return 0;
+
+	len = rx->buf[1] + 2;
+	memcpy(buf, rx->buf, len);
+	rx->valid = false;
+	priv->win_rx_seq++;
+	priv->win_nack_sent = false;
+
+	if (uart_win_ack(priv))
+		return -uart_exchange_err_uart;
+	return len;
+}
+
+/**
+ * Process a complete, CRC-checked windowed frame.
+ * @param priv exchange private state
+ * @param frame The frame, starting with the SOM
+ * @param buf Buffer to deliver the command into
+ * @return Length of the delivered command, 0 if none, negative on error
+ */
+static ssize_t uart_win_receive(struct uart_exchange_priv *priv, const uint8_t *frame, uint8_t *buf)
+{
+	uint8_t seq    = frame[1];
+	uint8_t ack    = frame[2];
+	uint8_t cmdid  = frame[3];
+	uint8_t cmdlen = frame[4];
+	uint8_t ahead  = seq - priv->win_rx_seq;
+
+	uart_win_handle_ack(priv, ack);
+
+	if (cmdlen == 0 && cmdid == EVBME_RXRDY)
+		return 0;
+
+	if (cmdlen == 0 && cmdid == EVBME_RXFAIL)
 	{
-		ca_log_crit("UART Send error!");
-		error = CA_ERROR_FAIL;
+		ca_log_debg("received NACK for frame %d", ack);
+		if (uart_win_resend(priv, ack))
+			return -uart_exchange_err_uart;
+		return 0;
 	}
-	else
+
+	if (ahead == 0)
 	{
-		//Wait for ack
-		ca_log_debg("Wrote to UART");
-		priv->tx_stalled = 1;
-		clock_gettime(CLOCK_REALTIME, &(priv->prev_send));
+		memcpy(buf, frame + 3, cmdlen + 2);
+		priv->win_rx_seq++;
+		priv->win_nack_sent = false;
+		if (uart_win_ack(priv))
+			return -uart_exchange_err_uart;
+		return cmdlen + 2;
 	}
-	return error;
+
+	if (ahead < UART_WINDOW_MAX)
+	{
+		//Hold on to it until the missing frames before it arrive
+		struct uart_rx_frame *rx = &priv->win_rx[seq % UART_WINDOW_MAX];
+
+		if (!rx->valid)
+		{
+			memcpy(rx->buf, frame + 3, cmdlen + 2);
+			rx->valid = true;
+		}
+	}
+
+	//Either ahead of sequence, or a duplicate because an ack was lost
+	if (uart_win_ack(priv))
+		return -uart_exchange_err_uart;
+	return 0;
+}
+
+/**
+ * Get the amount of time to wait for an ack before a timeout is due.
+ * @param since The time that the frame being acknowledged was sent
+ * @return Time to wait, limited to select_timeout
+ */
+static struct timespec get_ack_wait(const struct timespec *since)
+{
+	struct timespec timeout = get_time_passed(since);
+
+	timeout = time_sub(&ack_timeout, &timeout);
+	if (time_cmp(&timeout, &select_timeout) > 0)
+		timeout = select_timeout;
+	return timeout;
 }
 
 static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
@@ -225,34 +571,36 @@ static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 	struct timespec            timeout;
 	int                        nfds;
 	ssize_t                    len;
-	int                        error  = 0;
-	uint8_t *                  som    = priv->rx_buf;
-	uint8_t *                  cmdid  = priv->rx_buf + 1;
-	uint8_t *                  cmdlen = priv->rx_buf + 2;
+	size_t                     framelen;
+	int                        error = 0;
+	uint8_t *                  som   = priv->rx_buf;
+	uint8_t *                  cmdid = priv->rx_buf + 1;
 
 	assert_uart_exchange(pDeviceRef);
 
+	//Deliver any frame that arrived ahead of sequence and is now next in line
+	len = uart_win_pop(priv, buf);
+	if (len)
+		return len;
+
 	//Initialise fd set for blocking select()
 	FD_ZERO(&rx_block_fd_set);
-	FD_SET(priv->fd, &rx_block_fd_set);
+	if (priv->fd >= 0) //-1 after a failed reopen, which is retried by the read below
+		FD_SET(priv->fd, &rx_block_fd_set);
 	FD_SET(priv->dummyPipe[0], &rx_block_fd_set);
 	nfds = priv->fd > priv->dummyPipe[0] ? priv->fd : priv->dummyPipe[0];
 	nfds = nfds + 1;
 
 	//Set up timeout, taking ack timeout into account. Max block time = select_timeout
 	if (priv->tx_stalled)
-	{
-		timeout = get_tx_time_passed(priv);
-		timeout = time_sub(&ack_timeout, &timeout);
-		if (time_cmp(&timeout, &select_timeout) > 0)
-			timeout = select_timeout;
-	}
+		timeout = get_ack_wait(&priv->prev_send);
+	else if (priv->win_tx_seq != priv->win_tx_acked)
+		timeout = get_ack_wait(&priv->win_tx_time);
 	else
-	{
 		timeout = select_timeout;
-	}
 
-	if (!priv->offset)
+	//When serviced by a reactor, the read must not block
+	if (!priv->offset && !priv->base.reactor)
 	{
 		uint8_t dummybyte = 0;
 		//Block until activity required, then read potential dummy byte
@@ -273,6 +621,11 @@ static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 		{
 			ca_log_warn("UART read error 0x%02x", cur_errno);
 			error = -uart_exchange_err_uart;
+			if (reopen_uart_device(pDeviceRef) == CA_ERROR_SUCCESS) //uart disconnected - attempt to reopen it
+			{
+				len   = 0;
+				error = 0;
+			}
 			goto exit;
 		}
 	}
@@ -284,9 +637,10 @@ static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 	}
 
 	priv->offset += len;
+	len = 0;
 
 	//Catch SOM errors
-	while (priv->offset && *som != UART_SOM)
+	while (priv->offset && !uart_rx_header_valid(priv))
 	{
 		/*
 		 * Getting these very occasionally is ok, but if they are regular then either the
@@ -295,22 +649,42 @@ static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 		 * then it is likely a SOM has been missed and a packet has been lost.
 		 */
 		ca_log_warn("No SOM, got 0x%02x", priv->rx_buf[0]);
-		memmove(priv->rx_buf, priv->rx_buf + 1, priv->offset);
-		priv->offset -= 1;
+		uart_rx_discard(priv, 1);
 	}
 
 	// If an incomplete packet has been received, hold off returning it up until the full
 	// thing comes through.
-	if ((priv->offset >= 3) && (priv->offset >= (*cmdlen + 3U)))
+	framelen = priv->offset ? uart_rx_frame_len(priv) : 0;
+
+	if (framelen && *som == UART_WIN_SOM)
 	{
-		ssize_t framelen = *cmdlen + 3;
+		uint16_t crc = GETLE16(priv->rx_buf + framelen - 2);
+
+		if (crc != HASH_crc16_ccitt(priv->rx_buf + 1, framelen - 3))
+		{
+			//Drop the corrupted frame and have the missing frame resent
+			ca_log_warn("UART CRC error");
+			uart_rx_discard(priv, framelen);
+			if (send_uart_win_ack(priv->fd, EVBME_RXFAIL, priv->win_rx_seq))
+				error = -uart_exchange_err_uart;
+			goto exit;
+		}
 
+		len = uart_win_receive(priv, priv->rx_buf, buf);
+		uart_rx_discard(priv, framelen);
+		if (len < 0)
+		{
+			error = len;
+			goto exit;
+		}
+	}
+	else if (framelen)
+	{
 		//Skip SOM byte in copy
 		len = framelen - 1;
 		memcpy(buf, cmdid, len);
 		// If extra data has been received, shuffle about
-		memmove(priv->rx_buf, priv->rx_buf + framelen, (priv->offset - framelen));
-		priv->offset -= framelen;
+		uart_rx_discard(priv, framelen);
 
 		//Send ACK
 		if (buf[0] != EVBME_RXRDY && send_uart_ack(priv->fd, true) != CA_ERROR_SUCCESS)
@@ -318,6 +692,10 @@ static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 			error = -uart_exchange_err_uart;
 			goto exit;
 		}
+
+		//A stop-and-wait command means that the device has restarted without windowed framing
+		if (buf[0] != EVBME_RXRDY && buf[0] != EVBME_RXFAIL && __atomic_load_n(&priv->win_size, __ATOMIC_ACQUIRE))
+			uart_win_fallback(priv, "UART device stopped using windowed framing");
 	}
 	else
 	{
@@ -326,7 +704,10 @@ static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 		if (priv->offset && time_cmp(&timeDiff, &rx_timeout) > 0)
 		{
 			ca_log_warn("UART RX timed out");
-			send_uart_ack(priv->fd, false);
+			if (*som == UART_WIN_SOM)
+				send_uart_win_ack(priv->fd, EVBME_RXFAIL, priv->win_rx_seq);
+			else
+				send_uart_ack(priv->fd, false);
 			priv->offset = 0;
 		}
 		len = 0;
@@ -345,7 +726,7 @@ static ssize_t uart_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 	{
 		len = 0;
 		ca_log_debg("received NACK");
-		if (uart_try_write(priv->tx_buf, priv->tx_buf[1] + 2, pDeviceRef))
+		if (uart_write_legacy(priv->tx_buf, priv->tx_buf[1] + 2, priv))
 		{
 			ca_log_crit("UART failed to retransmit.");
 			error = -uart_exchange_err_uart;
@@ -381,9 +762,20 @@ static void unblock_read(struct ca821x_dev *pDeviceRef)
 	write(priv->dummyPipe[1], &dummybyte, 1);
 }
 
+static int uart_get_fd(struct ca821x_dev *pDeviceRef)
+{
+	struct uart_exchange_priv *priv = pDeviceRef->exchange_context;
+
+	assert_uart_exchange(pDeviceRef);
+
+	return priv->fd;
+}
+
 static ca_error uart_write_isready(struct ca821x_dev *pDeviceRef)
 {
 	struct uart_exchange_priv *priv = pDeviceRef->exchange_context;
+	uint8_t                    in_flight;
+	uint8_t                    win_size;
 
 	// Check ack timeout
 	if (priv->tx_stalled)
@@ -396,7 +788,42 @@ static ca_error uart_write_isready(struct ca821x_dev *pDeviceRef)
 		}
 	}
 
-	return priv->tx_stalled ? CA_ERROR_BUSY : CA_ERROR_SUCCESS;
+	if (priv->tx_stalled)
+		return CA_ERROR_BUSY;
+
+	// Check windowed ack timeout, resending the oldest unacknowledged frame
+	in_flight = priv->win_tx_seq - priv->win_tx_acked;
+	win_size  = __atomic_load_n(&priv->win_size, __ATOMIC_ACQUIRE);
+	if (in_flight && win_size)
+	{
+		struct timespec timeDiff = get_time_passed(&priv->win_tx_time);
+		if (time_cmp(&timeDiff, &ack_timeout) > 0)
+		{
+			if (++priv->win_timeouts >= UART_WIN_MAX_TIMEOUTS)
+			{
+				uart_win_fallback(priv, "UART device stopped acknowledging");
+			}
+			else
+			{
+				ca_log_warn("UART Ack missed");
+				if (uart_win_resend(priv, priv->win_tx_acked))
+					ca_log_crit("UART failed to retransmit.");
+			}
+		}
+	}
+
+	in_flight = priv->win_tx_seq - priv->win_tx_acked;
+	win_size  = __atomic_load_n(&priv->win_size, __ATOMIC_ACQUIRE);
+
+	// After falling back to stop-and-wait, resend the frames that were never acknowledged before anything new
+	if (in_flight && !win_size)
+	{
+		if (uart_win_resend_legacy(priv))
+			ca_log_crit("UART failed to retransmit.");
+		return CA_ERROR_BUSY;
+	}
+
+	return (win_size && in_flight >= win_size) ? CA_ERROR_BUSY : CA_ERROR_SUCCESS;
 }
 
 static void flush_unread_uart(struct ca821x_dev *pDeviceRef)
@@ -477,6 +904,8 @@ static ca_error init_statics()
 	ca_error    error              = CA_ERROR_SUCCESS;
 	const char *CONST_CASCODA_UART = getenv("CASCODA_UART");
 	//example: CASCODA_UART="/dev/ttyS0,115200:/dev/ttyS1,9600:/dev/ttyS2,6000000"
+	const char *CASCODA_UART_WINDOW = getenv("CASCODA_UART_WINDOW");
+	//example: CASCODA_UART_WINDOW=0 to disable windowed framing
 	size_t envLen;
 
 	if (s_initialised)
@@ -484,6 +913,17 @@ static ca_error init_statics()
 
 	s_initialised = 1;
 
+	s_window_max = UART_WINDOW_MAX;
+	if (CASCODA_UART_WINDOW)
+	{
+		int window = atoi(CASCODA_UART_WINDOW);
+
+		if (window < 0)
+			window = 0;
+		if (window < UART_WINDOW_MAX)
+			s_window_max = window;
+	}
+
 	if (!CONST_CASCODA_UART)
 	{
 		error = CA_ERROR_NOT_FOUND;
@@ -609,6 +1049,80 @@ static ca_error setup_port(int fd, int baudrate)
 	return CA_ERROR_SUCCESS;
 }
 
+/**
+ * Reopen the UART device after a read error, such as a USB serial adapter being unplugged and plugged back in.
+ * @param pDeviceRef Pointer to initialised ca821x_device_ref struct
+ * @retval CA_ERROR_SUCCESS The device was reopened
+ * @retval CA_ERROR_NOT_FOUND The device could not be reopened
+ */
+static ca_error reopen_uart_device(struct ca821x_dev *pDeviceRef)
+{
+	struct uart_exchange_priv *priv = pDeviceRef->exchange_context;
+
+	ca_log_warn("UART device dropped... attempting reopen");
+
+	//The reactor watches the open file, so it would miss the new one even if it reuses the same fd number
+	if (priv->base.reactor)
+		reactor_update_fd(pDeviceRef, priv->fd, -1);
+	close(priv->fd);
+	priv->offset = 0;
+
+	sleep(1);
+
+	priv->fd = open(priv->device, O_RDWR | O_NOCTTY | O_SYNC);
+	if (priv->fd >= 0 && (ioctl(priv->fd, TIOCEXCL) || setup_port(priv->fd, priv->baud) != CA_ERROR_SUCCESS))
+	{
+		close(priv->fd);
+		priv->fd = -1;
+	}
+
+	if (priv->fd < 0)
+	{
+		ca_log_crit("Failed to reopen UART device %s", priv->device);
+		return CA_ERROR_NOT_FOUND;
+	}
+
+	if (priv->base.reactor)
+		reactor_update_fd(pDeviceRef, -1, priv->fd);
+	ca_log_info("Successfully reopened UART device %s", priv->device);
+	return CA_ERROR_SUCCESS;
+}
+
+/**
+ * Negotiate windowed framing with a newly opened device. Devices that do not support it reject
+ * EVBME_UART_WINDOW, so the exchange stays with stop-and-wait framing.
+ * @param pDeviceRef Pointer to initialised ca821x_device_ref struct
+ */
+static void uart_negotiate_window(struct ca821x_dev *pDeviceRef)
+{
+	struct uart_exchange_priv *priv       = pDeviceRef->exchange_context;
+	uint8_t                    hostWindow = s_window_max;
+	uint8_t                    devWindow  = 0;
+	uint8_t                    len        = 0;
+
+	if (!hostWindow)
+		return;
+
+	if (EVBME_GET_request_sync(EVBME_UART_WINDOW, sizeof(devWindow), &devWindow, &len, pDeviceRef) ||
+	    len != sizeof(devWindow) || !devWindow)
+	{
+		ca_log_info("UART device does not support windowed framing.");
+		return;
+	}
+
+	//Tell the device how many frames it can have in flight to the host
+	if (EVBME_SET_request_sync(EVBME_UART_WINDOW, sizeof(hostWindow), &hostWindow, pDeviceRef))
+	{
+		ca_log_warn("Failed to enable windowed UART framing.");
+		return;
+	}
+
+	if (devWindow > hostWindow)
+		devWindow = hostWindow;
+	__atomic_store_n(&priv->win_size, devWindow, __ATOMIC_RELEASE);
+	ca_log_info("UART using windowed framing, %d frames in flight.", devWindow);
+}
+
 ca_error uart_exchange_init(ca821x_errorhandler callback, const char *path, struct ca821x_dev *pDeviceRef)
 {
 	struct uart_exchange_priv *priv = NULL;
@@ -642,6 +1156,7 @@ ca_error uart_exchange_init(ca821x_errorhandler callback, const char *path, stru
 	priv->base.signal_func        = &unblock_read;
 	priv->base.read_func          = &uart_try_read;
 	priv->base.flush_func         = &flush_unread_uart;
+	priv->base.get_fd_func        = &uart_get_fd;
 	priv->fd                      = -1;
 	priv->offset                  = 0;
 
@@ -699,6 +1214,14 @@ ca_error uart_exchange_init(ca821x_errorhandler callback, const char *path, stru
 		goto exit;
 	}
 
+	priv->device = strdup(uartdev->device);
+	priv->baud   = uartdev->baud;
+	if (!priv->device)
+	{
+		error = CA_ERROR_NO_BUFFER;
+		goto exit;
+	}
+
 	//Initialise the dummy pipe for releasing from select()
 	pipe(priv->dummyPipe);
 	fcntl(priv->dummyPipe[0], F_SETFL, O_NONBLOCK);
@@ -718,6 +1241,7 @@ ca_error uart_exchange_init(ca821x_errorhandler callback, const char *path, stru
 exit:
 	if (error && pDeviceRef->exchange_context)
 	{
+		free(priv->device);
 		free(pDeviceRef->exchange_context);
 		pDeviceRef->exchange_context = NULL;
 	}
@@ -727,7 +1251,10 @@ exit:
 	free_uartdev_ll(path_uartdev);
 	free(path_dup);
 	if (error == CA_ERROR_SUCCESS)
+	{
 		ca_log_info("Successfully started UART Exchange.");
+		uart_negotiate_window(pDeviceRef);
+	}
 	return error;
 }
 
@@ -745,6 +1272,7 @@ void uart_exchange_deinit(struct ca821x_dev *pDeviceRef)
 	pthread_cond_signal(&devs_cond);
 	pthread_mutex_unlock(&devs_mutex);
 
+	free(priv->device);
 	free(priv);
 	pDeviceRef->exchange_context = NULL;
 }
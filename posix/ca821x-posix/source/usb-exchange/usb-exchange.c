@@ -46,8 +46,11 @@
 #include "hidapi/hidapi.h"
 #include "ca821x-generic-exchange.h"
 #include "ca821x-posix-util-internal.h"
+#include "ca821x-posix/ca821x-posix-evbme.h"
+#include "ca821x-posix/ca821x-posix.h"
 #include "ca821x-queue.h"
 #include "ca821x_api.h"
+#include "evbme_messages.h"
 #include "usb-exchange.h"
 
 #define USB_VID 0x0416
@@ -55,13 +58,22 @@
 
 /** Maximum USB fragment size */
 #define MAX_FRAG_SIZE 64
-/** Max time to wait on rx data in milliseconds */
-#define POLL_DELAY 2
+/** Max time for the read thread to block on rx data in milliseconds, bounding how long deinit waits for it */
+#define READ_TIMEOUT 100
 
 #define FRAG_LEN_MASK 0x3F
 #define FRAG_LAST_MASK (1 << 7)
 #define FRAG_FIRST_MASK (1 << 6)
 
+/*
+ * Packed reports
+ * A message that fits in a single report is sent with both the first and last bits set, and a
+ * fragment length of exactly cmdlen + 2. Once packing has been negotiated with EVBME_USB_PACKED,
+ * further complete messages may follow it in the same report, with the fragment length covering
+ * all of them. Messages are only packed when they are queued back-to-back, so packing never delays
+ * a message. Packed reports are always accepted, regardless of negotiation.
+ */
+
 #define ARRAY_LENGTH(array) (sizeof((array)) / sizeof((array)[0]))
 
 #define NO_CONST_CHAR(x) (((char *)(x)))
@@ -71,9 +83,18 @@
  */
 struct usb_exchange_priv
 {
-	struct ca821x_exchange_base base;          //!< Exchange base struct
-	hid_device *                hid_dev;       //!< hidapi device reference struct
-	wchar_t *                   serial_number; //!< chili serial number
+	struct ca821x_exchange_base base;           //!< Exchange base struct
+	hid_device *                hid_dev;        //!< hidapi device reference struct
+	pthread_rwlock_t            hid_lock;       //!< Read-locked for hid_dev io, write-locked to reload hid_dev
+	unsigned int                hid_generation; //!< Incremented every time hid_dev is reloaded
+	wchar_t *                   serial_number;  //!< chili serial number
+
+	int     tx_packed;                      //!< Device unpacks packed reports, accessed atomically
+	uint8_t tx_pack_buf[MAX_FRAG_SIZE + 1]; //!< Report being packed for sending, with report ID
+	uint8_t tx_pack_len;                    //!< Length of the messages in tx_pack_buf
+	uint8_t rx_pack_buf[MAX_FRAG_SIZE];     //!< Messages from a received packed report not yet read
+	uint8_t rx_pack_len;                    //!< Length of the messages in rx_pack_buf
+	uint8_t rx_pack_offset;                 //!< Offset of the next message in rx_pack_buf
 
 #if CASCODA_RASPI_USB_WORKAROUND
 	struct timespec prev_send; //!< The time that the previous usb packet was sent
@@ -87,6 +108,7 @@ static struct ca821x_dev **s_devs        = NULL;
 static int                 s_maxdevcount = 0;
 static int                 s_devcount    = 0;
 static int                 s_initialised = 0;
+static bool                s_packing     = true;
 
 //Dynamic hid-api library
 #ifndef _WIN32
@@ -100,7 +122,10 @@ static int (*dhid_read_timeout)(hid_device *, unsigned char *, size_t, int);
 static int (*dhid_write)(hid_device *, const unsigned char *, size_t);
 static int (*dhid_exit)(void);
 
-static ca_error reload_hid_device(struct ca821x_dev *pDeviceRef);
+//Substitute hidapi, for testing
+static const struct usb_exchange_hid_ops *s_hid_ops = NULL;
+
+static ca_error reload_hid_device(struct ca821x_dev *pDeviceRef, unsigned int generation);
 
 static pthread_mutex_t devs_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  devs_cond  = PTHREAD_COND_INITIALIZER;
@@ -259,20 +284,50 @@ void usb_apply_raspi_workaround(struct ca821x_dev *pDeviceRef)
 #endif
 }
 
+/**
+ * Copy the next message of a received packed report into buf.
+ * @returns The length of the message, or 0 if the rest of the report was malformed and dropped
+ */
+static ssize_t unpack_next(struct usb_exchange_priv *priv, uint8_t *buf)
+{
+	const uint8_t *msg  = priv->rx_pack_buf + priv->rx_pack_offset;
+	size_t         left = priv->rx_pack_len - priv->rx_pack_offset;
+	size_t         len;
+
+	if (left < 2 || (size_t)msg[1] + 2 > left)
+	{
+		ca_log_warn("Dropped malformed packed USB report.");
+		priv->rx_pack_offset = priv->rx_pack_len = 0;
+		return 0;
+	}
+
+	len = msg[1] + 2;
+	memcpy(buf, msg, len);
+	priv->rx_pack_offset += len;
+	return len;
+}
+
 ssize_t usb_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 {
 	struct usb_exchange_priv *priv = pDeviceRef->exchange_context;
 	uint8_t                   frag_buf[MAX_FRAG_SIZE + 1]; //+1 for report ID
-	uint8_t                   delay, offset, len = 0;
-	int                       error;
+	uint8_t                   offset, len = 0;
+	int                       delay, error;
+	unsigned int              generation;
 
 	assert_usb_exchange(pDeviceRef);
 	usb_apply_raspi_workaround(pDeviceRef);
 
-	delay = POLL_DELAY;
+	//Messages left over from a packed report come first
+	if (priv->rx_pack_offset < priv->rx_pack_len)
+		return unpack_next(priv, buf);
+
+	delay = READ_TIMEOUT;
 
-	//Read from the device if possible
-	offset = 0;
+	//Block until the device sends something, writes are handled concurrently by the io write thread
+	pthread_rwlock_rdlock(&priv->hid_lock);
+	generation = priv->hid_generation;
+	offset     = 0;
 	do
 	{
 		error = dhid_read_timeout(priv->hid_dev, frag_buf, MAX_FRAG_SIZE, delay);
@@ -280,11 +335,21 @@ ssize_t usb_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 			break;
 		delay = -1;
 	} while (assemble_frags(frag_buf, buf, &len, &offset));
+	pthread_rwlock_unlock(&priv->hid_lock);
+
+	if (error > 0 && len > buf[1] + 2)
+	{
+		//Packed report, keep the messages after the first to be read next
+		priv->rx_pack_len    = len - (buf[1] + 2);
+		priv->rx_pack_offset = 0;
+		memcpy(priv->rx_pack_buf, buf + buf[1] + 2, priv->rx_pack_len);
+		len = buf[1] + 2;
+	}
 
 	if (error < 0)
 	{
 		error = -usb_exchange_err_usb;
-		if (reload_hid_device(pDeviceRef) == CA_ERROR_SUCCESS) //usb disconnected - attempt to grab new device
+		if (reload_hid_device(pDeviceRef, generation) == CA_ERROR_SUCCESS) //usb disconnected - attempt to grab new device
 		{
 			len   = 0;
 			error = 0;
@@ -312,6 +377,55 @@ ssize_t usb_try_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
 	return len;
 }
 
+static int write_report(struct usb_exchange_priv *priv, const uint8_t *frag_buf)
+{
+	uint8_t retries = 0;
+	int     error;
+
+	do
+	{
+		error = dhid_write(priv->hid_dev, frag_buf, MAX_FRAG_SIZE + 1);
+	} while ((error < 0) && (retries++ < 50));
+
+	return error;
+}
+
+//Send the report being packed, if there is one
+static int flush_packed(struct usb_exchange_priv *priv)
+{
+	if (!priv->tx_pack_len)
+		return 0;
+
+	priv->tx_pack_buf[0] = 0;
+	priv->tx_pack_buf[1] = FRAG_FIRST_MASK | FRAG_LAST_MASK | priv->tx_pack_len;
+	memset(priv->tx_pack_buf + 2 + priv->tx_pack_len, 0, MAX_FRAG_SIZE - 1 - priv->tx_pack_len);
+	priv->tx_pack_len = 0;
+
+	return write_report(priv, priv->tx_pack_buf);
+}
+
+//Add a message to the report being packed, only sending it if the next queued message won't fit
+static int write_packed(const uint8_t *buffer, size_t len, struct usb_exchange_priv *priv)
+{
+	int    error = 0;
+	size_t next_len;
+
+	if (priv->tx_pack_len + len > MAX_FRAG_SIZE - 1)
+		error = flush_packed(priv);
+	if (error < 0)
+		return error;
+
+	memcpy(priv->tx_pack_buf + 2 + priv->tx_pack_len, buffer, len);
+	priv->tx_pack_len += len;
+
+	//The io write thread is the only consumer, so the next message will be written straight after this
+	next_len = peek_queue(&priv->base.out_buffer_queue);
+	if (next_len && priv->tx_pack_len + next_len <= MAX_FRAG_SIZE - 1)
+		return 0;
+
+	return flush_packed(priv);
+}
+
 ca_error usb_try_write(const uint8_t *buffer, size_t len, struct ca821x_dev *pDeviceRef)
 {
 	uint8_t                   offset = 0;
@@ -319,25 +433,36 @@ ca_error usb_try_write(const uint8_t *buffer, size_t len, struct ca821x_dev *pDe
 	int                       rval, error;
 	ca_error                  caerror = CA_ERROR_SUCCESS;
 	struct usb_exchange_priv *priv    = pDeviceRef->exchange_context;
+	unsigned int              generation;
 
 	assert_usb_exchange(pDeviceRef);
 
-	do
-	{
-		uint8_t retries = 0;
+	//A rebooting device forgets that it was packing, so stop packing and don't try to unpack it on deinit
+	if (len >= 3 && buffer[0] == EVBME_DFU_CMD && buffer[2] == DFU_REBOOT)
+		__atomic_store_n(&priv->tx_packed, 0, __ATOMIC_RELEASE);
 
-		rval = get_next_frag(buffer, len, frag_buf, &offset);
-		do
+	pthread_rwlock_rdlock(&priv->hid_lock);
+	generation = priv->hid_generation;
+	if (len <= MAX_FRAG_SIZE - 1 && __atomic_load_n(&priv->tx_packed, __ATOMIC_ACQUIRE))
+	{
+		error = write_packed(buffer, len, priv);
+	}
+	else
+	{
+		error = flush_packed(priv);
+		for (rval = 1; rval && (error >= 0);)
 		{
-			error = dhid_write(priv->hid_dev, frag_buf, MAX_FRAG_SIZE + 1);
-		} while ((error < 0) && (retries++ < 50));
-	} while (rval && (error >= 0));
+			rval  = get_next_frag(buffer, len, frag_buf, &offset);
+			error = write_report(priv, frag_buf);
+		}
+	}
+	pthread_rwlock_unlock(&priv->hid_lock);
 
 	if (error < 0)
 	{
 		ca_log_crit("USB Send error!");
 		caerror = CA_ERROR_FAIL;
-		if (reload_hid_device(pDeviceRef) == CA_ERROR_SUCCESS)
+		if (reload_hid_device(pDeviceRef, generation) == CA_ERROR_SUCCESS)
 		{
 			caerror = usb_try_write(buffer, len, pDeviceRef); //usb disconnected - attempt to grab new device
 		}
@@ -359,12 +484,28 @@ void flush_unread_usb(struct ca821x_dev *pDeviceRef)
 
 	assert_usb_exchange(pDeviceRef);
 
+	pthread_rwlock_rdlock(&priv->hid_lock);
 	do
 	{
 		rval = dhid_read_timeout(priv->hid_dev, frag_buf, MAX_FRAG_SIZE, 10);
 	} while (rval > 0);
+	pthread_rwlock_unlock(&priv->hid_lock);
 }
 
+static ca_error load_hid_ops(const struct usb_exchange_hid_ops *ops)
+{
+	dhid_enumerate        = ops->enumerate;
+	dhid_open_path        = ops->open_path;
+	dhid_close            = ops->close;
+	dhid_free_enumeration = ops->free_enumeration;
+	dhid_read_timeout     = ops->read_timeout;
+	dhid_write            = ops->write;
+	dhid_exit             = ops->exit;
+
+	return CA_ERROR_SUCCESS;
+}
+
+
 #ifdef _WIN32
 //No Dynamic library, use statically linked
 static ca_error load_dlibs()
@@ -429,6 +570,7 @@ exit:
 	{
 		ca_log_debg("Error loading dynamic hidapi.");
 		dlclose(s_hid_lib_handle);
+		s_hid_lib_handle = NULL;
 	}
 	return error;
 }
@@ -443,7 +585,13 @@ static ca_error init_statics()
 
 	ca_log_debg("First time init, initialising statics (such as dynamic lib).");
 
-	error = load_dlibs();
+	//example: CASCODA_USB_PACKED=0 to disable packed reports
+	s_packing = !getenv("CASCODA_USB_PACKED") || atoi(getenv("CASCODA_USB_PACKED"));
+
+	if (s_hid_ops)
+		error = load_hid_ops(s_hid_ops);
+	else
+		error = load_dlibs();
 	if (error)
 		goto exit;
 
@@ -458,7 +606,9 @@ static ca_error deinit_statics()
 	dhid_exit();
 	s_initialised = 0;
 #ifndef _WIN32
-	dlclose(s_hid_lib_handle);
+	if (s_hid_lib_handle)
+		dlclose(s_hid_lib_handle);
+	s_hid_lib_handle = NULL;
 #endif
 	return CA_ERROR_SUCCESS;
 }
@@ -537,19 +687,30 @@ static struct hid_device_info *get_next_hid(struct hid_device_info *hid_cur)
 	return hid_cur;
 }
 
-static ca_error reload_hid_device(struct ca821x_dev *pDeviceRef)
+static ca_error reload_hid_device(struct ca821x_dev *pDeviceRef, unsigned int generation)
 {
 	struct usb_exchange_priv *priv   = pDeviceRef->exchange_context;
 	struct hid_device_info *  hid_ll = NULL, *hid_cur = NULL;
 	ca_error                  error = CA_ERROR_SUCCESS;
 
 	assert_usb_exchange(pDeviceRef);
+	pthread_rwlock_wrlock(&priv->hid_lock);
+
+	//The read and write threads can both fail on the same disconnection, only reload once
+	if (priv->hid_generation != generation)
+	{
+		pthread_rwlock_unlock(&priv->hid_lock);
+		return priv->hid_dev ? CA_ERROR_SUCCESS : CA_ERROR_NOT_FOUND;
+	}
+	priv->hid_generation++;
+
 	pthread_mutex_lock(&devs_mutex);
 
 	ca_log_warn("Hid device dropped... attempting reload");
 
 	dhid_close(priv->hid_dev);
 	priv->hid_dev = NULL;
+	__atomic_store_n(&priv->tx_packed, 0, __ATOMIC_RELEASE); //The device may have been reset
 
 	sleep(1);
 
@@ -581,6 +742,7 @@ exit:
 	else
 		ca_log_info("Successfully reloaded HID device");
 	pthread_mutex_unlock(&devs_mutex);
+	pthread_rwlock_unlock(&priv->hid_lock);
 	return error;
 }
 
@@ -646,6 +808,34 @@ static ca_error unlock_device(struct ca821x_dev *pDeviceRef)
 }
 #endif
 
+static void usb_negotiate_packing(struct ca821x_dev *pDeviceRef)
+{
+	struct usb_exchange_priv *priv   = pDeviceRef->exchange_context;
+	uint8_t                   packed = 1;
+	uint8_t                   len    = 0;
+
+	if (!s_packing)
+		return;
+
+	/* Probe with a GET first. Devices that don't support packing reject it, so keep sending one message per
+	 * report. The DFU bootloader answers GETs but never answers SETs, which would wait out the sync timeout. */
+	if (EVBME_GET_request_sync(EVBME_USB_PACKED, sizeof(packed), &packed, &len, pDeviceRef))
+	{
+		ca_log_info("USB device does not support packed reports.");
+		return;
+	}
+
+	packed = 1;
+	if (EVBME_SET_request_sync(EVBME_USB_PACKED, sizeof(packed), &packed, pDeviceRef))
+	{
+		ca_log_info("USB device rejected packed reports.");
+		return;
+	}
+
+	__atomic_store_n(&priv->tx_packed, 1, __ATOMIC_RELEASE);
+	ca_log_info("USB using packed reports.");
+}
+
 ca_error usb_exchange_init(ca821x_errorhandler callback, const char *path, struct ca821x_dev *pDeviceRef)
 {
 	struct hid_device_info *  hid_ll = NULL, *hid_cur = NULL;
@@ -682,6 +872,8 @@ ca_error usb_exchange_init(ca821x_errorhandler callback, const char *path, struc
 	priv->base.write_func     = usb_try_write;
 	priv->base.read_func      = usb_try_read;
 	priv->base.flush_func     = flush_unread_usb;
+	priv->base.split_io       = 1;
+	pthread_rwlock_init(&priv->hid_lock, NULL);
 
 	ca_log_debg("USB callbacks loaded into exchange struct.");
 
@@ -743,6 +935,7 @@ exit:
 		dhid_free_enumeration(hid_ll);
 	if (error && pDeviceRef->exchange_context)
 	{
+		pthread_rwlock_destroy(&priv->hid_lock);
 		free(priv->serial_number);
 		free(pDeviceRef->exchange_context);
 		pDeviceRef->exchange_context = NULL;
@@ -751,7 +944,10 @@ exit:
 		deinit_statics();
 	pthread_mutex_unlock(&devs_mutex);
 	if (error == CA_ERROR_SUCCESS)
+	{
 		ca_log_info("Successfully started USB Exchange.");
+		usb_negotiate_packing(pDeviceRef);
+	}
 	return error;
 }
 
@@ -760,6 +956,17 @@ void usb_exchange_deinit(struct ca821x_dev *pDeviceRef)
 	struct usb_exchange_priv *priv = pDeviceRef->exchange_context;
 
 	assert_usb_exchange(pDeviceRef);
+
+	//Stop the device packing, in case the next host doesn't support it. Queued messages are sent first, as one
+	//of them may be a reboot.
+	exchange_wait_send_complete(1, pDeviceRef);
+	if (__atomic_exchange_n(&priv->tx_packed, 0, __ATOMIC_ACQ_REL))
+	{
+		uint8_t packed = 0;
+
+		EVBME_SET_request_sync(EVBME_USB_PACKED, sizeof(packed), &packed, pDeviceRef);
+	}
+
 	deinit_generic(pDeviceRef);
 	dhid_close(priv->hid_dev);
 	unlock_device(pDeviceRef);
@@ -770,6 +977,7 @@ void usb_exchange_deinit(struct ca821x_dev *pDeviceRef)
 		deinit_statics();
 	pthread_mutex_unlock(&devs_mutex);
 
+	pthread_rwlock_destroy(&priv->hid_lock);
 	free(priv->serial_number);
 	free(priv);
 	pDeviceRef->exchange_context = NULL;
@@ -854,3 +1062,19 @@ int usb_exchange_reset(unsigned long resettime, struct ca821x_dev *pDeviceRef)
 
 	return 0;
 }
+
+#ifdef TEST_ENABLE
+ca_error usb_exchange_set_hid_ops(const struct usb_exchange_hid_ops *aOps)
+{
+	ca_error error = CA_ERROR_SUCCESS;
+
+	pthread_mutex_lock(&devs_mutex);
+	if (s_initialised)
+		error = CA_ERROR_INVALID_STATE;
+	else
+		s_hid_ops = aOps;
+	pthread_mutex_unlock(&devs_mutex);
+
+	return error;
+}
+#endif
@@ -36,6 +36,7 @@
 #ifndef USB_EXCHANGE_H
 #define USB_EXCHANGE_H
 
+#include "hidapi/hidapi.h"
 #include "ca821x-posix/ca821x-types.h"
 #include "ca821x_api.h"
 #define TEST_ENABLE 1
@@ -104,6 +105,28 @@ ca_error usb_exchange_enumerate(util_device_found aCallback, void *aContext);
 #ifdef TEST_ENABLE
 /**Run to test fragmentation. Crashes upon fail.*/
 void test_frag_loopback();
+
+/** The hidapi functions used by the usb exchange */
+struct usb_exchange_hid_ops
+{
+	struct hid_device_info *(*enumerate)(unsigned short, unsigned short);
+	hid_device *(*open_path)(const char *);
+	void (*close)(hid_device *);
+	void (*free_enumeration)(struct hid_device_info *);
+	int (*read_timeout)(hid_device *, unsigned char *, size_t, int);
+	int (*write)(hid_device *, const unsigned char *, size_t);
+	int (*exit)(void);
+};
+
+/**
+ * Substitute the hidapi functions used by the usb exchange, so that it can be run against a
+ * stand-in device. Must be called before the usb exchange is first used.
+ *
+ * @param aOps The functions to use, or NULL to load hidapi as normal
+ * @retval CA_ERROR_SUCCESS Functions substituted
+ * @retval CA_ERROR_INVALID_STATE hidapi is already loaded
+ */
+ca_error usb_exchange_set_hid_ops(const struct usb_exchange_hid_ops *aOps);
 #endif
 
 #endif
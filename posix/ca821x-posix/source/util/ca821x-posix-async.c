@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2021, Cascoda
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "ca821x-generic-exchange.h"
+#include "ca821x-posix/ca821x-posix.h"
+#include "mac_messages.h"
+
+ca_error MLME_GET_request_async(uint8_t               PIBAttribute,
+                                uint8_t               PIBAttributeIndex,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef)
+{
+	struct MAC_Message Command;
+
+	Command.CommandId                      = SPI_MLME_GET_REQUEST;
+	Command.Length                         = sizeof(struct MLME_GET_request_pset);
+	Command.PData.GetReq.PIBAttribute      = PIBAttribute;
+	Command.PData.GetReq.PIBAttributeIndex = PIBAttributeIndex;
+
+	return ca821x_api_downstream_async(&Command.CommandId, callback, context, pDeviceRef);
+}
+
+ca_error MLME_SET_request_async(uint8_t               PIBAttribute,
+                                uint8_t               PIBAttributeIndex,
+                                uint8_t               PIBAttributeLength,
+                                const void *          pPIBAttributeValue,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef)
+{
+	struct MAC_Message Command;
+
+	if (PIBAttributeLength > MAX_ATTRIBUTE_SIZE)
+		return CA_ERROR_INVALID_ARGS;
+
+	Command.CommandId                       = SPI_MLME_SET_REQUEST;
+	Command.Length                          = sizeof(struct MLME_SET_request_pset) - MAX_ATTRIBUTE_SIZE + PIBAttributeLength;
+	Command.PData.SetReq.PIBAttribute       = PIBAttribute;
+	Command.PData.SetReq.PIBAttributeIndex  = PIBAttributeIndex;
+	Command.PData.SetReq.PIBAttributeLength = PIBAttributeLength;
+	memcpy(Command.PData.SetReq.PIBAttributeValue, pPIBAttributeValue, PIBAttributeLength);
+
+	return ca821x_api_downstream_async(&Command.CommandId, callback, context, pDeviceRef);
+}
+
+ca_error HWME_GET_request_async(uint8_t               HWAttribute,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef)
+{
+	struct MAC_Message Command;
+
+	Command.CommandId                    = SPI_HWME_GET_REQUEST;
+	Command.Length                       = 1;
+	Command.PData.HWMEGetReq.HWAttribute = HWAttribute;
+
+	return ca821x_api_downstream_async(&Command.CommandId, callback, context, pDeviceRef);
+}
+
+ca_error HWME_SET_request_async(uint8_t               HWAttribute,
+                                uint8_t               HWAttributeLength,
+                                const uint8_t *       pHWAttributeValue,
+                                ca821x_async_callback callback,
+                                void *                context,
+                                struct ca821x_dev *   pDeviceRef)
+{
+	struct MAC_Message Command;
+
+	if (HWAttributeLength > sizeof(Command.PData.HWMESetReq.HWAttributeValue))
+		return CA_ERROR_INVALID_ARGS;
+
+	Command.CommandId                          = SPI_HWME_SET_REQUEST;
+	Command.Length                             = 2 + HWAttributeLength;
+	Command.PData.HWMESetReq.HWAttribute       = HWAttribute;
+	Command.PData.HWMESetReq.HWAttributeLength = HWAttributeLength;
+	memcpy(Command.PData.HWMESetReq.HWAttributeValue, pHWAttributeValue, HWAttributeLength);
+
+	return ca821x_api_downstream_async(&Command.CommandId, callback, context, pDeviceRef);
+}
@@ -162,6 +162,33 @@ ca_error EVBME_DFU_WRITE_request(uint32_t aStartAddr, size_t aWriteLen, void *aW
 	return ca821x_api_downstream((uint8_t *)&txMsg, NULL, pDeviceRef);
 }
 
+ca_error EVBME_DFU_ZWRITE_request(uint32_t           aStartAddr,
+                                  uint16_t           aBlockLen,
+                                  uint16_t           aZLen,
+                                  uint16_t           aOffset,
+                                  size_t             aDataLen,
+                                  const void *       aData,
+                                  struct ca821x_dev *pDeviceRef)
+{
+	struct EVBME_Message txMsg;
+	size_t len = sizeof(txMsg.EVBME.DFU_cmd.mDfuSubCmdId) + sizeof(txMsg.EVBME.DFU_cmd.mSubCmd.zwrite_cmd) + aDataLen;
+
+	if (len > sizeof(txMsg.EVBME))
+		return CA_ERROR_INVALID_ARGS;
+
+	txMsg.mCmdId = EVBME_DFU_CMD;
+	txMsg.mLen   = len;
+
+	txMsg.EVBME.DFU_cmd.mDfuSubCmdId = DFU_ZWRITE;
+	PUTLE32(aStartAddr, txMsg.EVBME.DFU_cmd.mSubCmd.zwrite_cmd.startAddr);
+	PUTLE16(aBlockLen, txMsg.EVBME.DFU_cmd.mSubCmd.zwrite_cmd.blockLen);
+	PUTLE16(aZLen, txMsg.EVBME.DFU_cmd.mSubCmd.zwrite_cmd.zLen);
+	PUTLE16(aOffset, txMsg.EVBME.DFU_cmd.mSubCmd.zwrite_cmd.offset);
+	memcpy(txMsg.EVBME.DFU_cmd.mSubCmd.zwrite_cmd.data, aData, aDataLen);
+
+	return ca821x_api_downstream((uint8_t *)&txMsg, NULL, pDeviceRef);
+}
+
 ca_error EVBME_DFU_CHECK_request(uint32_t           aStartAddr,
                                  uint32_t           aCheckLen,
                                  uint32_t           aChecksum,
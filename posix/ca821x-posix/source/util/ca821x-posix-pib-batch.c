@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2021, Cascoda
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ca821x-generic-exchange.h"
+#include "ca821x-pib-cache.h"
+#include "ca821x-posix/ca821x-posix.h"
+#include "evbme_messages.h"
+#include "hwme_tdme.h"
+#include "mac_messages.h"
+
+/** Shared state of the requests of a pipelined batch */
+struct pib_batch
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	size_t          outstanding; //!< Requests still awaiting a confirm
+	ca_error        error;       //!< First error reported for a request of the batch
+};
+
+/** A single request of a pipelined batch */
+struct pib_batch_request
+{
+	struct pib_batch *    batch;
+	struct ca821x_pib_op *op;
+	struct MAC_Message    command;
+	uint64_t              generation; //!< PIB cache generation of the request, for its confirm
+};
+
+/** Build the ca821x-api request for a PIB operation */
+static ca_error build_request(const struct ca821x_pib_op *op, struct MAC_Message *cmd)
+{
+	switch (op->op)
+	{
+	case EVBME_PIB_MLME_SET:
+		if (op->length > MAX_ATTRIBUTE_SIZE)
+			return CA_ERROR_INVALID_ARGS;
+		cmd->CommandId                       = SPI_MLME_SET_REQUEST;
+		cmd->Length                          = sizeof(struct MLME_SET_request_pset) - MAX_ATTRIBUTE_SIZE + op->length;
+		cmd->PData.SetReq.PIBAttribute       = op->attribute;
+		cmd->PData.SetReq.PIBAttributeIndex  = op->index;
+		cmd->PData.SetReq.PIBAttributeLength = op->length;
+		memcpy(cmd->PData.SetReq.PIBAttributeValue, op->value, op->length);
+		break;
+	case EVBME_PIB_MLME_GET:
+		cmd->CommandId                      = SPI_MLME_GET_REQUEST;
+		cmd->Length                         = sizeof(struct MLME_GET_request_pset);
+		cmd->PData.GetReq.PIBAttribute      = op->attribute;
+		cmd->PData.GetReq.PIBAttributeIndex = op->index;
+		break;
+	case EVBME_PIB_HWME_SET:
+		if (op->length > MAX_HWME_ATTRIBUTE_SIZE)
+			return CA_ERROR_INVALID_ARGS;
+		cmd->CommandId                          = SPI_HWME_SET_REQUEST;
+		cmd->Length                             = 2 + op->length;
+		cmd->PData.HWMESetReq.HWAttribute       = op->attribute;
+		cmd->PData.HWMESetReq.HWAttributeLength = op->length;
+		memcpy(cmd->PData.HWMESetReq.HWAttributeValue, op->value, op->length);
+		break;
+	case EVBME_PIB_HWME_GET:
+		cmd->CommandId                    = SPI_HWME_GET_REQUEST;
+		cmd->Length                       = 1;
+		cmd->PData.HWMEGetReq.HWAttribute = op->attribute;
+		break;
+	default:
+		return CA_ERROR_INVALID_ARGS;
+	}
+
+	return CA_ERROR_SUCCESS;
+}
+
+/** Build the confirm that the device would have sent for an operation, from an EVBME_PIB_BATCH result */
+static void build_confirm(const struct MAC_Message *cmd, const struct EVBME_PIB_BATCH_result *res, struct MAC_Message *cnf)
+{
+	cnf->CommandId = ca821x_get_sync_response_id(cmd->CommandId);
+
+	switch (cmd->CommandId)
+	{
+	case SPI_MLME_SET_REQUEST:
+		cnf->Length                         = sizeof(struct MLME_SET_confirm_pset);
+		cnf->PData.SetCnf.Status            = res->mStatus;
+		cnf->PData.SetCnf.PIBAttribute      = cmd->PData.SetReq.PIBAttribute;
+		cnf->PData.SetCnf.PIBAttributeIndex = cmd->PData.SetReq.PIBAttributeIndex;
+		break;
+	case SPI_MLME_GET_REQUEST:
+		cnf->Length                          = sizeof(struct MLME_GET_confirm_pset) - MAX_ATTRIBUTE_SIZE + res->mLen;
+		cnf->PData.GetCnf.Status             = res->mStatus;
+		cnf->PData.GetCnf.PIBAttribute       = cmd->PData.GetReq.PIBAttribute;
+		cnf->PData.GetCnf.PIBAttributeIndex  = cmd->PData.GetReq.PIBAttributeIndex;
+		cnf->PData.GetCnf.PIBAttributeLength = res->mLen;
+		memcpy(cnf->PData.GetCnf.PIBAttributeValue, res->mValue, res->mLen);
+		break;
+	case SPI_HWME_SET_REQUEST:
+		cnf->Length                       = sizeof(struct HWME_SET_confirm_pset);
+		cnf->PData.HWMESetCnf.Status      = res->mStatus;
+		cnf->PData.HWMESetCnf.HWAttribute = cmd->PData.HWMESetReq.HWAttribute;
+		break;
+	case SPI_HWME_GET_REQUEST:
+		cnf->Length                             = 3 + res->mLen;
+		cnf->PData.HWMEGetCnf.Status            = res->mStatus;
+		cnf->PData.HWMEGetCnf.HWAttribute       = cmd->PData.HWMEGetReq.HWAttribute;
+		cnf->PData.HWMEGetCnf.HWAttributeLength = res->mLen;
+		memcpy(cnf->PData.HWMEGetCnf.HWAttributeValue, res->mValue, res->mLen);
+		break;
+	}
+}
+
+/**
+ * Complete a PIB operation with the confirm for its request, keeping the PIB cache and the state tracked in
+ * the device reference consistent with the equivalent *_request_sync call.
+ */
+static void complete_op(struct ca821x_pib_op *    op,
+                        const struct MAC_Message *cmd,
+                        const struct MAC_Message *cnf,
+                        uint64_t                  generation,
+                        struct ca821x_dev *       pDeviceRef)
+{
+	struct ca821x_exchange_base *priv  = pDeviceRef->exchange_context;
+	const uint8_t *              value = NULL;
+	uint8_t                      len   = 0;
+
+	if (cnf->CommandId != ca821x_get_sync_response_id(cmd->CommandId))
+	{
+		op->status = MAC_SYSTEM_ERROR;
+		return;
+	}
+
+	switch (cnf->CommandId)
+	{
+	case SPI_MLME_SET_CONFIRM:
+		op->status = cnf->PData.SetCnf.Status;
+		break;
+	case SPI_MLME_GET_CONFIRM:
+		op->status = cnf->PData.GetCnf.Status;
+		len        = cnf->PData.GetCnf.PIBAttributeLength;
+		value      = cnf->PData.GetCnf.PIBAttributeValue;
+		break;
+	case SPI_HWME_SET_CONFIRM:
+		op->status = cnf->PData.HWMESetCnf.Status;
+		break;
+	case SPI_HWME_GET_CONFIRM:
+		op->status = cnf->PData.HWMEGetCnf.Status;
+		len        = cnf->PData.HWMEGetCnf.HWAttributeLength;
+		value      = cnf->PData.HWMEGetCnf.HWAttributeValue;
+		break;
+	}
+
+	if (op->status != MAC_SUCCESS)
+		return;
+
+	if (value)
+	{
+		if (len > op->length)
+			op->status = MAC_INVALID_PARAMETER;
+		else
+			memcpy(op->value, value, len);
+		op->length = len;
+	}
+
+	pib_cache_confirmed(&cmd->CommandId, &cnf->CommandId, generation, &priv->pib_cache);
+
+#if (CASCODA_CA_VER == 8210)
+	if (cmd->CommandId == SPI_MLME_SET_REQUEST)
+	{
+		if (op->attribute == macShortAddress)
+			pDeviceRef->shortaddr = GETLE16(op->value);
+		else if (op->attribute == nsIEEEAddress)
+			memcpy(pDeviceRef->extaddr, op->value, 8);
+	}
+#endif
+}
+
+/** Answer a GET operation from the PIB cache, returning true if it was */
+static bool lookup_op(struct ca821x_pib_op *op, const struct MAC_Message *cmd, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+	struct MAC_Message           cnf;
+	uint64_t                     generation;
+
+	if (op->op != EVBME_PIB_MLME_GET && op->op != EVBME_PIB_HWME_GET)
+		return false;
+	if (pib_cache_lookup(&cmd->CommandId, &cnf.CommandId, &priv->pib_cache))
+		return false;
+
+	generation = pib_cache_generation(&cmd->CommandId, &priv->pib_cache);
+	complete_op(op, cmd, &cnf, generation, pDeviceRef);
+	return true;
+}
+
+static void pipeline_callback(ca_error status, const uint8_t *response, void *context, struct ca821x_dev *pDeviceRef)
+{
+	struct pib_batch_request *req   = context;
+	struct pib_batch *        batch = req->batch;
+
+	if (status == CA_ERROR_SUCCESS)
+		complete_op(req->op, &req->command, (const struct MAC_Message *)response, req->generation, pDeviceRef);
+
+	pthread_mutex_lock(&batch->mutex);
+	if (status != CA_ERROR_SUCCESS && batch->error == CA_ERROR_SUCCESS)
+		batch->error = status;
+	batch->outstanding--;
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->mutex);
+}
+
+/**
+ * Apply PIB operations by sending them all to the device as individual asynchronous requests, and waiting
+ * for every confirm. Used when the device cannot apply a batch itself.
+ */
+static ca_error pib_batch_pipeline(struct ca821x_pib_op *aOps, size_t aCount, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv  = pDeviceRef->exchange_context;
+	struct pib_batch             batch = {.outstanding = 0, .error = CA_ERROR_SUCCESS};
+	struct pib_batch_request *   reqs  = calloc(aCount, sizeof(*reqs));
+	ca_error                     error = CA_ERROR_SUCCESS;
+
+	if (!reqs)
+		return CA_ERROR_NO_BUFFER;
+
+	pthread_mutex_init(&batch.mutex, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+
+	for (size_t i = 0; i < aCount && !error; i++)
+	{
+		struct pib_batch_request *req = &reqs[i];
+
+		req->batch = &batch;
+		req->op    = &aOps[i];
+		build_request(req->op, &req->command);
+		if (lookup_op(req->op, &req->command, pDeviceRef))
+			continue;
+
+		pthread_mutex_lock(&batch.mutex);
+		batch.outstanding++;
+		pthread_mutex_unlock(&batch.mutex);
+
+		/* The exchange updates the cache as it sends the request */
+		req->generation = pib_cache_generation(&req->command.CommandId, &priv->pib_cache);
+
+		while ((error = ca821x_api_downstream_async(&req->command.CommandId, pipeline_callback, req, pDeviceRef)) ==
+		       CA_ERROR_NO_BUFFER)
+		{
+			/* Too many requests in flight - wait for one to complete, unless only this one is outstanding */
+			pthread_mutex_lock(&batch.mutex);
+			if (batch.outstanding > 1)
+			{
+				size_t outstanding = batch.outstanding;
+
+				while (batch.outstanding == outstanding) pthread_cond_wait(&batch.cond, &batch.mutex);
+				pthread_mutex_unlock(&batch.mutex);
+				continue;
+			}
+			pthread_mutex_unlock(&batch.mutex);
+			break;
+		}
+
+		if (error)
+		{
+			pthread_mutex_lock(&batch.mutex);
+			batch.outstanding--;
+			pthread_mutex_unlock(&batch.mutex);
+		}
+	}
+
+	pthread_mutex_lock(&batch.mutex);
+	while (batch.outstanding) pthread_cond_wait(&batch.cond, &batch.mutex);
+	if (!error)
+		error = batch.error;
+	pthread_mutex_unlock(&batch.mutex);
+
+	pthread_cond_destroy(&batch.cond);
+	pthread_mutex_destroy(&batch.mutex);
+	free(reqs);
+
+	return error;
+}
+
+/**
+ * Get the longest EVBME_PIB_BATCH_REQUEST that the device accepts, probing for it the first time.
+ * Firmware without support reports the attribute as unknown, which is cached as a limit of 0.
+ */
+static int get_batch_limit(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv  = pDeviceRef->exchange_context;
+	int                          limit = __atomic_load_n(&priv->pib_batch_limit, __ATOMIC_RELAXED);
+	uint8_t                      val   = 0;
+	uint8_t                      len   = 0;
+
+	if (limit >= 0)
+		return limit;
+
+	limit = 0;
+	if (priv->exchange_type != ca821x_exchange_kernel &&
+	    EVBME_GET_request_sync(EVBME_PIB_BATCH, sizeof(val), &val, &len, pDeviceRef) == CA_ERROR_SUCCESS &&
+	    len == sizeof(val))
+	{
+		limit = val;
+	}
+	ca_log_debg("EVBME PIB batch limit: %d", limit);
+	__atomic_store_n(&priv->pib_batch_limit, limit, __ATOMIC_RELAXED);
+
+	return limit;
+}
+
+/**
+ * Apply PIB operations by packing as many as possible into each EVBME_PIB_BATCH_REQUEST, so that the
+ * device applies them over SPI.
+ */
+static ca_error pib_batch_evbme(struct ca821x_pib_op *aOps, size_t aCount, int aLimit, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_exchange_base *priv = pDeviceRef->exchange_context;
+	size_t                       next = 0;
+	ca_error                     error;
+
+	while (next < aCount)
+	{
+		uint8_t                         msgBuf[MAX_BUF_SIZE];
+		struct EVBME_Message *          msg     = (struct EVBME_Message *)msgBuf;
+		uint8_t *                       payload = (uint8_t *)&msg->EVBME;
+		struct EVBME_PIB_BATCH_confirm *cnf     = &msg->EVBME.PIB_BATCH_confirm;
+		size_t                          packed[EVBME_PIB_BATCH_MAX_LEN / sizeof(struct EVBME_PIB_BATCH_op)];
+		uint64_t                        generations[EVBME_PIB_BATCH_MAX_LEN / sizeof(struct EVBME_PIB_BATCH_op)];
+		size_t                          npacked = 0;
+		size_t                          len     = 0;
+		size_t                          off;
+
+		for (; next < aCount; next++)
+		{
+			struct ca821x_pib_op *     op = &aOps[next];
+			struct EVBME_PIB_BATCH_op *bop;
+			struct MAC_Message         cmd;
+			uint8_t                    setLen = 0;
+
+			build_request(op, &cmd);
+			if (lookup_op(op, &cmd, pDeviceRef))
+				continue;
+
+			if (op->op == EVBME_PIB_MLME_SET || op->op == EVBME_PIB_HWME_SET)
+				setLen = op->length;
+			if (len + sizeof(*bop) + setLen > (size_t)aLimit)
+				break;
+
+			bop             = (struct EVBME_PIB_BATCH_op *)(payload + len);
+			bop->mOp        = op->op;
+			bop->mAttribute = op->attribute;
+			bop->mIndex     = op->index;
+			bop->mLen       = setLen;
+			memcpy(bop->mValue, op->value, setLen);
+			len += sizeof(*bop) + setLen;
+			generations[npacked] = pib_cache_sent(&cmd.CommandId, &priv->pib_cache);
+			packed[npacked++]    = next;
+		}
+
+		if (!npacked)
+		{
+			/* Cache hits only, or an operation too long for the device to batch */
+			if (next < aCount && (error = pib_batch_pipeline(&aOps[next++], 1, pDeviceRef)))
+				return error;
+			continue;
+		}
+
+		msg->mCmdId = EVBME_PIB_BATCH_REQUEST;
+		msg->mLen   = len;
+		if ((error = ca821x_api_downstream(msgBuf, msgBuf, pDeviceRef)))
+			return error;
+		if (msg->mCmdId != EVBME_PIB_BATCH_CONFIRM || msg->mLen < sizeof(*cnf) || cnf->mCount > npacked ||
+		    !cnf->mCount)
+		{
+			return CA_ERROR_FAIL;
+		}
+
+		off = sizeof(*cnf);
+		for (size_t i = 0; i < cnf->mCount; i++)
+		{
+			struct EVBME_PIB_BATCH_result *res = (struct EVBME_PIB_BATCH_result *)(payload + off);
+			struct MAC_Message             cmd, rsp;
+
+			if (off + sizeof(*res) > msg->mLen || off + sizeof(*res) + res->mLen > msg->mLen ||
+			    res->mLen > MAX_ATTRIBUTE_SIZE)
+			{
+				return CA_ERROR_FAIL;
+			}
+			off += sizeof(*res) + res->mLen;
+
+			build_request(&aOps[packed[i]], &cmd);
+			build_confirm(&cmd, res, &rsp);
+			complete_op(&aOps[packed[i]], &cmd, &rsp, generations[i], pDeviceRef);
+		}
+
+		/* Resume from the first operation the device did not report */
+		next = packed[cnf->mCount - 1] + 1;
+	}
+
+	return CA_ERROR_SUCCESS;
+}
+
+ca_error ca821x_util_pib_batch(struct ca821x_pib_op *aOps, size_t aCount, struct ca821x_dev *pDeviceRef)
+{
+	struct MAC_Message cmd;
+	int                limit;
+
+	if (!pDeviceRef->exchange_context)
+		return CA_ERROR_INVALID_STATE;
+
+	for (size_t i = 0; i < aCount; i++)
+	{
+		if (build_request(&aOps[i], &cmd))
+			return CA_ERROR_INVALID_ARGS;
+		aOps[i].status = MAC_SYSTEM_ERROR;
+	}
+
+	limit = get_batch_limit(pDeviceRef);
+	if (limit)
+		return pib_batch_evbme(aOps, aCount, limit, pDeviceRef);
+
+	return pib_batch_pipeline(aOps, aCount, pDeviceRef);
+}
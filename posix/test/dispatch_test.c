@@ -0,0 +1,260 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief  Unit tests for the ca821x-posix downstream dispatch workers, using pipes that loop messages back
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-posix/ca821x-posix.h"
+#include "ca821x-generic-exchange.h"
+
+enum
+{
+	DEV_COUNT   = 2,    //!< Number of loopback devices
+	MSG_COUNT   = 8,    //!< Number of messages looped back through each device
+	IND_CMDID   = 0x3C, //!< Asynchronous command id that nothing handles, so reaches the user callback
+	DISPATCH_MS = 2000  //!< Time allowed for the messages to be dispatched
+};
+
+/** Private data for the loopback exchange, which reads back everything written to it */
+struct loopback_priv
+{
+	struct ca821x_exchange_base base;       //!< Exchange base structure
+	int                         pipe[2];    //!< Loopback pipe, the read end is nonblocking
+	int                         dispatched; //!< Number of messages dispatched (protected by sDispatchMutex)
+	pthread_t                   thread;     //!< Thread that the last message was dispatched from
+};
+
+static struct loopback_priv sPrivs[DEV_COUNT];
+static struct ca821x_dev    sDevices[DEV_COUNT];
+
+static pthread_mutex_t sDispatchMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sDispatchCond  = PTHREAD_COND_INITIALIZER;
+
+static ca_error loopback_write(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	return write(priv->pipe[1], buf, len) == (ssize_t)len ? CA_ERROR_SUCCESS : CA_ERROR_FAIL;
+}
+
+static ssize_t loopback_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	//Messages are written whole, so once the header is there the rest is too
+	if (read(priv->pipe[0], buf, 2) != 2)
+		return 0;
+	if (buf[1] && read(priv->pipe[0], buf + 2, buf[1]) != buf[1])
+		return -1;
+	return buf[1] + 2;
+}
+
+static void loopback_flush(struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+	uint8_t               junk[64];
+
+	while (read(priv->pipe[0], junk, sizeof(junk)) > 0)
+		;
+}
+
+static ca_error dispatch_callback(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	(void)buf;
+	(void)len;
+
+	pthread_mutex_lock(&sDispatchMutex);
+	priv->dispatched++;
+	priv->thread = pthread_self();
+	pthread_cond_broadcast(&sDispatchCond);
+	pthread_mutex_unlock(&sDispatchMutex);
+
+	return CA_ERROR_SUCCESS;
+}
+
+static ca_error loopback_init(struct loopback_priv *priv, struct ca821x_dev *pDeviceRef)
+{
+	memset(priv, 0, sizeof(*priv));
+	memset(pDeviceRef, 0, sizeof(*pDeviceRef));
+	if (pipe(priv->pipe) || fcntl(priv->pipe[0], F_SETFL, O_NONBLOCK))
+		return CA_ERROR_FAIL;
+
+	priv->base.user_callback = &dispatch_callback;
+	priv->base.write_func    = &loopback_write;
+	priv->base.read_func     = &loopback_read;
+	priv->base.flush_func    = &loopback_flush;
+
+	pDeviceRef->exchange_context = priv;
+
+	return init_generic(pDeviceRef);
+}
+
+static void loopback_deinit(struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	deinit_generic(pDeviceRef);
+	close(priv->pipe[0]);
+	close(priv->pipe[1]);
+	pDeviceRef->exchange_context = NULL;
+}
+
+/** Loop MSG_COUNT messages back through a device, and wait for every one to be dispatched */
+static void loop_messages(struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv  = pDeviceRef->exchange_context;
+	uint8_t               ind[] = {IND_CMDID, 1, 0};
+	struct timespec       ts;
+	int                   target;
+
+	pthread_mutex_lock(&sDispatchMutex);
+	target = priv->dispatched + MSG_COUNT;
+	pthread_mutex_unlock(&sDispatchMutex);
+
+	for (int i = 0; i < MSG_COUNT; i++)
+	{
+		ind[2] = i;
+		assert_int_equal(ca821x_exchange_commands(ind, sizeof(ind), NULL, pDeviceRef), CA_ERROR_SUCCESS);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += DISPATCH_MS / 1000;
+	pthread_mutex_lock(&sDispatchMutex);
+	while (priv->dispatched < target)
+	{
+		if (pthread_cond_timedwait(&sDispatchCond, &sDispatchMutex, &ts))
+			break;
+	}
+	assert_int_equal(priv->dispatched, target);
+	pthread_mutex_unlock(&sDispatchMutex);
+}
+
+/** Get the statistics of the worker of a device, once it has finished dispatching the expected messages */
+static void get_stats(struct ca821x_dispatch_stats *stats, uint64_t dispatched, struct ca821x_dev *pDeviceRef)
+{
+	//The statistics are updated just after the callback returns
+	for (int i = 0; i < DISPATCH_MS; i++)
+	{
+		assert_int_equal(ca821x_util_get_dispatch_stats(stats, pDeviceRef), CA_ERROR_SUCCESS);
+		if (stats->dispatched >= dispatched)
+			break;
+		usleep(1000);
+	}
+	assert_int_equal(stats->dispatched, dispatched);
+}
+
+static void dispatch_global_test(void **state)
+{
+	struct ca821x_dispatch_stats before, after;
+
+	(void)state;
+
+	assert_int_equal(ca821x_util_set_dispatch_mode(ca821x_dispatch_global), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_get_dispatch_stats(&before, NULL), CA_ERROR_SUCCESS);
+
+	for (int i = 0; i < DEV_COUNT; i++) assert_int_equal(loopback_init(&sPrivs[i], &sDevices[i]), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_start_downstream_dispatch_worker(), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_set_dispatch_mode(ca821x_dispatch_per_device), CA_ERROR_INVALID_STATE);
+
+	//Every device shares the same worker
+	for (int i = 0; i < DEV_COUNT; i++) loop_messages(&sDevices[i]);
+	assert_true(pthread_equal(sPrivs[0].thread, sPrivs[1].thread));
+
+	//The device reference is ignored in global mode
+	get_stats(&after, before.dispatched + DEV_COUNT * MSG_COUNT, &sDevices[1]);
+	assert_true(after.latency_total_us >= before.latency_total_us);
+	assert_int_equal(after.queue.count, 0);
+
+	//The worker keeps running while devices come and go, until the application stops it
+	loopback_deinit(&sDevices[0]);
+	loop_messages(&sDevices[1]);
+	loopback_deinit(&sDevices[1]);
+	assert_int_equal(loopback_init(&sPrivs[0], &sDevices[0]), CA_ERROR_SUCCESS);
+	loop_messages(&sDevices[0]);
+	loopback_deinit(&sDevices[0]);
+	assert_int_equal(ca821x_util_stop_downstream_dispatch_worker(), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_stop_downstream_dispatch_worker(), CA_ERROR_ALREADY);
+}
+
+static void dispatch_per_device_test(void **state)
+{
+	struct ca821x_dispatch_stats stats;
+
+	(void)state;
+
+	assert_int_equal(ca821x_util_set_dispatch_mode(ca821x_dispatch_per_device), CA_ERROR_SUCCESS);
+
+	//Workers are started both for devices that already exist, and for devices initialised later
+	assert_int_equal(loopback_init(&sPrivs[0], &sDevices[0]), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_start_downstream_dispatch_worker(), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_start_downstream_dispatch_worker(), CA_ERROR_ALREADY);
+	assert_int_equal(loopback_init(&sPrivs[1], &sDevices[1]), CA_ERROR_SUCCESS);
+
+	for (int i = 0; i < DEV_COUNT; i++) loop_messages(&sDevices[i]);
+	loop_messages(&sDevices[0]);
+	assert_false(pthread_equal(sPrivs[0].thread, sPrivs[1].thread));
+
+	//Each worker keeps its own statistics
+	assert_int_equal(ca821x_util_get_dispatch_stats(&stats, NULL), CA_ERROR_INVALID_ARGS);
+	get_stats(&stats, 2 * MSG_COUNT, &sDevices[0]);
+	get_stats(&stats, MSG_COUNT, &sDevices[1]);
+
+	//Devices initialised again after every device was deinitialised still get a worker
+	for (int i = 0; i < DEV_COUNT; i++) loopback_deinit(&sDevices[i]);
+	assert_int_equal(loopback_init(&sPrivs[0], &sDevices[0]), CA_ERROR_SUCCESS);
+	loop_messages(&sDevices[0]);
+	loopback_deinit(&sDevices[0]);
+	assert_int_equal(ca821x_util_stop_downstream_dispatch_worker(), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_set_dispatch_mode(ca821x_dispatch_global), CA_ERROR_SUCCESS);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test(dispatch_global_test),
+	    cmocka_unit_test(dispatch_per_device_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
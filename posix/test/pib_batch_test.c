@@ -0,0 +1,319 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief  Unit tests for batched PIB & HWME configuration and late confirms, using a loopback device with a simple PIB
+ */
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-posix/ca821x-posix.h"
+#include "ca821x-generic-exchange.h"
+#include "evbme_messages.h"
+
+enum
+{
+	CONFIRM_LEN = 63, //!< Longest message sent by the loopback, like a device answering in a single hid report
+	BATCH_LIMIT = 48, //!< Longest EVBME_PIB_BATCH_REQUEST accepted by the loopback, when enabled
+	BATCH_OPS   = 20  //!< Number of operations applied by the PIB batch test
+};
+
+/** Private data for the loopback exchange, which answers PIB requests and reads back the confirms */
+struct loopback_priv
+{
+	struct ca821x_exchange_base base;    //!< Exchange base structure
+	int                         pipe[2]; //!< Loopback pipe, the read end is nonblocking
+};
+
+/** PIB & HWME attributes of the loopback device, and how it answers PIB requests */
+static struct
+{
+	struct
+	{
+		uint8_t len;
+		uint8_t value[CONFIRM_LEN];
+	} attr[2][256];
+	uint8_t  batch_limit;       //!< Longest EVBME_PIB_BATCH_REQUEST accepted, 0 for firmware without support
+	uint32_t requests;          //!< Number of PIB and EVBME requests answered
+	uint8_t  hold;              //!< Hold back the next confirm, until the next request of the same type
+	uint8_t  held[CONFIRM_LEN]; //!< Confirm being held back
+	uint8_t  held_len;          //!< Length of held, 0 if no confirm is being held back
+} sLoopbackPib;
+
+static struct loopback_priv sPriv;
+static struct ca821x_dev    sDeviceRef;
+
+/** Apply a PIB operation to the loopback PIB, returning its status and setting *len for GETs */
+static uint8_t loopback_pib_op(uint8_t op, uint8_t attr, uint8_t *len, const uint8_t *value, uint8_t *out)
+{
+	int type = op >= EVBME_PIB_HWME_SET;
+
+	if (op == EVBME_PIB_MLME_SET || op == EVBME_PIB_HWME_SET)
+	{
+		sLoopbackPib.attr[type][attr].len = *len;
+		memcpy(sLoopbackPib.attr[type][attr].value, value, *len);
+		*len = 0;
+		return MAC_SUCCESS;
+	}
+
+	*len = sLoopbackPib.attr[type][attr].len;
+	memcpy(out, sLoopbackPib.attr[type][attr].value, *len);
+	return *len ? MAC_SUCCESS : MAC_UNSUPPORTED_ATTRIBUTE;
+}
+
+/** Answer a PIB request, writing its confirm to the loopback pipe */
+static ca_error loopback_write(const uint8_t *msg, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+	uint8_t               rsp[CONFIRM_LEN];
+	uint8_t               vlen = 0, off = 2;
+
+	switch (msg[0])
+	{
+	case SPI_MLME_SET_REQUEST:
+		vlen   = msg[4];
+		rsp[0] = SPI_MLME_SET_CONFIRM;
+		rsp[2] = loopback_pib_op(EVBME_PIB_MLME_SET, msg[2], &vlen, msg + 5, NULL);
+		rsp[3] = msg[2];
+		rsp[4] = msg[3];
+		off    = 5;
+		break;
+	case SPI_MLME_GET_REQUEST:
+		rsp[0] = SPI_MLME_GET_CONFIRM;
+		rsp[2] = loopback_pib_op(EVBME_PIB_MLME_GET, msg[2], &vlen, NULL, rsp + 6);
+		rsp[3] = msg[2];
+		rsp[4] = msg[3];
+		rsp[5] = vlen;
+		off    = 6 + vlen;
+		break;
+	case SPI_HWME_SET_REQUEST:
+		vlen   = msg[3];
+		rsp[0] = SPI_HWME_SET_CONFIRM;
+		rsp[2] = loopback_pib_op(EVBME_PIB_HWME_SET, msg[2], &vlen, msg + 4, NULL);
+		rsp[3] = msg[2];
+		off    = 4;
+		break;
+	case SPI_HWME_GET_REQUEST:
+		rsp[0] = SPI_HWME_GET_CONFIRM;
+		rsp[2] = loopback_pib_op(EVBME_PIB_HWME_GET, msg[2], &vlen, NULL, rsp + 5);
+		rsp[3] = msg[2];
+		rsp[4] = vlen;
+		off    = 5 + vlen;
+		break;
+	case EVBME_GET_REQUEST:
+		assert_int_equal(msg[2], EVBME_PIB_BATCH);
+		rsp[0] = EVBME_GET_CONFIRM;
+		rsp[2] = sLoopbackPib.batch_limit ? CA_ERROR_SUCCESS : CA_ERROR_UNKNOWN;
+		rsp[3] = msg[2];
+		rsp[4] = sLoopbackPib.batch_limit ? 1 : 0;
+		rsp[5] = sLoopbackPib.batch_limit;
+		off    = 5 + rsp[4];
+		break;
+	case EVBME_PIB_BATCH_REQUEST:
+		assert_true(sLoopbackPib.batch_limit);
+		assert_true(msg[1] <= sLoopbackPib.batch_limit);
+		rsp[0] = EVBME_PIB_BATCH_CONFIRM;
+		rsp[2] = 0;
+		off    = 3;
+		//Like the firmware, stop when the next result might not fit
+		for (uint8_t i = 2; i + 4 <= msg[1] + 2 && off + 2 + MAX_HWME_ATTRIBUTE_SIZE <= sizeof(rsp); rsp[2]++)
+		{
+			vlen         = msg[i + 3];
+			rsp[off]     = loopback_pib_op(msg[i], msg[i + 1], &vlen, msg + i + 4, rsp + off + 2);
+			rsp[off + 1] = vlen;
+			i += 4 + msg[i + 3];
+			off += 2 + vlen;
+		}
+		break;
+	default:
+		fail_msg("Unexpected command 0x%02x of length %zu", msg[0], len);
+	}
+
+	rsp[1] = off - 2;
+	sLoopbackPib.requests++;
+
+	if (sLoopbackPib.hold)
+	{
+		sLoopbackPib.hold     = 0;
+		sLoopbackPib.held_len = off;
+		memcpy(sLoopbackPib.held, rsp, off);
+		return CA_ERROR_SUCCESS;
+	}
+	if (sLoopbackPib.held_len && sLoopbackPib.held[0] == rsp[0])
+	{
+		if (write(priv->pipe[1], sLoopbackPib.held, sLoopbackPib.held_len) != sLoopbackPib.held_len)
+			return CA_ERROR_FAIL;
+		sLoopbackPib.held_len = 0;
+	}
+
+	return write(priv->pipe[1], rsp, off) == off ? CA_ERROR_SUCCESS : CA_ERROR_FAIL;
+}
+
+static ssize_t loopback_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	//Messages are written whole, so once the header is there the rest is too
+	if (read(priv->pipe[0], buf, 2) != 2)
+		return 0;
+	if (buf[1] && read(priv->pipe[0], buf + 2, buf[1]) != buf[1])
+		return -1;
+	return buf[1] + 2;
+}
+
+static void loopback_flush(struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+	uint8_t               junk[64];
+
+	while (read(priv->pipe[0], junk, sizeof(junk)) > 0)
+		;
+}
+
+static void loopback_init(uint8_t batch_limit)
+{
+	memset(&sLoopbackPib, 0, sizeof(sLoopbackPib));
+	sLoopbackPib.batch_limit = batch_limit;
+
+	memset(&sPriv, 0, sizeof(sPriv));
+	memset(&sDeviceRef, 0, sizeof(sDeviceRef));
+	assert_int_equal(pipe(sPriv.pipe), 0);
+	assert_int_equal(fcntl(sPriv.pipe[0], F_SETFL, O_NONBLOCK), 0);
+
+	sPriv.base.write_func = &loopback_write;
+	sPriv.base.read_func  = &loopback_read;
+	sPriv.base.flush_func = &loopback_flush;
+
+	sDeviceRef.exchange_context = &sPriv;
+	assert_int_equal(init_generic(&sDeviceRef), CA_ERROR_SUCCESS);
+}
+
+static void loopback_deinit(void)
+{
+	deinit_generic(&sDeviceRef);
+	close(sPriv.pipe[0]);
+	close(sPriv.pipe[1]);
+	sDeviceRef.exchange_context = NULL;
+}
+
+/** Apply a batch of PIB operations, checking the result of each, and return the requests sent to the device */
+static uint32_t run_pib_batch(uint8_t batch_limit)
+{
+	struct ca821x_pib_op ops[BATCH_OPS];
+	uint8_t              shortaddr[] = {0x34, 0x12}, panid[] = {0xCD, 0xAB}, lqilimit = 0x80;
+	uint8_t              values[BATCH_OPS][2];
+
+	loopback_init(batch_limit);
+
+	ops[0] = (struct ca821x_pib_op){EVBME_PIB_MLME_SET, macShortAddress, 0, sizeof(shortaddr), shortaddr};
+	ops[1] = (struct ca821x_pib_op){EVBME_PIB_MLME_SET, macPANId, 0, sizeof(panid), panid};
+	ops[2] = (struct ca821x_pib_op){EVBME_PIB_HWME_SET, HWME_LQILIMIT, 0, sizeof(lqilimit), &lqilimit};
+	ops[3] = (struct ca821x_pib_op){EVBME_PIB_HWME_GET, HWME_LQILIMIT, 0, 2, values[3]};
+	ops[4] = (struct ca821x_pib_op){EVBME_PIB_MLME_GET, macPANId, 0, 1, values[4]};
+	ops[5] = (struct ca821x_pib_op){EVBME_PIB_MLME_GET, nsIEEEAddress, 0, 2, values[5]};
+	for (int i = 6; i < BATCH_OPS; i++)
+		ops[i] = (struct ca821x_pib_op){EVBME_PIB_MLME_GET, macShortAddress, 0, 2, values[i]};
+
+	assert_int_equal(ca821x_util_pib_batch(ops, BATCH_OPS, &sDeviceRef), CA_ERROR_SUCCESS);
+
+	for (int i = 0; i < 3; i++) assert_int_equal(ops[i].status, MAC_SUCCESS);
+	assert_int_equal(ops[3].status, MAC_SUCCESS);
+	assert_int_equal(ops[3].length, 1);
+	assert_int_equal(values[3][0], lqilimit);
+	assert_int_equal(ops[4].status, MAC_INVALID_PARAMETER);
+	assert_int_equal(ops[5].status, MAC_UNSUPPORTED_ATTRIBUTE);
+	for (int i = 6; i < BATCH_OPS; i++)
+	{
+		assert_int_equal(ops[i].status, MAC_SUCCESS);
+		assert_int_equal(ops[i].length, sizeof(shortaddr));
+		assert_memory_equal(values[i], shortaddr, sizeof(shortaddr));
+	}
+
+	loopback_deinit();
+
+	return sLoopbackPib.requests;
+}
+
+static void pib_batch_test(void **state)
+{
+	uint32_t pipelined, batched;
+
+	(void)state;
+
+	//One request per operation, plus the probe
+	pipelined = run_pib_batch(0);
+	assert_int_equal(pipelined, BATCH_OPS + 1);
+
+	//The device applies several operations per request, and reports a partial batch when the confirm is full
+	batched = run_pib_batch(BATCH_LIMIT);
+	assert_true(batched < pipelined / 4);
+
+	printf("pib batch of %u operations: %u requests pipelined, %u requests batched\n", BATCH_OPS, pipelined, batched);
+}
+
+static void late_confirm_test(void **state)
+{
+	uint8_t old = 0x40, new = 0x80, value = 0, len = 0;
+
+	(void)state;
+
+	loopback_init(0);
+	assert_int_equal(HWME_SET_request_sync(HWME_LQILIMIT, sizeof(old), &old, &sDeviceRef), MAC_SUCCESS);
+
+	//The confirm is held back until the request has timed out
+	sLoopbackPib.hold = 1;
+	assert_int_equal(HWME_GET_request_sync(HWME_LQILIMIT, &len, &value, &sDeviceRef), MAC_SYSTEM_ERROR);
+	assert_int_equal(HWME_SET_request_sync(HWME_LQILIMIT, sizeof(new), &new, &sDeviceRef), MAC_SUCCESS);
+
+	//The late confirm arrives first, and must be discarded rather than completing the new request
+	assert_int_equal(HWME_GET_request_sync(HWME_LQILIMIT, &len, &value, &sDeviceRef), MAC_SUCCESS);
+	assert_int_equal(len, sizeof(new));
+	assert_int_equal(value, new);
+
+	loopback_deinit();
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test(pib_batch_test),
+	    cmocka_unit_test(late_confirm_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,231 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief  Unit tests for the ca821x-posix PIB cache
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-pib-cache.h"
+#include "hwme_tdme.h"
+#include "ieee_802_15_4.h"
+#include "mac_messages.h"
+
+static struct ca821x_pib_cache sCache;
+
+static int cache_setup(void **state)
+{
+	(void)state;
+	pib_cache_init(&sCache);
+	sCache.enabled = 1;
+	return 0;
+}
+
+static int cache_teardown(void **state)
+{
+	(void)state;
+	pib_cache_deinit(&sCache);
+	return 0;
+}
+
+/** Run an MLME-SET through the cache as the exchange would, with the given confirm status */
+static void mlme_set(uint8_t attribute, uint8_t length, uint8_t value, uint8_t status)
+{
+	uint8_t cmd[] = {SPI_MLME_SET_REQUEST, 3 + length, attribute, 0, length, value, value};
+	uint8_t rsp[] = {SPI_MLME_SET_CONFIRM, 3, status, attribute, 0};
+
+	pib_cache_confirmed(cmd, rsp, pib_cache_sent(cmd, &sCache), &sCache);
+}
+
+/** Look up an MLME-GET in the cache, returning the first byte of the value or -1 on a miss */
+static int mlme_get(uint8_t attribute)
+{
+	uint8_t            cmd[] = {SPI_MLME_GET_REQUEST, 2, attribute, 0};
+	struct MAC_Message rsp;
+
+	if (pib_cache_lookup(cmd, &rsp.CommandId, &sCache))
+		return -1;
+
+	assert_int_equal(rsp.CommandId, SPI_MLME_GET_CONFIRM);
+	assert_int_equal(rsp.PData.GetCnf.Status, MAC_SUCCESS);
+	assert_int_equal(rsp.PData.GetCnf.PIBAttribute, attribute);
+	assert_int_equal(rsp.Length, 4 + rsp.PData.GetCnf.PIBAttributeLength);
+	return rsp.PData.GetCnf.PIBAttributeValue[0];
+}
+
+static void pib_cache_write_through_test(void **state)
+{
+	uint8_t get[]    = {SPI_MLME_GET_REQUEST, 2, phyCurrentChannel, 0};
+	uint8_t getcnf[] = {SPI_MLME_GET_CONFIRM, 5, MAC_SUCCESS, phyCurrentChannel, 0, 1, 15};
+
+	(void)state;
+
+	//Reads populate the cache on a miss
+	assert_int_equal(mlme_get(phyCurrentChannel), -1);
+	pib_cache_confirmed(get, getcnf, pib_cache_sent(get, &sCache), &sCache);
+	assert_int_equal(mlme_get(phyCurrentChannel), 15);
+
+	//Successful writes replace the value, failed writes leave it uncached
+	mlme_set(phyCurrentChannel, 1, 20, MAC_SUCCESS);
+	assert_int_equal(mlme_get(phyCurrentChannel), 20);
+	mlme_set(phyCurrentChannel, 1, 21, MAC_INVALID_PARAMETER);
+	assert_int_equal(mlme_get(phyCurrentChannel), -1);
+
+	//Two byte values, such as the short address
+	mlme_set(macShortAddress, 2, 0x34, MAC_SUCCESS);
+	assert_int_equal(mlme_get(macShortAddress), 0x34);
+
+	assert_int_equal(sCache.hits, 3);
+	assert_int_equal(sCache.misses, 2);
+}
+
+static void pib_cache_invalidate_test(void **state)
+{
+	uint8_t reset[]  = {SPI_MLME_RESET_REQUEST, 1, 1};
+	uint8_t wakeup[] = {SPI_HWME_WAKEUP_INDICATION, 1, HWME_WAKEUP_POWERUP};
+	uint8_t dataind  = SPI_MCPS_DATA_INDICATION;
+
+	(void)state;
+
+	mlme_set(macPANId, 2, 0xCA, MAC_SUCCESS);
+	pib_cache_received(&dataind, &sCache);
+	assert_int_equal(mlme_get(macPANId), 0xCA);
+
+	pib_cache_sent(reset, &sCache);
+	assert_int_equal(mlme_get(macPANId), -1);
+
+	mlme_set(macPANId, 2, 0xCA, MAC_SUCCESS);
+	pib_cache_received(wakeup, &sCache);
+	assert_int_equal(mlme_get(macPANId), -1);
+	assert_int_equal(sCache.invalidations, 2);
+}
+
+static void pib_cache_concurrent_test(void **state)
+{
+	uint8_t  get[]    = {SPI_MLME_GET_REQUEST, 2, phyCurrentChannel, 0};
+	uint8_t  getcnf[] = {SPI_MLME_GET_CONFIRM, 5, MAC_SUCCESS, phyCurrentChannel, 0, 1, 15};
+	uint8_t  set11[]  = {SPI_MLME_SET_REQUEST, 4, phyCurrentChannel, 0, 1, 11};
+	uint8_t  set12[]  = {SPI_MLME_SET_REQUEST, 4, phyCurrentChannel, 0, 1, 12};
+	uint8_t  setpan[] = {SPI_MLME_SET_REQUEST, 5, macPANId, 0, 2, 0xCA, 0xCA};
+	uint8_t  reset[]  = {SPI_MLME_RESET_REQUEST, 1, 1};
+	uint8_t  chcnf[]  = {SPI_MLME_SET_CONFIRM, 3, MAC_SUCCESS, phyCurrentChannel, 0};
+	uint8_t  pancnf[] = {SPI_MLME_SET_CONFIRM, 3, MAC_SUCCESS, macPANId, 0};
+	uint64_t getgen, set11gen, set12gen, pangen;
+
+	(void)state;
+
+	//A GET confirm sent before a SET holds the old value, so must not be stored
+	getgen = pib_cache_sent(get, &sCache);
+	mlme_set(phyCurrentChannel, 1, 20, MAC_SUCCESS);
+	pib_cache_confirmed(get, getcnf, getgen, &sCache);
+	assert_int_equal(mlme_get(phyCurrentChannel), 20);
+
+	getgen   = pib_cache_sent(get, &sCache);
+	set11gen = pib_cache_sent(set11, &sCache);
+	pib_cache_confirmed(get, getcnf, getgen, &sCache);
+	assert_int_equal(mlme_get(phyCurrentChannel), -1);
+	pib_cache_confirmed(set11, chcnf, set11gen, &sCache);
+	assert_int_equal(mlme_get(phyCurrentChannel), 11);
+
+	//Only the last of several SETs to the same attribute is stored, whatever order the confirms are seen in
+	set11gen = pib_cache_sent(set11, &sCache);
+	set12gen = pib_cache_sent(set12, &sCache);
+	pangen   = pib_cache_sent(setpan, &sCache);
+	pib_cache_confirmed(set12, chcnf, set12gen, &sCache);
+	pib_cache_confirmed(set11, chcnf, set11gen, &sCache);
+	assert_int_equal(mlme_get(phyCurrentChannel), 12);
+
+	//SETs to other attributes don't interfere
+	pib_cache_confirmed(setpan, pancnf, pangen, &sCache);
+	assert_int_equal(mlme_get(macPANId), 0xCA);
+
+	//Nor is anything sent before the device is reset
+	getgen = pib_cache_generation(get, &sCache);
+	pib_cache_sent(reset, &sCache);
+	pib_cache_confirmed(get, getcnf, getgen, &sCache);
+	assert_int_equal(mlme_get(phyCurrentChannel), -1);
+
+	//The generation can be predicted for requests sent by another layer
+	set11gen = pib_cache_generation(set11, &sCache);
+	assert_int_equal(pib_cache_sent(set11, &sCache), set11gen);
+	pib_cache_confirmed(set11, chcnf, set11gen, &sCache);
+	assert_int_equal(mlme_get(phyCurrentChannel), 11);
+}
+
+static void pib_cache_nocache_test(void **state)
+{
+	uint8_t hwset[] = {SPI_HWME_SET_REQUEST, 3, HWME_TXPOWER, 1, 0x3F};
+	uint8_t hwcnf[] = {SPI_HWME_SET_CONFIRM, 2, HWME_SUCCESS, HWME_TXPOWER};
+	uint8_t hwget[] = {SPI_HWME_GET_REQUEST, 1, HWME_TXPOWER};
+	uint8_t hwrsp[sizeof(struct MAC_Message)];
+
+	(void)state;
+
+	//The MAC changes the sequence numbers itself
+	mlme_set(macDSN, 1, 7, MAC_SUCCESS);
+	assert_int_equal(mlme_get(macDSN), -1);
+
+	//Attributes can be made uncacheable at runtime
+	mlme_set(macRxOnWhenIdle, 1, 1, MAC_SUCCESS);
+	assert_int_equal(mlme_get(macRxOnWhenIdle), 1);
+	sCache.nocache[ca821x_pib_cache_mlme][macRxOnWhenIdle / 8] |= 1 << (macRxOnWhenIdle % 8);
+	mlme_set(macRxOnWhenIdle, 1, 0, MAC_SUCCESS);
+	assert_int_equal(mlme_get(macRxOnWhenIdle), -1);
+
+	//HWME_TXPOWER and phyTransmitPower are the same setting
+	mlme_set(phyTransmitPower, 1, 10, MAC_SUCCESS);
+	pib_cache_confirmed(hwset, hwcnf, pib_cache_sent(hwset, &sCache), &sCache);
+	assert_int_equal(mlme_get(phyTransmitPower), -1);
+	assert_int_equal(pib_cache_lookup(hwget, hwrsp, &sCache), CA_ERROR_SUCCESS);
+	assert_int_equal(hwrsp[0], SPI_HWME_GET_CONFIRM);
+	assert_int_equal(((struct MAC_Message *)hwrsp)->PData.HWMEGetCnf.HWAttributeValue[0], 0x3F);
+
+	//Disabled caches answer nothing
+	sCache.enabled = 0;
+	assert_int_equal(pib_cache_lookup(hwget, hwrsp, &sCache), CA_ERROR_NOT_FOUND);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test_setup_teardown(pib_cache_write_through_test, cache_setup, cache_teardown),
+	    cmocka_unit_test_setup_teardown(pib_cache_invalidate_test, cache_setup, cache_teardown),
+	    cmocka_unit_test_setup_teardown(pib_cache_concurrent_test, cache_setup, cache_teardown),
+	    cmocka_unit_test_setup_teardown(pib_cache_nocache_test, cache_setup, cache_teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+/**
+ * @file
+ * @brief  Unit tests for the ca821x-posix exchange queues
+ */
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-queue.h"
+
+enum
+{
+	THREAD_TEST_COUNT = 100000
+};
+
+static struct buffer_queue sQueue;
+
+static int queue_setup(void **state)
+{
+	(void)state;
+	init_queue(&sQueue);
+	return 0;
+}
+
+static int queue_teardown(void **state)
+{
+	(void)state;
+	flush_queue(&sQueue);
+	deinit_queue(&sQueue);
+	return 0;
+}
+
+static void queue_order_test(void **state)
+{
+	struct ca821x_dev *dev_out = NULL;
+	uint8_t            buf[CA821X_QUEUE_BUF_SIZE];
+
+	(void)state;
+
+	for (uint8_t i = 1; i <= 10; i++)
+	{
+		memset(buf, i, i);
+		assert_int_equal(add_to_queue(&sQueue, buf, i, (struct ca821x_dev *)&sQueue), CA_ERROR_SUCCESS);
+	}
+
+	for (uint8_t i = 1; i <= 10; i++)
+	{
+		assert_int_equal(peek_queue(&sQueue), i);
+		assert_int_equal(pop_from_queue(&sQueue, buf, sizeof(buf), &dev_out), i);
+		assert_ptr_equal(dev_out, &sQueue);
+		assert_int_equal(buf[0], i);
+		assert_int_equal(buf[i - 1], i);
+	}
+
+	assert_int_equal(peek_queue(&sQueue), 0);
+	assert_int_equal(pop_from_queue(&sQueue, buf, sizeof(buf), &dev_out), 0);
+	assert_int_equal(wait_on_queue_empty(&sQueue, 1), CA_ERROR_SUCCESS);
+}
+
+static void queue_overflow_test(void **state)
+{
+	struct buffer_queue_stats stats;
+	struct ca821x_dev *       dev_out = NULL;
+	uint8_t                   buf[4]  = {0};
+
+	(void)state;
+
+	for (size_t i = 0; i < CASCODA_POSIX_QUEUE_DEPTH; i++)
+		assert_int_equal(add_to_queue(&sQueue, buf, sizeof(buf), NULL), CA_ERROR_SUCCESS);
+
+	assert_int_equal(add_to_queue(&sQueue, buf, sizeof(buf), NULL), CA_ERROR_NO_BUFFER);
+	assert_int_equal(add_to_queue(&sQueue, buf, CA821X_QUEUE_BUF_SIZE + 1, NULL), CA_ERROR_INVALID_ARGS);
+	assert_int_equal(wait_on_queue_empty(&sQueue, 1), CA_ERROR_TIMEOUT);
+
+	get_queue_stats(&sQueue, &stats);
+	assert_int_equal(stats.depth, CASCODA_POSIX_QUEUE_DEPTH);
+	assert_int_equal(stats.count, CASCODA_POSIX_QUEUE_DEPTH);
+	assert_int_equal(stats.high_water, CASCODA_POSIX_QUEUE_DEPTH);
+	assert_int_equal(stats.overflows, 1);
+
+	//Wraparound
+	assert_int_equal(pop_from_queue(&sQueue, buf, sizeof(buf), &dev_out), sizeof(buf));
+	assert_int_equal(add_to_queue(&sQueue, buf, sizeof(buf), NULL), CA_ERROR_SUCCESS);
+
+	flush_queue(&sQueue);
+	get_queue_stats(&sQueue, &stats);
+	assert_int_equal(stats.count, 0);
+	assert_int_equal(stats.high_water, CASCODA_POSIX_QUEUE_DEPTH);
+}
+
+static void *producer_thread(void *arg)
+{
+	(void)arg;
+
+	for (uint32_t i = 0; i < THREAD_TEST_COUNT; i++)
+	{
+		while (add_to_queue(&sQueue, (uint8_t *)&i, sizeof(i), NULL) == CA_ERROR_NO_BUFFER)
+			wait_on_queue_empty(&sQueue, 1);
+	}
+	return NULL;
+}
+
+static void queue_thread_test(void **state)
+{
+	struct ca821x_dev *dev_out = NULL;
+	pthread_t          producer;
+	uint32_t           val;
+
+	(void)state;
+
+	assert_int_equal(pthread_create(&producer, NULL, &producer_thread, NULL), 0);
+
+	for (uint32_t i = 0; i < THREAD_TEST_COUNT; i++)
+	{
+		assert_int_equal(wait_on_queue(&sQueue, 5), sizeof(val));
+		assert_int_equal(pop_from_queue(&sQueue, (uint8_t *)&val, sizeof(val), &dev_out), sizeof(val));
+		assert_int_equal(val, i);
+	}
+
+	pthread_join(producer, NULL);
+	assert_int_equal(peek_queue(&sQueue), 0);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test_setup_teardown(queue_order_test, queue_setup, queue_teardown),
+	    cmocka_unit_test_setup_teardown(queue_overflow_test, queue_setup, queue_teardown),
+	    cmocka_unit_test_setup_teardown(queue_thread_test, queue_setup, queue_teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,234 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief  Unit tests for the ca821x-posix exchange reactor, using a pipe that loops messages back to the host
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-posix/ca821x-posix.h"
+#include "ca821x-generic-exchange.h"
+
+enum
+{
+	DEV_COUNT       = 4,    //!< Number of loopback devices serviced by the reactor
+	ECHO_CMDID      = 0x7C, //!< Synchronous command id with no known response id, so matched by any response
+	ERROR_CMDID     = 0x3B, //!< Command id that makes the loopback read fail
+	CALLBACK_MS     = 2000, //!< Time allowed for the error callback to run
+	REACTOR_THREADS = 2     //!< Number of reactor threads used by the echo test
+};
+
+/** Private data for the loopback exchange, which reads back everything written to it */
+struct loopback_priv
+{
+	struct ca821x_exchange_base base;    //!< Exchange base structure
+	int                         pipe[2]; //!< Loopback pipe, the read end is nonblocking
+};
+
+static struct loopback_priv sPrivs[DEV_COUNT];
+static struct ca821x_dev    sDevices[DEV_COUNT];
+
+static pthread_mutex_t sCallbackMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sCallbackCond  = PTHREAD_COND_INITIALIZER;
+static int             sCallbackCount;
+
+static ca_error loopback_write(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	return write(priv->pipe[1], buf, len) == (ssize_t)len ? CA_ERROR_SUCCESS : CA_ERROR_FAIL;
+}
+
+static ssize_t loopback_read(struct ca821x_dev *pDeviceRef, uint8_t *buf)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	//Messages are written whole, so once the header is there the rest is too
+	if (read(priv->pipe[0], buf, 2) != 2)
+		return 0;
+	if (buf[1] && read(priv->pipe[0], buf + 2, buf[1]) != buf[1])
+		return -1;
+	if (buf[0] == ERROR_CMDID)
+		return -1;
+	return buf[1] + 2;
+}
+
+static void loopback_flush(struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+	uint8_t               junk[64];
+
+	while (read(priv->pipe[0], junk, sizeof(junk)) > 0)
+		;
+}
+
+static int loopback_get_fd(struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	return priv->pipe[0];
+}
+
+static ca_error loopback_init(ca821x_errorhandler callback, struct loopback_priv *priv, struct ca821x_dev *pDeviceRef)
+{
+	memset(priv, 0, sizeof(*priv));
+	memset(pDeviceRef, 0, sizeof(*pDeviceRef));
+	if (pipe(priv->pipe) || fcntl(priv->pipe[0], F_SETFL, O_NONBLOCK))
+		return CA_ERROR_FAIL;
+
+	priv->base.error_callback = callback;
+	priv->base.write_func     = &loopback_write;
+	priv->base.read_func      = &loopback_read;
+	priv->base.flush_func     = &loopback_flush;
+	priv->base.get_fd_func    = &loopback_get_fd;
+
+	pDeviceRef->exchange_context = priv;
+
+	return init_generic(pDeviceRef);
+}
+
+static void loopback_deinit(struct ca821x_dev *pDeviceRef)
+{
+	struct loopback_priv *priv = pDeviceRef->exchange_context;
+
+	deinit_generic(pDeviceRef);
+	close(priv->pipe[0]);
+	close(priv->pipe[1]);
+	pDeviceRef->exchange_context = NULL;
+}
+
+/** Error callback that deinitialises the device from the reactor thread, as an application closing it would */
+static ca_error deinit_callback(ca_error error, struct ca821x_dev *pDeviceRef)
+{
+	(void)error;
+	loopback_deinit(pDeviceRef);
+
+	pthread_mutex_lock(&sCallbackMutex);
+	sCallbackCount++;
+	pthread_cond_broadcast(&sCallbackCond);
+	pthread_mutex_unlock(&sCallbackMutex);
+
+	return CA_ERROR_SUCCESS;
+}
+
+static void echo(struct ca821x_dev *pDeviceRef)
+{
+	uint8_t cmd[] = {ECHO_CMDID, 3, 1, 2, 3};
+	uint8_t rsp[sizeof(struct MAC_Message)];
+
+	memset(rsp, 0, sizeof(rsp));
+	assert_int_equal(ca821x_exchange_commands(cmd, sizeof(cmd), rsp, pDeviceRef), CA_ERROR_SUCCESS);
+	assert_memory_equal(rsp, cmd, sizeof(cmd));
+}
+
+static void reactor_echo_test(void **state)
+{
+	struct ca821x_reactor_stats stats;
+
+	(void)state;
+
+	assert_int_equal(ca821x_util_start_reactor(REACTOR_THREADS), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_start_reactor(REACTOR_THREADS), CA_ERROR_ALREADY);
+
+	for (int i = 0; i < DEV_COUNT; i++)
+	{
+		assert_int_equal(loopback_init(NULL, &sPrivs[i], &sDevices[i]), CA_ERROR_SUCCESS);
+		assert_non_null(sPrivs[i].base.reactor);
+	}
+
+	//Every request is written on a signal from the requesting thread, and its response read while servicing it
+	for (int i = 0; i < DEV_COUNT * 4; i++) echo(&sDevices[i % DEV_COUNT]);
+
+	assert_int_equal(ca821x_util_get_reactor_stats(&stats), CA_ERROR_SUCCESS);
+	assert_int_equal(stats.threads, REACTOR_THREADS);
+	assert_int_equal(stats.devices, DEV_COUNT);
+	assert_true(stats.signals > 0);
+	assert_true(stats.wakeups >= stats.signals);
+
+	//Devices must be deinitialised before the reactor is stopped
+	assert_int_equal(ca821x_util_stop_reactor(), CA_ERROR_INVALID_STATE);
+	for (int i = 0; i < DEV_COUNT; i++) loopback_deinit(&sDevices[i]);
+	assert_int_equal(ca821x_util_stop_reactor(), CA_ERROR_SUCCESS);
+	assert_int_equal(ca821x_util_stop_reactor(), CA_ERROR_ALREADY);
+	assert_int_equal(ca821x_util_get_reactor_stats(&stats), CA_ERROR_INVALID_STATE);
+}
+
+static void reactor_deinit_from_callback_test(void **state)
+{
+	const uint8_t   error_cmd[] = {ERROR_CMDID, 0};
+	struct timespec ts;
+
+	(void)state;
+
+	//A single thread, so that the surviving device is serviced by the same thread that ran the callback
+	assert_int_equal(ca821x_util_start_reactor(1), CA_ERROR_SUCCESS);
+	assert_int_equal(loopback_init(&deinit_callback, &sPrivs[0], &sDevices[0]), CA_ERROR_SUCCESS);
+	assert_int_equal(loopback_init(NULL, &sPrivs[1], &sDevices[1]), CA_ERROR_SUCCESS);
+	sCallbackCount = 0;
+
+	//The failed read calls the error callback on the reactor thread, which deinitialises the device
+	assert_int_equal(write(sPrivs[0].pipe[1], error_cmd, sizeof(error_cmd)), sizeof(error_cmd));
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += CALLBACK_MS / 1000;
+	pthread_mutex_lock(&sCallbackMutex);
+	while (!sCallbackCount && !pthread_cond_timedwait(&sCallbackCond, &sCallbackMutex, &ts))
+		;
+	pthread_mutex_unlock(&sCallbackMutex);
+	assert_int_equal(sCallbackCount, 1);
+	assert_null(sDevices[0].exchange_context);
+
+	//The reactor thread is still running
+	echo(&sDevices[1]);
+
+	loopback_deinit(&sDevices[1]);
+	assert_int_equal(ca821x_util_stop_reactor(), CA_ERROR_SUCCESS);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test(reactor_echo_test),
+	    cmocka_unit_test(reactor_deinit_from_callback_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,500 @@
+/*
+ *  Copyright (c) 2020, Cascoda Ltd.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief  Unit tests and benchmarks for the ca821x-posix usb exchange, using a loopback stand-in for hidapi
+ */
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//cmocka must be after system headers
+#include <cmocka.h>
+
+#include "ca821x-posix/ca821x-posix-evbme.h"
+#include "ca821x-posix/ca821x-posix.h"
+#include "ca821x-generic-exchange.h"
+#include "evbme_messages.h"
+#include "usb-exchange.h"
+
+enum
+{
+	FRAG_SIZE        = 64,   //!< Size of a hid report, excluding the report ID
+	LOOPBACK_FRAGS   = 64,   //!< Number of hid reports buffered by the loopback
+	BENCHMARK_COUNT  = 2000, //!< Number of synchronous commands timed by the benchmark
+	ASYNC_COUNT      = 200,  //!< Number of commands sent by the asynchronous benchmark, as many in flight as fit
+	FLOOD_COUNT      = 500,  //!< Number of small asynchronous messages sent by the throughput benchmark
+	FLOOD_LEN        = 14,   //!< Length of each asynchronous message, like a small MCPS indication
+	FLOOD_CMDID      = 0x3A, //!< Asynchronous command id unknown to the api, so passed to the user callback
+	REPORT_PERIOD_US = 1000, //!< Interrupt endpoint interval simulated by the throughput benchmark
+	ECHO_CMDID       = 0x7C  //!< Synchronous command id with no known response id, so matched by any response
+};
+
+/**
+ * Loopback stand-in for a hid device, which returns every report written to it. It answers EVBME_USB_PACKED
+ * requests like a device that supports packed reports.
+ */
+static struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	uint8_t         frags[LOOPBACK_FRAGS][FRAG_SIZE];
+	size_t          head, tail;
+	uint32_t        period_us; //!< Minimum time between reports read, 0 for none
+	uint64_t        last_read_us;
+	int             bootloader;  //!< Answer EVBME_USB_PACKED like the DFU bootloader, which never answers SETs
+	uint32_t        packed_sets; //!< Number of EVBME_USB_PACKED SETs written
+} sLoopback = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static uint32_t sFloodReceived;
+static uint32_t sAsyncCompleted;
+
+static struct hid_device_info sLoopbackInfo = {.path = "loopback", .serial_number = L"LOOPBACK"};
+static struct ca821x_dev      sDeviceRef;
+
+static struct hid_device_info *loopback_enumerate(unsigned short vid, unsigned short pid)
+{
+	(void)vid;
+	(void)pid;
+	return &sLoopbackInfo;
+}
+
+static hid_device *loopback_open_path(const char *path)
+{
+	(void)path;
+	return (hid_device *)&sLoopback;
+}
+
+static void loopback_close(hid_device *dev)
+{
+	(void)dev;
+}
+
+static void loopback_free_enumeration(struct hid_device_info *devs)
+{
+	(void)devs;
+}
+
+static uint64_t get_monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int loopback_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	struct timespec ts;
+	int             rval = 0;
+
+	(void)dev;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (long)milliseconds * 1000000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+
+	pthread_mutex_lock(&sLoopback.mutex);
+	while (sLoopback.head == sLoopback.tail && milliseconds)
+	{
+		if (milliseconds < 0)
+			pthread_cond_wait(&sLoopback.cond, &sLoopback.mutex);
+		else if (pthread_cond_timedwait(&sLoopback.cond, &sLoopback.mutex, &ts))
+			break;
+	}
+	if (sLoopback.head != sLoopback.tail)
+	{
+		uint64_t next_us = sLoopback.last_read_us + sLoopback.period_us;
+		uint64_t now_us  = get_monotonic_us();
+
+		if (sLoopback.period_us && now_us < next_us)
+		{
+			usleep(next_us - now_us);
+			now_us = next_us;
+		}
+		sLoopback.last_read_us = now_us;
+
+		rval = length < FRAG_SIZE ? length : FRAG_SIZE;
+		memcpy(data, sLoopback.frags[sLoopback.head++ % LOOPBACK_FRAGS], rval);
+		pthread_cond_broadcast(&sLoopback.cond);
+	}
+	pthread_mutex_unlock(&sLoopback.mutex);
+
+	return rval;
+}
+
+/** Answer an EVBME_USB_PACKED GET in an unfragmented report, replacing it with the confirm */
+static void loopback_answer(uint8_t *frag)
+{
+	uint8_t *msg = frag + 1;
+	uint8_t  off;
+
+	if (msg[0] != EVBME_GET_REQUEST || msg[2] != EVBME_USB_PACKED)
+		return;
+
+	if (sLoopback.bootloader)
+	{
+		msg[2] = CA_ERROR_INVALID_STATE;
+		off    = 3;
+	}
+	else
+	{
+		msg[2] = CA_ERROR_SUCCESS;
+		msg[3] = EVBME_USB_PACKED;
+		msg[4] = 1;
+		msg[5] = 0;
+		off    = 6;
+	}
+
+	msg[0]  = EVBME_GET_CONFIRM;
+	msg[1]  = off - 2;
+	frag[0] = 0xC0 | off;
+}
+
+static int loopback_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	(void)dev;
+	assert_int_equal(length, FRAG_SIZE + 1);
+
+	pthread_mutex_lock(&sLoopback.mutex);
+	while (sLoopback.tail - sLoopback.head >= LOOPBACK_FRAGS)
+		pthread_cond_wait(&sLoopback.cond, &sLoopback.mutex);
+	//Strip the report ID
+	memcpy(sLoopback.frags[sLoopback.tail % LOOPBACK_FRAGS], data + 1, FRAG_SIZE);
+	if (data[2] == EVBME_SET_REQUEST && data[4] == EVBME_USB_PACKED && sLoopback.bootloader)
+	{
+		//Dropped without an answer
+		sLoopback.packed_sets++;
+		pthread_mutex_unlock(&sLoopback.mutex);
+		return length;
+	}
+	if (data[2] == EVBME_SET_REQUEST && data[4] == EVBME_USB_PACKED)
+	{
+		uint8_t *confirm = sLoopback.frags[sLoopback.tail % LOOPBACK_FRAGS];
+
+		confirm[0] = 0xC0 | 3; //first, last, 3 bytes
+		confirm[1] = EVBME_SET_CONFIRM;
+		confirm[2] = 1;
+		confirm[3] = CA_ERROR_SUCCESS;
+		sLoopback.packed_sets++;
+	}
+	else if ((data[1] & 0xC0) == 0xC0)
+	{
+		loopback_answer(sLoopback.frags[sLoopback.tail % LOOPBACK_FRAGS]);
+	}
+	sLoopback.tail++;
+	pthread_cond_broadcast(&sLoopback.cond);
+	pthread_mutex_unlock(&sLoopback.mutex);
+
+	return length;
+}
+
+static int loopback_exit(void)
+{
+	return 0;
+}
+
+static const struct usb_exchange_hid_ops sLoopbackOps = {
+    .enumerate        = loopback_enumerate,
+    .open_path        = loopback_open_path,
+    .close            = loopback_close,
+    .free_enumeration = loopback_free_enumeration,
+    .read_timeout     = loopback_read_timeout,
+    .write            = loopback_write,
+    .exit             = loopback_exit,
+};
+
+static int usb_setup(void **state)
+{
+	(void)state;
+	if (usb_exchange_set_hid_ops(&sLoopbackOps))
+		return -1;
+	return usb_exchange_init(NULL, NULL, &sDeviceRef);
+}
+
+static int usb_teardown(void **state)
+{
+	(void)state;
+	usb_exchange_deinit(&sDeviceRef);
+	return usb_exchange_set_hid_ops(NULL);
+}
+
+static void usb_sync_echo_test(void **state)
+{
+	uint8_t cmd[200], rsp[sizeof(struct MAC_Message)];
+
+	(void)state;
+
+	//Sizes spanning several hid reports exercise fragmentation in both directions
+	for (size_t len = 0; len <= sizeof(cmd) - 2; len += 33)
+	{
+		cmd[0] = ECHO_CMDID;
+		cmd[1] = len;
+		for (size_t i = 0; i < len; i++) cmd[i + 2] = len + i;
+
+		memset(rsp, 0, sizeof(rsp));
+		assert_int_equal(ca821x_exchange_commands(cmd, len + 2, rsp, &sDeviceRef), CA_ERROR_SUCCESS);
+		assert_memory_equal(rsp, cmd, len + 2);
+	}
+}
+
+static void usb_sync_latency_benchmark(void **state)
+{
+	uint8_t  cmd[] = {ECHO_CMDID, 2, 0x00, 0x00};
+	uint8_t  rsp[sizeof(struct MAC_Message)];
+	uint64_t start_us, latency_us, total_us = 0, max_us = 0;
+
+	(void)state;
+
+	for (uint32_t i = 0; i < BENCHMARK_COUNT; i++)
+	{
+		cmd[2] = i;
+		start_us = get_monotonic_us();
+		assert_int_equal(ca821x_exchange_commands(cmd, sizeof(cmd), rsp, &sDeviceRef), CA_ERROR_SUCCESS);
+		latency_us = get_monotonic_us() - start_us;
+		assert_memory_equal(rsp, cmd, sizeof(cmd));
+
+		total_us += latency_us;
+		if (latency_us > max_us)
+			max_us = latency_us;
+	}
+
+	printf("usb sync round trip over loopback: %u commands, mean %.1f us, max %llu us\n",
+	       BENCHMARK_COUNT,
+	       (double)total_us / BENCHMARK_COUNT,
+	       (unsigned long long)max_us);
+}
+
+static void async_callback(ca_error status, const uint8_t *response, void *context, struct ca821x_dev *pDeviceRef)
+{
+	uint32_t count = __atomic_load_n(&sAsyncCompleted, __ATOMIC_RELAXED);
+
+	assert_ptr_equal(pDeviceRef, &sDeviceRef);
+	assert_int_equal(status, CA_ERROR_SUCCESS);
+	//Requests must complete in order, each with its own response
+	assert_int_equal((uintptr_t)context, count);
+	assert_int_equal(response[0], ECHO_CMDID);
+	assert_int_equal(response[2], (uint8_t)count);
+
+	__atomic_store_n(&sAsyncCompleted, count + 1, __ATOMIC_RELEASE);
+}
+
+/** Time ASYNC_COUNT echoed commands at one report per REPORT_PERIOD_US, returning the commands per second */
+static double run_echoes(int async)
+{
+	uint8_t  cmd[] = {ECHO_CMDID, 2, 0x00, 0x00};
+	uint8_t  rsp[sizeof(struct MAC_Message)];
+	uint64_t start_us, elapsed_us;
+
+	__atomic_store_n(&sAsyncCompleted, 0, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&sLoopback.mutex);
+	sLoopback.period_us = REPORT_PERIOD_US;
+	pthread_mutex_unlock(&sLoopback.mutex);
+
+	start_us = get_monotonic_us();
+	for (uint32_t i = 0; i < ASYNC_COUNT; i++)
+	{
+		cmd[2] = i;
+		if (async)
+		{
+			ca_error error;
+
+			//Every pending slot may be in use, in which case wait for a response to free one
+			while ((error = ca821x_api_downstream_async(cmd, async_callback, (void *)(uintptr_t)i, &sDeviceRef)) ==
+			       CA_ERROR_NO_BUFFER)
+				usleep(REPORT_PERIOD_US);
+			assert_int_equal(error, CA_ERROR_SUCCESS);
+		}
+		else
+		{
+			assert_int_equal(ca821x_api_downstream(cmd, rsp, &sDeviceRef), CA_ERROR_SUCCESS);
+			assert_int_equal(rsp[2], (uint8_t)i);
+		}
+	}
+	while (async && __atomic_load_n(&sAsyncCompleted, __ATOMIC_ACQUIRE) < ASYNC_COUNT &&
+	       get_monotonic_us() - start_us < 10000000)
+	{
+		usleep(100);
+	}
+	elapsed_us = get_monotonic_us() - start_us;
+
+	pthread_mutex_lock(&sLoopback.mutex);
+	sLoopback.period_us = 0;
+	pthread_mutex_unlock(&sLoopback.mutex);
+
+	if (async)
+		assert_int_equal(sAsyncCompleted, ASYNC_COUNT);
+
+	return ASYNC_COUNT * 1000000.0 / elapsed_us;
+}
+
+static void usb_async_pipeline_benchmark(void **state)
+{
+	uint8_t                   cmd[] = {0x05, 0};
+	struct buffer_queue_stats in_stats;
+	double                    sync, async;
+
+	(void)state;
+
+	assert_int_equal(ca821x_api_downstream_async(cmd, async_callback, NULL, &sDeviceRef), CA_ERROR_INVALID_ARGS);
+
+	sync  = run_echoes(0);
+	async = run_echoes(1);
+
+	assert_int_equal(exchange_get_queue_stats(&in_stats, NULL, NULL, &sDeviceRef), CA_ERROR_SUCCESS);
+	assert_int_equal(in_stats.count, 0);
+	assert_true(in_stats.high_water > 1);
+
+	printf("usb requests over loopback at one report per %u us: %.0f req/s sync, %.0f req/s async (%zu in flight)\n",
+	       REPORT_PERIOD_US,
+	       sync,
+	       async,
+	       in_stats.high_water);
+	assert_true(async > sync);
+}
+
+static ca_error flood_callback(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	uint32_t count = __atomic_load_n(&sFloodReceived, __ATOMIC_RELAXED);
+
+	(void)pDeviceRef;
+
+	//Messages must arrive intact and in order
+	if (buf[0] != FLOOD_CMDID || len != FLOOD_LEN + 2 || buf[2] != (uint8_t)count || buf[len - 1] != (uint8_t)count)
+		return CA_ERROR_INVALID;
+
+	__atomic_store_n(&sFloodReceived, count + 1, __ATOMIC_RELEASE);
+	return CA_ERROR_SUCCESS;
+}
+
+/** Send a flood of small asynchronous messages through the loopback, returning the messages per second received */
+static double run_flood(const char *packed)
+{
+	uint8_t  payload[FLOOD_LEN];
+	uint64_t start_us, elapsed_us;
+
+	setenv("CASCODA_USB_PACKED", packed, 1);
+	assert_int_equal(usb_setup(NULL), CA_ERROR_SUCCESS);
+	assert_int_equal(exchange_register_user_callback(flood_callback, &sDeviceRef), CA_ERROR_SUCCESS);
+	ca821x_util_start_downstream_dispatch_worker();
+	__atomic_store_n(&sFloodReceived, 0, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&sLoopback.mutex);
+	sLoopback.period_us = REPORT_PERIOD_US;
+	pthread_mutex_unlock(&sLoopback.mutex);
+
+	start_us = get_monotonic_us();
+	for (uint32_t i = 0; i < FLOOD_COUNT; i++)
+	{
+		memset(payload, i, sizeof(payload));
+		while (exchange_user_command(FLOOD_CMDID, sizeof(payload), payload, &sDeviceRef) == CA_ERROR_NO_BUFFER)
+			usleep(100);
+	}
+	while (__atomic_load_n(&sFloodReceived, __ATOMIC_ACQUIRE) < FLOOD_COUNT &&
+	       get_monotonic_us() - start_us < 10000000)
+	{
+		usleep(100);
+	}
+	elapsed_us = get_monotonic_us() - start_us;
+
+	pthread_mutex_lock(&sLoopback.mutex);
+	sLoopback.period_us = 0;
+	pthread_mutex_unlock(&sLoopback.mutex);
+
+	ca821x_util_stop_downstream_dispatch_worker();
+	assert_int_equal(usb_teardown(NULL), CA_ERROR_SUCCESS);
+	unsetenv("CASCODA_USB_PACKED");
+	assert_int_equal(sFloodReceived, FLOOD_COUNT);
+
+	return FLOOD_COUNT * 1000000.0 / elapsed_us;
+}
+
+static void usb_packed_throughput_benchmark(void **state)
+{
+	double unpacked, packed;
+
+	(void)state;
+
+	unpacked = run_flood("0");
+	packed   = run_flood("1");
+
+	printf("usb %u byte messages over loopback at one report per %u us: %.0f msg/s unpacked, %.0f msg/s packed\n",
+	       FLOOD_LEN + 2,
+	       REPORT_PERIOD_US,
+	       unpacked,
+	       packed);
+	assert_true(packed > unpacked);
+}
+
+static void usb_bootloader_test(void **state)
+{
+	uint64_t start_us;
+
+	(void)state;
+
+	//The bootloader rejects the probe, so packing is never negotiated and there is nothing to wait for
+	sLoopback.bootloader  = 1;
+	sLoopback.packed_sets = 0;
+	start_us              = get_monotonic_us();
+	assert_int_equal(usb_setup(NULL), CA_ERROR_SUCCESS);
+	assert_int_equal(usb_teardown(NULL), CA_ERROR_SUCCESS);
+	assert_int_equal(sLoopback.packed_sets, 0);
+	assert_true(get_monotonic_us() - start_us < 1000000);
+	sLoopback.bootloader = 0;
+
+	//A device rebooting into the bootloader is not asked to stop packing on deinit
+	assert_int_equal(usb_setup(NULL), CA_ERROR_SUCCESS);
+	assert_int_equal(sLoopback.packed_sets, 1);
+	sLoopback.bootloader = 1;
+	assert_int_equal(EVBME_DFU_REBOOT_request(EVBME_DFU_REBOOT_DFU, &sDeviceRef), CA_ERROR_SUCCESS);
+	start_us = get_monotonic_us();
+	assert_int_equal(usb_teardown(NULL), CA_ERROR_SUCCESS);
+	assert_int_equal(sLoopback.packed_sets, 1);
+	assert_true(get_monotonic_us() - start_us < 1000000);
+	sLoopback.bootloader = 0;
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+	    cmocka_unit_test_setup_teardown(usb_sync_echo_test, usb_setup, usb_teardown),
+	    cmocka_unit_test_setup_teardown(usb_sync_latency_benchmark, usb_setup, usb_teardown),
+	    cmocka_unit_test_setup_teardown(usb_async_pipeline_benchmark, usb_setup, usb_teardown),
+	    cmocka_unit_test(usb_packed_throughput_benchmark),
+	    cmocka_unit_test(usb_bootloader_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -87,14 +87,35 @@ static bool IsLinkLocal(const struct otIp6Address *aAddress)
 	return aAddress->mFields.m16[0] == htons(0xfe80);
 }
 
+/**
+ * Copy a pbuf chain into an OpenThread message. The message is sized up front, so that its buffers are allocated in
+ * one go, and each segment is then written directly into place.
+ */
+static otError writeMessage(otMessage *aMessage, const struct pbuf *aBuffer)
+{
+	uint16_t length = aBuffer->tot_len;
+	uint16_t offset = 0;
+	otError  error  = otMessageSetLength(aMessage, length);
+
+	if (error)
+		return error;
+
+	for (; aBuffer && offset < length; aBuffer = aBuffer->next)
+	{
+		otMessageWrite(aMessage, offset, aBuffer->payload, aBuffer->len);
+		offset += aBuffer->len;
+	}
+
+	return OT_ERROR_NONE;
+}
+
 static err_t netifOutputIp6(struct netif *aNetif, struct pbuf *aBuffer, const ip6_addr_t *aPeerAddr)
 {
 	(void)aPeerAddr;
 
-	err_t        err     = ERR_OK;
-	otError      error   = OT_ERROR_NONE;
-	otMessage *  message = NULL;
-	struct pbuf *curBuf  = NULL;
+	err_t      err     = ERR_OK;
+	otError    error   = OT_ERROR_NONE;
+	otMessage *message = NULL;
 
 	ca_log_info("netif output");
 	assert(aNetif == &sNetif);
@@ -102,13 +123,9 @@ static err_t netifOutputIp6(struct netif *aNetif, struct pbuf *aBuffer, const ip
 	message = otIp6NewMessage(sInstance, NULL);
 	VerifyOrExit(message != NULL, error = OT_ERROR_NO_BUFS);
 
-	while (aBuffer)
-	{
-		error   = otMessageAppend(message, aBuffer->payload, aBuffer->len);
-		aBuffer = aBuffer->next;
-		if (error)
-			goto exit;
-	}
+	error = writeMessage(message, aBuffer);
+	if (error)
+		goto exit;
 
 	error   = otIp6Send(sInstance, message);
 	message = NULL;
@@ -122,6 +139,10 @@ exit:
 		}
 
 		ca_log_warn("Failed to transmit IPv6 packet: %s", otThreadErrorToString(error));
+
+		// Report a lack of buffers to lwIP, so that TCP keeps the segment queued and retries it shortly, rather
+		// than treating it as sent and waiting for the retransmission timeout.
+		err = (error == OT_ERROR_NO_BUFS) ? ERR_MEM : ERR_IF;
 	}
 
 	return err;
@@ -306,7 +327,11 @@ static void processReceive(otMessage *aMessage, void *aContext)
 
 	assert(sNetif.state == aInstance);
 
+	// Pool pbufs are sized for a full TCP segment. If the pool runs out, such as while TCP holds out of order
+	// segments, fall back to the heap rather than dropping the packet.
 	buffer = pbuf_alloc(PBUF_RAW, length, PBUF_POOL);
+	if (buffer == NULL)
+		buffer = pbuf_alloc(PBUF_RAW, length, PBUF_RAM);
 
 	VerifyOrExit(buffer != NULL, error = OT_ERROR_NO_BUFS);
 
@@ -318,7 +343,12 @@ static void processReceive(otMessage *aMessage, void *aContext)
 		lengthRem -= copyLen;
 	}
 
-	VerifyOrExit(ERR_OK == sNetif.input(buffer, &sNetif), error = OT_ERROR_FAILED);
+	// Release the message before lwIP handles the packet, so its buffers are free for the ACK or reply
+	otMessageFree(aMessage);
+	aMessage = NULL;
+
+	err = sNetif.input(buffer, &sNetif);
+	VerifyOrExit(err == ERR_OK, error = OT_ERROR_FAILED);
 
 exit:
 	if (error != OT_ERROR_NONE)
@@ -336,7 +366,8 @@ exit:
 		ca_log_warn("%s failed: %s", __func__, otThreadErrorToString(error));
 	}
 
-	otMessageFree(aMessage);
+	if (aMessage != NULL)
+		otMessageFree(aMessage);
 }
 
 u32_t sys_now()
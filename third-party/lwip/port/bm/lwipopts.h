@@ -82,6 +82,9 @@
 #define LWIP_EVENT_API 0
 #define LWIP_CALLBACK_API 1
 #define TCP_MSS 200
+// Size pool pbufs for the IPv6 and TCP headers plus a full segment, so that each received segment fits in one pbuf.
+// The lwIP default only allows for the 20 byte IPv4 header, so a full segment would be split across two.
+#define PBUF_POOL_BUFSIZE LWIP_MEM_ALIGN_SIZE(TCP_MSS + 40 + 20 + PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN)
 
 #define LWIP_IPV4 0
 
@@ -83,6 +83,28 @@ static bool IsLinkLocal(const struct otIp6Address *aAddress)
 	return aAddress->mFields.m16[0] == htons(0xfe80);
 }
 
+/**
+ * Copy a pbuf chain into an OpenThread message. The message is sized up front, so that its buffers are allocated in
+ * one go, and each segment is then written directly into place.
+ */
+static otError writeMessage(otMessage *aMessage, const struct pbuf *aBuffer)
+{
+	uint16_t length = aBuffer->tot_len;
+	uint16_t offset = 0;
+	otError  error  = otMessageSetLength(aMessage, length);
+
+	if (error)
+		return error;
+
+	for (; aBuffer && offset < length; aBuffer = aBuffer->next)
+	{
+		otMessageWrite(aMessage, offset, aBuffer->payload, aBuffer->len);
+		offset += aBuffer->len;
+	}
+
+	return OT_ERROR_NONE;
+}
+
 static err_t netifOutputIp6(struct netif *aNetif, struct pbuf *aBuffer, const ip6_addr_t *aPeerAddr)
 {
 	(void)aPeerAddr;
@@ -104,24 +126,18 @@ static err_t netifOutputIp6(struct netif *aNetif, struct pbuf *aBuffer, const ip
 static otError netifHandleOut()
 {
 	struct pbuf *buf     = NULL;
-	struct pbuf *curBuf  = NULL;
 	otMessage *  message = NULL;
 	otError      error   = OT_ERROR_NONE;
 
 	if (xQueueReceive(sOutQueue, &buf, 1) == pdFALSE)
 		return OT_ERROR_NOT_FOUND;
-	curBuf = buf;
 
 	message = otIp6NewMessage(sInstance, NULL);
 	VerifyOrExit(message != NULL, error = OT_ERROR_NO_BUFS);
 
-	while (curBuf)
-	{
-		error  = otMessageAppend(message, curBuf->payload, curBuf->len);
-		curBuf = curBuf->next;
-		if (error)
-			goto exit;
-	}
+	error = writeMessage(message, buf);
+	if (error)
+		goto exit;
 
 	error   = otIp6Send(sInstance, message);
 	message = NULL;
@@ -330,7 +346,11 @@ static void processReceive(otMessage *aMessage, void *aContext)
 
 	assert(sNetif.state == aInstance);
 
+	// Pool pbufs are sized for a full TCP segment. If the pool runs out, such as while TCP holds out of order
+	// segments, fall back to the heap rather than dropping the packet.
 	buffer = pbuf_alloc(PBUF_RAW, length, PBUF_POOL);
+	if (buffer == NULL)
+		buffer = pbuf_alloc(PBUF_RAW, length, PBUF_RAM);
 
 	VerifyOrExit(buffer != NULL, error = OT_ERROR_NO_BUFS);
 
@@ -342,7 +362,12 @@ static void processReceive(otMessage *aMessage, void *aContext)
 		lengthRem -= copyLen;
 	}
 
-	VerifyOrExit(ERR_OK == sNetif.input(buffer, &sNetif), error = OT_ERROR_FAILED);
+	// Release the message before lwIP handles the packet, so its buffers are free for the ACK or reply
+	otMessageFree(aMessage);
+	aMessage = NULL;
+
+	err = sNetif.input(buffer, &sNetif);
+	VerifyOrExit(err == ERR_OK, error = OT_ERROR_FAILED);
 
 exit:
 	if (error != OT_ERROR_NONE)
@@ -360,7 +385,8 @@ exit:
 		ca_log_warn("%s failed: %s", __func__, otThreadErrorToString(error));
 	}
 
-	otMessageFree(aMessage);
+	if (aMessage != NULL)
+		otMessageFree(aMessage);
 }
 
 void LWIP_NetifInit(struct otInstance *aInstance)